@@ -0,0 +1,205 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to ModbusClient
+//               MIT license - see license.md for details
+// =================================================================================================
+#include "TCPstub.h"
+
+// Constructors
+TCPstub::TCPstub() :
+  myIP(IPAddress(0, 0, 0, 0)),
+  myPort(0),
+  running(false),
+  clearRequested(false),
+  tm(nullptr) { }
+
+TCPstub::TCPstub(IPAddress ip, uint16_t port) :
+  myIP(ip),
+  myPort(port),
+  running(false),
+  clearRequested(false),
+  tm(nullptr) { }
+
+// Destructor
+TCPstub::~TCPstub() {
+  stop();
+}
+
+// Client.h method set
+// Connect will check the identity and only start the worker thread if it is matching
+int TCPstub::connect(IPAddress ip, uint16_t port) {
+  if (ip == myIP && port == myPort) {
+    // if we do not have a worker already running
+    if (!running) {
+      // A worker may have ended itself - collect it first
+      if (worker.joinable()) worker.join();
+      running = true;
+      worker = std::thread(workerThread, this);
+    }
+    return 0;
+  }
+  // Else we return a EADDRNOTAVAIL
+  return 99;
+}
+
+// write shoves a byte into the worker's inQueue
+size_t TCPstub::write(uint8_t byte) {
+  return inQueue.write(&byte, 1);
+}
+
+// ... or a rack of bytes in sequence
+size_t TCPstub::write(const uint8_t *buf, size_t size) {
+  return inQueue.write(buf, size);
+}
+
+// ... or all segments of a frame
+size_t TCPstub::write(const ModbusSegments& segments) {
+  size_t cnt = 0;
+  for (auto& s : segments) {
+    cnt += inQueue.write(s.data, s.len);
+  }
+  return cnt;
+}
+
+// available returns the number of bytes in the worker's outQueue
+int TCPstub::available() {
+  return outQueue.available();
+}
+
+// read picks a single byte from the worker's outQueue and deletes it
+int TCPstub::read() {
+  uint8_t byte;
+  if (outQueue.read(&byte, 1) == 0) return -1;
+  return byte;
+}
+
+// The array read does the same for the requested number of bytes or until the outQueue is exhausted
+int TCPstub::read(uint8_t *buf, size_t size) {
+  uint32_t cnt = outQueue.read(buf, size);
+  if (cnt == 0) return -1;
+  return cnt;
+}
+
+// peek works as read, without deleting the picked byte
+int TCPstub::peek() {
+  uint8_t byte;
+  if (outQueue.peek(&byte, 1) == 0) return -1;
+  return byte;
+}
+
+// flush will do nothing
+void TCPstub::flush() {
+}
+
+// clear will empty the inQueue
+void TCPstub::clear() {
+  // Only the worker may read the inQueue - let it do the job, if it is running.
+  // We will have to wait for it, else it might drop the next request as well.
+  if (running) {
+    clearRequested = true;
+    while (clearRequested && running) delay(1);
+  } else {
+    inQueue.clear();
+  }
+}
+
+// stop will end the worker thread
+void TCPstub::stop() {
+  running = false;
+  if (worker.joinable() && worker.get_id() != std::this_thread::get_id()) {
+    worker.join();
+  }
+  // Delete inQueue, if anything is still in it
+  clearRequested = false;
+  inQueue.clear();
+}
+
+// Special stub methods
+// begin connects the TCPstub to a test case map and optionally sets the identity
+bool TCPstub::begin(TidMap *mp) {
+  tm = mp;
+  if (tm && myIP && myPort) return true;
+  return false;    
+}
+
+bool TCPstub::begin(TidMap *mp, IPAddress ip, uint16_t port) {
+  tm = mp;
+  setIdentity(ip, port);
+  if (tm && myIP && myPort) return true;
+  return false;    
+}
+
+// setIdentity changes the simulated host/port
+void TCPstub::setIdentity(IPAddress ip, uint16_t port) {
+  myIP = ip;
+  myPort = port;    
+}
+
+// workerThread: worker thread method
+void TCPstub::workerThread(TCPstub *instance) {
+  while (instance->running) {
+    // Shall we drop the pending requests?
+    if (instance->clearRequested.exchange(false)) {
+      instance->inQueue.clear();
+    }
+    // Do we have at least 6 bytes in the inQueue (TCP header)?
+    if (instance->inQueue.available() >= 6) {
+      // Yes. This should be led in by the transactionID and the length of the remainder
+      uint8_t TCPhead[6];
+      instance->inQueue.peek(TCPhead, 6);
+      uint32_t len = 6 + ((TCPhead[4] << 8) | TCPhead[5]);
+      // A length exceeding the queue can not be right - drop everything
+      if (len > QUEUELIMIT) {
+        instance->inQueue.clear();
+        continue;
+      }
+      // Wait for the complete request. Keep the TCPhead and discard the rest.
+      if (instance->inQueue.available() < len) {
+        delay(1);
+        continue;
+      }
+      instance->inQueue.skip(len);
+
+      // Get the TID
+      uint16_t tid = (TCPhead[0] << 8) | TCPhead[1];
+
+      // Look for the tid in the TestCase map
+      auto tc = (*instance->tm).find(tid);
+      if (tc != (*instance->tm).end()) {
+        // Get a handier pointer for the TestCase found
+        TestCase *myTest(tc->second);
+
+        // Does the test case prescribe an initial delay?
+        if (myTest->delayTime) {
+          // Yes. idle until time has passed
+          delay(myTest->delayTime);
+        }
+        // Do we have to send a response?
+        if (myTest->response.size() > 0) {
+          // Are we asked to fake the transaction ID?
+          if (myTest->fakeTransactionID == true) {
+            TCPhead[0] += 13;
+          }
+
+          // Set the response size in the TCP header
+          TCPhead[4] = (myTest->response.size() >> 8) & 0xFF;
+          TCPhead[5] = myTest->response.size() & 0xFF;
+
+          // Write the TCP header and the response in one go - the client may read any time
+          uint8_t frame[6 + 256];
+          uint16_t cnt = myTest->response.size() > 256 ? 256 : myTest->response.size();
+          memcpy(frame, TCPhead, 6);
+          memcpy(frame + 6, myTest->response.data(), cnt);
+          instance->outQueue.write(frame, 6 + cnt);
+        }
+        // Are we to stop ourselves after response has been sent?
+        if (myTest->stopAfterResponding == true) {
+          instance->running = false;
+        }
+      } else {
+        printf("No test case for TID %04X\n", tid);
+      }
+    } else {
+      delay(1);
+    }
+  }
+}
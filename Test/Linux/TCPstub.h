@@ -0,0 +1,105 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to ModbusClient
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _TCPSTUB_H
+#define _TCPSTUB_H
+#include <Client.h>
+#include <atomic>
+#include <map>
+#include <thread>     // NOLINT
+#include "ByteRing.h"
+#include "ModbusMessage.h"
+
+// Linux version of the TCPstub: an in-memory Client answering requests from a map of test cases.
+// Requests and responses are passed through lock-free ByteRings instead of mutex-protected queues,
+// the worker is a std::thread instead of a FreeRTOS task.
+
+#define QUEUELIMIT 512
+
+// Struct holding the data for a test case
+// These will be mapped to the transactionID for the TCPstub worker to identify the request
+struct TestCase {
+  const char *name;              // Name of the test function
+  const char *testname;          // Name of the test case
+  uint16_t transactionID;        // For easy reference, again the transactionID
+  uint32_t token;                // For reference as well
+  ModbusMessage response;      // byte sequence of the response
+  ModbusMessage expected;      // byte sequence to be expected in onError/onData handlers
+  uint32_t delayTime;            // A time in ms to wait before the response is sent
+  bool stopAfterResponding;      // if true, worker will kill itself after answering (simulate server disconnect)
+  bool fakeTransactionID;        // if true, stub will use a wrong TID in response
+};
+
+// Short names for the test cases' maps
+using TidMap = std::map<uint16_t, TestCase *>;
+using TokenMap = std::map<uint32_t, TestCase *>;
+
+class TCPstub : public Client {
+public:
+// Constructors
+  TCPstub();
+  TCPstub(IPAddress ip, uint16_t port);
+
+// Destructor
+  ~TCPstub();
+
+// Client.h method set
+  // Connect will check the identity and only start the worker thread if it is matching
+  int connect(IPAddress ip, uint16_t port);
+  inline int connect(IPAddress ip, uint16_t port, int32_t timeout) { return connect(ip, port); }
+
+  // We do not need hostnames here, so we will return EADDRNOTAVAIL (=99) to prevent use
+  inline int connect(const char *host, uint16_t port) { return 99; }
+  inline int connect(const char *host, uint16_t port, int32_t timeout) { return 99; }
+  inline bool disconnect() { stop(); return true; }
+
+  size_t write(uint8_t);
+  size_t write(const uint8_t *buf, size_t size);
+  size_t write(const ModbusSegments& segments);
+
+  int available();
+  int read();
+  int read(uint8_t *buf, size_t size);
+  int peek();
+
+  // clear will empty the request queue
+  void clear();
+  
+  // flush does nothing
+  void flush();
+
+  // stop will end the worker thread
+  void stop();
+
+  // connected will return true (=1) as long as the worker thread is running
+  inline uint8_t connected() { return (running ? 1 : 0); }
+  inline operator bool() { return running; }
+
+// Special stub methods
+  // begin connects the TCPstub to a test case map and optionally sets the identity
+  bool begin(TidMap* mp);
+  bool begin(TidMap* mp, IPAddress ip, uint16_t port);
+
+  // setIdentity changes the simulated host/port
+  void setIdentity(IPAddress ip, uint16_t port);
+
+protected:
+  // Prevent copy construction and assignment - the queues can not be shared
+  TCPstub(const TCPstub& t) = delete;
+  TCPstub& operator=(const TCPstub& t) = delete;
+
+  IPAddress myIP;
+  uint16_t  myPort;
+  std::thread worker;
+  std::atomic<bool> running;           // Worker is serving requests
+  std::atomic<bool> clearRequested;    // Worker shall drop all pending request bytes
+  TidMap* tm;
+  ByteRing<QUEUELIMIT> inQueue;        // Requests: written by the client, read by the worker
+  ByteRing<QUEUELIMIT> outQueue;       // Responses: written by the worker, read by the client
+
+  // workerThread: worker thread method
+  static void workerThread(TCPstub *instance);
+};
+
+#endif
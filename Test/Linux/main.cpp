@@ -0,0 +1,284 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to ModbusClient
+//               MIT license - see license.md for details
+// =================================================================================================
+// Linux test runner: the TCP loop stub tests of Test/main.cpp, run against the in-memory TCPstub.
+// Time is simulated by a VirtualClock that is only advanced while all threads involved are waiting
+// for it, so the forced timeouts will not hold up the run and the results do not depend on the
+// scheduler. Call with "-r" to use the real clock instead.
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <utility>
+#include "ModbusClientTCP.h"
+#include "ModbusError.h"
+#include "TCPstub.h"
+
+#define STRINGIFY(x) #x
+#define LNO(x) "line " STRINGIFY(x) " "
+
+// Test prerequisites
+VirtualClock virtualClock(false);      // Simulated time. Must outlive the threads using it!
+TCPstub stub;
+ModbusClientTCP TestTCP(stub, 2);      // ModbusClientTCP test instance for stub use.
+uint16_t testsExecuted = 0;            // Global test cases counter. Incremented in testOutput().
+uint16_t testsPassed = 0;              // Global passed test cases counter. Incremented in testOutput().
+bool printPassed = false;              // If true, testOutput will print passed tests as well.
+TidMap testCasesByTID;
+TokenMap testCasesByToken;
+std::atomic<uint32_t> highestTokenProcessed(0);
+uint32_t Token = 1;
+
+#define WAIT_FOR_FINISH(x) while ((highestTokenProcessed < (Token - 1)) && (x.pendingRequests() != 0)) { delay(100); }
+
+ModbusMessage empty;                   // Empty message for initializers
+
+// testOutput:  takes the test function name called, the test case name and expected and recieved messages,
+// compares both and prints out the result.
+// If the test passed, true is returned - else false.
+bool testOutput(const char *testname, const char *name, ModbusMessage expected, ModbusMessage received) {
+  testsExecuted++;
+
+  if (expected == received) {
+    testsPassed++;
+    if (printPassed) printf("%s, %s - passed.\n", testname, name);
+    return true;
+  } 
+
+  printf("%s, %s - failed:\n", testname, name);
+  printf("   Expected:");
+  for (auto& b : expected) {
+    printf(" %02X", b);
+  }
+  if (expected.size() == 1) {
+    ModbusError me((Error)expected[0]);
+    printf(" %s", (const char *)me);
+  }
+  printf("\n   Received:");
+  for (auto& b : received) {
+    printf(" %02X", b);
+  }
+  if (received.size() == 1) {
+    ModbusError me((Error)received[0]);
+    printf(" %s", (const char *)me);
+  }
+  printf("\n");
+  
+  return false;
+}
+
+// Helper function to convert hexadecimal ([0-9A-F]) digits in a char array into a vector of bytes
+ModbusMessage makeVector(const char *text) {
+  ModbusMessage rv;            // The vector to be returned
+  uint8_t byte = 0;
+  bool tick = false;             // Counting nibbles
+
+  for (const char *cp = text; *cp; cp++) {
+    uint8_t nibble;
+    if (*cp >= '0' && *cp <= '9') {
+      nibble = *cp - '0';
+    } else if (*cp >= 'A' && *cp <= 'F') {
+      nibble = *cp - 'A' + 10;
+    } else {
+      // No hexadecimal digit, ignore it.
+      continue;
+    }
+    byte = (byte << 4) | nibble;
+    // Are we at the second nibble of a byte?
+    if (tick) {
+      rv.push_back(byte);
+      byte = 0;
+    }
+    tick = !tick;
+  }
+  return rv;
+}
+
+// onResponse handler: look up the test case by token and check the response
+void handleData(ModbusMessage response, uint32_t token) 
+{
+  // Look for the token in the TestCase map
+  auto tc = testCasesByToken.find(token);
+  if (tc != testCasesByToken.end()) {
+    // Get a handier pointer for the TestCase found
+    TestCase *myTest(tc->second);
+    testOutput(myTest->testname, myTest->name, myTest->expected, response);
+  } else {
+    printf("Could not find test case for token %08X\n", token);
+  }
+  // catch highest token processed
+  if (highestTokenProcessed < token) highestTokenProcessed = token;
+}
+
+// newCase: create a test case for the next request of TestTCP
+TestCase *newCase(const char *name, const char *testname, const char *response, const char *expected,
+                  uint32_t delayTime = 0, bool stopAfterResponding = false, bool fakeTransactionID = false) {
+  return new TestCase {
+    name,
+    testname,
+    // getMessageCount will be used internally to generate the transaction ID, so get a copy
+    static_cast<uint16_t>(TestTCP.getMessageCount() & 0xFFFF),
+    // The token value _must_ be different for each test case!!!
+    Token++,
+    makeVector(response),
+    makeVector(expected),
+    delayTime,
+    stopAfterResponding,
+    fakeTransactionID
+  };
+}
+
+// runCase: register a test case in both reference maps and issue its request
+template <typename... Args>
+void runCase(TestCase *tc, Args&&... args) {
+  testCasesByTID[tc->transactionID] = tc;
+  testCasesByToken[tc->token] = tc;
+  Error e = TestTCP.addRequest(tc->token, std::forward<Args>(args)...);
+  // Did the call immediately return an error?
+  if (e != SUCCESS) {
+    // Yes, give it to the test result examiner
+    ModbusMessage r;
+    r.add(e);
+    testOutput(tc->testname, tc->name, tc->expected, r);
+    highestTokenProcessed = tc->token;
+  }
+}
+
+int main(int argc, char **argv) {
+  uint16_t failed = 0;
+
+  // Virtual time ticker. Time will pass in 1ms steps whenever the test thread, the ModbusClientTCP
+  // worker and - while connected - the stub worker are all sleeping.
+  // When winding down, it lets time pass freely to allow the threads to see their ends.
+  std::atomic<bool> freeRun(false);
+  std::atomic<bool> done(false);
+  std::thread ticker;
+  if (!(argc > 1 && !strcmp(argv[1], "-r"))) {
+    ModbusClock::use(&virtualClock);
+    ticker = std::thread([&]() {
+      while (!done) {
+        if (freeRun || virtualClock.sleepers() >= (stub.connected() ? 3U : 2U)) {
+          virtualClock.advance(1);
+        }
+        std::this_thread::yield();
+      }
+    });
+  }
+
+  // ******************************************************************************
+  // Tests using the complete turnaround next. TCP is simulated by TCPstub stub!
+  //
+  // ATTENTION: the request queue limit has been set to >>> 2 <<< entries only for
+  //            test reasons. Better have a 
+  //              WAIT_FOR_FINISH(<client>)
+  //            after longer test cases to not flood it!
+  // ******************************************************************************
+
+  // Restart test case and tests passed counter
+  testsExecuted = 0;
+  testsPassed = 0;
+
+  // Some prerequisites 
+  IPAddress testHost = IPAddress(192, 166, 1, 1);
+  IPAddress testHost2 = IPAddress(26, 183, 4, 22);
+
+  // Register onResponse handler
+  TestTCP.onResponseHandler(&handleData);
+
+  // Start ModbusClientTCP background task
+  TestTCP.begin();
+
+  // Start TCP stub
+  // testCasesByTID is the map to find the matching test case in the worker thread
+  stub.begin(&testCasesByTID);
+
+  stub.setIdentity(testHost, 502);
+  TestTCP.setTarget(testHost, 502, 2000, 200);
+  runCase(newCase(LNO(__LINE__), "Simple 0x03 request",
+    "01 03 08 00 00 11 11 22 22 33 33", "01 03 08 00 00 11 11 22 22 33 33"), 1, 0x03, 1, 4);
+  WAIT_FOR_FINISH(TestTCP)
+
+  // Case to test timeout handling. The stub is asked to delay the response by 3 seconds
+  stub.setIdentity(testHost, 502);
+  TestTCP.setTarget(testHost, 502, 500, 200);
+  runCase(newCase(LNO(__LINE__), "Forced timeout!", "01 07", "01 87 E0", 3000), 1, 0x07);
+  // Wait for secure timeout end
+  WAIT_FOR_FINISH(TestTCP)
+  delay(5000);
+  stub.flush();
+
+  // Send response with wrong transaction ID
+  runCase(newCase(LNO(__LINE__), "Wrong transaction ID in response", "01 07", "01 87 EB", 0, false, true), 1, 0x07);
+  WAIT_FOR_FINISH(TestTCP)
+
+  // Send response with wrong server ID
+  runCase(newCase(LNO(__LINE__), "Wrong server ID in response",
+    "2F 03 06 11 22 33 44 55 66", "01 83 E4"), 1, 0x03, 1, 3);
+  WAIT_FOR_FINISH(TestTCP)
+
+  // Send response with wrong function code
+  runCase(newCase(LNO(__LINE__), "Wrong FC in response",
+    "01 04 06 11 22 33 44 55 66", "01 83 E3"), 1, 0x03, 1, 3);
+  WAIT_FOR_FINISH(TestTCP)
+
+  // Stub will not respond at all - another timeout constellation
+  runCase(newCase(LNO(__LINE__), "No answer from server", "", "01 83 E0"), 1, 0x03, 1, 3);
+  // Wait for secure timeout end
+  WAIT_FOR_FINISH(TestTCP)
+  delay(5000);
+  stub.clear();
+
+  // Provoke full request queue by sending 3 requests without delay.
+  // The third shall get the REQUEST_QUEUE_FULL error
+  runCase(newCase(LNO(__LINE__), "Request queue full - pre 1", "01 07 2B", "01 07 2B"), 1, 0x07);
+  runCase(newCase(LNO(__LINE__), "Request queue full - pre 2", "01 07 2B", "01 07 2B"), 1, 0x07);
+  runCase(newCase(LNO(__LINE__), "Request queue full", "01 07 2B", "E8"), 1, 0x07);
+  WAIT_FOR_FINISH(TestTCP)
+  delay(5000);
+  stub.clear();
+
+  // Simulate Server not responding (host/port different from stub's identity)
+  TestTCP.setTarget(testHost2, 502);
+  runCase(newCase(LNO(__LINE__), "Server not responding", "01 07 2B", "01 87 EA"), 1, 0x07);
+  WAIT_FOR_FINISH(TestTCP)
+
+  // Server returns undefined error code
+  TestTCP.setTarget(testHost, 502);
+  runCase(newCase(LNO(__LINE__), "Unknown error code", "01 87 46", "01 87 46"), 1, 0x07);
+  WAIT_FOR_FINISH(TestTCP)
+
+  // Host switch sequence (requires re-connect())
+  // testHost2, testHost2, testHost, testHost2
+  // testHost2 is simulated to stop-after-response, so a re-connect has to be done each time
+  TestTCP.setTarget(testHost2, 502);
+  stub.setIdentity(testHost2, 502);
+  runCase(newCase(LNO(__LINE__), "testHost2 stop after response(1)", "01 87 01", "01 87 01", 0, true), 1, 0x07);
+  WAIT_FOR_FINISH(TestTCP)
+  runCase(newCase(LNO(__LINE__), "testHost2 stop after response(2)", "01 87 02", "01 87 02", 0, true), 1, 0x07);
+  WAIT_FOR_FINISH(TestTCP)
+
+  TestTCP.setTarget(testHost, 502, 2000, 200);
+  stub.setIdentity(testHost, 502);
+  runCase(newCase(LNO(__LINE__), "testHost interlude", "01 87 11", "01 87 11"), 1, 0x07);
+  WAIT_FOR_FINISH(TestTCP)
+
+  TestTCP.setTarget(testHost2, 502);
+  stub.setIdentity(testHost2, 502);
+  runCase(newCase(LNO(__LINE__), "testHost2 stop after response(3)", "01 87 03", "01 87 03", 0, true), 1, 0x07);
+
+  // Print summary. We will have to wait a bit to get all test cases executed!
+  WAIT_FOR_FINISH(TestTCP)
+
+  printf("----->    TCP loop stub tests: %4d, passed: %4d\n", testsExecuted, testsPassed);
+  failed += testsExecuted - testsPassed;
+
+  // Stop the stub worker, then the ticker. The ModbusClientTCP worker will be cancelled
+  // by its destructor.
+  freeRun = true;
+  stub.stop();
+  done = true;
+  if (ticker.joinable()) ticker.join();
+
+  printf("\n\n *** ----> All finished.\n");
+  return failed ? 1 : 0;
+}
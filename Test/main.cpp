@@ -15,6 +15,12 @@
 
 #include "TCPstub.h"
 #include "CoilData.h"
+#include "DecodePlan.h"
+#include "PDUutils.h"
+#include "ModbusFrame.h"
+#include "ModbusSegments.h"
+#include "CoilMap.h"
+#include "AtomicCoilBank.h"
 
 #define STRINGIFY(x) #x
 #define LNO(x) "line " STRINGIFY(x) " "
@@ -581,6 +587,16 @@ void setup()
   MSG08(1, 0x05, (Error)0xE1, LNO(__LINE__) "correct call", "01 85 E1");
   MSG08(1, 0x05, (Error)0x73, LNO(__LINE__) "correct call (unk.err)", "01 85 73");
 
+  // #### Request<FC, N> compile-time builders
+  testOutput(__func__, LNO(__LINE__) "Request<0x01, 2000>", makeVector("01 01 10 20 07 D0"), Request<READ_COIL, 2000>(1, 0x1020));
+  testOutput(__func__, LNO(__LINE__) "Request<0x03, 125>",  makeVector("01 03 10 20 00 7D"), Request<READ_HOLD_REGISTER, 125>(1, 0x1020));
+  testOutput(__func__, LNO(__LINE__) "Request<0x05> ON",    makeVector("01 05 10 20 FF 00"), Request<WRITE_COIL>(1, 0x1020, true));
+  testOutput(__func__, LNO(__LINE__) "Request<0x05> OFF",   makeVector("01 05 10 20 00 00"), Request<WRITE_COIL>(1, 0x1020, false));
+  testOutput(__func__, LNO(__LINE__) "Request<0x06>",       makeVector("01 06 00 00 FF FF"), Request<WRITE_HOLD_REGISTER>(1, 0x0000, 0xFFFF));
+  testOutput(__func__, LNO(__LINE__) "Request<0x11>",       makeVector("01 11"), Request<REPORT_SERVER_ID_SERIAL>(1));
+  testOutput(__func__, LNO(__LINE__) "Request<0x16>",       makeVector("01 16 00 00 FA FF DE EB"), Request<MASK_WRITE_REGISTER>(1, 0x0000, 0xFAFF, 0xDEEB));
+  testOutput(__func__, LNO(__LINE__) "Request<0x18>",       makeVector("01 18 9A 20"), Request<READ_FIFO_QUEUE>(1, 0x9A20));
+
   // Testing add()
   ModbusMessage adder;
 
@@ -2092,6 +2108,69 @@ void setup()
   coilset = coils;
   testOutput("Set coil set from message data", LNO(__LINE__), makeVector("47 29 B5 F3 16"), (ModbusMessage)coilset);
 
+  // Word-wise operations on ranges longer than 64 coils at odd offsets
+  CoilData coils5(150);
+  vector<uint8_t> pattern = { 0xF0, 0x0F, 0xA5, 0x5A, 0xC3, 0x3C, 0x81, 0x7E, 0x01, 0x80, 0xFF, 0x00 };
+  coils5.set(13, 96, pattern);
+  coilset = coils5.slice(13, 96);
+  testOutput("Long unaligned set/slice", LNO(__LINE__), makeVector("F0 0F A5 5A C3 3C 81 7E 01 80 FF 00"), (ModbusMessage)coilset);
+  testsExecuted++;
+  if (coils5.coilsSetON() == 42 && coils5.coilsSetOFF() == 108) {
+    testsPassed++;
+  } else {
+    Serial.print(LNO(__LINE__) "coilsSetON failed\n");
+  }
+  CoilData coils6(150);
+  coils6.set(0, coils5);
+  testsExecuted++;
+  if (coils6 == coils5 && !(coils6 != coils5)) {
+    testsPassed++;
+  } else {
+    Serial.print(LNO(__LINE__) "set with CoilData failed\n");
+  }
+  coils6.set(140, true);
+  testsExecuted++;
+  if (coils6 != coils5) {
+    testsPassed++;
+  } else {
+    Serial.print(LNO(__LINE__) "long compare failed\n");
+  }
+
+  // XOR-diff and iteration over set and changed coils
+  coils6 = coils5;
+  coils6.set(0, true);
+  coils6.set(20, false);
+  coils6.set(149, true);
+  CoilData changed = coils6 ^ coils5;
+  testsExecuted++;
+  if (changed.coils() == 150 && changed.coilsSetON() == 3 && changed[0] && changed[20] && changed[149]) {
+    testsPassed++;
+  } else {
+    Serial.print(LNO(__LINE__) "XOR-diff failed\n");
+  }
+  uint16_t sum = 0;
+  uint16_t ones = 0;
+  changed.forEachSet([&](uint16_t i) { sum += i; });
+  uint16_t changes = coils6.forEachChange(coils5, [&](uint16_t i, bool v) { sum += i; if (v) ones++; });
+  testsExecuted++;
+  if (sum == 2 * (0 + 20 + 149) && changes == 3 && ones == 2) {
+    testsPassed++;
+  } else {
+    Serial.print(LNO(__LINE__) "forEachSet/forEachChange failed\n");
+  }
+
+  // Sets of different sizes are compared up to the smaller size
+  CoilData shortSet = coils5.slice(0, 21);
+  changed = coils6 ^ shortSet;
+  changes = coils6.forEachChange(shortSet, [](uint16_t, bool) { });
+  testsExecuted++;
+  if (changed.coils() == 21 && changed.coilsSetON() == 2 && changed[0] && changed[20]
+   && changes == 2 && (shortSet ^ coils6) == changed) {
+    testsPassed++;
+  } else {
+    Serial.print(LNO(__LINE__) "XOR-diff/forEachChange of different sizes failed\n");
+  }
+
   // Some comparison tests
   testsExecuted++;
   uint8_t okay = 0;
@@ -2160,6 +2239,340 @@ void setup()
   // Print summary.
   Serial.printf("----->    FC redefiniton: %4d, passed: %4d\n", testsExecuted, testsPassed);
 
+  // ******************************************************************************
+  // DecodePlan tests
+  // ******************************************************************************
+  testsExecuted = 0;
+  testsPassed = 0;
+
+  struct DPtest { int16_t t; float volts; uint32_t cnt; float pwr; };
+  DPtest dpt;
+  DecodePlan plan(0x20);
+  plan.add(0x20, DEC_INT16).to(offsetof(DPtest, t))
+      .add(0x21, DEC_INT16).scale(0.1).to(offsetof(DPtest, volts))
+      .add(0x22, DEC_UINT32).to(offsetof(DPtest, cnt))
+      .add(0x24, DEC_FLOAT, SWAP_REGISTERS).to(offsetof(DPtest, pwr));
+  ModbusMessage dpResponse = makeVector("01 03 0C FF FE 08 FC 00 01 E2 40 06 51 3F 9E");
+
+  // #1 - decode into struct
+  testsExecuted++;
+  if (plan.decodeStruct(dpResponse, dpt) == SUCCESS && dpt.t == -2 && dpt.volts == (float)2300 * 0.1f
+   && dpt.cnt == 123456 && dpt.pwr == (float)1.2345678) {
+    testsPassed++;
+  } else {
+    Serial.print(LNO(__LINE__) "DecodePlan #1 failed\n");
+  }
+
+  // #2 - decode into values
+  double dpValues[4];
+  testsExecuted++;
+  if (plan.decode(dpResponse, dpValues, 4) == SUCCESS && dpValues[0] == -2.0 && dpValues[2] == 123456.0) {
+    testsPassed++;
+  } else {
+    Serial.print(LNO(__LINE__) "DecodePlan #2 failed\n");
+  }
+
+  // #3 - response too short for the plan
+  testsExecuted++;
+  if (plan.decodeStruct(makeVector("01 03 02 FF FE"), dpt) == PACKET_LENGTH_ERROR) {
+    testsPassed++;
+  } else {
+    Serial.print(LNO(__LINE__) "DecodePlan #3 failed\n");
+  }
+
+  // #4 - error response is passed through
+  testsExecuted++;
+  if (plan.decode(makeVector("01 83 02"), dpValues, 4) == ILLEGAL_DATA_ADDRESS) {
+    testsPassed++;
+  } else {
+    Serial.print(LNO(__LINE__) "DecodePlan #4 failed\n");
+  }
+
+  // Print summary.
+  Serial.printf("----->    DecodePlan tests: %4d, passed: %4d\n", testsExecuted, testsPassed);
+
+  // ******************************************************************************
+  // PDU validation tests
+  // ******************************************************************************
+  testsExecuted = 0;
+  testsPassed = 0;
+
+  // Helper to put an Error into a ModbusMessage for testOutput()
+  auto errMsg = [](Error e) { ModbusMessage m; m.add(e); return m; };
+  ModbusMessage okay = errMsg(SUCCESS);
+  ModbusMessage req03 = makeVector("01 03 00 10 00 03");
+  ModbusMessage req17 = makeVector("01 17 00 01 00 02 00 10 00 01 02 AB CD");
+
+  testOutput("PDU request", LNO(__LINE__) "FC03 okay", okay, errMsg(PDUutils::checkRequest(req03)));
+  testOutput("PDU request", LNO(__LINE__) "FC03 too short", errMsg(ILLEGAL_DATA_VALUE), errMsg(PDUutils::checkRequest(makeVector("01 03 00 10 00"))));
+  testOutput("PDU request", LNO(__LINE__) "FC03 quantity 0", errMsg(ILLEGAL_DATA_VALUE), errMsg(PDUutils::checkRequest(makeVector("01 03 00 10 00 00"))));
+  testOutput("PDU request", LNO(__LINE__) "FC03 quantity 126", errMsg(ILLEGAL_DATA_VALUE), errMsg(PDUutils::checkRequest(makeVector("01 03 00 10 00 7E"))));
+  testOutput("PDU request", LNO(__LINE__) "FC05 illegal value", errMsg(ILLEGAL_DATA_VALUE), errMsg(PDUutils::checkRequest(makeVector("01 05 00 10 00 FF"))));
+  testOutput("PDU request", LNO(__LINE__) "FC0F okay", okay, errMsg(PDUutils::checkRequest(makeVector("01 0F 10 20 00 1F 04 00 11 22 33"))));
+  testOutput("PDU request", LNO(__LINE__) "FC0F byte count", errMsg(ILLEGAL_DATA_VALUE), errMsg(PDUutils::checkRequest(makeVector("01 0F 10 20 00 1F 03 00 11 22"))));
+  testOutput("PDU request", LNO(__LINE__) "FC10 length", errMsg(ILLEGAL_DATA_VALUE), errMsg(PDUutils::checkRequest(makeVector("01 10 10 20 00 01 02 00"))));
+  testOutput("PDU request", LNO(__LINE__) "FC17 okay", okay, errMsg(PDUutils::checkRequest(req17)));
+  testOutput("PDU request", LNO(__LINE__) "user FC okay", okay, errMsg(PDUutils::checkRequest(makeVector("01 44 01 02 03"))));
+
+  testOutput("PDU response", LNO(__LINE__) "FC03 okay", okay, errMsg(PDUutils::checkResponse(makeVector("01 03 06 11 22 33 44 55 66"), req03)));
+  testOutput("PDU response", LNO(__LINE__) "FC03 byte count", errMsg(PACKET_LENGTH_ERROR), errMsg(PDUutils::checkResponse(makeVector("01 03 04 11 22 33 44"), req03)));
+  testOutput("PDU response", LNO(__LINE__) "FC03 length", errMsg(PACKET_LENGTH_ERROR), errMsg(PDUutils::checkResponse(makeVector("01 03 06 11 22 33 44 55"), req03)));
+  testOutput("PDU response", LNO(__LINE__) "FC03 server ID", errMsg(SERVER_ID_MISMATCH), errMsg(PDUutils::checkResponse(makeVector("02 03 06 11 22 33 44 55 66"), req03)));
+  testOutput("PDU response", LNO(__LINE__) "FC03 FC", errMsg(FC_MISMATCH), errMsg(PDUutils::checkResponse(makeVector("01 04 06 11 22 33 44 55 66"), req03)));
+  testOutput("PDU response", LNO(__LINE__) "FC03 error", okay, errMsg(PDUutils::checkResponse(makeVector("01 83 02"), req03)));
+  testOutput("PDU response", LNO(__LINE__) "FC03 error length", errMsg(PACKET_LENGTH_ERROR), errMsg(PDUutils::checkResponse(makeVector("01 83 02 00"), req03)));
+  testOutput("PDU response", LNO(__LINE__) "FC17 okay", okay, errMsg(PDUutils::checkResponse(makeVector("01 17 04 00 01 00 02"), req17)));
+  testOutput("PDU response", LNO(__LINE__) "FC18 okay", okay, errMsg(PDUutils::checkResponse(makeVector("01 18 00 06 00 02 12 34 56 78"), makeVector("01 18 00 10"))));
+  testOutput("PDU response", LNO(__LINE__) "FC07 from ANY_FUNCTION_CODE worker", okay, errMsg(PDUutils::checkResponse(makeVector("01 07 41 4E 59 20 46 43"), makeVector("01 07"))));
+
+  // frameLength
+  testsExecuted++;
+  if (PDUutils::frameLength(req17.data(), 2, false) == 0
+   && PDUutils::frameLength(req17.data(), 11, false) == 13
+   && PDUutils::frameLength(req03.data(), 2, false) == 6
+   && PDUutils::frameLength(makeVector("01 83").data(), 2, true) == 3
+   && PDUutils::frameLength(makeVector("01 44").data(), 2, true) == -1) {
+    testsPassed++;
+  } else {
+    Serial.print(LNO(__LINE__) "frameLength failed\n");
+  }
+
+  // RTU frameLength: CRC included, FC 0x44 has no length rule and is found by its CRC
+  testsExecuted++;
+  ModbusMessage rtu03 = makeVector("01 03 00 10 00 02");
+  RTUutils::addCRC(rtu03);
+  ModbusMessage rtu44 = makeVector("01 44 11 22 33");
+  RTUutils::addCRC(rtu44);
+  if (RTUutils::frameLength(rtu03.data(), 5, false) == 0
+   && RTUutils::frameLength(rtu03.data(), rtu03.size(), false) == 8
+   && RTUutils::frameLength(rtu44.data(), rtu44.size() - 1, true) == 0
+   && RTUutils::frameLength(rtu44.data(), rtu44.size(), true) == 7) {
+    testsPassed++;
+  } else {
+    Serial.print(LNO(__LINE__) "RTU frameLength failed\n");
+  }
+
+  // Print summary.
+  Serial.printf("----->    PDU validation tests: %4d, passed: %4d\n", testsExecuted, testsPassed);
+
+  // ******************************************************************************
+  // ModbusFrame tests
+  // ******************************************************************************
+  testsExecuted = 0;
+  testsPassed = 0;
+
+  {
+    ModbusMessage fm = makeVector("01 03 04 11 22 33 44");
+    FramePool pool(2, 32);
+
+    // Frame from the pool: same data, one reference
+    ModbusFrame f1 = pool.make(fm);
+    testOutput("ModbusFrame", LNO(__LINE__) "pool frame", fm, f1);
+    testsExecuted++;
+    if (f1.useCount() == 1 && pool.available() == 1 && f1.getServerID() == 1 && f1.getFunctionCode() == 3 && f1[6] == 0x44) {
+      testsPassed++;
+    } else {
+      Serial.print(LNO(__LINE__) "pool frame accessors failed\n");
+    }
+
+    // Copies share the buffer
+    testsExecuted++;
+    {
+      ModbusFrame f2 = f1;
+      ModbusFrame f3;
+      f3 = f2;
+      uint16_t v = 0;
+      f3.get(3, v);
+      if (f1.useCount() == 3 && f3.data() == f1.data() && v == 0x1122 && f3 == fm) {
+        testsPassed++;
+      } else {
+        Serial.print(LNO(__LINE__) "frame sharing failed\n");
+      }
+    }
+
+    // Last reference returns the buffer to the pool
+    testsExecuted++;
+    if (f1.useCount() == 1) {
+      f1 = ModbusFrame();
+      if (pool.available() == 2 && !f1 && f1.size() == 0) {
+        testsPassed++;
+      } else {
+        Serial.print(LNO(__LINE__) "frame recycling failed\n");
+      }
+    } else {
+      Serial.print(LNO(__LINE__) "frame reference count failed\n");
+    }
+
+    // Exhausted pool still delivers frames
+    testsExecuted++;
+    {
+      ModbusFrame a = pool.make(fm);
+      ModbusFrame b = pool.make(fm);
+      ModbusFrame c = pool.make(fm);
+      if (pool.available() == 0 && c == fm && c.useCount() == 1) {
+        testsPassed++;
+      } else {
+        Serial.print(LNO(__LINE__) "exhausted pool failed\n");
+      }
+    }
+
+    // A frame outlives the pool it was made from
+    {
+      ModbusFrame f5;
+      {
+        FramePool shortLived(1, 32);
+        f5 = shortLived.make(fm);
+      }
+      testOutput("ModbusFrame", LNO(__LINE__) "frame outliving its pool", makeVector("01 03 04 11 22 33 44"), f5);
+    }
+
+    // A frame converts into a modifiable ModbusMessage copy
+    ModbusFrame f4(std::move(fm));
+    ModbusMessage copy = f4;
+    copy.setServerID(2);
+    testOutput("ModbusFrame", LNO(__LINE__) "message copy", makeVector("02 03 04 11 22 33 44"), copy);
+    testOutput("ModbusFrame", LNO(__LINE__) "adopted message", makeVector("01 03 04 11 22 33 44"), f4);
+  }
+
+  // Print summary.
+  Serial.printf("----->    ModbusFrame tests: %4d, passed: %4d\n", testsExecuted, testsPassed);
+
+  // ******************************************************************************
+  // ModbusSegments tests
+  // ******************************************************************************
+  testsExecuted = 0;
+  testsPassed = 0;
+
+  {
+    uint8_t head[6] = { 0x00, 0x01, 0x00, 0x00, 0x00, 0x06 };
+    uint8_t trailer[2] = { 0xAA, 0x55 };
+    ModbusMessage pdu = makeVector("01 03 00 10 00 02");
+    ModbusSegments frame;
+    frame.add(head, 6);
+    frame.add(pdu);
+    frame.add(trailer, 0);
+
+    // Segments refer to the data, empty ones are skipped
+    testsExecuted++;
+    if (frame.count() == 2 && frame.size() == 12 && frame[0].data == head && frame[1].data == pdu.data()) {
+      testsPassed++;
+    } else {
+      Serial.print(LNO(__LINE__) "segment view failed\n");
+    }
+
+    // No more than MAXSEGMENTS segments
+    testsExecuted++;
+    if (frame.add(trailer, 2) && !frame.add(trailer, 2) && frame.count() == 3 && frame.size() == 14) {
+      testsPassed++;
+    } else {
+      Serial.print(LNO(__LINE__) "segment limit failed\n");
+    }
+
+    // Gathering into a contiguous buffer, truncated if too small
+    uint8_t buffer[16];
+    uint16_t len = frame.copyTo(buffer, sizeof(buffer));
+    testOutput("ModbusSegments", LNO(__LINE__) "copyTo", makeVector("00 01 00 00 00 06 01 03 00 10 00 02 AA 55"), ModbusMessage(std::vector<uint8_t>(buffer, buffer + len)));
+    len = frame.copyTo(buffer, 8);
+    testOutput("ModbusSegments", LNO(__LINE__) "copyTo (short)", makeVector("00 01 00 00 00 06 01 03"), ModbusMessage(std::vector<uint8_t>(buffer, buffer + len)));
+  }
+
+  // Print summary.
+  Serial.printf("----->    ModbusSegments tests: %4d, passed: %4d\n", testsExecuted, testsPassed);
+
+  // ******************************************************************************
+  // CoilMap tests
+  // ******************************************************************************
+  testsExecuted = 0;
+  testsPassed = 0;
+
+  {
+    CoilMap map;
+    CoilData window("1011 0011 1000 1111 01");
+    map.set(65000, window);
+
+    // Views refer to the map's coils at any offset
+    CoilView v = map.view(65000, window.coils());
+    testsExecuted++;
+    if (map.coils() == 65536 && v == window && v[2] && !v[1] && map.coilsSetON() == 11 && v.coilsSetON() == 11) {
+      testsPassed++;
+    } else {
+      Serial.print(LNO(__LINE__) "CoilMap view failed\n");
+    }
+
+    // Views beyond the end of the map are empty
+    testsExecuted++;
+    if (!map.view(65530, 7) && map.view(65535, 1) && !map.set(65536, true)) {
+      testsPassed++;
+    } else {
+      Serial.print(LNO(__LINE__) "CoilMap limits failed\n");
+    }
+
+    // Changes to the map show in the view
+    map.set(65001, true);
+    CoilData copy = v;
+    testsExecuted++;
+    if (copy == "1111 0011 1000 1111 01" && v != window) {
+      testsPassed++;
+    } else {
+      Serial.print(LNO(__LINE__) "CoilMap view update failed\n");
+    }
+
+    // Serving requests from the map
+    testOutput("CoilMap", LNO(__LINE__) "FC01", makeVector("01 01 03 CF F1 02"), map.serve(ModbusMessage(1, READ_COIL, 65000, 18)));
+    testOutput("CoilMap", LNO(__LINE__) "FC02 unaligned", makeVector("01 02 01 33"), map.serve(ModbusMessage(1, READ_DISCR_INPUT, 65002, 6)));
+    testOutput("CoilMap", LNO(__LINE__) "FC01 out of range", makeVector("01 81 02"), map.serve(ModbusMessage(1, READ_COIL, 65530, 7)));
+    testOutput("CoilMap", LNO(__LINE__) "FC05", makeVector("01 05 00 0A FF 00"), map.serve(ModbusMessage(1, WRITE_COIL, 10, 0xFF00)));
+    ModbusMessage fc0f;
+    fc0f.add((uint8_t)1, WRITE_MULT_COILS, (uint16_t)3, (uint16_t)10, (uint8_t)2, (uint8_t)0xFF, (uint8_t)0x03);
+    testOutput("CoilMap", LNO(__LINE__) "FC0F", makeVector("01 0F 00 03 00 0A"), map.serve(fc0f));
+    testOutput("CoilMap", LNO(__LINE__) "FC01 after writes", makeVector("01 01 02 F8 1F"), map.serve(ModbusMessage(1, READ_COIL, 0, 16)));
+  }
+
+  // Print summary.
+  Serial.printf("----->    CoilMap tests: %4d, passed: %4d\n", testsExecuted, testsPassed);
+
+  // ******************************************************************************
+  // AtomicCoilBank tests
+  // ******************************************************************************
+  testsExecuted = 0;
+  testsPassed = 0;
+
+  {
+    AtomicCoilBank bank(1000);
+    CoilData pattern("1011 0011 1000 1111 01");
+
+    // Single coil operations
+    bank.set(3, true);
+    bank.toggle(4);
+    bank.toggle(3);
+    bank.set(999, true);
+    bank.clear(999);
+    testsExecuted++;
+    if (!bank[3] && bank[4] && !bank[999] && !bank.set(1000, true) && !bank.toggle(1000)) {
+      testsPassed++;
+    } else {
+      Serial.print(LNO(__LINE__) "AtomicCoilBank single coils failed\n");
+    }
+
+    // Range write across word boundaries and snapshot at the same position
+    bank.set(30, pattern);
+    testsExecuted++;
+    if (bank.slice(30, pattern.coils()) == pattern && bank.slice(990, 11).coils() == 0) {
+      testsPassed++;
+    } else {
+      Serial.print(LNO(__LINE__) "AtomicCoilBank snapshot failed\n");
+    }
+
+    // Serving requests from the bank
+    testOutput("AtomicCoilBank", LNO(__LINE__) "FC01", makeVector("01 01 03 CD F1 02"), bank.serve(ModbusMessage(1, READ_COIL, 30, 18)));
+    testOutput("AtomicCoilBank", LNO(__LINE__) "FC01 out of range", makeVector("01 81 02"), bank.serve(ModbusMessage(1, READ_COIL, 999, 2)));
+    testOutput("AtomicCoilBank", LNO(__LINE__) "FC05", makeVector("01 05 00 1F FF 00"), bank.serve(ModbusMessage(1, WRITE_COIL, 31, 0xFF00)));
+    testOutput("AtomicCoilBank", LNO(__LINE__) "FC02 after write", makeVector("01 02 01 0F"), bank.serve(ModbusMessage(1, READ_DISCR_INPUT, 30, 4)));
+  }
+
+  // Print summary.
+  Serial.printf("----->    AtomicCoilBank tests: %4d, passed: %4d\n", testsExecuted, testsPassed);
+
   // ******************************************************************************
   // Counter tests
   // ******************************************************************************
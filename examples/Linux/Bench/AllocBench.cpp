@@ -0,0 +1,172 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+// AllocBench: heap allocations and bytes per transaction in steady state, for the request paths
+// that can be run on Linux:
+//   - ModbusClientTCP syncRequest() and addRequest() through a LoopbackClient to a ModbusServer
+//   - the TCP server side alone: Modbus TCP frames answered by the LoopbackClient's server thread,
+//     which does what ModbusServerTCP does with a request
+//   - a ModbusBridge forwarding requests to a TCP server
+//   - RTU and ASCII round trips: RTUutils send() and receive() on both sides of a ModbusServer,
+//     through HardwareSerial stand-ins. This is the framing of ModbusClientRTU and ModbusServerRTU,
+//     but not their queue handling.
+// Every path is warmed up before counting. Counts include all threads, both sides of a connection.
+// A path has a budget of allocations per transaction, set to its current state. The program prints
+// OVER BUDGET and exits with 1 if a path needs more - run it as a regression check, and lower the
+// budgets whenever a path has become cheaper. The goal for all of them is 0.
+// ModbusClientTCPasync and the ESP32 TCP server classes need AsyncTCP or FreeRTOS and are not covered.
+//
+// Usage: AllocBench [transactions]
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+#include "AllocCount.h"
+#include "Bench.h"
+#include "LoopbackClient.h"
+#include "ModbusBridgeTemp.h"
+#include "ModbusClientTCP.h"
+#include "ModbusServer.h"
+#include "RTUutils.h"
+
+volatile uint32_t benchSink = 0;
+
+// Server with public constructor for local requests
+class BenchServer : public ModbusServer {
+public:
+  BenchServer() : ModbusServer() {}
+protected:
+  void isInstance() {}
+};
+
+// RTUport: access to the protected RTUutils send() and receive()
+struct RTUport : RTUutils {
+  using RTUutils::send;
+  using RTUutils::receive;
+};
+
+// Worker returning 10 registers
+ModbusMessage FC03(const ModbusMessage& request) {
+  ModbusMessage response(23);
+  response.add(request.getServerID(), request.getFunctionCode(), (uint8_t)20);
+  for (uint16_t i = 0; i < 10; ++i) response.add(i);
+  return response;
+}
+
+// measure: run a transaction count times after a warm-up, and print allocations per transaction.
+// Returns false if the budget was exceeded or a transaction failed
+template <typename F>
+static bool measure(const char *name, uint32_t count, double budget, F transaction) {
+  uint32_t failed = 0;
+  for (uint32_t i = 0; i < count / 10 + 1; ++i) {
+    if (!transaction()) failed++;
+  }
+  AllocCount start;
+  for (uint32_t i = 0; i < count; ++i) {
+    if (!transaction()) failed++;
+  }
+  AllocCount c = AllocCount() - start;
+  double perCall = (double)c.count / count;
+  bool ok = perCall < budget + 0.05 && failed == 0;   // some slack for container housekeeping
+  printf("%-36s %8.2f allocs %9.1f bytes/transaction  (budget %4.1f)  %s\n", name, perCall, (double)c.bytes / count, budget,
+    failed ? "FAILED" : ok ? "OK" : "OVER BUDGET");
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  uint32_t count = (argc > 1) ? atoi(argv[1]) : 2000;
+  bool allOk = true;
+  IPAddress localhost(127, 0, 0, 1);
+
+  BenchServer server;
+  server.registerWorker(1, READ_HOLD_REGISTER, &FC03);
+  server.registerWorker(1, WRITE_HOLD_REGISTER, [](const ModbusMessage&) { return ECHO_RESPONSE; });
+
+  // 1. ModbusClientTCP through a LoopbackClient
+  {
+    LoopbackClient loop(server);
+    ModbusClientTCP client(loop);
+    // No pause between requests, no sleeping while waiting
+    client.setTimeout(2000, 0);
+    client.setTarget(localhost, 502);
+    client.setBusyPoll(true);
+    std::atomic<uint32_t> responses(0);
+    client.onDataHandler([&responses](ModbusMessage msg, uint32_t) {
+      benchSink += msg.size();
+      responses++;
+    });
+    client.begin();
+    uint32_t token = 1;
+
+    allOk &= measure("ModbusClientTCP syncRequest FC03", count, 6, [&]() {
+      ModbusMessage response = client.syncRequest(token++, 1, READ_HOLD_REGISTER, 0, 10);
+      return response.getError() == SUCCESS;
+    });
+    allOk &= measure("ModbusClientTCP syncRequest FC06", count, 6, [&]() {
+      ModbusMessage response = client.syncRequest(token++, 1, WRITE_HOLD_REGISTER, 1, 0x1234);
+      return response.getError() == SUCCESS;
+    });
+    allOk &= measure("ModbusClientTCP addRequest FC03", count, 5, [&]() {
+      uint32_t expected = responses + 1;
+      if (client.addRequest(token++, 1, READ_HOLD_REGISTER, 0, 10) != SUCCESS) return false;
+      while (responses < expected) std::this_thread::yield();
+      return true;
+    });
+  }
+
+  // 2. Server side only: raw Modbus TCP frames
+  {
+    LoopbackClient loop(server);
+    loop.connect(localhost, 502);
+    const uint8_t request[] = { 0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0x01, 0x03, 0x00, 0x00, 0x00, 0x0A };
+    const int responseLength = 6 + 3 + 20;
+    uint8_t response[responseLength];
+    allOk &= measure("TCP server FC03", count, 2, [&]() {
+      loop.write(request, sizeof(request));
+      while (loop.available() < responseLength) std::this_thread::yield();
+      loop.read(response, responseLength);
+      return response[7] == READ_HOLD_REGISTER;
+    });
+  }
+
+  // 3. Bridge forwarding server ID 4 to server ID 1 over TCP
+  {
+    LoopbackClient loop(server);
+    ModbusClientTCP client(loop);
+    client.setTimeout(2000, 0);
+    client.setBusyPoll(true);
+    client.begin();
+    ModbusBridge<BenchServer> bridge;
+    bridge.attachServer(4, 1, READ_HOLD_REGISTER, &client, localhost, 502);
+    allOk &= measure("ModbusBridge to TCP FC03", count, 7, [&]() {
+      ModbusMessage response = bridge.localRequest(ModbusMessage(4, READ_HOLD_REGISTER, (uint16_t)0, (uint16_t)10));
+      return response.getError() == SUCCESS;
+    });
+  }
+
+  // 4. RTU and ASCII round trips, with the bytes handed over from one serial to the other
+  {
+    HardwareSerial clientSerial;
+    HardwareSerial serverSerial;
+    unsigned long clientMicros = 0;
+    unsigned long serverMicros = 0;
+    const uint32_t interval = 50;   // in microseconds, no UART timing to respect here
+    RTScallback rts(RTUutils::RTSauto);
+    for (bool ascii : { false, true }) {
+      allOk &= measure(ascii ? "ASCII round trip FC03" : "RTU round trip FC03", count / 4, 14, [&]() {
+        RTUport::send(clientSerial, clientMicros, interval, rts, ModbusMessage(1, READ_HOLD_REGISTER, (uint16_t)0, (uint16_t)10), ascii);
+        serverSerial.feed(clientSerial.sent().data(), clientSerial.sent().size());
+        clientSerial.clearSent();
+        ModbusMessage request = RTUport::receive(serverSerial, 1000, serverMicros, interval, ascii);
+        ModbusMessage response = server.localRequest(std::move(request));
+        RTUport::send(serverSerial, serverMicros, interval, rts, response, ascii);
+        clientSerial.feed(serverSerial.sent().data(), serverSerial.sent().size());
+        serverSerial.clearSent();
+        ModbusMessage answer = RTUport::receive(clientSerial, 1000, clientMicros, interval, ascii);
+        return answer.getError() == SUCCESS && answer.size() == 23;
+      });
+    }
+  }
+
+  return allOk ? 0 : 1;
+}
@@ -0,0 +1,42 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _ALLOC_COUNT_H
+#define _ALLOC_COUNT_H
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// Heap allocation counting for the benchmarks. This header replaces the global operator new and
+// delete, so it must be included by exactly one source file of a program - its main file.
+// All threads are counted: a snapshot difference covers the library's worker threads as well.
+
+// Allocation counters, fed by the replaced global operator new
+static std::atomic<uint32_t> allocs(0);
+static std::atomic<uint32_t> allocBytes(0);
+
+void *operator new(size_t size) {
+  allocs++;
+  allocBytes += size;
+  void *p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void *operator new[](size_t size) { return operator new(size); }
+// Not inlined: the compiler would take the free() for a mismatch with the new expression's operator new
+__attribute__((noinline)) void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { operator delete(p); }
+void operator delete[](void *p) noexcept { operator delete(p); }
+void operator delete[](void *p, size_t) noexcept { operator delete(p); }
+
+// Snapshot of the counters around a piece of code
+struct AllocCount {
+  uint32_t count;
+  uint32_t bytes;
+  AllocCount() : count(allocs), bytes(allocBytes) {}
+  AllocCount operator-(const AllocCount& a) const { AllocCount r(*this); r.count -= a.count; r.bytes -= a.bytes; return r; }
+};
+
+#endif
@@ -0,0 +1,71 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _BENCH_H
+#define _BENCH_H
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+// Minimal benchmark harness for the Linux benchmarks.
+// bench() runs a callable for a number of iterations after a short warm-up and
+// prints one result line: name, iterations, nanoseconds per call.
+// With BENCH_FORMAT=json in the environment, result lines are JSON objects instead, with
+// BENCH_FORMAT=csv comma separated values after a header line - to be collected and compared
+// between releases. Other output of a benchmark is not affected.
+
+// Sink for results to keep the optimizer from dropping the measured code
+extern volatile uint32_t benchSink;
+
+struct BenchResult {
+  const char *name;     // Name of the benchmark
+  uint32_t iterations;  // Number of calls measured
+  double nsPerCall;     // Average time per call
+};
+
+enum BenchFormat : uint8_t { BENCH_TEXT = 0, BENCH_CSV, BENCH_JSON };
+
+// benchFormat: output format requested by BENCH_FORMAT
+inline BenchFormat benchFormat() {
+  static int format = -1;
+  if (format < 0) {
+    const char *f = getenv("BENCH_FORMAT");
+    format = (f && !strcmp(f, "json")) ? BENCH_JSON : (f && !strcmp(f, "csv")) ? BENCH_CSV : BENCH_TEXT;
+    if (format == BENCH_CSV) printf("name,iterations,ns_per_call\n");
+  }
+  return (BenchFormat)format;
+}
+
+// benchPrint: one line per result
+inline void benchPrint(const BenchResult& r) {
+  switch (benchFormat()) {
+  case BENCH_JSON:
+    printf("{\"name\":\"%s\",\"iterations\":%u,\"ns_per_call\":%.2f}\n", r.name, r.iterations, r.nsPerCall);
+    break;
+  case BENCH_CSV:
+    printf("\"%s\",%u,%.2f\n", r.name, r.iterations, r.nsPerCall);
+    break;
+  default:
+    printf("%-40s %10u %12.1f ns/call\n", r.name, r.iterations, r.nsPerCall);
+    break;
+  }
+}
+
+// bench: measure f() and print the result
+template <typename F>
+BenchResult bench(const char *name, uint32_t iterations, F f) {
+  using clk = std::chrono::steady_clock;
+  // Warm up caches and branch predictors
+  for (uint32_t i = 0; i < iterations / 10 + 1; ++i) f();
+  clk::time_point start = clk::now();
+  for (uint32_t i = 0; i < iterations; ++i) f();
+  double ns = std::chrono::duration<double, std::nano>(clk::now() - start).count();
+  BenchResult r = { name, iterations, ns / iterations };
+  benchPrint(r);
+  return r;
+}
+
+#endif
@@ -0,0 +1,75 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+// ClockBench: cost of reading the system and the virtual clock, and the wall time a syncRequest()
+// to a server that never answers needs to time out - with real and with virtual time.
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include "Bench.h"
+#include "Loopback.h"
+#include "ModbusClientTCP.h"
+
+volatile uint32_t benchSink = 0;
+
+// silentServe: accept one connection and swallow all requests
+static void silentServe(int listenFD) {
+  int fd = accept(listenFD, nullptr, nullptr);
+  if (fd < 0) return;
+  uint8_t buf[256];
+  while (read(fd, buf, sizeof(buf)) > 0) { }
+  close(fd);
+}
+
+// timeoutRun: let a request with a timeout of timeout ms time out and print the times taken
+static bool timeoutRun(const char *name, uint32_t timeout) {
+  using wall = std::chrono::steady_clock;
+  uint16_t serverPort = 0;
+  int listenFD = loopbackListen(serverPort);
+  if (listenFD < 0) {
+    printf("Could not open listener socket\n");
+    return false;
+  }
+  std::thread srv(silentServe, listenFD);
+  Error e = SUCCESS;
+  unsigned long simulated = 0;
+  double real = 0.0;
+  {
+    Client cl;
+    ModbusClientTCP MBclient(cl, IPAddress(127, 0, 0, 1), serverPort);
+    MBclient.setTimeout(timeout, 1);
+    MBclient.setTarget(IPAddress(127, 0, 0, 1), serverPort);
+    MBclient.begin();
+
+    wall::time_point start = wall::now();
+    unsigned long startMillis = millis();
+    ModbusMessage response = MBclient.syncRequest(1, 1, READ_HOLD_REGISTER, 0, 10);
+    simulated = millis() - startMillis;
+    real = std::chrono::duration<double, std::milli>(wall::now() - start).count();
+    e = response.getError();
+  }
+  shutdown(listenFD, SHUT_RDWR);
+  close(listenFD);
+  srv.join();
+  printf("%-40s error %02X after %8lu ms clock time, %10.1f ms wall time\n", name, e, simulated, real);
+  return e == TIMEOUT;
+}
+
+int main(int argc, char **argv) {
+  uint32_t loops = (argc > 1) ? atoi(argv[1]) : 1000000;
+  VirtualClock virtualClock;
+
+  // 1. Clock reading costs
+  bench("millis() - system clock", loops, [&]() { benchSink += millis(); });
+  ModbusClock::use(&virtualClock);
+  bench("millis() - virtual clock", loops, [&]() { benchSink += millis(); });
+  ModbusClock::use(nullptr);
+
+  // 2. Timeouts
+  bool ok = timeoutRun("syncRequest timeout 2s, system clock", 2000);
+  ModbusClock::use(&virtualClock);
+  ok &= timeoutRun("syncRequest timeout 30s, virtual clock", 30000);
+  ModbusClock::use(nullptr);
+  return ok ? 0 : 1;
+}
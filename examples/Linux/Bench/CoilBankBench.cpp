@@ -0,0 +1,107 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+// CoilBankBench: AtomicCoilBank operation costs, and a concurrency check of its snapshots.
+// Writer threads flip whole 2000-coil blocks at unaligned positions between all 0 and all 1,
+// while other threads toggle single coils elsewhere. Readers snapshot the blocks and must
+// never see a block half changed.
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "Bench.h"
+#include "AtomicCoilBank.h"
+
+volatile uint32_t benchSink = 0;
+
+const uint32_t BLOCK = 2000;       // coils per block
+const uint32_t BLOCKS = 16;        // blocks at coils 5, 2005, 4005, ...
+const uint32_t NOISE = 40000;      // coils from here on get single coil toggles
+
+int main(int argc, char **argv) {
+  uint32_t loops = (argc > 1) ? atoi(argv[1]) : 1000000;
+  uint32_t seconds = (argc > 2) ? atoi(argv[2]) : 2;
+  AtomicCoilBank bank;
+  uint8_t buffer[8192];
+
+  // 1. Single-threaded costs
+  uint32_t i = 0;
+  bench("set(index, value)", loops, [&]() { bank.set(NOISE + (i & 1023), i & 1); i++; });
+  bench("toggle(index)", loops, [&]() { bank.toggle(NOISE + (i++ & 1023)); });
+  bench("operator[]", loops, [&]() { benchSink += bank[NOISE + (i++ & 1023)]; });
+  bench("snapshot(3, 2000)", loops / 100, [&]() { benchSink += bank.snapshot(3, 2000, buffer); });
+  bench("snapshot(0, 65536)", loops / 1000, [&]() { benchSink += bank.snapshot(0, 65536, buffer); });
+
+  // 2. Concurrency check
+  std::atomic<bool> stop(false);
+  std::atomic<uint32_t> blockWrites(0);
+  std::atomic<uint32_t> toggles(0);
+  std::atomic<uint32_t> snapshots(0);
+  std::atomic<uint32_t> busy(0);
+  std::atomic<uint32_t> torn(0);
+  std::vector<std::thread> threads;
+
+  // Block writers
+  for (uint32_t t = 0; t < 2; ++t) {
+    threads.emplace_back([&, t]() {
+      uint8_t ones[BLOCK / 8 + 1];
+      uint8_t zeroes[BLOCK / 8 + 1];
+      memset(ones, 0xFF, sizeof(ones));
+      memset(zeroes, 0, sizeof(zeroes));
+      uint32_t n = t;
+      while (!stop) {
+        uint32_t b = n % BLOCKS;
+        bank.set(5 + b * BLOCK, BLOCK, (n / BLOCKS) & 1 ? ones : zeroes);
+        n += 2;
+        blockWrites++;
+      }
+    });
+  }
+  // Single coil togglers
+  for (uint32_t t = 0; t < 2; ++t) {
+    threads.emplace_back([&, t]() {
+      uint32_t n = t;
+      while (!stop) {
+        bank.toggle(NOISE + (n & 4095));
+        n += 7;
+        toggles++;
+      }
+    });
+  }
+  // Readers
+  for (uint32_t t = 0; t < 2; ++t) {
+    threads.emplace_back([&, t]() {
+      uint8_t snap[BLOCK / 8 + 1];
+      uint32_t n = t;
+      while (!stop) {
+        uint32_t b = n++ % BLOCKS;
+        // A writer preempted within a write will keep snapshots failing - give it the CPU
+        while (!bank.snapshot(5 + b * BLOCK, BLOCK, snap) && !stop) {
+          busy++;
+          std::this_thread::yield();
+        }
+        if (stop) break;
+        snapshots++;
+        // All coils of the block must be equal
+        bool first = snap[0] & 1;
+        for (uint32_t c = 0; c < BLOCK; ++c) {
+          if (((snap[c >> 3] >> (c & 7)) & 1) != first) {
+            torn++;
+            break;
+          }
+        }
+      }
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+  stop = true;
+  for (auto& t : threads) t.join();
+
+  printf("%u s with 2 block writers, 2 togglers, 2 readers:\n", seconds);
+  printf("  block writes %10u  toggles %10u\n", (uint32_t)blockWrites, (uint32_t)toggles);
+  printf("  snapshots    %10u  failed  %10u  torn %u\n", (uint32_t)snapshots, (uint32_t)busy, (uint32_t)torn);
+  return torn ? 1 : 0;
+}
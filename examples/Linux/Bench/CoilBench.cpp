@@ -0,0 +1,158 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+// CoilBench: word-parallel CoilData operations against coil-by-coil loops,
+// for 1 to 2000 coils at unaligned offsets. The results are cross-checked first.
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "Bench.h"
+#include "CoilData.h"
+
+volatile uint32_t benchSink = 0;
+
+// Reference implementations: one coil at a time, as CoilData did before
+static inline bool refGet(const uint8_t *buf, uint16_t i) { return buf[i >> 3] & (1 << (i & 7)); }
+static inline void refPut(uint8_t *buf, uint16_t i, bool v) {
+  buf[i >> 3] &= ~(1 << (i & 7));
+  if (v) buf[i >> 3] |= (1 << (i & 7));
+}
+
+static void refSet(CoilData& c, uint16_t start, uint16_t length, const uint8_t *src) {
+  for (uint16_t i = 0; i < length; ++i) refPut(c.data(), start + i, refGet(src, i));
+}
+
+static CoilData refSlice(const CoilData& c, uint16_t start, uint16_t length) {
+  CoilData r(length);
+  for (uint16_t i = 0; i < length; ++i) refPut(r.data(), i, refGet(c.data(), start + i));
+  return r;
+}
+
+static uint16_t refCount(const CoilData& c) {
+  uint16_t count = 0;
+  for (uint8_t i = 0; i < c.size(); ++i) {
+    uint8_t by = c.data()[i];
+    while (by) {
+      by &= by - 1;
+      count++;
+    }
+  }
+  return count;
+}
+
+static bool refEqual(const CoilData& a, const CoilData& b) {
+  if (a.coils() != b.coils()) return false;
+  for (uint16_t i = 0; i < a.coils(); ++i) {
+    if (a[i] != b[i]) return false;
+  }
+  return true;
+}
+
+// Random bit buffer
+static void randomize(uint8_t *buf, uint16_t len) {
+  for (uint16_t i = 0; i < len; ++i) buf[i] = rand() & 0xFF;
+}
+
+// verify: random sizes and offsets, word-parallel against reference results
+static bool verify(uint32_t rounds) {
+  uint8_t src[256];
+  for (uint32_t r = 0; r < rounds; ++r) {
+    uint16_t size = 1 + rand() % 2000;
+    uint16_t start = rand() % size;
+    uint16_t length = 1 + rand() % (size - start);
+    CoilData a(size, rand() & 1);
+    CoilData b(a);
+    randomize(src, sizeof(src));
+
+    a.set(start, length, src);
+    refSet(b, start, length, src);
+    if (memcmp(a.data(), b.data(), a.size())) {
+      printf("set(%u, %u) of %u coils differs\n", start, length, size);
+      return false;
+    }
+    if (!(a == b) || !refEqual(a, b)) {
+      printf("operator== on %u coils failed\n", size);
+      return false;
+    }
+    if (a.coilsSetON() != refCount(a)) {
+      printf("coilsSetON on %u coils differs\n", size);
+      return false;
+    }
+    CoilData s1 = a.slice(start, length);
+    CoilData s2 = refSlice(a, start, length);
+    if (!(s1 == s2) || !refEqual(s1, s2)) {
+      printf("slice(%u, %u) of %u coils differs\n", start, length, size);
+      return false;
+    }
+    // Changes found by forEachChange and the XOR-diff must match the coils flipped
+    CoilData p(a);
+    uint16_t flips = 0;
+    for (uint16_t i = start; i < start + length; i += 1 + rand() % 50) {
+      p.set(i, !p[i]);
+      flips++;
+    }
+    uint16_t found = 0;
+    bool ok = true;
+    uint16_t changes = a.forEachChange(p, [&](uint16_t i, bool v) { found++; ok &= (a[i] == v) && (p[i] != v); });
+    CoilData x = a ^ p;
+    uint16_t setBits = 0;
+    x.forEachSet([&](uint16_t i) { setBits++; ok &= (a[i] != p[i]); });
+    if (!ok || changes != flips || found != flips || setBits != flips || x.coilsSetON() != flips) {
+      printf("change detection on %u coils failed\n", size);
+      return false;
+    }
+    // Flip one coil in the range: must be unequal now
+    b.set(start + length / 2, !b[start + length / 2]);
+    if (a == b || refEqual(a, b)) {
+      printf("operator== missed a difference in %u coils\n", size);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  uint32_t loops = (argc > 1) ? atoi(argv[1]) : 20000;
+  const uint16_t sizes[] = { 1, 8, 13, 64, 100, 250, 1000, 2000 };
+  uint8_t src[256];
+
+  srand(4711);
+  if (!verify(20000)) return 1;
+
+  randomize(src, sizeof(src));
+  for (uint16_t size : sizes) {
+    // Unaligned offset within a set of up to size + 11 coils
+    uint16_t start = (size > 1) ? 3 : 0;
+    CoilData c((size + 11 > 2000) ? 2000 : size + 11);
+    uint16_t length = (start + size > c.coils()) ? c.coils() - start : size;
+    CoilData d;
+    c.set(0, c.coils(), src);
+
+    printf("--- %u coils, offset %u\n", length, start);
+    bench("set(start, length, buffer)", loops, [&]() { c.set(start, length, src); benchSink += c.data()[0]; });
+    bench("  reference", loops, [&]() { refSet(c, start, length, src); benchSink += c.data()[0]; });
+
+    bench("slice(start, length)", loops, [&]() { benchSink += c.slice(start, length).coils(); });
+    bench("  reference", loops, [&]() { benchSink += refSlice(c, start, length).coils(); });
+
+    // Equal sets, so the comparison has to look at all coils
+    d = c;
+    bench("operator==", loops, [&]() { benchSink += (c == d); });
+    bench("  reference", loops, [&]() { benchSink += refEqual(c, d); });
+
+    bench("coilsSetON()", loops, [&]() { benchSink += c.coilsSetON(); });
+    bench("  reference", loops, [&]() { benchSink += refCount(c); });
+
+    // Change detection with a few coils changed
+    d = c;
+    for (uint16_t i = 0; i < length; i += 397) d.set(start + i, !d[start + i]);
+    bench("forEachChange()", loops, [&]() { benchSink += d.forEachChange(c, [](uint16_t i, bool v) { benchSink += i; }); });
+    bench("  reference (operator[])", loops, [&]() {
+      for (uint16_t i = 0; i < d.coils(); ++i) {
+        if (d[i] != c[i]) benchSink += i;
+      }
+    });
+  }
+  return 0;
+}
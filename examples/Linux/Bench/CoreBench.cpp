@@ -0,0 +1,213 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+// CoreBench: the library's hot paths one by one, to catch regressions between releases.
+//   - ModbusMessage construction, setMessage(), add()/get() and copies
+//   - RTUutils::calcCRC() for several frame sizes
+//   - CoilData set(), slice() and compare
+//   - ModbusServer::getWorker() dispatch, for registered and unknown server IDs
+//   - ModbusClientTCP response parsing from a canned Client
+//   - RTUutils ASCII frame parsing from the HardwareSerial stand-in
+//   - FCT::getType()
+// Run with BENCH_FORMAT=json or BENCH_FORMAT=csv to get results that can be stored and compared.
+// RTU framing is left out: it depends on real inter-character timing, not on code paths.
+#include <cstdlib>
+#include <vector>
+#include "Bench.h"
+#include "CoilData.h"
+#include "ModbusClientTCP.h"
+#include "ModbusServer.h"
+#include "RTUutils.h"
+
+volatile uint32_t benchSink = 0;
+
+// Server with public constructor to register workers on
+class BenchServer : public ModbusServer {
+public:
+  BenchServer() : ModbusServer() {}
+protected:
+  void isInstance() {}
+};
+
+// CannedClient: a Client delivering the same response again after each rewind()
+class CannedClient : public Client {
+public:
+  explicit CannedClient(const std::vector<uint8_t>& r) : response(r), pos(0) {}
+  inline void rewind() { pos = 0; }
+  int available() { return response.size() - pos; }
+  int read(uint8_t *buf, size_t size) {
+    if (size > response.size() - pos) size = response.size() - pos;
+    memcpy(buf, response.data() + pos, size);
+    pos += size;
+    return size;
+  }
+  uint8_t connected() { return 1; }
+protected:
+  std::vector<uint8_t> response;
+  size_t pos;
+};
+
+// ParseClient: ModbusClientTCP giving access to its response parsing
+class ParseClient : public ModbusClientTCP {
+public:
+  explicit ParseClient(Client& c) : ModbusClientTCP(c), target(IPAddress(127, 0, 0, 1), 502, 1000, 0) { setBusyPoll(true); }
+  // parse: run receive() for a request entry built from msg
+  ModbusMessage parse(const ModbusMessage& msg) {
+    RequestEntry entry(0, msg, target);
+    return receive(&entry);
+  }
+protected:
+  TargetHost target;
+};
+
+// RTUParse: access to the protected RTUutils::receive()
+struct RTUParse : RTUutils {
+  using RTUutils::receive;
+};
+
+static void messageBenches() {
+  const uint32_t N = 1000000;
+  uint16_t words[10] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+
+  bench("ModbusMessage empty", N, [] { ModbusMessage m; benchSink += m.size(); });
+  bench("ModbusMessage(FC03)", N, [] {
+    ModbusMessage m(1, READ_HOLD_REGISTER, (uint16_t)100, (uint16_t)10);
+    benchSink += m.size();
+  });
+  bench("setMessage FC03", N, [] {
+    ModbusMessage m;
+    m.setMessage(1, READ_HOLD_REGISTER, 100, 10);
+    benchSink += m.size();
+  });
+  bench("setMessage FC10, 10 words", N, [&words] {
+    ModbusMessage m;
+    m.setMessage(1, WRITE_MULT_REGISTERS, 100, 10, 20, words);
+    benchSink += m.size();
+  });
+  bench("add 10 words", N, [] {
+    ModbusMessage m(23);
+    m.add((uint8_t)1, (uint8_t)3, (uint8_t)20);
+    for (uint16_t i = 0; i < 10; ++i) m.add(i);
+    benchSink += m.size();
+  });
+
+  ModbusMessage full(256);
+  full.add((uint8_t)1, (uint8_t)3, (uint8_t)252);
+  for (uint16_t i = 0; i < 126; ++i) full.add(i);
+  bench("get 10 words", N, [&full] {
+    uint16_t v = 0;
+    uint16_t sum = 0;
+    for (uint16_t i = 0; i < 10; ++i) {
+      full.get(3 + i * 2, v);
+      sum += v;
+    }
+    benchSink += sum;
+  });
+  bench("copy 255 bytes", N, [&full] { ModbusMessage m(full); benchSink += m.size(); });
+  bench("copy and move 255 bytes", N, [&full] {
+    ModbusMessage m(full);
+    ModbusMessage n(std::move(m));
+    benchSink += n.size();
+  });
+}
+
+static void crcBenches() {
+  const uint32_t N = 200000;
+  uint8_t frame[256];
+  for (uint16_t i = 0; i < sizeof(frame); ++i) frame[i] = rand() & 0xFF;
+
+  bench("calcCRC 8 bytes", N * 10, [&frame] { benchSink += RTUutils::calcCRC(frame, 8); });
+  bench("calcCRC 64 bytes", N, [&frame] { benchSink += RTUutils::calcCRC(frame, 64); });
+  bench("calcCRC 256 bytes", N, [&frame] { benchSink += RTUutils::calcCRC(frame, 256); });
+}
+
+static void coilBenches() {
+  const uint32_t N = 500000;
+  uint8_t bits[250];
+  for (uint16_t i = 0; i < sizeof(bits); ++i) bits[i] = rand() & 0xFF;
+  CoilData coils(2000);
+  coils.set(0, 2000, bits);
+
+  bench("CoilData set 100 at 13", N, [&coils, &bits] { benchSink += coils.set(13, 100, bits); });
+  bench("CoilData slice 100 at 13", N, [&coils] { benchSink += coils.slice(13, 100).coils(); });
+  CoilData a = coils.slice(0, 1000);
+  CoilData b = coils.slice(0, 1000);
+  bench("CoilData compare 1000", N, [&a, &b] { benchSink += (a == b); });
+}
+
+static void dispatchBenches() {
+  const uint32_t N = 2000000;
+  BenchServer server;
+  MBSworker worker = [](const ModbusMessage&) { return ECHO_RESPONSE; };
+  const uint8_t FCs[] = { READ_HOLD_REGISTER, READ_INPUT_REGISTER, WRITE_HOLD_REGISTER, WRITE_MULT_REGISTERS };
+  for (uint8_t id = 1; id <= 10; ++id) {
+    for (uint8_t fc : FCs) server.registerWorker(id, fc, worker);
+  }
+
+  bench("getWorker hit", N, [&server] { benchSink += (bool)server.getWorker(7, WRITE_HOLD_REGISTER); });
+  bench("getWorker unknown FC", N, [&server] { benchSink += (bool)server.getWorker(7, READ_COIL); });
+  bench("getWorker unknown server", N, [&server] { benchSink += (bool)server.getWorker(99, READ_HOLD_REGISTER); });
+  bench("FCT::getType", N, [] {
+    static uint8_t fc = 0;
+    benchSink += FCT::getType(fc++ & 0x7F);
+  });
+}
+
+static void parseBenches() {
+  const uint32_t N = 200000;
+
+  // TCP: MBAP header (transaction ID 0 as in a default RequestEntry) and FC03 response with 10 words
+  ModbusMessage request(1, READ_HOLD_REGISTER, (uint16_t)100, (uint16_t)10);
+  std::vector<uint8_t> tcp = { 0x00, 0x00, 0x00, 0x00, 0x00, 23, 0x01, 0x03, 20 };
+  for (uint16_t i = 0; i < 10; ++i) {
+    tcp.push_back(0);
+    tcp.push_back(i);
+  }
+  CannedClient canned(tcp);
+  ParseClient parser(canned);
+  if (parser.parse(request).getError() != SUCCESS) {
+    printf("TCP response not accepted\n");
+    return;
+  }
+  // receive() will yield once in idle() before returning
+  bench("TCP parse FC03 10 words", N, [&canned, &parser, &request] {
+    canned.rewind();
+    benchSink += parser.parse(request).size();
+  });
+
+  // ASCII: same response, with LRC and lead-in/lead-out
+  HardwareSerial serial;
+  std::vector<uint8_t> pdu(tcp.begin() + 6, tcp.end());
+  uint8_t lrc = 0;
+  for (uint8_t b : pdu) lrc += b;
+  pdu.push_back(-lrc);
+  std::vector<uint8_t> ascii = { ':' };
+  const char *hex = "0123456789ABCDEF";
+  for (uint8_t b : pdu) {
+    ascii.push_back(hex[b >> 4]);
+    ascii.push_back(hex[b & 0x0F]);
+  }
+  ascii.push_back('\r');
+  ascii.push_back('\n');
+  unsigned long lastMicros = 0;
+  serial.feed(ascii.data(), ascii.size());
+  ModbusMessage check = RTUParse::receive(serial, 1000, lastMicros, 0, true);
+  if (check.size() != pdu.size() - 1) {
+    printf("ASCII frame not accepted\n");
+    return;
+  }
+  bench("ASCII parse FC03 10 words", N, [&serial, &ascii, &lastMicros] {
+    serial.feed(ascii.data(), ascii.size());
+    benchSink += RTUParse::receive(serial, 1000, lastMicros, 0, true).size();
+  });
+}
+
+int main() {
+  messageBenches();
+  crcBenches();
+  coilBenches();
+  dispatchBenches();
+  parseBenches();
+  return 0;
+}
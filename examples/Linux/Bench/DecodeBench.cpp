@@ -0,0 +1,96 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+// DecodeBench: DecodePlan against hand-written get() chains for a typical meter layout
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include "Bench.h"
+#include "DecodePlan.h"
+
+volatile uint32_t benchSink = 0;
+
+// Register layout of the simulated meter, starting at register 0x100:
+//   0x100..0x107  8 x int16, scaled by 0.1 (voltages, currents)
+//   0x108..0x10F  4 x uint32 (energy counters)
+//   0x110..0x11B  6 x float, word swapped (power values)
+//   0x11C..0x11F  4 x int16 (temperatures)
+//   0x120..0x121  2 x uint16 (status words)
+struct Meter {
+  float volts[8];
+  uint32_t energy[4];
+  float power[6];
+  int16_t temp[4];
+  uint16_t status[2];
+};
+
+const uint16_t FIRST = 0x100;
+const uint16_t REGS = 0x22;
+
+// Hand-written decoder, the way the applications do it today
+static void decodeByHand(const ModbusMessage& msg, Meter& m) {
+  uint16_t idx = 3;
+  int16_t raw;
+  for (uint8_t i = 0; i < 8; ++i) {
+    idx = msg.get(idx, raw);
+    m.volts[i] = raw * 0.1f;
+  }
+  for (uint8_t i = 0; i < 4; ++i) idx = msg.get(idx, m.energy[i]);
+  for (uint8_t i = 0; i < 6; ++i) idx = msg.get(idx, m.power[i], SWAP_REGISTERS);
+  for (uint8_t i = 0; i < 4; ++i) idx = msg.get(idx, m.temp[i]);
+  for (uint8_t i = 0; i < 2; ++i) idx = msg.get(idx, m.status[i]);
+}
+
+int main(int argc, char **argv) {
+  uint32_t loops = (argc > 1) ? atoi(argv[1]) : 1000000;
+
+  // Build a FC 0x03 response
+  ModbusMessage response;
+  response.add((uint8_t)1, (uint8_t)READ_HOLD_REGISTER, (uint8_t)(REGS * 2));
+  for (uint8_t i = 0; i < 8; ++i) response.add((uint16_t)(2300 + i * 7 - (i & 1) * 5000));
+  for (uint8_t i = 0; i < 4; ++i) response.add((uint32_t)(123456789 + i * 1000003));
+  for (uint8_t i = 0; i < 6; ++i) response.add(1.5f * i - 3.25f, SWAP_REGISTERS);
+  for (uint8_t i = 0; i < 4; ++i) response.add((uint16_t)(i * 1000 - 1500));
+  for (uint8_t i = 0; i < 2; ++i) response.add((uint16_t)(0xA5A5 >> i));
+
+  // Describe the same layout as a plan
+  DecodePlan plan(FIRST);
+  plan.add(0x100, DEC_INT16, 0, 8).scale(0.1).to(offsetof(Meter, volts))
+      .add(0x108, DEC_UINT32, 0, 4).to(offsetof(Meter, energy))
+      .add(0x110, DEC_FLOAT, SWAP_REGISTERS, 6).to(offsetof(Meter, power))
+      .add(0x11C, DEC_INT16, 0, 4).to(offsetof(Meter, temp))
+      .add(0x120, DEC_UINT16, 0, 2).to(offsetof(Meter, status));
+
+  // Both must yield identical results
+  Meter a, b;
+  memset(&a, 0, sizeof(a));
+  memset(&b, 0, sizeof(b));
+  decodeByHand(response, a);
+  Error e = plan.decodeStruct(response, b);
+  if (e != SUCCESS || memcmp(&a, &b, sizeof(Meter))) {
+    printf("Mismatch between get() chain and DecodePlan (rc=%02X)\n", e);
+    return 1;
+  }
+  double values[24];
+  e = plan.decode(response, values, 24);
+  if (e != SUCCESS || (float)values[8 + 4] != a.power[0]) {
+    printf("Mismatch between get() chain and DecodePlan values (rc=%02X)\n", e);
+    return 1;
+  }
+  printf("%u registers, %u values, %u decode steps\n", plan.registers(), plan.values(), plan.steps());
+
+  bench("decode get() chain", loops, [&]() {
+    decodeByHand(response, a);
+    benchSink += a.energy[0];
+  });
+  bench("decode DecodePlan::decodeStruct", loops, [&]() {
+    plan.decodeStruct(response, b);
+    benchSink += b.energy[0];
+  });
+  bench("decode DecodePlan::decode (double)", loops, [&]() {
+    plan.decode(response, values, 24);
+    benchSink += (uint32_t)values[9];
+  });
+  return 0;
+}
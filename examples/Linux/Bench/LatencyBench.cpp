@@ -0,0 +1,101 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+// LatencyBench: round trip latency distribution of ModbusClientTCP::syncRequest() against a
+// loopback server, with the default sleeping worker, with busy-polling, and with a pinned SCHED_FIFO
+// worker thread. Realtime priority needs root or CAP_SYS_NICE; without, the worker falls back to
+// normal scheduling and will tell so.
+// A busy-polling realtime worker will not let lower priority threads on its CPU run at all, so
+// that combination is measured only with at least two CPUs, the worker pinned to the last one.
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "Bench.h"
+#include "Loopback.h"
+#include "ModbusClientTCP.h"
+
+volatile uint32_t benchSink = 0;
+
+struct LatencyMode {
+  const char *name;   // Description
+  int coreID;         // CPU to pin the worker to, -1 for none
+  int priority;       // SCHED_FIFO priority, 0 for none
+  bool busyPoll;      // Spin instead of sleeping
+};
+
+// percentile: value at fraction p of the sorted samples
+static double percentile(const std::vector<double>& sorted, double p) {
+  size_t i = (size_t)(p * (sorted.size() - 1) + 0.5);
+  return sorted[i];
+}
+
+// measure: run transactions syncRequests in the given mode and print the latency distribution
+static bool measure(const LatencyMode& mode, uint32_t transactions) {
+  using clk = std::chrono::steady_clock;
+  uint16_t serverPort = 0;
+  int listenFD = loopbackListen(serverPort);
+  if (listenFD < 0) {
+    printf("Could not open listener socket\n");
+    return false;
+  }
+  std::thread srv(loopbackServe, listenFD);
+  std::vector<double> samples;
+  samples.reserve(transactions);
+  {
+    Client cl;
+    ModbusClientTCP MBclient(cl);
+    // No pause between requests
+    MBclient.setTimeout(2000, 0);
+    MBclient.setTarget(IPAddress(127, 0, 0, 1), serverPort);
+    MBclient.setPriority(mode.priority);
+    MBclient.setBusyPoll(mode.busyPoll);
+    MBclient.begin(mode.coreID);
+
+    // Establish the connection outside of the measurement
+    ModbusMessage r = MBclient.syncRequest(0, 1, READ_HOLD_REGISTER, 0, 10);
+    if (r.getError() != SUCCESS) {
+      printf("No connection to loopback server\n");
+      return false;
+    }
+
+    for (uint32_t i = 0; i < transactions; ++i) {
+      clk::time_point start = clk::now();
+      ModbusMessage response = MBclient.syncRequest(i + 1, 1, READ_HOLD_REGISTER, 0, 10);
+      samples.push_back(std::chrono::duration<double, std::micro>(clk::now() - start).count());
+      benchSink += response.size();
+    }
+  }
+  shutdown(listenFD, SHUT_RDWR);
+  close(listenFD);
+  srv.join();
+
+  std::sort(samples.begin(), samples.end());
+  printf("%-40s p50 %9.1f  p90 %9.1f  p99 %9.1f  max %9.1f us\n", mode.name,
+    percentile(samples, 0.5), percentile(samples, 0.9), percentile(samples, 0.99), samples.back());
+  fflush(stdout);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  uint32_t transactions = (argc > 1) ? atoi(argv[1]) : 500;
+  int cpus = std::thread::hardware_concurrency();
+  int coreID = (argc > 2) ? atoi(argv[2]) : (cpus > 1 ? cpus - 1 : 0);
+
+  LatencyMode modes[] = {
+    { "default (sleeping worker)", -1, 0, false },
+    { "busy-poll", -1, 0, true },
+    { "pinned, SCHED_FIFO 50", coreID, 50, false },
+    { "busy-poll, pinned, SCHED_FIFO 50", coreID, 50, true },
+  };
+  for (auto& m : modes) {
+    if (m.busyPoll && m.priority && cpus < 2) {
+      printf("%-40s skipped - needs at least 2 CPUs\n", m.name);
+      continue;
+    }
+    if (!measure(m, transactions)) return 1;
+  }
+  return 0;
+}
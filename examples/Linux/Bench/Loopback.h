@@ -0,0 +1,71 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _LOOPBACK_H
+#define _LOOPBACK_H
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// Minimal Modbus TCP server on the loopback interface for the benchmarks, answering
+// FC 0x03 requests with zeroes. It works on plain buffers and will not allocate anything.
+
+// loopbackListen: open a listening socket on a free port. Returns the socket or -1
+inline int loopbackListen(uint16_t& port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  sa.sin_port = 0;
+  socklen_t len = sizeof(sa);
+  if (bind(fd, (struct sockaddr *)&sa, len) < 0 || listen(fd, 1) < 0) {
+    close(fd);
+    return -1;
+  }
+  getsockname(fd, (struct sockaddr *)&sa, &len);
+  port = ntohs(sa.sin_port);
+  return fd;
+}
+
+// loopbackReadFully: read exactly len bytes
+inline bool loopbackReadFully(int fd, uint8_t *buf, size_t len) {
+  while (len) {
+    ssize_t r = read(fd, buf, len);
+    if (r <= 0) return false;
+    buf += r;
+    len -= r;
+  }
+  return true;
+}
+
+// loopbackServe: accept one connection and answer requests until it is closed
+inline void loopbackServe(int listenFD) {
+  int fd = accept(listenFD, nullptr, nullptr);
+  if (fd < 0) return;
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  uint8_t req[260];
+  uint8_t resp[260];
+  while (loopbackReadFully(fd, req, 6)) {
+    uint16_t len = (req[4] << 8) | req[5];
+    if (len > 254 || !loopbackReadFully(fd, req + 6, len)) break;
+    uint16_t words = (req[10] << 8) | req[11];
+    if (words > 125) words = 125;
+    memcpy(resp, req, 4);
+    resp[4] = 0;
+    resp[5] = 3 + words * 2;
+    resp[6] = req[6];
+    resp[7] = req[7];
+    resp[8] = words * 2;
+    memset(resp + 9, 0, words * 2);
+    if (write(fd, resp, 9 + words * 2) < 0) break;
+  }
+  close(fd);
+}
+
+#endif
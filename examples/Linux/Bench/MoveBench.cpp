@@ -0,0 +1,151 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+// MoveBench: count heap allocations along the request/response pipeline.
+// Every ModbusMessage copy needs a buffer of its own, so the number of allocations per
+// transaction tells how often a message was materialized on its way through the library.
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+#include "AllocCount.h"
+#include "Bench.h"
+#include "Loopback.h"
+#include "ModbusClientTCP.h"
+#include "ModbusServer.h"
+
+volatile uint32_t benchSink = 0;
+
+// allocReport: print allocations per call against the number of messages that have to exist
+static bool allocReport(const char *name, AllocCount c, uint32_t calls, uint32_t expected) {
+  double perCall = (double)c.count / calls;
+  bool ok = perCall < expected + 0.1;   // some slack for container housekeeping
+  printf("%-44s %8.2f allocs %8.1f bytes/call  (minimum %u)  %s\n", name, perCall, (double)c.bytes / calls, expected, ok ? "OK" : "EXTRA COPIES");
+  return ok;
+}
+
+// Server with public constructor for local requests
+class BenchServer : public ModbusServer {
+public:
+  BenchServer() : ModbusServer() {}
+protected:
+  void isInstance() {}
+};
+
+// Worker returning 10 registers
+ModbusMessage FC03(const ModbusMessage& request) {
+  ModbusMessage response(23);
+  response.add(request.getServerID(), request.getFunctionCode(), (uint8_t)20);
+  for (uint16_t i = 0; i < 10; ++i) response.add(i);
+  return response;
+}
+
+// Worker echoing the request
+ModbusMessage FC06(const ModbusMessage& request) {
+  return ECHO_RESPONSE;
+}
+
+int main(int argc, char **argv) {
+  uint32_t loops = 1000;
+  uint32_t transactions = 200;
+  bool allOk = true;
+  if (argc > 1) loops = atoi(argv[1]);
+  if (argc > 2) transactions = atoi(argv[2]);
+
+  // 1. Creating a request: one buffer
+  {
+    AllocCount start;
+    for (uint32_t i = 0; i < loops; ++i) {
+      ModbusMessage m;
+      m.setMessage(1, READ_HOLD_REGISTER, 0, 10);
+      benchSink += m.size();
+    }
+    allOk &= allocReport("ModbusMessage::setMessage", AllocCount() - start, loops, 1);
+  }
+
+  // 2. Local server requests: request plus response.
+  //    ECHO reuses the request, but the worker returns a copy of the ECHO_RESPONSE marker
+  {
+    BenchServer server;
+    server.registerWorker(1, READ_HOLD_REGISTER, &FC03);
+    server.registerWorker(1, WRITE_HOLD_REGISTER, &FC06);
+
+    AllocCount start;
+    for (uint32_t i = 0; i < loops; ++i) {
+      ModbusMessage m;
+      m.setMessage(1, READ_HOLD_REGISTER, 0, 10);
+      ModbusMessage r = server.localRequest(std::move(m));
+      benchSink += r.size();
+    }
+    allOk &= allocReport("ModbusServer::localRequest (data)", AllocCount() - start, loops, 2);
+
+    start = AllocCount();
+    for (uint32_t i = 0; i < loops; ++i) {
+      ModbusMessage m;
+      m.setMessage(1, WRITE_HOLD_REGISTER, 0, 10);
+      ModbusMessage r = server.localRequest(std::move(m));
+      benchSink += r.size();
+    }
+    allOk &= allocReport("ModbusServer::localRequest (ECHO)", AllocCount() - start, loops, 2);
+  }
+
+  // 3. TCP client against the loopback server
+  uint16_t serverPort = 0;
+  int listenFD = loopbackListen(serverPort);
+  if (listenFD < 0) {
+    printf("Could not open listener socket\n");
+    return 1;
+  }
+  std::thread srv(loopbackServe, listenFD);
+  {
+    Client cl;
+    ModbusClientTCP MBclient(cl, IPAddress(127, 0, 0, 1), serverPort);
+    std::atomic<uint32_t> responses(0);
+    MBclient.onDataHandler([&](ModbusMessage msg, uint32_t token) {
+      benchSink += msg.size();
+      responses++;
+    });
+    MBclient.setTimeout(2000, 1);
+    MBclient.begin();
+
+    // Establish the connection outside of the measurement
+    ModbusMessage r = MBclient.syncRequest(0, 1, READ_HOLD_REGISTER, 0, 10);
+    if (r.getError() != SUCCESS) {
+      printf("No connection to loopback server\n");
+      return 1;
+    }
+
+    // Synchronous requests: request, queue entry, response, map node
+    AllocCount start;
+    for (uint32_t i = 0; i < transactions; ++i) {
+      ModbusMessage response = MBclient.syncRequest(i + 1, 1, READ_HOLD_REGISTER, 0, 10);
+      benchSink += response.size();
+    }
+    allOk &= allocReport("ModbusClientTCP::syncRequest", AllocCount() - start, transactions, 4);
+
+    // Asynchronous requests: request, queue entry, response
+    start = AllocCount();
+    for (uint32_t i = 0; i < transactions; ++i) {
+      uint32_t expected = responses + 1;
+      MBclient.addRequest(i + 1, 1, READ_HOLD_REGISTER, 0, 10);
+      while (responses < expected) usleep(50);
+    }
+    allOk &= allocReport("ModbusClientTCP::addRequest/onData", AllocCount() - start, transactions, 3);
+
+    // Preformatted messages handed over with std::move()
+    start = AllocCount();
+    for (uint32_t i = 0; i < transactions; ++i) {
+      uint32_t expected = responses + 1;
+      ModbusMessage m;
+      m.setMessage(1, READ_HOLD_REGISTER, 0, 10);
+      MBclient.addRequest(std::move(m), i + 1);
+      while (responses < expected) usleep(50);
+    }
+    allOk &= allocReport("ModbusClientTCP::addRequest(ModbusMessage)", AllocCount() - start, transactions, 3);
+  }
+  shutdown(listenFD, SHUT_RDWR);
+  close(listenFD);
+  srv.join();
+
+  return allOk ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+// SyscallBench: count socket system calls per ModbusClientTCP transaction.
+// The socket calls of the library are intercepted and counted, except for those of the
+// loopback server thread answering the requests.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+#include <dlfcn.h>
+#include "Bench.h"
+#include "Loopback.h"
+#include "ModbusClientTCP.h"
+
+volatile uint32_t benchSink = 0;
+
+// Counters of intercepted calls
+static std::atomic<uint32_t> recvCalls(0);
+static std::atomic<uint32_t> readCalls(0);
+static std::atomic<uint32_t> sendCalls(0);
+// The loopback server thread is not counted
+static thread_local bool counted = true;
+
+// Interceptors forwarding to the C library
+extern "C" {
+ssize_t recv(int fd, void *buf, size_t len, int flags) {
+  static ssize_t (*real)(int, void *, size_t, int) = (ssize_t (*)(int, void *, size_t, int))dlsym(RTLD_NEXT, "recv");
+  if (counted) recvCalls++;
+  return real(fd, buf, len, flags);
+}
+
+ssize_t read(int fd, void *buf, size_t len) {
+  static ssize_t (*real)(int, void *, size_t) = (ssize_t (*)(int, void *, size_t))dlsym(RTLD_NEXT, "read");
+  if (counted) readCalls++;
+  return real(fd, buf, len);
+}
+
+ssize_t send(int fd, const void *buf, size_t len, int flags) {
+  static ssize_t (*real)(int, const void *, size_t, int) = (ssize_t (*)(int, const void *, size_t, int))dlsym(RTLD_NEXT, "send");
+  if (counted) sendCalls++;
+  return real(fd, buf, len, flags);
+}
+
+ssize_t sendmsg(int fd, const struct msghdr *msg, int flags) {
+  static ssize_t (*real)(int, const struct msghdr *, int) = (ssize_t (*)(int, const struct msghdr *, int))dlsym(RTLD_NEXT, "sendmsg");
+  if (counted) sendCalls++;
+  return real(fd, msg, flags);
+}
+}
+
+// Snapshot of the counters
+struct CallCount {
+  uint32_t recvs;
+  uint32_t reads;
+  uint32_t sends;
+  CallCount() : recvs(recvCalls), reads(readCalls), sends(sendCalls) {}
+};
+
+// report: print calls per transaction
+static void report(const char *name, const CallCount& start, uint32_t transactions) {
+  CallCount now;
+  double recvs = (double)(now.recvs - start.recvs) / transactions;
+  double reads = (double)(now.reads - start.reads) / transactions;
+  double sends = (double)(now.sends - start.sends) / transactions;
+  printf("%-40s recv %6.2f  read %6.2f  send %6.2f  total %6.2f syscalls/transaction\n",
+    name, recvs, reads, sends, recvs + reads + sends);
+}
+
+int main(int argc, char **argv) {
+  uint32_t transactions = (argc > 1) ? atoi(argv[1]) : 1000;
+
+  uint16_t serverPort = 0;
+  int listenFD = loopbackListen(serverPort);
+  if (listenFD < 0) {
+    printf("Could not open listener socket\n");
+    return 1;
+  }
+  std::thread srv([listenFD]() {
+    counted = false;
+    loopbackServe(listenFD);
+  });
+
+  {
+    Client cl;
+    ModbusClientTCP MBclient(cl, IPAddress(127, 0, 0, 1), serverPort);
+    MBclient.setTimeout(2000, 1);
+    MBclient.begin();
+
+    // Establish the connection outside of the measurement
+    ModbusMessage r = MBclient.syncRequest(0, 1, READ_HOLD_REGISTER, 0, 10);
+    if (r.getError() != SUCCESS) {
+      printf("No connection to loopback server\n");
+      return 1;
+    }
+
+    // Small response: 10 registers, 29 bytes
+    CallCount start;
+    for (uint32_t i = 0; i < transactions; ++i) {
+      ModbusMessage response = MBclient.syncRequest(i + 1, 1, READ_HOLD_REGISTER, 0, 10);
+      benchSink += response.size();
+    }
+    report("syncRequest FC03, 10 registers", start, transactions);
+
+    // Maximum response: 125 registers, 259 bytes
+    start = CallCount();
+    for (uint32_t i = 0; i < transactions; ++i) {
+      ModbusMessage response = MBclient.syncRequest(i + 1, 1, READ_HOLD_REGISTER, 0, 125);
+      benchSink += response.size();
+    }
+    report("syncRequest FC03, 125 registers", start, transactions);
+  }
+  shutdown(listenFD, SHUT_RDWR);
+  close(listenFD);
+  srv.join();
+  return 0;
+}
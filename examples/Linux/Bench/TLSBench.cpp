@@ -0,0 +1,223 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+// TLSBench: cost of Modbus/TCP Security compared to plain Modbus TCP on the loopback interface,
+// in nanoseconds per transaction:
+//   - ModbusClientTCP syncRequests over a kept plain TCP connection and over a kept TLS connection,
+//     the difference being the TLS overhead per transaction,
+//   - a connection set up for a single transaction: plain TCP, TLS with a full handshake, and TLS
+//     resuming the session of the previous connection.
+// Server and client authenticate each other with self-signed certificates (EC P-256) made at start.
+// The ModbusClientTCP is busy-polling. Optional arguments: number of transactions (20000) and of connections
+// (1000, these leave sockets in TIME_WAIT).
+#include <atomic>
+#include <string>
+#include <thread>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+#include "Bench.h"
+#include "Loopback.h"
+#include "ModbusClientTCP.h"
+#include "ModbusServerTLS.h"
+#include "TLSClient.h"
+
+volatile uint32_t benchSink = 0;
+static std::atomic<bool> stopping(false);
+
+// Worker returning the requested number of zero registers, as the loopback TCP server does
+ModbusMessage FC03(const ModbusMessage& request) {
+  uint16_t words = 0;
+  request.get(4, words);
+  ModbusMessage response(3 + words * 2);
+  response.add(request.getServerID(), request.getFunctionCode(), (uint8_t)(words * 2));
+  for (uint16_t i = 0; i < words; ++i) response.add((uint16_t)0);
+  return response;
+}
+
+// tcpServe: answer connections one after the other until stopped
+static void tcpServe(int listenFD) {
+  while (!stopping) loopbackServe(listenFD);
+}
+
+// toPEM: get the PEM text written by f
+template <typename F>
+static std::string toPEM(F f) {
+  BIO *bio = BIO_new(BIO_s_mem());
+  f(bio);
+  char *data;
+  long len = BIO_get_mem_data(bio, &data);
+  std::string pem(data, len);
+  BIO_free(bio);
+  return pem;
+}
+
+// makeCertificate: self-signed certificate for 127.0.0.1 and its key, PEM encoded
+static bool makeCertificate(const char *name, std::string& cert, std::string& key) {
+  EVP_PKEY *pkey = nullptr;
+  EVP_PKEY_CTX *kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+  if (!kctx || EVP_PKEY_keygen_init(kctx) <= 0
+   || EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, NID_X9_62_prime256v1) <= 0
+   || EVP_PKEY_keygen(kctx, &pkey) <= 0) {
+    EVP_PKEY_CTX_free(kctx);
+    return false;
+  }
+  EVP_PKEY_CTX_free(kctx);
+
+  X509 *x = X509_new();
+  X509_set_version(x, 2);
+  ASN1_INTEGER_set(X509_get_serialNumber(x), 1);
+  X509_gmtime_adj(X509_getm_notBefore(x), -3600);
+  X509_gmtime_adj(X509_getm_notAfter(x), 86400);
+  X509_set_pubkey(x, pkey);
+  X509_NAME *subject = X509_get_subject_name(x);
+  X509_NAME_add_entry_by_txt(subject, "CN", MBSTRING_ASC, (const unsigned char *)name, -1, -1, 0);
+  X509_set_issuer_name(x, subject);
+  // The client will check the server's IP address
+  X509V3_CTX v3;
+  X509V3_set_ctx(&v3, x, x, nullptr, nullptr, 0);
+  X509_EXTENSION *ext = X509V3_EXT_conf_nid(nullptr, &v3, NID_subject_alt_name, "IP:127.0.0.1");
+  X509_add_ext(x, ext, -1);
+  X509_EXTENSION_free(ext);
+  bool ok = X509_sign(x, pkey, EVP_sha256()) > 0;
+
+  cert = toPEM([x](BIO *b) { PEM_write_bio_X509(b, x); });
+  key = toPEM([pkey](BIO *b) { PEM_write_bio_PrivateKey(b, pkey, nullptr, nullptr, 0, nullptr, nullptr); });
+  X509_free(x);
+  EVP_PKEY_free(pkey);
+  return ok;
+}
+
+// transaction: send a FC 0x03 request through client and wait for the response
+static bool transaction(Client& client, uint16_t tid) {
+  uint8_t request[12] = { (uint8_t)(tid >> 8), (uint8_t)(tid & 0xFF), 0, 0, 0, 6, 1, 3, 0, 0, 0, 10 };
+  uint8_t response[64];
+  if (client.write(request, sizeof(request)) != sizeof(request)) return false;
+  uint16_t got = 0;
+  unsigned long start = millis();
+  while (got < 29 && millis() - start < 2000) {
+    if (client.available() > 0) {
+      int r = client.read(response + got, sizeof(response) - got);
+      if (r > 0) got += r;
+    }
+  }
+  benchSink += got;
+  return got == 29 && response[0] == request[0] && response[1] == request[1];
+}
+
+// polling: syncRequests through a ModbusClientTCP kept connected to port
+static bool polling(const char *name, Client& cl, uint16_t port, uint32_t count, double& nsPerCall) {
+  ModbusClientTCP MBclient(cl);
+  MBclient.setTimeout(2000, 0);
+  MBclient.setBusyPoll(true);
+  MBclient.setTarget(IPAddress(127, 0, 0, 1), port);
+  MBclient.begin();
+  uint32_t token = 1;
+  uint32_t errors = 0;
+  BenchResult r = bench(name, count, [&]() {
+    ModbusMessage response = MBclient.syncRequest(token++, 1, READ_HOLD_REGISTER, 0, 10);
+    if (response.getError() != SUCCESS) errors++;
+    benchSink += response.size();
+  });
+  nsPerCall = r.nsPerCall;
+  if (errors) printf("%s: %u errors\n", name, errors);
+  return errors == 0;
+}
+
+// connecting: a new connection for each transaction
+static bool connecting(const char *name, Client& client, uint16_t port, uint32_t count) {
+  IPAddress ip(127, 0, 0, 1);
+  uint32_t errors = 0;
+  uint16_t tid = 0;
+  bench(name, count, [&]() {
+    if (client.connect(ip, port) < 0 || !transaction(client, tid++)) errors++;
+    client.stop();
+  });
+  if (errors) printf("%s: %u errors\n", name, errors);
+  return errors == 0;
+}
+
+int main(int argc, char **argv) {
+  uint32_t count = (argc > 1) ? atoi(argv[1]) : 20000;
+  uint32_t connects = (argc > 2) ? atoi(argv[2]) : 1000;
+  bool allOk = true;
+
+  // Credentials for both sides
+  std::string serverCert, serverKey, clientCert, clientKey;
+  if (!makeCertificate("eModbus server", serverCert, serverKey) || !makeCertificate("eModbus client", clientCert, clientKey)) {
+    printf("Could not create certificates\n");
+    return 1;
+  }
+
+  // Plain TCP server
+  uint16_t tcpPort = 0;
+  int listenFD = loopbackListen(tcpPort);
+  if (listenFD < 0) {
+    printf("Could not open listener socket\n");
+    return 1;
+  }
+  std::thread tcpThread(tcpServe, listenFD);
+
+  // TLS server, accepting our client certificate only
+  ModbusServerTLS tlsServer;
+  tlsServer.registerWorker(1, READ_HOLD_REGISTER, &FC03);
+  if (!tlsServer.setCertificate(serverCert.c_str(), serverKey.c_str())
+   || !tlsServer.setClientCA(clientCert.c_str())
+   || !tlsServer.start(0, 4, 0)) {
+    printf("Could not start TLS server\n");
+    return 1;
+  }
+  uint16_t tlsPort = tlsServer.getPort();
+
+  // Kept connections
+  double plainNs = 0.0;
+  double tlsNs = 0.0;
+  {
+    Client cl;
+    allOk &= polling("TCP syncRequest, kept connection", cl, tcpPort, count, plainNs);
+  }
+  {
+    TLSClient cl;
+    cl.setCACert(serverCert.c_str());
+    cl.setCertificate(clientCert.c_str());
+    cl.setPrivateKey(clientKey.c_str());
+    allOk &= polling("TLS syncRequest, kept connection", cl, tlsPort, count, tlsNs);
+  }
+  printf("%-40s %10s %12.1f ns/transaction\n", "TLS overhead", "", tlsNs - plainNs);
+
+  // A connection per transaction
+  {
+    Client cl;
+    allOk &= connecting("TCP connect + 1 transaction", cl, tcpPort, connects);
+  }
+  {
+    TLSClient cl;
+    cl.setCACert(serverCert.c_str());
+    cl.setCertificate(clientCert.c_str());
+    cl.setPrivateKey(clientKey.c_str());
+    cl.setSessionResumption(false);
+    uint32_t before = tlsServer.getResumed();
+    allOk &= connecting("TLS full handshake + 1 transaction", cl, tlsPort, connects);
+    if (tlsServer.getResumed() != before) {
+      printf("Sessions were resumed with resumption disabled\n");
+      allOk = false;
+    }
+    cl.setSessionResumption(true);
+    uint32_t handshakes = tlsServer.getHandshakes();
+    before = tlsServer.getResumed();
+    allOk &= connecting("TLS resumed + 1 transaction", cl, tlsPort, connects);
+    // All but the very first connection shall have resumed the session
+    handshakes = tlsServer.getHandshakes() - handshakes;
+    uint32_t reused = tlsServer.getResumed() - before;
+    printf("%-40s %10u of %u\n", "TLS sessions resumed", reused, handshakes);
+    if (reused + 1 < handshakes) allOk = false;
+  }
+
+  tlsServer.stop();
+  stopping = true;
+  shutdown(listenFD, SHUT_RDWR);
+  close(listenFD);
+  tcpThread.join();
+  return allOk ? 0 : 1;
+}
@@ -0,0 +1,103 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+// TransportBench: cost of a ModbusClientTCP transaction against a ModbusServer, in nanoseconds.
+// The same FC 0x03 request is answered
+//   - by a direct localRequest() - the server's dispatch cost alone,
+//   - through a LoopbackClient - client and server protocol handling without the kernel,
+//   - through a TCP connection on the loopback interface - including the network stack.
+// The client is busy-polling in both transport cases. With a single CPU, the spinning threads
+// will take turns by yielding only, so the numbers are best taken with at least 2 CPUs.
+#include <cstdlib>
+#include <thread>
+#include "Bench.h"
+#include "Loopback.h"
+#include "LoopbackClient.h"
+#include "ModbusClientTCP.h"
+
+volatile uint32_t benchSink = 0;
+
+// Server with public constructor for local requests
+class BenchServer : public ModbusServer {
+public:
+  BenchServer() : ModbusServer() {}
+protected:
+  void isInstance() {}
+};
+
+// Worker returning the requested number of zero registers, as the loopback TCP server does
+ModbusMessage FC03(const ModbusMessage& request) {
+  uint16_t words = 0;
+  request.get(4, words);
+  ModbusMessage response(3 + words * 2);
+  response.add(request.getServerID(), request.getFunctionCode(), (uint8_t)(words * 2));
+  for (uint16_t i = 0; i < words; ++i) response.add((uint16_t)0);
+  return response;
+}
+
+// transactions: run syncRequests through client and print the time per transaction
+static bool transactions(const char *name, Client& client, IPAddress ip, uint16_t port, uint32_t count) {
+  ModbusClientTCP MBclient(client);
+  // No pause between requests, no sleeping while waiting
+  MBclient.setTimeout(2000, 0);
+  MBclient.setTarget(ip, port);
+  MBclient.setBusyPoll(true);
+  MBclient.begin();
+
+  // Establish the connection outside of the measurement
+  ModbusMessage r = MBclient.syncRequest(0, 1, READ_HOLD_REGISTER, 0, 10);
+  if (r.getError() != SUCCESS) {
+    printf("%s: no connection to server\n", name);
+    return false;
+  }
+  uint32_t token = 1;
+  uint32_t errors = 0;
+  bench(name, count, [&]() {
+    ModbusMessage response = MBclient.syncRequest(token++, 1, READ_HOLD_REGISTER, 0, 10);
+    if (response.getError() != SUCCESS) errors++;
+    benchSink += response.size();
+  });
+  if (errors) printf("%s: %u errors\n", name, errors);
+  return errors == 0;
+}
+
+int main(int argc, char **argv) {
+  uint32_t loops = (argc > 1) ? atoi(argv[1]) : 1000000;
+  uint32_t count = (argc > 2) ? atoi(argv[2]) : 20000;
+  bool allOk = true;
+
+  BenchServer server;
+  server.registerWorker(1, READ_HOLD_REGISTER, &FC03);
+
+  // 1. Dispatch only
+  ModbusMessage request(1, READ_HOLD_REGISTER, (uint16_t)0, (uint16_t)10);
+  bench("localRequest FC03, 10 registers", loops, [&]() {
+    ModbusMessage response = server.localRequest(request);
+    benchSink += response.size();
+  });
+
+  // 2. In-process transport
+  {
+    LoopbackClient lc(server);
+    allOk &= transactions("syncRequest via LoopbackClient", lc, IPAddress(127, 0, 0, 1), 502, count);
+    printf("%-40s %10u frames served\n", "", lc.getFrameCount());
+  }
+
+  // 3. Kernel TCP loopback
+  uint16_t serverPort = 0;
+  int listenFD = loopbackListen(serverPort);
+  if (listenFD < 0) {
+    printf("Could not open listener socket\n");
+    return 1;
+  }
+  std::thread srv(loopbackServe, listenFD);
+  {
+    Client cl;
+    allOk &= transactions("syncRequest via TCP loopback", cl, IPAddress(127, 0, 0, 1), serverPort, count);
+  }
+  shutdown(listenFD, SHUT_RDWR);
+  close(listenFD);
+  srv.join();
+  return allOk ? 0 : 1;
+}
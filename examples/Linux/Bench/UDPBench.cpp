@@ -0,0 +1,149 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+// UDPBench: cost of polling a number of servers with ModbusClientTCP and with ModbusClientUDP,
+// in nanoseconds per transaction. All servers run on the loopback interface, one port each.
+//   - TCP and UDP syncRequests to a single server - the connection is kept open for TCP,
+//   - TCP and UDP syncRequests to all servers in turn - TCP has to connect for every request,
+//   - rounds of UDP addRequests to all servers at once, waiting for all responses of a round.
+// Both clients are busy-polling. Optional arguments: number of servers (32), of transactions (20000)
+// and of TCP transactions with a new connection each (2000, these leave sockets in TIME_WAIT).
+#include <atomic>
+#include <cstdlib>
+#include <list>
+#include <thread>
+#include <vector>
+#include "Bench.h"
+#include "Loopback.h"
+#include "ModbusClientTCP.h"
+#include "ModbusClientUDP.h"
+#include "ModbusServerUDP.h"
+
+volatile uint32_t benchSink = 0;
+static std::atomic<bool> stopping(false);
+static std::atomic<uint32_t> answered(0);
+
+// Worker returning the requested number of zero registers, as the loopback TCP server does
+ModbusMessage FC03(const ModbusMessage& request) {
+  uint16_t words = 0;
+  request.get(4, words);
+  ModbusMessage response(3 + words * 2);
+  response.add(request.getServerID(), request.getFunctionCode(), (uint8_t)(words * 2));
+  for (uint16_t i = 0; i < words; ++i) response.add((uint16_t)0);
+  return response;
+}
+
+// tcpServe: answer connections one after the other until stopped
+static void tcpServe(int listenFD) {
+  while (!stopping) loopbackServe(listenFD);
+}
+
+// countResponse: response handler for the pipelined requests
+static void countResponse(ModbusMessage response, uint32_t token) {
+  if (response.getError() == SUCCESS) answered++;
+}
+
+// polling: run syncRequests through client, to the ports in turn, and print the time per transaction
+template <typename CLIENT>
+static bool polling(const char *name, CLIENT& client, const std::vector<uint16_t>& ports, uint32_t count) {
+  IPAddress ip(127, 0, 0, 1);
+  uint32_t token = 1;
+  uint32_t errors = 0;
+  uint32_t next = 0;
+  bench(name, count, [&]() {
+    client.setTarget(ip, ports[next]);
+    if (++next == ports.size()) next = 0;
+    ModbusMessage response = client.syncRequest(token++, 1, READ_HOLD_REGISTER, 0, 10);
+    if (response.getError() != SUCCESS) errors++;
+    benchSink += response.size();
+  });
+  if (errors) printf("%s: %u errors\n", name, errors);
+  return errors == 0;
+}
+
+int main(int argc, char **argv) {
+  uint32_t numServers = (argc > 1) ? atoi(argv[1]) : 32;
+  uint32_t count = (argc > 2) ? atoi(argv[2]) : 20000;
+  uint32_t connects = (argc > 3) ? atoi(argv[3]) : 2000;
+  bool allOk = true;
+  if (numServers < 1) numServers = 1;
+
+  // Set up the servers
+  std::list<ModbusServerUDP> udpServers;
+  std::vector<uint16_t> udpPorts;
+  std::vector<int> listenFDs;
+  std::vector<uint16_t> tcpPorts;
+  std::vector<std::thread> tcpThreads;
+  for (uint32_t i = 0; i < numServers; ++i) {
+    udpServers.emplace_back();
+    udpServers.back().registerWorker(1, READ_HOLD_REGISTER, &FC03);
+    if (!udpServers.back().start(0)) {
+      printf("Could not start UDP server\n");
+      return 1;
+    }
+    udpPorts.push_back(udpServers.back().getPort());
+    uint16_t port = 0;
+    int fd = loopbackListen(port);
+    if (fd < 0) {
+      printf("Could not open listener socket\n");
+      return 1;
+    }
+    listenFDs.push_back(fd);
+    tcpPorts.push_back(port);
+    tcpThreads.emplace_back(tcpServe, fd);
+  }
+  char name[64];
+
+  // TCP: one connection kept, and a new one for every request
+  {
+    Client cl;
+    ModbusClientTCP MBclient(cl);
+    MBclient.setTimeout(2000, 0);
+    MBclient.setBusyPoll(true);
+    MBclient.begin();
+    std::vector<uint16_t> one(1, tcpPorts[0]);
+    allOk &= polling("TCP syncRequest, 1 server", MBclient, one, count);
+    snprintf(name, sizeof(name), "TCP syncRequest, %u servers in turn", numServers);
+    allOk &= polling(name, MBclient, numServers > 1 ? tcpPorts : one, connects);
+  }
+
+  // UDP: the same, then all servers at once
+  {
+    ModbusClientUDP MBclient(numServers + 1);
+    MBclient.setTimeout(2000);
+    MBclient.setBusyPoll(true);
+    MBclient.onResponseHandler(&countResponse);
+    MBclient.begin();
+    std::vector<uint16_t> one(1, udpPorts[0]);
+    allOk &= polling("UDP syncRequest, 1 server", MBclient, one, count);
+    snprintf(name, sizeof(name), "UDP syncRequest, %u servers in turn", numServers);
+    allOk &= polling(name, MBclient, udpPorts, count);
+
+    IPAddress ip(127, 0, 0, 1);
+    uint32_t rounds = count / numServers + 1;
+    uint32_t expected = 0;
+    snprintf(name, sizeof(name), "UDP addRequest, round of %u servers", numServers);
+    BenchResult r = bench(name, rounds, [&]() {
+      for (uint32_t i = 0; i < numServers; ++i) {
+        MBclient.setTarget(ip, udpPorts[i]);
+        MBclient.addRequest(i, 1, READ_HOLD_REGISTER, 0, 10);
+      }
+      expected += numServers;
+      while (MBclient.pendingRequests()) std::this_thread::yield();
+    });
+    printf("%-40s %10u %12.1f ns/request\n", "", expected, r.nsPerCall / numServers);
+    if (answered != expected) {
+      printf("%s: %u errors\n", name, expected - answered);
+      allOk = false;
+    }
+  }
+
+  stopping = true;
+  for (auto fd : listenFDs) {
+    shutdown(fd, SHUT_RDWR);
+    close(fd);
+  }
+  for (auto& t : tcpThreads) t.join();
+  return allOk ? 0 : 1;
+}
@@ -0,0 +1,378 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+// Analyze: statistics of recorded Modbus traffic. The capture (see Capture.h for the formats) is scanned
+// once, front to back, and requests are paired with their responses on the fly - the memory needed depends
+// on the requests waiting for a response, not on the size of the capture. Reported are
+//   - per server ID and per function code: requests, request rate over the time span of the capture,
+//     responses, exception responses, errors and the p50, p99, p99.9 and maximum response latencies
+//   - a breakdown of the errors: exception codes, responses not fitting their request, requests without
+//     response and CRC errors
+//   - the CRC failure rate of RTU frames recorded with their CRC
+// Requests and responses are checked with PDUutils, RTU CRCs with RTUutils. Frames with a wrong CRC are
+// counted, but not analyzed further - a response with a wrong CRC is an error of its request.
+// Latency percentiles come from histograms with a resolution of 1/8 of a power of two, 12.5%.
+//
+// Usage: Analyze [options] capture
+//   capture     pcap, pcapng or frame log file
+//   -P port     Modbus TCP server port of the traffic in pcap files (502)
+//   -T ms       time a response may take before its request is counted as unanswered (10000)
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "Capture.h"
+#include "ModbusError.h"
+#include "PDUutils.h"
+#include "RTUutils.h"
+
+// Histogram: counts of values in logarithmic buckets
+class Histogram {
+public:
+  Histogram() : counts(BUCKETS, 0), total(0), maximum(0) {}
+
+  // add: count a value
+  void add(uint64_t v) {
+    counts[bucket(v)]++;
+    total++;
+    if (v > maximum) maximum = v;
+  }
+
+  // percentile: upper bound of the bucket holding fraction p of the values
+  uint64_t percentile(double p) const {
+    uint64_t target = (uint64_t)(p * total + 0.5);
+    if (target == 0) target = 1;
+    uint64_t seen = 0;
+    for (uint16_t i = 0; i < BUCKETS; ++i) {
+      seen += counts[i];
+      if (seen >= target) return std::min(upperBound(i), maximum);
+    }
+    return maximum;
+  }
+
+  uint64_t count() const { return total; }
+  uint64_t max() const { return maximum; }
+
+protected:
+  // Values below 16 have a bucket each, above that every power of two has 8 buckets
+  static const uint16_t BUCKETS = 16 + 60 * 8;
+
+  static uint16_t bucket(uint64_t v) {
+    if (v < 16) return v;
+    uint8_t msb = 63 - __builtin_clzll(v);
+    return 16 + (msb - 4) * 8 + ((v >> (msb - 3)) & 7);
+  }
+
+  static uint64_t upperBound(uint16_t i) {
+    if (i < 16) return i;
+    uint8_t shift = (i - 16) / 8 + 1;
+    uint64_t lower = (uint64_t)(8 + (i - 16) % 8) << shift;
+    return lower + (1ULL << shift) - 1;
+  }
+
+  std::vector<uint64_t> counts;
+  uint64_t total;
+  uint64_t maximum;
+};
+
+// Statistics of a server ID or function code
+struct Stats {
+  uint64_t requests = 0;
+  uint64_t responses = 0;
+  uint64_t exceptions = 0;
+  uint64_t errors = 0;          // Unanswered requests, responses not fitting and CRC errors
+  Histogram latency;            // Microseconds
+};
+
+// A request waiting for its response. Requests with the same connection and TID are chained in order.
+// Slots are recycled through a free list, their messages keep their buffers.
+struct Pending {
+  uint64_t micros;
+  uint32_t next;
+  ModbusMessage request;
+};
+static const uint32_t NONE = UINT32_MAX;
+
+// WaitMap: hash table from connection and TID to the first slot of a chain of waiting requests.
+// Open addressing with linear probing and backward shift deletion - no allocations once it has grown,
+// which matters with a new key for almost every request.
+class WaitMap {
+public:
+  WaitMap() : mask(1023), used(0), entries(1024, Entry{ 0, NONE }) {}
+
+  // find: position of a key, NONE if it is not in
+  uint32_t find(uint64_t key) const {
+    for (uint32_t i = home(key); entries[i].slot != NONE; i = (i + 1) & mask) {
+      if (entries[i].key == key) return i;
+    }
+    return NONE;
+  }
+
+  // insert: add a key that is not in
+  void insert(uint64_t key, uint32_t slot) {
+    if ((used + 1) * 2 > entries.size()) grow();
+    uint32_t i = home(key);
+    while (entries[i].slot != NONE) i = (i + 1) & mask;
+    entries[i] = { key, slot };
+    used++;
+  }
+
+  // erase: remove the key at a position, moving up the keys that had to probe past it
+  void erase(uint32_t i) {
+    entries[i].slot = NONE;
+    used--;
+    for (uint32_t j = (i + 1) & mask; entries[j].slot != NONE; j = (j + 1) & mask) {
+      if (((j - home(entries[j].key)) & mask) >= ((j - i) & mask)) {
+        entries[i] = entries[j];
+        entries[j].slot = NONE;
+        i = j;
+      }
+    }
+  }
+
+  // slot: first slot of the chain at a position
+  uint32_t& slot(uint32_t i) { return entries[i].slot; }
+
+  // forEach: call f with the first slot of every chain
+  template <typename F> void forEach(F f) const {
+    for (auto& e : entries) if (e.slot != NONE) f(e.slot);
+  }
+
+protected:
+  struct Entry {
+    uint64_t key;
+    uint32_t slot;     // NONE for a free entry
+  };
+
+  uint32_t home(uint64_t key) const { return (key * 0x9E3779B97F4A7C15ULL) >> 32 & mask; }
+
+  void grow() {
+    std::vector<Entry> old(entries.size() * 2, Entry{ 0, NONE });
+    old.swap(entries);
+    mask = entries.size() - 1;
+    used = 0;
+    for (auto& e : old) if (e.slot != NONE) insert(e.key, e.slot);
+  }
+
+  uint32_t mask;
+  uint32_t used;
+  std::vector<Entry> entries;
+};
+
+static std::vector<Stats> servers(256);
+static std::vector<Stats> functions(128);
+static std::map<Error, uint64_t> errors;
+static std::vector<Pending> slots;
+static uint32_t freeSlots = NONE;
+static WaitMap waiting;                 // Connection and TID -> first slot of the chain
+static uint64_t frameCount = 0;
+static uint64_t requestCount = 0;
+static uint64_t invalidRequests = 0;
+static uint64_t orphans = 0;
+static uint64_t crcFrames = 0;
+static uint64_t crcErrors = 0;
+static uint64_t firstMicros = UINT64_MAX;
+static uint64_t lastMicros = 0;
+static uint64_t timeout = 10000000;
+
+// failed: count an error of a request
+static void failed(const ModbusMessage& request, Error e) {
+  servers[request[0]].errors++;
+  functions[request[1] & 0x7F].errors++;
+  errors[e]++;
+}
+
+// answered: take the response to a request
+static void answered(const Pending& p, const CapturedFrame& f, bool crcOk) {
+  const ModbusMessage& request = p.request;
+  if (!crcOk) {
+    failed(request, CRC_ERROR);
+    return;
+  }
+  Error e = PDUutils::checkResponse(f.message.data(), f.message.size(), request);
+  if (e != SUCCESS) {
+    failed(request, e);
+    return;
+  }
+  Stats& s = servers[request[0]];
+  Stats& fc = functions[request[1] & 0x7F];
+  uint64_t latency = f.micros > p.micros ? f.micros - p.micros : 0;
+  s.responses++;
+  fc.responses++;
+  s.latency.add(latency);
+  fc.latency.add(latency);
+  if (f.message[1] & 0x80) {
+    s.exceptions++;
+    fc.exceptions++;
+    errors[static_cast<Error>(f.message[2])]++;
+  }
+}
+
+// release: give a slot back
+static inline void release(uint32_t slot) {
+  slots[slot].next = freeSlots;
+  freeSlots = slot;
+}
+
+// frame: account one frame of the capture
+static void frame(const CapturedFrame& f) {
+  frameCount++;
+  firstMicros = std::min(firstMicros, f.micros);
+  lastMicros = std::max(lastMicros, f.micros);
+  bool crcOk = true;
+  if (f.crc >= 0) {
+    crcFrames++;
+    crcOk = RTUutils::validCRC(f.message.data(), f.message.size(), f.crc);
+    if (!crcOk) crcErrors++;
+  }
+  if (f.message.size() < 2) return;
+  uint64_t key = ((uint64_t)f.connection << 16) | f.transactionID;
+
+  if (f.request) {
+    requestCount++;
+    if (!crcOk) {
+      // Neither the server ID nor the function code can be trusted
+      errors[CRC_ERROR]++;
+      return;
+    }
+    servers[f.message[0]].requests++;
+    functions[f.message[1] & 0x7F].requests++;
+    if (PDUutils::checkRequest(f.message.data(), f.message.size()) != SUCCESS) invalidRequests++;
+    // Broadcasts are not answered
+    if (f.message[0] == 0) return;
+    uint32_t slot = freeSlots;
+    if (slot != NONE) {
+      freeSlots = slots[slot].next;
+    } else {
+      slot = slots.size();
+      slots.emplace_back();
+    }
+    Pending& p = slots[slot];
+    p.micros = f.micros;
+    p.next = NONE;
+    p.request.clear();
+    p.request.add(f.message.data(), f.message.size());
+    // Append to the chain of the key
+    uint32_t w = waiting.find(key);
+    if (w == NONE) {
+      waiting.insert(key, slot);
+    } else {
+      uint32_t last = waiting.slot(w);
+      while (slots[last].next != NONE) last = slots[last].next;
+      slots[last].next = slot;
+    }
+    return;
+  }
+
+  // Response: requests with this key waiting too long were not answered, the oldest of the others is
+  uint32_t w = waiting.find(key);
+  if (w == NONE) {
+    orphans++;
+    return;
+  }
+  uint32_t slot = waiting.slot(w);
+  while (slot != NONE && f.micros > slots[slot].micros + timeout) {
+    failed(slots[slot].request, TIMEOUT);
+    uint32_t next = slots[slot].next;
+    release(slot);
+    slot = next;
+  }
+  if (slot == NONE) {
+    waiting.erase(w);
+    orphans++;
+    return;
+  }
+  answered(slots[slot], f, crcOk);
+  if (slots[slot].next == NONE) {
+    waiting.erase(w);
+  } else {
+    waiting.slot(w) = slots[slot].next;
+  }
+  release(slot);
+}
+
+// printStats: one line of a table
+static void printStats(const char *label, unsigned id, const Stats& s, double span) {
+  printf("%-6s %3u %10llu %10.1f %10llu %10llu %10llu", label, id, (unsigned long long)s.requests,
+    span > 0.0 ? s.requests / span : 0.0, (unsigned long long)s.responses, (unsigned long long)s.exceptions,
+    (unsigned long long)s.errors);
+  if (s.latency.count()) {
+    printf(" %9.3f %9.3f %9.3f %9.3f\n", s.latency.percentile(0.5) / 1000.0, s.latency.percentile(0.99) / 1000.0,
+      s.latency.percentile(0.999) / 1000.0, s.latency.max() / 1000.0);
+  } else {
+    printf("\n");
+  }
+}
+
+// percentOf: share of requests
+static double percentOf(uint64_t n) {
+  return requestCount ? 100.0 * n / requestCount : 0.0;
+}
+
+int main(int argc, char **argv) {
+  uint16_t pcapPort = 502;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "P:T:")) != -1) {
+    switch (opt) {
+    case 'P': pcapPort = atoi(optarg); break;
+    case 'T': timeout = atoll(optarg) * 1000; break;
+    default:
+      optind = argc + 1;
+      break;
+    }
+  }
+  if (optind >= argc) {
+    printf("Usage: %s [-P port] [-T timeout] capture\n", argv[0]);
+    return -1;
+  }
+  const char *fileName = argv[optind];
+
+  auto start = std::chrono::steady_clock::now();
+  if (!scanCapture(fileName, pcapPort, &frame)) {
+    printf("Could not read capture %s\n", fileName);
+    return -1;
+  }
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  // Requests still waiting at the end were not answered
+  waiting.forEach([](uint32_t first) {
+    for (uint32_t slot = first; slot != NONE; slot = slots[slot].next) failed(slots[slot].request, TIMEOUT);
+  });
+
+  struct stat st;
+  double megabytes = (stat(fileName, &st) == 0) ? st.st_size / 1e6 : 0.0;
+  double span = frameCount ? (lastMicros - firstMicros) / 1e6 : 0.0;
+  printf("%s: %llu frames, %llu requests over %.3f s", fileName, (unsigned long long)frameCount,
+    (unsigned long long)requestCount, span);
+  if (span > 0.0) printf(", %.1f requests/s", requestCount / span);
+  printf("\nScanned %.1f MB in %.3f s: %.1f MB/s, %.0f frames/s\n", megabytes, elapsed,
+    elapsed > 0.0 ? megabytes / elapsed : 0.0, elapsed > 0.0 ? frameCount / elapsed : 0.0);
+  if (!requestCount) return 0;
+
+  const char *header = "%-10s %10s %10s %10s %10s %10s %9s %9s %9s %9s\n";
+  printf("\n");
+  printf(header, "", "requests", "req/s", "responses", "exceptions", "errors", "p50 ms", "p99 ms", "p99.9 ms", "max ms");
+  for (uint16_t i = 0; i < servers.size(); ++i) {
+    if (servers[i].requests) printStats("server", i, servers[i], span);
+  }
+  for (uint16_t i = 0; i < functions.size(); ++i) {
+    if (functions[i].requests) printStats("FC", i, functions[i], span);
+  }
+
+  printf("\n%-40s %12s %10s\n", "Errors", "count", "% req");
+  for (auto& e : errors) {
+    ModbusError me(e.first);
+    printf("%02X %-37s %12llu %9.3f%%\n", e.first, (const char *)me, (unsigned long long)e.second, percentOf(e.second));
+  }
+  printf("   %-37s %12llu %9.3f%%\n", "Invalid requests", (unsigned long long)invalidRequests, percentOf(invalidRequests));
+  printf("   %-37s %12llu\n", "Responses without request", (unsigned long long)orphans);
+  if (crcFrames) {
+    printf("\nCRC: %llu frames checked, %llu failed (%.3f%%)\n", (unsigned long long)crcFrames,
+      (unsigned long long)crcErrors, 100.0 * crcErrors / crcFrames);
+  }
+  return 0;
+}
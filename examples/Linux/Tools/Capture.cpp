@@ -0,0 +1,548 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#include "Capture.h"
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Byte order helpers for network data
+static inline uint16_t be16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+static inline uint32_t be32(const uint8_t *p) { return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+// ... and for capture file data, that may be written in either order
+static inline uint32_t get32(const uint8_t *p, bool swapped) {
+  return swapped ? be32(p) : ((uint32_t)p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+}
+static inline uint16_t get16(const uint8_t *p, bool swapped) {
+  return swapped ? be16(p) : (p[1] << 8) | p[0];
+}
+
+// Start of binary frame logs
+static const uint8_t binaryLogMagic[8] = { 'e', 'M', 'B', 'f', 'l', 'o', 'g', 0x01 };
+
+// Link layer types of pcap files we understand
+enum LinkType : uint16_t { LT_NULL = 0, LT_ETHERNET = 1, LT_RAW = 101, LT_LINUX_SLL = 113, LT_IPV4 = 228, LT_IPV6 = 229, LT_LINUX_SLL2 = 276 };
+
+// Reassembler: collect the TCP payload of each direction of a connection and cut out Modbus TCP frames
+class Reassembler {
+public:
+  Reassembler(uint16_t port, FrameHandler& h) : serverPort(port), handler(h), nextConnection(1) {}
+
+  // packet: take a captured packet of the link type given
+  void packet(uint16_t linkType, const uint8_t *data, uint32_t len, uint64_t micros);
+
+protected:
+  // One direction of a connection
+  struct Stream {
+    uint32_t connection = 0;
+    bool synced = false;           // nextSeq is valid
+    uint32_t nextSeq = 0;          // Sequence number of the next byte expected
+    std::vector<uint8_t> buffer;   // Payload not yet cut into frames
+  };
+
+  void tcp(const uint8_t *src, const uint8_t *dst, uint8_t addrLen, const uint8_t *seg, uint32_t len, uint64_t micros);
+  size_t cutFrames(Stream& s, const uint8_t *data, size_t len, bool request, uint64_t micros);
+
+  uint16_t serverPort;
+  FrameHandler& handler;
+  CapturedFrame frame;                                     // Reused for all frames handed out
+  uint32_t nextConnection;
+  std::unordered_map<std::string, uint32_t> connections;   // Client and server address and port -> connection number
+  std::unordered_map<std::string, Stream> streams;         // Direction, client and server address and port -> stream
+};
+
+// packet: find the IP header behind the link layer
+void Reassembler::packet(uint16_t linkType, const uint8_t *data, uint32_t len, uint64_t micros) {
+  uint32_t offset = 0;
+  uint16_t etherType = 0;
+  switch (linkType) {
+  case LT_ETHERNET:
+    if (len < 14) return;
+    etherType = be16(data + 12);
+    offset = 14;
+    // Skip VLAN tags
+    while ((etherType == 0x8100 || etherType == 0x88A8) && len >= offset + 4) {
+      etherType = be16(data + offset + 2);
+      offset += 4;
+    }
+    break;
+  case LT_LINUX_SLL:
+    if (len < 16) return;
+    etherType = be16(data + 14);
+    offset = 16;
+    break;
+  case LT_LINUX_SLL2:
+    if (len < 20) return;
+    etherType = be16(data);
+    offset = 20;
+    break;
+  case LT_NULL:
+    offset = 4;
+    break;
+  case LT_RAW:
+  case LT_IPV4:
+  case LT_IPV6:
+    break;
+  default:
+    return;
+  }
+  if (len <= offset) return;
+  data += offset;
+  len -= offset;
+  // Without an ether type, the IP version tells
+  if (etherType == 0) etherType = ((data[0] >> 4) == 6) ? 0x86DD : ((data[0] >> 4) == 4) ? 0x0800 : 0;
+
+  if (etherType == 0x0800) {
+    // IPv4: TCP only, no fragments
+    if (len < 20) return;
+    uint16_t headLen = (data[0] & 0x0F) * 4;
+    uint16_t total = be16(data + 2);
+    if (data[9] != 6 || (be16(data + 6) & 0x3FFF) || total < headLen || total > len) return;
+    tcp(data + 12, data + 16, 4, data + headLen, total - headLen, micros);
+  } else if (etherType == 0x86DD) {
+    // IPv6: TCP directly behind the header only
+    if (len < 40) return;
+    uint16_t payload = be16(data + 4);
+    if (data[6] != 6 || 40U + payload > len) return;
+    tcp(data + 8, data + 24, 16, data + 40, payload, micros);
+  }
+}
+
+// tcp: add a segment's payload to its stream
+void Reassembler::tcp(const uint8_t *src, const uint8_t *dst, uint8_t addrLen, const uint8_t *seg, uint32_t len, uint64_t micros) {
+  if (len < 20) return;
+  uint16_t srcPort = be16(seg);
+  uint16_t dstPort = be16(seg + 2);
+  uint32_t seq = be32(seg + 4);
+  uint16_t headLen = (seg[12] >> 4) * 4;
+  uint8_t flags = seg[13];
+  if (headLen < 20 || headLen > len) return;
+
+  bool request;
+  if (dstPort == serverPort) {
+    request = true;
+  } else if (srcPort == serverPort) {
+    request = false;
+  } else {
+    return;
+  }
+  // Connection key: client address and port, then server address and port
+  const uint8_t *client = request ? src : dst;
+  const uint8_t *server = request ? dst : src;
+  uint16_t clientPort = request ? srcPort : dstPort;
+  std::string key((const char *)client, addrLen);
+  key.append((const char *)server, addrLen);
+  key.push_back(clientPort >> 8);
+  key.push_back(clientPort & 0xFF);
+  auto c = connections.find(key);
+  if (c == connections.end()) c = connections.emplace(key, nextConnection++).first;
+  key.push_back(request ? '>' : '<');
+  Stream& s = streams[key];
+  s.connection = c->second;
+
+  // SYN: new stream start
+  if (flags & 0x02) {
+    s.synced = true;
+    s.nextSeq = seq + 1;
+    s.buffer.clear();
+    return;
+  }
+  const uint8_t *payload = seg + headLen;
+  uint32_t payloadLen = len - headLen;
+  if (payloadLen == 0) return;
+  // Pick up a stream whose start was not captured
+  if (!s.synced) {
+    s.synced = true;
+    s.nextSeq = seq;
+    s.buffer.clear();
+  }
+  int32_t diff = (int32_t)(seq - s.nextSeq);
+  if (diff > 0) {
+    // Bytes are missing - start over with this segment
+    s.buffer.clear();
+    s.nextSeq = seq;
+  } else if (diff < 0) {
+    // Retransmission, maybe with some new data at the end
+    if ((uint32_t)-diff >= payloadLen) return;
+    payload += -diff;
+    payloadLen += diff;
+  }
+  s.nextSeq += payloadLen;
+  // Segments usually hold whole frames - cut them directly, keep only a remainder
+  if (s.buffer.empty()) {
+    size_t used = cutFrames(s, payload, payloadLen, request, micros);
+    if (s.synced) s.buffer.assign(payload + used, payload + payloadLen);
+  } else {
+    s.buffer.insert(s.buffer.end(), payload, payload + payloadLen);
+    size_t used = cutFrames(s, s.buffer.data(), s.buffer.size(), request, micros);
+    if (s.synced) s.buffer.erase(s.buffer.begin(), s.buffer.begin() + used);
+  }
+}
+
+// cutFrames: hand out all complete Modbus TCP frames of the data. Returns the number of bytes used.
+// If the data does not start with a Modbus TCP header, the stream is out of step: it is reset to wait for the next segment.
+size_t Reassembler::cutFrames(Stream& s, const uint8_t *data, size_t len, bool request, uint64_t micros) {
+  size_t pos = 0;
+  while (len - pos >= 6) {
+    const uint8_t *head = data + pos;
+    uint16_t frameLen = be16(head + 4);
+    if (be16(head + 2) != 0 || frameLen < 2 || frameLen > 254) {
+      s.buffer.clear();
+      s.synced = false;
+      return len;
+    }
+    if (len - pos < 6U + frameLen) break;
+    frame.micros = micros;
+    frame.connection = s.connection;
+    frame.transactionID = be16(head);
+    frame.request = request;
+    frame.message.assign(head + 6, head + 6 + frameLen);
+    handler(frame);
+    pos += 6 + frameLen;
+  }
+  return pos;
+}
+
+// readPcap: classic pcap format
+static bool readPcap(const uint8_t *file, size_t size, Reassembler& r) {
+  if (size < 24) return false;
+  uint32_t magic = get32(file, false);
+  bool swapped = (magic == 0xD4C3B2A1 || magic == 0x4D3CB2A1);
+  bool nanos = (magic == 0xA1B23C4D || magic == 0x4D3CB2A1);
+  uint16_t linkType = get32(file + 20, swapped) & 0xFFFF;
+  size_t pos = 24;
+  while (pos + 16 <= size) {
+    const uint8_t *rec = file + pos;
+    uint64_t micros = get32(rec, swapped) * 1000000ULL + get32(rec + 4, swapped) / (nanos ? 1000 : 1);
+    uint32_t capLen = get32(rec + 8, swapped);
+    if (pos + 16 + capLen > size) break;
+    r.packet(linkType, rec + 16, capLen, micros);
+    pos += 16 + capLen;
+  }
+  return true;
+}
+
+// readPcapng: pcapng format, enhanced packet blocks only
+static bool readPcapng(const uint8_t *file, size_t size, Reassembler& r) {
+  struct Interface {
+    uint16_t linkType;
+    uint64_t unitsPerSecond;
+  };
+  std::vector<Interface> interfaces;
+  bool swapped = false;
+  size_t pos = 0;
+  while (pos + 12 <= size) {
+    const uint8_t *block = file + pos;
+    uint32_t type = get32(block, false);
+    // Section header: byte order and a new set of interfaces
+    if (type == 0x0A0D0D0A) {
+      swapped = (get32(block + 8, false) != 0x1A2B3C4D);
+      interfaces.clear();
+    }
+    uint32_t len = get32(block + 4, swapped);
+    if (len < 12 || pos + len > size) break;
+    if (type == 1 && len >= 20) {
+      // Interface description: link type, then options - we need the time stamp resolution
+      Interface i = { get16(block + 8, swapped), 1000000 };
+      size_t opt = 16;
+      while (opt + 4 <= len - 4) {
+        uint16_t code = get16(block + opt, swapped);
+        uint16_t optLen = get16(block + opt + 2, swapped);
+        if (code == 0) break;
+        if (code == 9 && optLen >= 1) {
+          uint8_t res = block[opt + 4];
+          i.unitsPerSecond = (res & 0x80) ? (1ULL << (res & 0x3F)) : 1;
+          if (!(res & 0x80)) for (uint8_t e = 0; e < res && e < 19; ++e) i.unitsPerSecond *= 10;
+        }
+        opt += 4 + ((optLen + 3) & ~3);
+      }
+      interfaces.push_back(i);
+    } else if (type == 6 && len >= 32) {
+      // Enhanced packet
+      uint32_t ifIndex = get32(block + 8, swapped);
+      uint64_t ts = ((uint64_t)get32(block + 12, swapped) << 32) | get32(block + 16, swapped);
+      uint32_t capLen = get32(block + 20, swapped);
+      if (ifIndex < interfaces.size() && 28 + capLen <= len) {
+        // Whole seconds and fraction separately, to neither overflow nor round
+        uint64_t ups = interfaces[ifIndex].unitsPerSecond;
+        uint64_t micros = (ts / ups) * 1000000ULL + (ts % ups) * 1000000ULL / ups;
+        r.packet(interfaces[ifIndex].linkType, block + 28, capLen, micros);
+      }
+    }
+    pos += len;
+  }
+  return true;
+}
+
+// hexDigit: value of a hex digit, -1 for other characters
+static inline int hexDigit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+// hexBytes: convert pairs of hex digits into bytes, up to the next blank or the end.
+// Returns the position behind them, nullptr for invalid data
+static const char *hexBytes(const char *cp, const char *end, std::vector<uint8_t>& bytes) {
+  bytes.clear();
+  while (cp < end && *cp != ' ' && *cp != '\t' && *cp != '\r') {
+    int hi = hexDigit(*cp);
+    int lo = (cp + 1 < end) ? hexDigit(cp[1]) : -1;
+    if (hi < 0 || lo < 0) return nullptr;
+    bytes.push_back((hi << 4) | lo);
+    cp += 2;
+  }
+  return cp;
+}
+
+// parseLine: one frame of a text frame log. Returns false if the line is no valid frame
+static bool parseLine(const char *cp, const char *end, CapturedFrame& f) {
+  auto skipBlanks = [&]() { while (cp < end && (*cp == ' ' || *cp == '\t')) cp++; };
+  auto number = [&](uint64_t& n) {
+    const char *start = cp;
+    for (n = 0; cp < end && *cp >= '0' && *cp <= '9'; ++cp) n = n * 10 + (*cp - '0');
+    return cp > start;
+  };
+  uint64_t seconds;
+  uint64_t value;
+  if (!number(seconds) || cp >= end || *cp++ != '.') return false;
+  // Scale the fraction to microseconds, whatever number of digits it has
+  uint32_t micros = 0;
+  uint8_t digits = 0;
+  for (; cp < end && *cp >= '0' && *cp <= '9'; ++cp, ++digits) {
+    if (digits < 6) micros = micros * 10 + (*cp - '0');
+  }
+  if (digits == 0) return false;
+  for (; digits < 6; ++digits) micros *= 10;
+  f.micros = seconds * 1000000ULL + micros;
+  skipBlanks();
+  if (!number(value)) return false;
+  f.connection = value;
+  skipBlanks();
+  uint16_t tid = 0;
+  for (uint8_t i = 0; i < 4; ++i, ++cp) {
+    int d = (cp < end) ? hexDigit(*cp) : -1;
+    if (d < 0) return false;
+    tid = (tid << 4) | d;
+  }
+  f.transactionID = tid;
+  skipBlanks();
+  if (cp >= end || (*cp != '>' && *cp != '<')) return false;
+  f.request = (*cp++ == '>');
+  skipBlanks();
+  cp = hexBytes(cp, end, f.message);
+  if (!cp || f.message.size() < 2 || f.message.size() > 300) return false;
+  // Optional CRC
+  f.crc = -1;
+  skipBlanks();
+  if (cp < end && *cp != '\r') {
+    std::vector<uint8_t> crc;
+    cp = hexBytes(cp, end, crc);
+    if (!cp || crc.size() != 2) return false;
+    f.crc = crc[0] | (crc[1] << 8);
+    skipBlanks();
+  }
+  return cp == end || *cp == '\r';
+}
+
+// readFrameLog: the text format
+static bool readFrameLog(const char *data, size_t size, const char *fileName, FrameHandler& handler) {
+  CapturedFrame f;
+  const char *end = data + size;
+  uint32_t lineNo = 0;
+  for (const char *line = data; line < end; ) {
+    const char *eol = (const char *)memchr(line, '\n', end - line);
+    if (!eol) eol = end;
+    lineNo++;
+    const char *cp = line;
+    line = eol + 1;
+    while (cp < eol && (*cp == ' ' || *cp == '\t')) cp++;
+    if (cp == eol || *cp == '#' || *cp == '\r') continue;
+    if (!parseLine(cp, eol, f)) {
+      fprintf(stderr, "%s:%u: invalid frame\n", fileName, lineNo);
+      return false;
+    }
+    handler(f);
+  }
+  return true;
+}
+
+// readBinaryLog: the binary frame log format
+static bool readBinaryLog(const uint8_t *data, size_t size, FrameHandler& handler) {
+  CapturedFrame f;
+  size_t pos = sizeof(binaryLogMagic);
+  while (pos + 16 <= size) {
+    const uint8_t *rec = data + pos;
+    uint8_t flags = rec[14];
+    uint8_t len = rec[15];
+    size_t recLen = 16 + len + ((flags & 0x02) ? 2 : 0);
+    if (pos + recLen > size) break;
+    f.micros = ((uint64_t)get32(rec + 4, false) << 32) | get32(rec, false);
+    f.connection = get32(rec + 8, false);
+    f.transactionID = get16(rec + 12, false);
+    f.request = flags & 0x01;
+    f.message.assign(rec + 16, rec + 16 + len);
+    f.crc = (flags & 0x02) ? get16(rec + 16 + len, false) : -1;
+    handler(f);
+    pos += recLen;
+  }
+  return true;
+}
+
+// MappedFile: a file mapped into memory for reading, read sequentially
+class MappedFile {
+public:
+  MappedFile() : data(nullptr), size(0) {}
+  ~MappedFile() { if (data) munmap(data, size); }
+
+  // open: map the file. Returns false if it can not be read
+  bool open(const char *fileName) {
+    int fd = ::open(fileName, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+      perror(fileName);
+      if (fd >= 0) ::close(fd);
+      return false;
+    }
+    size = st.st_size;
+    if (size) {
+      void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        perror(fileName);
+        size = 0;
+        ::close(fd);
+        return false;
+      }
+      data = (uint8_t *)p;
+      madvise(data, size, MADV_SEQUENTIAL);
+    }
+    ::close(fd);
+    return true;
+  }
+
+  uint8_t *data;
+  size_t size;
+};
+
+// scanCapture: find out the file type and read it
+bool scanCapture(const char *fileName, uint16_t serverPort, FrameHandler handler) {
+  MappedFile file;
+  if (!file.open(fileName)) return false;
+  uint32_t m = (file.size >= 4) ? get32(file.data, false) : 0;
+  if (m == 0xA1B2C3D4 || m == 0xD4C3B2A1 || m == 0xA1B23C4D || m == 0x4D3CB2A1) {
+    Reassembler r(serverPort, handler);
+    return readPcap(file.data, file.size, r);
+  }
+  if (m == 0x0A0D0D0A) {
+    Reassembler r(serverPort, handler);
+    return readPcapng(file.data, file.size, r);
+  }
+  if (file.size >= sizeof(binaryLogMagic) && memcmp(file.data, binaryLogMagic, sizeof(binaryLogMagic)) == 0) {
+    return readBinaryLog(file.data, file.size, handler);
+  }
+  return readFrameLog((const char *)file.data, file.size, fileName, handler);
+}
+
+// readCapture: collect the frames of a capture
+bool readCapture(const char *fileName, uint16_t serverPort, std::vector<CapturedFrame>& frames) {
+  bool ok = scanCapture(fileName, serverPort, [&frames](const CapturedFrame& f) { frames.push_back(f); });
+  // Frame logs may have been merged from several sources
+  std::stable_sort(frames.begin(), frames.end(), [](const CapturedFrame& a, const CapturedFrame& b) { return a.micros < b.micros; });
+  return ok;
+}
+
+// pairFrames: match responses to requests by connection and transaction ID, oldest request first
+std::vector<int32_t> pairFrames(const std::vector<CapturedFrame>& frames) {
+  std::vector<int32_t> pairs(frames.size(), -1);
+  std::map<std::pair<uint32_t, uint16_t>, std::deque<int32_t>> open;
+  for (int32_t i = 0; i < (int32_t)frames.size(); ++i) {
+    auto& q = open[std::make_pair(frames[i].connection, frames[i].transactionID)];
+    if (frames[i].request) {
+      q.push_back(i);
+    } else if (!q.empty()) {
+      pairs[q.front()] = i;
+      q.pop_front();
+    }
+  }
+  return pairs;
+}
+
+// open: create a frame log
+bool FrameLog::open(const char *fileName, bool binaryLog) {
+  close();
+  binary = binaryLog;
+  file = strcmp(fileName, "-") ? fopen(fileName, binary ? "wb" : "w") : stdout;
+  if (!file) {
+    perror(fileName);
+    return false;
+  }
+  if (binary) {
+    fwrite(binaryLogMagic, 1, sizeof(binaryLogMagic), file);
+  } else {
+    fprintf(file, "# eModbus frame log: seconds.micros connection TID direction(> request, < response) message [CRC]\n");
+  }
+  return true;
+}
+
+// close: finish the log
+void FrameLog::close() {
+  if (file && file != stdout) fclose(file);
+  if (file == stdout) fflush(stdout);
+  file = nullptr;
+}
+
+// write: a frame as one line or one record. Binary records can not hold messages longer than 255 bytes -
+// which are no valid Modbus messages anyway - those are skipped.
+void FrameLog::write(uint64_t micros, uint32_t connection, uint16_t transactionID, bool request, const uint8_t *message, uint16_t len,
+    int32_t crc) {
+  if (!file) return;
+  if (binary) {
+    if (len > 255) return;
+    uint8_t rec[16 + 255 + 2];
+    for (uint8_t i = 0; i < 8; ++i) rec[i] = (micros >> (8 * i)) & 0xFF;
+    for (uint8_t i = 0; i < 4; ++i) rec[8 + i] = (connection >> (8 * i)) & 0xFF;
+    rec[12] = transactionID & 0xFF;
+    rec[13] = transactionID >> 8;
+    rec[14] = (request ? 0x01 : 0) | (crc >= 0 ? 0x02 : 0);
+    rec[15] = len;
+    memcpy(rec + 16, message, len);
+    uint16_t recLen = 16 + len;
+    if (crc >= 0) {
+      rec[recLen++] = crc & 0xFF;
+      rec[recLen++] = (crc >> 8) & 0xFF;
+    }
+    fwrite(rec, 1, recLen, file);
+    return;
+  }
+  fprintf(file, "%llu.%06llu %u %04X %c ", (unsigned long long)(micros / 1000000), (unsigned long long)(micros % 1000000),
+    connection, transactionID, request ? '>' : '<');
+  for (uint16_t i = 0; i < len; ++i) fprintf(file, "%02X", message[i]);
+  if (crc >= 0) fprintf(file, " %02X%02X", crc & 0xFF, (crc >> 8) & 0xFF);
+  fputc('\n', file);
+}
+
+void FrameLog::write(const CapturedFrame& f) {
+  write(f.micros, f.connection, f.transactionID, f.request, f.message.data(), f.message.size(), f.crc);
+}
+
+// writeTCP: strip the MBAP header, but keep its transaction ID
+void FrameLog::writeTCP(uint64_t micros, uint32_t connection, bool request, const uint8_t *frame, uint16_t len) {
+  if (len < 8) return;
+  write(micros, connection, be16(frame), request, frame + 6, len - 6);
+}
+
+// writeRTU: split off the CRC
+void FrameLog::writeRTU(uint64_t micros, uint32_t connection, bool request, const uint8_t *frame, uint16_t len) {
+  if (len < 4) return;
+  write(micros, connection, 0, request, frame, len - 2, frame[len - 2] | (frame[len - 1] << 8));
+}
@@ -0,0 +1,88 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+// Recorded Modbus traffic for the replay and analysis tools.
+// These file formats are read:
+//   - pcap and pcapng files of Modbus TCP traffic, as written by tcpdump or Wireshark. IPv4 and IPv6 over
+//     Ethernet, Linux cooked capture (v1 and v2), BSD loopback and raw IP are understood. TCP streams are
+//     reassembled in order; after a gap in the capture a stream is picked up again at the next segment.
+//   - frame logs, written by FrameLog below as text or in a binary form. Frame logs may hold TCP and RTU traffic.
+// Files are memory mapped and read front to back, so captures of any size can be scanned.
+//
+// Frame log text format: one frame per line, fields separated by blanks. Lines starting with '#' are comments.
+//   seconds.micros connection TID direction message [CRC]
+//     seconds.micros   time stamp, e.g. 1700000000.123456
+//     connection       decimal number of the TCP connection or serial line the frame was seen on
+//     TID              Modbus TCP transaction ID as 4 hex digits, 0000 for RTU
+//     direction        '>' for a request to the server, '<' for a response from it
+//     message          server ID, function code and data as hex digits - no MBAP header, no CRC
+//     CRC              RTU only, optional: the two CRC bytes as received, 4 hex digits in wire order
+//   1700000000.123456 1 002A > 01030000000A
+//   1700000000.123456 2 0000 > 01030000000A C5CD
+// Responses belong to the oldest unanswered request with the same connection and TID.
+//
+// Frame log binary format, all numbers little endian: the 8 bytes "eMBflog" and 0x01, then one record per frame
+//   uint64_t micros, uint32_t connection, uint16_t TID, uint8_t flags, uint8_t length, message[length], CRC[2]
+// flags bit 0 is set for requests, bit 1 if the two CRC bytes follow the message.
+
+// CapturedFrame: one Modbus message of a capture
+struct CapturedFrame {
+  uint64_t micros;                 // Time stamp in microseconds since the epoch
+  uint32_t connection;             // Connection or serial line
+  uint16_t transactionID;          // Modbus TCP transaction ID, 0 for RTU
+  bool request;                    // true for a request, false for a response
+  std::vector<uint8_t> message;    // Server ID, function code and data
+  int32_t crc = -1;                // RTU CRC bytes as received, first byte in the low half, -1 if not recorded
+};
+
+// FrameHandler: callback taking the frames of a capture one by one.
+// The frame is only valid during the call, it is reused for the next one.
+using FrameHandler = std::function<void(const CapturedFrame&)>;
+
+// scanCapture: hand all frames of a pcap, pcapng or frame log file to the handler, in file order.
+// serverPort is the TCP port telling requests from responses in pcap files.
+// Returns false if the file could not be read or has an unknown format.
+bool scanCapture(const char *fileName, uint16_t serverPort, FrameHandler handler);
+
+// readCapture: read all frames of a capture into memory, in order of their time stamps
+bool readCapture(const char *fileName, uint16_t serverPort, std::vector<CapturedFrame>& frames);
+
+// pairFrames: find the response to each request. Returns the index of the response frame for every
+// frame that is a request, -1 for requests without a response and for responses
+std::vector<int32_t> pairFrames(const std::vector<CapturedFrame>& frames);
+
+// FrameLog: writer for frame logs
+class FrameLog {
+public:
+  FrameLog() : file(nullptr), binary(false) {}
+  ~FrameLog() { close(); }
+
+  // open: create the log file, "-" for stdout, as text or binary. Returns false if it could not be opened
+  bool open(const char *fileName, bool binaryLog = false);
+  void close();
+
+  // write: append a frame. crc is that of an RTU frame as in CapturedFrame, -1 for none
+  void write(const CapturedFrame& f);
+  void write(uint64_t micros, uint32_t connection, uint16_t transactionID, bool request, const uint8_t *message, uint16_t len,
+    int32_t crc = -1);
+
+  // writeTCP: append a Modbus TCP frame, MBAP header included
+  void writeTCP(uint64_t micros, uint32_t connection, bool request, const uint8_t *frame, uint16_t len);
+
+  // writeRTU: append a Modbus RTU frame, CRC included
+  void writeRTU(uint64_t micros, uint32_t connection, bool request, const uint8_t *frame, uint16_t len);
+
+protected:
+  FILE *file;
+  bool binary;
+};
+
+#endif
@@ -0,0 +1,586 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+// DeviceFarm: simulates many Modbus TCP devices for load tests of clients and gateways.
+// Each port of a range is a ModbusServer with a number of unit IDs, each unit has its own holding and
+// input registers. A single thread serves all connections with epoll. Latency, busy responses, lost
+// requests and disconnects can be injected at random.
+//
+// Usage: DeviceFarm [options]
+//   -p port     first TCP port (5020)
+//   -n count    number of ports (10)
+//   -u count    unit IDs 1..count per port (1)
+//   -r count    holding and input registers per unit (100)
+//   -m file     register map file, lines of "port|* unit|* H|I address value [value...]"
+//   -l model    response latency: none, fixed:ms, uniform:min:max, exp:mean or normal:mean:sd (none)
+//   -b percent  rate of SERVER_DEVICE_BUSY responses (0)
+//   -t percent  rate of requests left unanswered, to provoke timeouts (0)
+//   -d percent  rate of requests answered by closing the connection (0)
+//   -s seed     random seed (1)
+//   -i seconds  statistics interval, 0 for none (10)
+//   -w file     record all requests and responses in a frame log, for Replay and Analyze
+//   -W file     the same as a binary frame log - smaller and faster to analyze
+// Registers are preset with their address, unless the map file has other values.
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include "Capture.h"
+#include "ModbusServer.h"
+
+// Response latency model
+struct Latency {
+  enum Kind : uint8_t { NONE, FIXED, UNIFORM, EXPONENTIAL, NORMAL };
+  Kind kind = NONE;
+  double a = 0.0;             // fixed, min or mean in ms
+  double b = 0.0;             // max or standard deviation in ms
+
+  // parse: read a model description. Returns false if it is not understood
+  bool parse(const char *text) {
+    if (!strcmp(text, "none")) { kind = NONE; return true; }
+    if (sscanf(text, "fixed:%lf", &a) == 1) { kind = FIXED; return a >= 0; }
+    if (sscanf(text, "uniform:%lf:%lf", &a, &b) == 2) { kind = UNIFORM; return a >= 0 && b >= a; }
+    if (sscanf(text, "exp:%lf", &a) == 1) { kind = EXPONENTIAL; return a > 0; }
+    if (sscanf(text, "normal:%lf:%lf", &a, &b) == 2) { kind = NORMAL; return a >= 0 && b >= 0; }
+    return false;
+  }
+
+  // draw: a random latency in microseconds
+  uint64_t draw(std::mt19937& rng) {
+    double ms = 0.0;
+    switch (kind) {
+    case FIXED: ms = a; break;
+    case UNIFORM: ms = std::uniform_real_distribution<double>(a, b)(rng); break;
+    case EXPONENTIAL: ms = std::exponential_distribution<double>(1.0 / a)(rng); break;
+    case NORMAL: ms = std::normal_distribution<double>(a, b)(rng); break;
+    default: break;
+    }
+    return ms > 0.0 ? (uint64_t)(ms * 1000.0) : 0;
+  }
+};
+
+// Farm settings from the command line
+struct FarmConfig {
+  uint16_t firstPort = 5020;
+  uint16_t ports = 10;
+  uint8_t units = 1;
+  uint16_t registers = 100;
+  const char *mapFile = nullptr;
+  Latency latency;
+  double busyRate = 0.0;        // all rates in percent
+  double timeoutRate = 0.0;
+  double disconnectRate = 0.0;
+  uint32_t seed = 1;
+  uint32_t interval = 10;
+  const char *logFile = nullptr;
+  bool binaryLog = false;
+};
+
+// Counters for the statistics
+struct FarmStats {
+  uint64_t connections = 0;
+  uint64_t requests = 0;
+  uint64_t responses = 0;
+  uint64_t exceptions = 0;      // error responses, including injected busy ones
+  uint64_t busy = 0;
+  uint64_t dropped = 0;
+  uint64_t disconnects = 0;
+};
+
+// Register set of a single unit
+struct Device {
+  std::vector<uint16_t> holding;
+  std::vector<uint16_t> input;
+};
+
+// One port of the farm: a ModbusServer with its units
+class FarmServer : public ModbusServer {
+public:
+  FarmServer(uint16_t port, uint8_t units, uint16_t registers);
+  uint16_t port;
+  int listenFD;
+  std::vector<Device> devices;    // devices[0] is unit 1
+protected:
+  void isInstance() {}
+};
+
+// Epoll tags: a listening socket or a client connection
+struct Endpoint {
+  bool listener;
+  int fd;
+  FarmServer *server;
+  uint64_t id;                    // Connection serial number, to recognize delayed responses for it
+  uint8_t rx[6 + 256];            // Request being assembled
+  uint16_t rxCount;
+  std::vector<uint8_t> tx;        // Response bytes the socket did not take yet
+};
+
+// A response waiting for its latency to pass
+struct Delayed {
+  uint64_t due;                   // in microseconds
+  uint64_t connection;            // Endpoint id
+  std::vector<uint8_t> frame;
+  bool operator>(const Delayed& d) const { return due > d.due; }
+};
+
+static volatile sig_atomic_t stopRequested = 0;
+
+// epochMicros: wall clock time in microseconds, for the frame log
+static uint64_t epochMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// nowMicros: monotonic time in microseconds
+static uint64_t nowMicros() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000ULL + t.tv_nsec / 1000;
+}
+
+// Constructor: set up the units' registers and their worker functions
+FarmServer::FarmServer(uint16_t p, uint8_t units, uint16_t registers) :
+  ModbusServer(),
+  port(p),
+  listenFD(-1),
+  devices(units) {
+  for (uint8_t u = 1; u <= units; ++u) {
+    Device& d = devices[u - 1];
+    d.holding.resize(registers);
+    d.input.resize(registers);
+    for (uint16_t i = 0; i < registers; ++i) {
+      d.holding[i] = d.input[i] = i;
+    }
+    // Read holding or input registers
+    auto readRegisters = [](const std::vector<uint16_t>& regs, const ModbusMessage& request) -> ModbusMessage {
+      uint16_t addr = 0;
+      uint16_t words = 0;
+      ModbusMessage response;
+      request.get(2, addr);
+      request.get(4, words);
+      if ((uint32_t)addr + words > regs.size()) {
+        response.setError(request.getServerID(), request.getFunctionCode(), ILLEGAL_DATA_ADDRESS);
+        return response;
+      }
+      response.add(request.getServerID(), request.getFunctionCode(), (uint8_t)(words * 2));
+      for (uint16_t i = 0; i < words; ++i) response.add(regs[addr + i]);
+      return response;
+    };
+    registerWorker(u, READ_HOLD_REGISTER, [&d, readRegisters](const ModbusMessage& request) -> ModbusMessage {
+      return readRegisters(d.holding, request);
+    });
+    registerWorker(u, READ_INPUT_REGISTER, [&d, readRegisters](const ModbusMessage& request) -> ModbusMessage {
+      return readRegisters(d.input, request);
+    });
+    // Write a single holding register
+    registerWorker(u, WRITE_HOLD_REGISTER, [&d](const ModbusMessage& request) -> ModbusMessage {
+      uint16_t addr = 0;
+      uint16_t value = 0;
+      request.get(2, addr);
+      request.get(4, value);
+      if (addr >= d.holding.size()) {
+        ModbusMessage response;
+        response.setError(request.getServerID(), request.getFunctionCode(), ILLEGAL_DATA_ADDRESS);
+        return response;
+      }
+      d.holding[addr] = value;
+      return ECHO_RESPONSE;
+    });
+    // Write multiple holding registers
+    registerWorker(u, WRITE_MULT_REGISTERS, [&d](const ModbusMessage& request) -> ModbusMessage {
+      uint16_t addr = 0;
+      uint16_t words = 0;
+      ModbusMessage response;
+      request.get(2, addr);
+      request.get(4, words);
+      if ((uint32_t)addr + words > d.holding.size()) {
+        response.setError(request.getServerID(), request.getFunctionCode(), ILLEGAL_DATA_ADDRESS);
+        return response;
+      }
+      uint16_t offs = 7;
+      for (uint16_t i = 0; i < words; ++i) offs = request.get(offs, d.holding[addr + i]);
+      response.add(request.getServerID(), request.getFunctionCode(), addr, words);
+      return response;
+    });
+  }
+}
+
+// loadMap: set register values from a map file. Returns false on errors
+static bool loadMap(const char *name, std::vector<FarmServer *>& servers) {
+  FILE *f = fopen(name, "r");
+  if (!f) {
+    perror(name);
+    return false;
+  }
+  char line[1024];
+  uint32_t lineNo = 0;
+  bool ok = true;
+  while (fgets(line, sizeof(line), f)) {
+    lineNo++;
+    char *tok = strtok(line, " \t\r\n");
+    // Skip empty lines and comments
+    if (!tok || *tok == '#') continue;
+    char *portTok = tok;
+    char *unitTok = strtok(nullptr, " \t\r\n");
+    char *typeTok = strtok(nullptr, " \t\r\n");
+    char *addrTok = strtok(nullptr, " \t\r\n");
+    if (!unitTok || !typeTok || !addrTok || (*typeTok != 'H' && *typeTok != 'I')) {
+      printf("%s:%u: expected \"port|* unit|* H|I address value...\"\n", name, lineNo);
+      ok = false;
+      continue;
+    }
+    std::vector<uint16_t> values;
+    while ((tok = strtok(nullptr, " \t\r\n"))) values.push_back(strtoul(tok, nullptr, 0) & 0xFFFF);
+    uint16_t addr = strtoul(addrTok, nullptr, 0) & 0xFFFF;
+    for (auto s : servers) {
+      if (*portTok != '*' && atoi(portTok) != s->port) continue;
+      for (uint8_t u = 1; u <= s->devices.size(); ++u) {
+        if (*unitTok != '*' && atoi(unitTok) != u) continue;
+        std::vector<uint16_t>& regs = (*typeTok == 'H') ? s->devices[u - 1].holding : s->devices[u - 1].input;
+        for (uint16_t i = 0; i < values.size() && addr + i < regs.size(); ++i) regs[addr + i] = values[i];
+      }
+    }
+  }
+  fclose(f);
+  return ok;
+}
+
+// Farm: the event loop serving all ports
+class Farm {
+public:
+  Farm(FarmConfig& c) : cfg(c), rng(c.seed), epollFD(-1), nextID(1) {}
+  bool begin();
+  void run();
+
+protected:
+  void accept(Endpoint *l);
+  void receive(Endpoint *c);
+  // handle, send and flush return false if they have closed the connection - c is gone then
+  bool handle(Endpoint *c, uint8_t *frame, uint16_t len);
+  bool send(Endpoint *c, const uint8_t *data, size_t len);
+  bool flush(Endpoint *c);
+  void close(Endpoint *c);
+  void report();
+
+  FarmConfig& cfg;
+  FarmStats stats;
+  std::mt19937 rng;
+  std::uniform_real_distribution<double> dice{0.0, 100.0};
+  int epollFD;
+  uint64_t nextID;
+  std::vector<FarmServer *> servers;
+  std::unordered_map<uint64_t, Endpoint *> connections;
+  std::priority_queue<Delayed, std::vector<Delayed>, std::greater<Delayed>> delayed;
+  FrameLog log;
+  bool logging = false;
+};
+
+// begin: create the servers and their listening sockets
+bool Farm::begin() {
+  // Every port and every connection needs a file descriptor - use what we are allowed to
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+  epollFD = epoll_create1(0);
+  if (epollFD < 0) {
+    perror("epoll_create1");
+    return false;
+  }
+  for (uint32_t p = cfg.firstPort; p < (uint32_t)cfg.firstPort + cfg.ports && p <= 0xFFFF; ++p) {
+    FarmServer *s = new FarmServer(p, cfg.units, cfg.registers);
+    servers.push_back(s);
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);
+    sa.sin_port = htons(p);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(fd, 128) < 0) {
+      printf("Port %u: %s\n", p, strerror(errno));
+      if (fd >= 0) ::close(fd);
+      return false;
+    }
+    s->listenFD = fd;
+    Endpoint *l = new Endpoint();
+    l->listener = true;
+    l->fd = fd;
+    l->server = s;
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = l;
+    epoll_ctl(epollFD, EPOLL_CTL_ADD, fd, &ev);
+  }
+  if (cfg.mapFile && !loadMap(cfg.mapFile, servers)) return false;
+  if (cfg.logFile && !(logging = log.open(cfg.logFile, cfg.binaryLog))) return false;
+  printf("Serving %u ports from %u with %u units of %u registers each\n",
+    (unsigned)servers.size(), cfg.firstPort, cfg.units, cfg.registers);
+  return true;
+}
+
+// run: serve until SIGINT or SIGTERM
+void Farm::run() {
+  const int MAXEVENTS = 256;
+  struct epoll_event events[MAXEVENTS];
+  uint64_t nextReport = nowMicros() + cfg.interval * 1000000ULL;
+
+  while (!stopRequested) {
+    // Sleep until the next delayed response is due at most
+    int timeout = 1000;
+    if (!delayed.empty()) {
+      uint64_t now = nowMicros();
+      timeout = (delayed.top().due > now) ? (int)std::min<uint64_t>((delayed.top().due - now + 999) / 1000, 1000) : 0;
+    }
+    int n = epoll_wait(epollFD, events, MAXEVENTS, timeout);
+    for (int i = 0; i < n; ++i) {
+      Endpoint *e = (Endpoint *)events[i].data.ptr;
+      if (e->listener) {
+        accept(e);
+      } else {
+        if ((events[i].events & EPOLLOUT) && !flush(e)) continue;
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) receive(e);
+      }
+    }
+    // Send all responses that are due now
+    uint64_t now = nowMicros();
+    while (!delayed.empty() && delayed.top().due <= now) {
+      auto c = connections.find(delayed.top().connection);
+      // The connection may have gone meanwhile
+      if (c != connections.end()) send(c->second, delayed.top().frame.data(), delayed.top().frame.size());
+      delayed.pop();
+    }
+    if (cfg.interval && now >= nextReport) {
+      report();
+      nextReport = now + cfg.interval * 1000000ULL;
+    }
+  }
+  report();
+}
+
+// accept: take all waiting connections of a port
+void Farm::accept(Endpoint *l) {
+  int fd;
+  while ((fd = accept4(l->fd, nullptr, nullptr, SOCK_NONBLOCK)) >= 0) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    Endpoint *c = new Endpoint();
+    c->listener = false;
+    c->fd = fd;
+    c->server = l->server;
+    c->id = nextID++;
+    c->rxCount = 0;
+    connections[c->id] = c;
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    epoll_ctl(epollFD, EPOLL_CTL_ADD, fd, &ev);
+    stats.connections++;
+  }
+}
+
+// receive: read what the socket has and handle all complete requests
+void Farm::receive(Endpoint *c) {
+  while (true) {
+    // Read the header first, then exactly the remainder of the frame
+    uint16_t want = 6;
+    if (c->rxCount >= 6) want = 6 + ((c->rx[4] << 8) | c->rx[5]);
+    ssize_t r = read(c->fd, c->rx + c->rxCount, want - c->rxCount);
+    if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR)) {
+      close(c);
+      return;
+    }
+    if (r < 0) return;
+    c->rxCount += r;
+    if (c->rxCount == 6) {
+      uint16_t len = (c->rx[4] << 8) | c->rx[5];
+      // Server ID and FC at least, 256 bytes at most. Else the stream is out of sync.
+      if (len < 2 || len > 256) {
+        close(c);
+        return;
+      }
+    }
+    if (c->rxCount > 6 && c->rxCount == 6 + ((c->rx[4] << 8) | c->rx[5])) {
+      c->rxCount = 0;
+      if (!handle(c, c->rx, 6 + ((c->rx[4] << 8) | c->rx[5]))) return;
+    }
+  }
+}
+
+// handle: answer a request, or inject a fault instead
+bool Farm::handle(Endpoint *c, uint8_t *frame, uint16_t len) {
+  stats.requests++;
+  if (logging) log.writeTCP(epochMicros(), c->id, true, frame, len);
+  ModbusMessage request;
+  request.add(frame + 6, len - 6);
+  ModbusMessage response;
+
+  double roll = dice(rng);
+  if (roll < cfg.disconnectRate) {
+    stats.disconnects++;
+    close(c);
+    return false;
+  }
+  roll -= cfg.disconnectRate;
+  if (roll < cfg.timeoutRate) {
+    stats.dropped++;
+    return true;
+  }
+  roll -= cfg.timeoutRate;
+  if (frame[2] != 0 || frame[3] != 0) {
+    response.setError(request.getServerID(), request.getFunctionCode(), TCP_HEAD_MISMATCH);
+  } else if (roll < cfg.busyRate) {
+    stats.busy++;
+    response.setError(request.getServerID(), request.getFunctionCode(), SERVER_DEVICE_BUSY);
+  } else {
+    response = c->server->localRequest(std::move(request));
+  }
+  // NIL response?
+  if (response.size() < 3) return true;
+  stats.responses++;
+  if (response.getError() != SUCCESS) stats.exceptions++;
+
+  // Keep TID and protocol ID, update the length and append the response
+  std::vector<uint8_t> out(frame, frame + 4);
+  out.push_back((response.size() >> 8) & 0xFF);
+  out.push_back(response.size() & 0xFF);
+  out.insert(out.end(), response.begin(), response.end());
+
+  uint64_t latency = cfg.latency.draw(rng);
+  if (latency) {
+    Delayed d;
+    d.due = nowMicros() + latency;
+    d.connection = c->id;
+    d.frame = std::move(out);
+    delayed.push(std::move(d));
+    return true;
+  }
+  return send(c, out.data(), out.size());
+}
+
+// send: write a response, keep what the socket will not take for later
+bool Farm::send(Endpoint *c, const uint8_t *data, size_t len) {
+  if (logging) log.writeTCP(epochMicros(), c->id, false, data, len);
+  if (c->tx.empty()) {
+    ssize_t w = write(c->fd, data, len);
+    if (w < 0 && errno != EAGAIN && errno != EINTR) {
+      close(c);
+      return false;
+    }
+    if (w > 0) {
+      data += w;
+      len -= w;
+    }
+    if (len == 0) return true;
+    // Get notified when there is room again
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.ptr = c;
+    epoll_ctl(epollFD, EPOLL_CTL_MOD, c->fd, &ev);
+  }
+  c->tx.insert(c->tx.end(), data, data + len);
+  return true;
+}
+
+// flush: write pending response bytes
+bool Farm::flush(Endpoint *c) {
+  if (c->tx.empty()) return true;
+  ssize_t w = write(c->fd, c->tx.data(), c->tx.size());
+  if (w < 0 && errno != EAGAIN && errno != EINTR) {
+    close(c);
+    return false;
+  }
+  if (w > 0) c->tx.erase(c->tx.begin(), c->tx.begin() + w);
+  if (c->tx.empty()) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    epoll_ctl(epollFD, EPOLL_CTL_MOD, c->fd, &ev);
+  }
+  return true;
+}
+
+// close: drop a connection
+void Farm::close(Endpoint *c) {
+  epoll_ctl(epollFD, EPOLL_CTL_DEL, c->fd, nullptr);
+  ::close(c->fd);
+  connections.erase(c->id);
+  delete c;
+}
+
+// report: print the statistics
+void Farm::report() {
+  printf("connections %8lu open %6lu  requests %10lu  responses %10lu  exceptions %8lu (busy %lu)  dropped %8lu  disconnects %6lu\n",
+    (unsigned long)stats.connections, (unsigned long)connections.size(), (unsigned long)stats.requests,
+    (unsigned long)stats.responses, (unsigned long)stats.exceptions, (unsigned long)stats.busy,
+    (unsigned long)stats.dropped, (unsigned long)stats.disconnects);
+  fflush(stdout);
+}
+
+static void onSignal(int) {
+  stopRequested = 1;
+}
+
+int main(int argc, char **argv) {
+  FarmConfig cfg;
+  int opt;
+  while ((opt = getopt(argc, argv, "p:n:u:r:m:l:b:t:d:s:i:w:W:")) != -1) {
+    switch (opt) {
+    case 'p': cfg.firstPort = atoi(optarg); break;
+    case 'n': cfg.ports = atoi(optarg); break;
+    case 'u': cfg.units = std::min(std::max(atoi(optarg), 1), 247); break;
+    case 'r': cfg.registers = atoi(optarg); break;
+    case 'm': cfg.mapFile = optarg; break;
+    case 'l':
+      if (!cfg.latency.parse(optarg)) {
+        printf("Latency model must be none, fixed:ms, uniform:min:max, exp:mean or normal:mean:sd\n");
+        return -1;
+      }
+      break;
+    case 'b': cfg.busyRate = atof(optarg); break;
+    case 't': cfg.timeoutRate = atof(optarg); break;
+    case 'd': cfg.disconnectRate = atof(optarg); break;
+    case 's': cfg.seed = atoi(optarg); break;
+    case 'i': cfg.interval = atoi(optarg); break;
+    case 'w': cfg.logFile = optarg; break;
+    case 'W':
+      cfg.logFile = optarg;
+      cfg.binaryLog = true;
+      break;
+    default:
+      printf("Usage: %s [-p port] [-n ports] [-u units] [-r registers] [-m mapfile] [-l latency]\n"
+             "       [-b busy%%] [-t timeout%%] [-d disconnect%%] [-s seed] [-i seconds] [-w|-W framelog]\n", argv[0]);
+      return -1;
+    }
+  }
+  if (cfg.busyRate + cfg.timeoutRate + cfg.disconnectRate > 100.0) {
+    printf("Fault rates add up to more than 100%%\n");
+    return -1;
+  }
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  signal(SIGPIPE, SIG_IGN);
+
+  Farm farm(cfg);
+  if (!farm.begin()) return 1;
+  farm.run();
+  return 0;
+}
@@ -0,0 +1,284 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+// LoadGen: open-loop load generator for Modbus TCP servers and gateways.
+// Requests are issued at a fixed rate, spread over a number of ModbusClientTCP connections. The
+// schedule never waits for responses, and every latency is taken from the time a request was
+// due to be sent, not from the time it actually was. A stalled server or client thus shows up in the
+// latencies of all requests it held up, instead of silently lowering the request rate
+// ("coordinated omission").
+//
+// Usage: LoadGen [options] target [target...]
+//   target      IP[:port[:serverID]] or hostname[:port[:serverID]], connections are spread over all
+//   -r rate     requests per second (100)
+//   -d seconds  duration of the run (10)
+//   -c count    number of connections (1)
+//   -m mix      request mix as list of FC:count[:weight], FC one of 1, 2, 3, 4, 5, 6, 15, 16 (3:10)
+//   -a address  first register or coil address (0)
+//   -T ms       response timeout (2000)
+//   -q count    request queue limit per connection (100)
+//   -b          busy-polling client workers
+//   -s seed     random seed for the request mix (1)
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "ModbusClientTCP.h"
+#include "parseTarget.h"
+
+using clk = std::chrono::steady_clock;
+
+// One kind of request of the mix
+struct MixEntry {
+  uint8_t fc;
+  uint16_t count;           // registers or coils
+  uint32_t weight;
+};
+
+// Results for one kind of request
+struct MixStats {
+  std::vector<uint32_t> latencies;   // in microseconds, successful responses only
+  uint32_t sent = 0;
+  uint32_t rejected = 0;             // not accepted by the client's queue
+  std::map<Error, uint32_t> errors;
+};
+
+// A target to connect to
+struct Target {
+  IPAddress ip;
+  uint16_t port;
+  uint8_t serverID;
+};
+
+// Shared state of the run
+static clk::time_point startTime;
+static double intervalMicros;             // time between two requests
+static std::vector<uint8_t> plan;         // mix entry for each request, indexed by token
+static std::vector<MixStats> stats;       // one per mix entry
+static std::mutex statsLock;
+static uint32_t answered = 0;
+
+// dueMicros: time after start when request number token was due
+static inline uint64_t dueMicros(uint32_t token) {
+  return (uint64_t)(token * intervalMicros);
+}
+
+// handleResponse: account a response against the request's due time
+static void handleResponse(ModbusMessage response, uint32_t token) {
+  uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(clk::now() - startTime).count();
+  uint64_t latency = now - dueMicros(token);
+  Error e = response.getError();
+  std::lock_guard<std::mutex> lock(statsLock);
+  MixStats& s = stats[plan[token]];
+  if (e == SUCCESS) {
+    s.latencies.push_back(latency > UINT32_MAX ? UINT32_MAX : latency);
+  } else {
+    s.errors[e]++;
+  }
+  answered++;
+}
+
+// parseMix: read the request mix description. Returns false if it is not understood
+static bool parseMix(const char *text, std::vector<MixEntry>& mix) {
+  const uint8_t FCs[] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x0F, 0x10 };
+  const char *cp = text;
+  while (*cp) {
+    unsigned fc = 0;
+    unsigned count = 0;
+    unsigned weight = 1;
+    int used = 0;
+    if (sscanf(cp, "%u:%u%n", &fc, &count, &used) != 2) return false;
+    cp += used;
+    if (*cp == ':') {
+      if (sscanf(cp, ":%u%n", &weight, &used) != 1) return false;
+      cp += used;
+    }
+    if (*cp == ',') cp++;
+    else if (*cp) return false;
+    // FCs are given in decimal: 15 is WRITE_MULT_COILS, 16 WRITE_MULT_REGISTERS
+    if (std::find(std::begin(FCs), std::end(FCs), fc) == std::end(FCs)) return false;
+    // Stay within the limits of the FCs - single writes always have a count of 1
+    uint16_t limit = (fc == 0x01 || fc == 0x02) ? 2000 : (fc == 0x0F) ? 1968 : (fc == 0x10) ? 123 : 125;
+    if (fc == 0x05 || fc == 0x06) count = 1;
+    if (count < 1 || count > limit || weight == 0) return false;
+    mix.push_back({ (uint8_t)fc, (uint16_t)count, weight });
+  }
+  return !mix.empty();
+}
+
+// issue: build and send a request of the mix entry given
+static Error issue(ModbusClientTCP& client, const MixEntry& m, uint8_t serverID, uint16_t addr, uint32_t token) {
+  static uint16_t words[125] = { 0 };
+  static uint8_t coils[256] = { 0 };
+  switch (m.fc) {
+  case READ_COIL:
+  case READ_DISCR_INPUT:
+  case READ_HOLD_REGISTER:
+  case READ_INPUT_REGISTER:
+    return client.addRequest(token, serverID, (FunctionCode)m.fc, addr, m.count);
+  case WRITE_COIL:
+    return client.addRequest(token, serverID, WRITE_COIL, addr, (uint16_t)0xFF00);
+  case WRITE_HOLD_REGISTER:
+    return client.addRequest(token, serverID, WRITE_HOLD_REGISTER, addr, (uint16_t)token);
+  case WRITE_MULT_COILS:
+    return client.addRequest(token, serverID, WRITE_MULT_COILS, addr, m.count, (uint8_t)((m.count + 7) / 8), coils);
+  case WRITE_MULT_REGISTERS:
+    return client.addRequest(token, serverID, WRITE_MULT_REGISTERS, addr, m.count, (uint8_t)(m.count * 2), words);
+  default:
+    return ILLEGAL_FUNCTION;
+  }
+}
+
+// percentile: value at fraction p of the sorted samples
+static uint32_t percentile(const std::vector<uint32_t>& sorted, double p) {
+  size_t i = (size_t)(p * (sorted.size() - 1) + 0.5);
+  return sorted[i];
+}
+
+int main(int argc, char **argv) {
+  double rate = 100.0;
+  uint32_t seconds = 10;
+  uint32_t connections = 1;
+  const char *mixText = "3:10";
+  uint16_t addr = 0;
+  uint32_t timeout = 2000;
+  uint16_t queueLimit = 100;
+  bool busyPoll = false;
+  uint32_t seed = 1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "r:d:c:m:a:T:q:bs:")) != -1) {
+    switch (opt) {
+    case 'r': rate = atof(optarg); break;
+    case 'd': seconds = atoi(optarg); break;
+    case 'c': connections = std::max(atoi(optarg), 1); break;
+    case 'm': mixText = optarg; break;
+    case 'a': addr = atoi(optarg) & 0xFFFF; break;
+    case 'T': timeout = atoi(optarg); break;
+    case 'q': queueLimit = atoi(optarg); break;
+    case 'b': busyPoll = true; break;
+    case 's': seed = atoi(optarg); break;
+    default:
+      optind = argc + 1;
+      break;
+    }
+  }
+  if (optind >= argc || rate <= 0.0 || seconds == 0) {
+    printf("Usage: %s [-r rate] [-d seconds] [-c connections] [-m FC:count[:weight],...] [-a address]\n"
+           "       [-T timeout] [-q queuelimit] [-b] [-s seed] target [target...]\n", argv[0]);
+    return -1;
+  }
+
+  std::vector<Target> targets;
+  for (int i = optind; i < argc; ++i) {
+    Target t = { NIL_ADDR, 502, 1 };
+    if (parseTarget(argv[i], t.ip, t.port, t.serverID)) {
+      printf("Invalid target descriptor %s. Must be IP[:port[:serverID]] or hostname[:port[:serverID]]\n", argv[i]);
+      return -1;
+    }
+    targets.push_back(t);
+  }
+  std::vector<MixEntry> mix;
+  if (!parseMix(mixText, mix)) {
+    printf("Invalid request mix %s. Must be a list of FC:count[:weight]\n", mixText);
+    return -1;
+  }
+
+  // Plan all requests ahead: nothing but sending shall happen when they are due
+  uint32_t total = (uint32_t)(rate * seconds);
+  std::vector<uint32_t> weights;
+  for (auto& m : mix) weights.push_back(m.weight);
+  std::mt19937 rng(seed);
+  std::discrete_distribution<uint8_t> pick(weights.begin(), weights.end());
+  plan.resize(total);
+  for (auto& p : plan) p = pick(rng);
+  stats.resize(mix.size());
+  for (auto& s : stats) s.latencies.reserve(total / mix.size() + 1);
+  intervalMicros = 1000000.0 / rate;
+
+  // Set up the connections, spread over the targets
+  // Lists will not move their elements; the ModbusClientTCPs are destroyed first, as they use the Clients
+  std::list<Client> clients;
+  std::list<ModbusClientTCP> MBclientList;
+  std::vector<ModbusClientTCP *> MBclients;
+  for (uint32_t i = 0; i < connections; ++i) {
+    const Target& t = targets[i % targets.size()];
+    clients.emplace_back();
+    clients.back().setNoDelay(true);
+    MBclientList.emplace_back(clients.back(), queueLimit);
+    ModbusClientTCP *mc = &MBclientList.back();
+    mc->setTimeout(timeout, 0);
+    mc->setTarget(t.ip, t.port, timeout, 0);
+    mc->setBusyPoll(busyPoll);
+    mc->onResponseHandler(&handleResponse);
+    mc->begin();
+    MBclients.push_back(mc);
+  }
+  printf("%u requests at %.1f/s over %u connections to %u targets\n", total, rate, connections, (unsigned)targets.size());
+
+  // Issue the requests on schedule
+  startTime = clk::now();
+  for (uint32_t token = 0; token < total; ++token) {
+    std::this_thread::sleep_until(startTime + std::chrono::microseconds(dueMicros(token)));
+    uint32_t c = token % connections;
+    const Target& t = targets[c % targets.size()];
+    const MixEntry& m = mix[plan[token]];
+    Error e = issue(*MBclients[c], m, t.serverID, addr, token);
+    std::lock_guard<std::mutex> lock(statsLock);
+    if (e == SUCCESS) {
+      stats[plan[token]].sent++;
+    } else {
+      stats[plan[token]].rejected++;
+    }
+  }
+  double elapsed = std::chrono::duration<double>(clk::now() - startTime).count();
+
+  // Wait for the outstanding responses - they will time out at the latest
+  uint32_t expected = 0;
+  for (auto& s : stats) expected += s.sent;
+  clk::time_point drainEnd = clk::now() + std::chrono::milliseconds(timeout * 2 + 1000);
+  while (clk::now() < drainEnd) {
+    {
+      std::lock_guard<std::mutex> lock(statsLock);
+      if (answered >= expected) break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  // Report
+  {
+    std::lock_guard<std::mutex> lock(statsLock);
+    printf("Issued in %.3f s: %.1f requests/s\n", elapsed, total / elapsed);
+    printf("FC  count       sent     ok/s     p50 ms     p99 ms   p99.9 ms     max ms   rejected   errors\n");
+    bool lost = false;
+    for (uint32_t i = 0; i < mix.size(); ++i) {
+      MixStats& s = stats[i];
+      uint32_t errors = 0;
+      for (auto& e : s.errors) errors += e.second;
+      printf("%02X  %5u %10u %8.1f", mix[i].fc, mix[i].count, s.sent, s.latencies.size() / elapsed);
+      if (s.latencies.empty()) {
+        printf(" %10s %10s %10s %10s", "-", "-", "-", "-");
+      } else {
+        std::sort(s.latencies.begin(), s.latencies.end());
+        printf(" %10.3f %10.3f %10.3f %10.3f", percentile(s.latencies, 0.5) / 1000.0, percentile(s.latencies, 0.99) / 1000.0,
+          percentile(s.latencies, 0.999) / 1000.0, s.latencies.back() / 1000.0);
+      }
+      printf(" %10u %8u\n", s.rejected, errors);
+      for (auto& e : s.errors) {
+        ModbusError me(e.first);
+        printf("    %02X %-40s %8u\n", (int)e.first, (const char *)me, e.second);
+      }
+      if (s.latencies.size() + errors < s.sent) lost = true;
+    }
+    if (lost) printf("Some responses were still missing at the end.\n");
+  }
+  return 0;
+}
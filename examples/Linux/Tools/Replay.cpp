@@ -0,0 +1,279 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+// Replay: re-issue recorded Modbus requests against a server or bridge and compare the responses.
+// The requests of a capture (see Capture.h for the formats) are sent through ModbusClientTCP connections,
+// each recorded connection mapped to one of them. Requests are sent with the recorded timing, scaled by
+// a speed factor, or as fast as the server will take them. Latencies are counted from the time a request
+// was due, like LoadGen does. Every response is compared with the recorded one:
+//   same        identical
+//   data        same server ID, function code and length, other data - to be expected for live values
+//   differs     other length or function code, an exception instead of data or another exception code
+//   failed      no response: timeout or connection error
+//   unrecorded  the capture has no response to compare with
+// Broadcasts (server ID 0) are not replayed.
+//
+// Usage: Replay [options] capture target
+//        Replay [-P port] -w|-W framelog capture
+//   capture     pcap, pcapng or frame log file
+//   target      IP[:port] or hostname[:port] of the server or bridge (port 502)
+//   -P port     Modbus TCP server port of the traffic in pcap files (502)
+//   -x factor   replay speed: 1 as recorded, 2 twice as fast, 0 as fast as possible (1)
+//   -c count    connections to the target at most (8)
+//   -T ms       response timeout (2000)
+//   -q count    requests in flight per connection at most (100)
+//   -s          strict: count responses with other data as differing
+//   -v count    print the first count differing responses (0)
+//   -w file     convert the capture to a frame log ("-" for stdout) instead of replaying it
+//   -W file     convert the capture to a binary frame log instead of replaying it
+// The exit code is 1 if any response failed or differed.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "Capture.h"
+#include "ModbusClientTCP.h"
+#include "parseTarget.h"
+
+using clk = std::chrono::steady_clock;
+
+// One request to replay
+struct Job {
+  uint32_t frame;          // Request frame in the capture
+  int32_t recorded;        // Recorded response frame, -1 if none
+  uint64_t due;            // Time to send it, microseconds after start
+  uint32_t client;         // Connection to use
+};
+
+// Comparison results
+enum Outcome : uint8_t { SAME = 0, DATA, DIFFERS, FAILED, UNRECORDED, OUTCOMES };
+static const char *outcomeNames[] = { "same", "data", "differs", "failed", "unrecorded" };
+
+// Shared state of the run
+static std::vector<CapturedFrame> frames;
+static std::vector<Job> jobs;
+static std::vector<uint64_t> sentMicros;          // Actual send times, for the maximum rate
+static std::vector<std::atomic<uint32_t>> *inFlight;
+static clk::time_point startTime;
+static bool maxRate = false;
+static bool strict = false;
+static uint32_t verbose = 0;
+static std::mutex statsLock;
+static std::vector<uint32_t> latencies;           // Microseconds, answered requests only
+static uint32_t outcomes[OUTCOMES] = { 0 };
+static uint32_t answered = 0;
+
+// nowMicros: time since start
+static inline uint64_t nowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(clk::now() - startTime).count();
+}
+
+// compare: judge a response against the recorded one
+static Outcome compare(const ModbusMessage& response, const Job& j) {
+  Error e = response.getError();
+  if (e >= TIMEOUT) return FAILED;
+  if (j.recorded < 0) return UNRECORDED;
+  const std::vector<uint8_t>& rec = frames[j.recorded].message;
+  if (response.size() == rec.size() && std::equal(response.begin(), response.end(), rec.begin())) return SAME;
+  // Exceptions must match exactly, data responses in length
+  if (e != SUCCESS || (rec[1] & 0x80) || response.size() != rec.size() || response[1] != rec[1]) return DIFFERS;
+  return strict ? DIFFERS : DATA;
+}
+
+// printHex: a message as hex bytes
+static void printHex(const char *label, const uint8_t *data, size_t len) {
+  printf("  %-9s", label);
+  for (size_t i = 0; i < len; ++i) printf(" %02X", data[i]);
+  printf("\n");
+}
+
+// handleResponse: account and compare a response
+static void handleResponse(ModbusMessage response, uint32_t token) {
+  uint64_t now = nowMicros();
+  const Job& j = jobs[token];
+  (*inFlight)[j.client]--;
+  Outcome o = compare(response, j);
+  std::lock_guard<std::mutex> lock(statsLock);
+  outcomes[o]++;
+  answered++;
+  if (o != FAILED) {
+    uint64_t latency = now - (maxRate ? sentMicros[token] : j.due);
+    latencies.push_back(latency > UINT32_MAX ? UINT32_MAX : latency);
+  }
+  if (o == DIFFERS && verbose) {
+    verbose--;
+    const CapturedFrame& req = frames[j.frame];
+    printf("Request %u (connection %u, TID %04X):\n", token, req.connection, req.transactionID);
+    printHex("request", req.message.data(), req.message.size());
+    printHex("recorded", frames[j.recorded].message.data(), frames[j.recorded].message.size());
+    printHex("replayed", response.data(), response.size());
+  }
+}
+
+// percentile: value at fraction p of the sorted samples
+static uint32_t percentile(const std::vector<uint32_t>& sorted, double p) {
+  size_t i = (size_t)(p * (sorted.size() - 1) + 0.5);
+  return sorted[i];
+}
+
+int main(int argc, char **argv) {
+  uint16_t pcapPort = 502;
+  double speed = 1.0;
+  uint32_t maxConnections = 8;
+  uint32_t timeout = 2000;
+  uint16_t queueLimit = 100;
+  const char *logName = nullptr;
+  bool binaryLog = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "P:x:c:T:q:sv:w:W:")) != -1) {
+    switch (opt) {
+    case 'P': pcapPort = atoi(optarg); break;
+    case 'x': speed = atof(optarg); break;
+    case 'c': maxConnections = std::max(atoi(optarg), 1); break;
+    case 'T': timeout = atoi(optarg); break;
+    case 'q': queueLimit = std::max(atoi(optarg), 1); break;
+    case 's': strict = true; break;
+    case 'v': verbose = atoi(optarg); break;
+    case 'w': logName = optarg; break;
+    case 'W':
+      logName = optarg;
+      binaryLog = true;
+      break;
+    default:
+      optind = argc + 1;
+      break;
+    }
+  }
+  if (optind >= argc || (!logName && optind + 1 >= argc) || speed < 0.0) {
+    printf("Usage: %s [-P port] [-x factor] [-c connections] [-T timeout] [-q inflight] [-s] [-v count] capture target\n"
+           "       %s [-P port] -w|-W framelog capture\n", argv[0], argv[0]);
+    return -1;
+  }
+  if (!readCapture(argv[optind], pcapPort, frames)) {
+    printf("Could not read capture %s\n", argv[optind]);
+    return -1;
+  }
+
+  // Conversion only?
+  if (logName) {
+    FrameLog log;
+    if (!log.open(logName, binaryLog)) return -1;
+    for (auto& f : frames) log.write(f);
+    return 0;
+  }
+
+  IPAddress ip;
+  uint16_t port = 502;
+  uint8_t serverID = 1;
+  if (parseTarget(argv[optind + 1], ip, port, serverID)) {
+    printf("Invalid target descriptor %s. Must be IP[:port] or hostname[:port]\n", argv[optind + 1]);
+    return -1;
+  }
+
+  // Plan the requests, keeping their recorded distance in time
+  std::vector<int32_t> pairs = pairFrames(frames);
+  std::map<uint32_t, uint32_t> clientOf;     // Recorded connection -> client
+  uint32_t skipped = 0;
+  for (uint32_t i = 0; i < frames.size(); ++i) {
+    if (!frames[i].request) continue;
+    if (frames[i].message.size() < 2 || frames[i].message[0] == 0) {
+      skipped++;
+      continue;
+    }
+    auto c = clientOf.find(frames[i].connection);
+    if (c == clientOf.end()) c = clientOf.emplace(frames[i].connection, clientOf.size() % maxConnections).first;
+    uint64_t offset = frames[i].micros - frames[0].micros;
+    jobs.push_back({ i, pairs[i], speed > 0.0 ? (uint64_t)(offset / speed) : 0, c->second });
+  }
+  if (jobs.empty()) {
+    printf("No requests found in %s\n", argv[optind]);
+    return -1;
+  }
+  maxRate = (speed == 0.0);
+  sentMicros.resize(jobs.size());
+  latencies.reserve(jobs.size());
+  uint32_t connections = std::min<uint32_t>(clientOf.size(), maxConnections);
+  std::vector<std::atomic<uint32_t>> flight(connections);
+  for (auto& f : flight) f = 0;
+  inFlight = &flight;
+
+  // Set up the connections
+  // Lists will not move their elements; the ModbusClientTCPs are destroyed first, as they use the Clients
+  std::list<Client> clients;
+  std::list<ModbusClientTCP> MBclientList;
+  std::vector<ModbusClientTCP *> MBclients;
+  for (uint32_t i = 0; i < connections; ++i) {
+    clients.emplace_back();
+    clients.back().setNoDelay(true);
+    MBclientList.emplace_back(clients.back(), queueLimit);
+    ModbusClientTCP *mc = &MBclientList.back();
+    mc->setTimeout(timeout, 0);
+    mc->setTarget(ip, port, timeout, 0);
+    mc->onResponseHandler(&handleResponse);
+    mc->begin();
+    MBclients.push_back(mc);
+  }
+  double span = (frames.back().micros - frames[0].micros) / 1000000.0;
+  printf("%u requests recorded over %.3f s on %u connections, replayed on %u", (unsigned)jobs.size(), span,
+    (unsigned)clientOf.size(), connections);
+  if (maxRate) printf(" as fast as possible\n");
+  else printf(" at %.2f times the recorded speed\n", speed);
+  if (skipped) printf("%u broadcasts or invalid requests skipped\n", skipped);
+
+  // Issue the requests
+  uint32_t rejected = 0;
+  startTime = clk::now();
+  for (uint32_t token = 0; token < jobs.size(); ++token) {
+    const Job& j = jobs[token];
+    if (maxRate) {
+      while (flight[j.client] >= queueLimit) std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_until(startTime + std::chrono::microseconds(j.due));
+    }
+    ModbusMessage request;
+    request.add(frames[j.frame].message.data(), frames[j.frame].message.size());
+    sentMicros[token] = nowMicros();
+    flight[j.client]++;
+    if (MBclients[j.client]->addRequest(std::move(request), token) != SUCCESS) {
+      flight[j.client]--;
+      rejected++;
+    }
+  }
+  double elapsed = std::chrono::duration<double>(clk::now() - startTime).count();
+
+  // Wait for the outstanding responses - they will time out at the latest
+  uint32_t expected = jobs.size() - rejected;
+  clk::time_point drainEnd = clk::now() + std::chrono::milliseconds(timeout * 2 + 1000);
+  while (clk::now() < drainEnd) {
+    {
+      std::lock_guard<std::mutex> lock(statsLock);
+      if (answered >= expected) break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  // Report
+  bool ok;
+  {
+    std::lock_guard<std::mutex> lock(statsLock);
+    printf("Issued in %.3f s: %.1f requests/s, %u rejected by the client queue\n", elapsed, jobs.size() / elapsed, rejected);
+    for (uint8_t o = 0; o < OUTCOMES; ++o) printf("%-11s %10u\n", outcomeNames[o], outcomes[o]);
+    if (answered < expected) printf("%-11s %10u\n", "missing", expected - answered);
+    if (!latencies.empty()) {
+      std::sort(latencies.begin(), latencies.end());
+      printf("latency ms  p50 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n", percentile(latencies, 0.5) / 1000.0,
+        percentile(latencies, 0.99) / 1000.0, percentile(latencies, 0.999) / 1000.0, latencies.back() / 1000.0);
+    }
+    ok = outcomes[DIFFERS] == 0 && outcomes[FAILED] == 0 && rejected == 0 && answered >= expected;
+  }
+  return ok ? 0 : 1;
+}
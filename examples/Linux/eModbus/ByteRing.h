@@ -0,0 +1,94 @@
+// =================================================================================================
+// eModbus: Copyright 2020, 2021 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _BYTE_RING_H
+#define _BYTE_RING_H
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+// ByteRing: lock-free single producer/single consumer byte queue of fixed capacity.
+// Exactly one thread may call write(), exactly one other thread read(), peek(), skip() and clear().
+// available() and room() may be called from anywhere, but are a snapshot only.
+// The producer publishes data by advancing tail after copying, the consumer frees space by advancing
+// head after copying - each index is written by one side only, so no locks or CAS are needed.
+template <uint32_t CAPACITY>
+class ByteRing {
+  // Capacity must be a power of 2 to let the indices wrap around freely
+  static_assert(CAPACITY && !(CAPACITY & (CAPACITY - 1)), "ByteRing capacity must be a power of 2");
+
+public:
+  ByteRing() : BRhead(0), BRtail(0) { }
+
+  // available: number of bytes waiting to be read
+  inline uint32_t available() const {
+    return BRtail.load(std::memory_order_acquire) - BRhead.load(std::memory_order_acquire);
+  }
+
+  // room: number of bytes that may be written
+  inline uint32_t room() const { return CAPACITY - available(); }
+
+  // write: append up to len bytes. Returns the number of bytes written (producer only)
+  uint32_t write(const uint8_t *data, uint32_t len) {
+    uint32_t tail = BRtail.load(std::memory_order_relaxed);
+    uint32_t space = CAPACITY - (tail - BRhead.load(std::memory_order_acquire));
+    if (len > space) len = space;
+    copyIn(tail, data, len);
+    BRtail.store(tail + len, std::memory_order_release);
+    return len;
+  }
+
+  // read: take up to len bytes. Returns the number of bytes read (consumer only)
+  uint32_t read(uint8_t *data, uint32_t len) {
+    uint32_t head = BRhead.load(std::memory_order_relaxed);
+    len = copyOut(head, data, len);
+    BRhead.store(head + len, std::memory_order_release);
+    return len;
+  }
+
+  // peek: copy up to len bytes without taking them (consumer only)
+  inline uint32_t peek(uint8_t *data, uint32_t len) const {
+    return copyOut(BRhead.load(std::memory_order_relaxed), data, len);
+  }
+
+  // skip: drop up to len bytes (consumer only)
+  uint32_t skip(uint32_t len) {
+    uint32_t head = BRhead.load(std::memory_order_relaxed);
+    uint32_t avail = BRtail.load(std::memory_order_acquire) - head;
+    if (len > avail) len = avail;
+    BRhead.store(head + len, std::memory_order_release);
+    return len;
+  }
+
+  // clear: drop everything written so far (consumer only)
+  inline void clear() { BRhead.store(BRtail.load(std::memory_order_acquire), std::memory_order_release); }
+
+protected:
+  // copyIn: copy len bytes to ring position pos, wrapping around at the end
+  void copyIn(uint32_t pos, const uint8_t *data, uint32_t len) {
+    uint32_t offset = pos & (CAPACITY - 1);
+    uint32_t first = (len < CAPACITY - offset) ? len : CAPACITY - offset;
+    memcpy(BRbuffer + offset, data, first);
+    memcpy(BRbuffer, data + first, len - first);
+  }
+
+  // copyOut: copy up to len available bytes from ring position pos. Returns number of bytes copied
+  uint32_t copyOut(uint32_t pos, uint8_t *data, uint32_t len) const {
+    uint32_t avail = BRtail.load(std::memory_order_acquire) - pos;
+    if (len > avail) len = avail;
+    uint32_t offset = pos & (CAPACITY - 1);
+    uint32_t first = (len < CAPACITY - offset) ? len : CAPACITY - offset;
+    memcpy(data, BRbuffer + offset, first);
+    memcpy(data + first, BRbuffer, len - first);
+    return len;
+  }
+
+  // Head and tail are kept on cache lines of their own, so producer and consumer will not
+  // invalidate each other's cache with every index update
+  alignas(64) std::atomic<uint32_t> BRhead;     // Next byte to read, only advanced by the consumer
+  alignas(64) std::atomic<uint32_t> BRtail;     // Next byte to write, only advanced by the producer
+  alignas(64) uint8_t BRbuffer[CAPACITY];       // Ring storage
+};
+
+#endif
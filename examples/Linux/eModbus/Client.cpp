@@ -7,33 +7,47 @@
 #if IS_LINUX
 #include "Client.h"
 #include "Logging.h"
+#include <fcntl.h>
+#include <poll.h>
 #include <libexplain/connect.h>
 
+// DNS cache shared by all clients
+std::map<std::string, Client::DNSEntry> Client::dnsCache;
+std::mutex Client::dnsMutex;
+uint32_t Client::dnsTTL = 60000;
+
 // Default constructor: just initialize host variables
-Client::Client() : sockfd(-1), host(NIL_ADDR), port(0) { } 
+Client::Client() : sockfd(-1), host(NIL_ADDR), port(0), connectTimeout(CONNECT_TIMEOUT), rxHead(0), rxTail(0) { } 
 
 // Constructor with IP/port: initialize, then try to connect
-Client::Client(IPAddress ip, uint16_t p) : sockfd(-1), host(NIL_ADDR), port(0) {
+Client::Client(IPAddress ip, uint16_t p) : sockfd(-1), host(NIL_ADDR), port(0), connectTimeout(CONNECT_TIMEOUT), rxHead(0), rxTail(0) {
   connect(ip, p);
 }
 
 // Constructor with hostname/port: initialize, then try to connect
-Client::Client(const char *hostname, uint16_t p) : sockfd(-1), host(NIL_ADDR), port(0) {
+Client::Client(const char *hostname, uint16_t p) : sockfd(-1), host(NIL_ADDR), port(0), connectTimeout(CONNECT_TIMEOUT), rxHead(0), rxTail(0) {
   connect(hostname, p);
 }
 
 // Destructor: terminate connection, if any.
 Client::~Client() { stop(); }
 
-// connect with IP/port: establish a connection
+// connect with IP/port: establish a connection, waiting the default timeout at most
 int Client::connect(IPAddress ip, uint16_t p) {
+  return connect(ip, p, connectTimeout);
+}
+
+// connect with IP/port/timeout: establish a connection, waiting timeout ms at most
+int Client::connect(IPAddress ip, uint16_t p, int32_t timeout) {
 // Are we still connected? Then terminate the existing connection.
   if (connected()) disconnect();
 
-// Get a fresh socket
+// Get a fresh socket and an empty receive buffer
   sockfd = ::socket(AF_INET, SOCK_STREAM, 0);
+  rxHead = rxTail = 0;
   if (sockfd < 0) {
     LOG_E("Error %d opening socket\n", errno);
+    return -1;
   }
 
 // Set up sockaddr_in struct
@@ -44,17 +58,55 @@ int Client::connect(IPAddress ip, uint16_t p) {
   server.sin_addr.s_addr = ::htonl(uint32_t(ip));
   server.sin_port = ::htons(p);
 
+// Switch the socket to non-blocking, so we will not hang in the kernel's connect timeout
+  int flags = ::fcntl(sockfd, F_GETFL, 0);
+  ::fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
+
 // Try to connect
   int rc = ::connect(sockfd, (struct sockaddr *)&server, sizeof(server));
 
+// Still in progress? Then wait for the socket to become writable
+  if (rc < 0 && errno == EINPROGRESS) {
+    struct pollfd pfd;
+    pfd.fd = sockfd;
+    pfd.events = POLLOUT;
+    uint32_t startTime = millis();
+    int32_t remaining = timeout;
+    do {
+      rc = ::poll(&pfd, 1, remaining);
+      remaining = timeout - (int32_t)(millis() - startTime);
+    } while (rc < 0 && errno == EINTR && remaining > 0);
+    if (rc == 0 || (rc < 0 && errno == EINTR)) {
+    // Timed out
+      errno = ETIMEDOUT;
+      rc = -1;
+    } else if (rc > 0) {
+    // Socket is writable - get the connection result
+      int err = 0;
+      socklen_t len = sizeof(err);
+      ::getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &err, &len);
+      if (err) {
+        errno = err;
+        rc = -1;
+      } else {
+        rc = 0;
+      }
+    }
+  }
+
 // Failed?
   if (rc < 0) {
-  // Yes. Print out error and return
-    LOG_E("Error %d connecting to %s:%d -\n", rc, buf, p);
-    LOG_E("%s\n\n", explain_connect(sockfd, (struct sockaddr *)&server, sizeof(server)));
+  // Yes. Print out error, drop the socket and return
+    LOG_E("Error %d connecting to %s:%d -\n", errno, buf, p);
+    LOG_E("%s\n\n", explain_errno_connect(errno, sockfd, (struct sockaddr *)&server, sizeof(server)));
+    ::close(sockfd);
+    sockfd = -1;
     return rc;
   }
 
+// Back to blocking mode - reads will use MSG_DONTWAIT anyway
+  ::fcntl(sockfd, F_SETFL, flags);
+
 // Connection was successful. Remember host data and return
   LOG_D("Connected.\n");
   host = ip;
@@ -63,17 +115,26 @@ int Client::connect(IPAddress ip, uint16_t p) {
 }
 
 // connect with hostname/port: try to find and connect to host 
-int Client::connect(const char *host, uint16_t port) {
+int Client::connect(const char *hostname, uint16_t p) {
+  return connect(hostname, p, connectTimeout);
+}
+
+// connect with hostname/port/timeout: try to find and connect to host, waiting timeout ms at most
+int Client::connect(const char *hostname, uint16_t p, int32_t timeout) {
 // Get IP for given hostname
-  char ip[16];
-  IPAddress myHost = hostname_to_ip(host);
-  if (myHost != NIL_ADDR) {
+  IPAddress myHost = hostname_to_ip(hostname);
+  if (myHost == NIL_ADDR) {
   // Failure. Report and bail out
-    LOG_E("No such host '%s'\n", host);
+    LOG_E("No such host '%s'\n", hostname);
     return -1;
   }
   // Success - connect to found IP/port
-  return connect(myHost, port);
+  return connect(myHost, p, timeout);
+}
+
+// setConnectTimeout: set the default time in ms to wait for a connection
+void Client::setConnectTimeout(uint32_t timeout) {
+  connectTimeout = timeout;
 }
 
 // disconnect: cut any existing connection
@@ -93,6 +154,7 @@ bool Client::disconnect() {
     ::close(sockfd);
     sockfd = -1;
   }
+  rxHead = rxTail = 0;
   host = NIL_ADDR;
   port = 0;
   return true;
@@ -126,41 +188,83 @@ size_t Client::write(const uint8_t *buf, size_t size) {
   return rc;
 }
 
-// available: return number of waiting bytes to be read - if any (but 255 max)
-int Client::available() {
-  uint8_t buf[256];
+// write (segments): send all segments of a frame in one gathering call
+size_t Client::write(const ModbusSegments& segments) {
+  struct iovec iov[ModbusSegments::MAXSEGMENTS];
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = segments.toIovec(iov);
+  size_t written = 0;
+// A signal may cut the frame short - send the rest until all is out
+  while (msg.msg_iovlen) {
+  // Send segments, disabled SIGPIPE
+    ssize_t rc = ::sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+    LOG_D("sendmsg [%d segments, %d bytes] -> %d\n", (int)msg.msg_iovlen, (int)(segments.size() - written), (int)rc);
+  // Interrupted before anything was sent? Try again
+    if (rc < 0 && errno == EINTR) continue;
+  // Something wrong?
+    if (rc <= 0) {
+    // Yes, print it out
+      LOG_E("Error sending: %s (%d)\n", strerror(errno), errno);
+      return 0;
+    }
+    written += rc;
+  // Skip the segments sent completely, then the part sent of the next one
+    while (msg.msg_iovlen && (size_t)rc >= msg.msg_iov->iov_len) {
+      rc -= msg.msg_iov->iov_len;
+      msg.msg_iov++;
+      msg.msg_iovlen--;
+    }
+    if (msg.msg_iovlen) {
+      msg.msg_iov->iov_base = (uint8_t *)msg.msg_iov->iov_base + rc;
+      msg.msg_iov->iov_len -= rc;
+    }
+  }
+  return written;
+}
+
+// fill: refill the receive buffer, if it is empty. Returns number of bytes buffered
+int Client::fill() {
+  if (rxHead < rxTail) return rxTail - rxHead;
+  rxHead = rxTail = 0;
 interrupted:
-// peek-read buffer
-  int r = ::recv(sockfd, &buf, 256, MSG_DONTWAIT|MSG_PEEK);
-// Anything >0 is number of bytes available
-  if (r > 0) return r;
+// Get as much as the buffer will take, without blocking
+  int r = ::recv(sockfd, rxBuffer, RXBUFSIZE, MSG_DONTWAIT);
+  if (r > 0) {
+    rxTail = r;
+    return r;
+  }
 // We may have been prevented to read
   if (r < 0 && errno == EINTR) goto interrupted;
-// All else is either an empty buffer or no connection at all
+// All else is either no data or no connection at all
   return 0;
 }
 
+// available: return number of waiting bytes to be read - if any (buffered ones first)
+int Client::available() {
+  return fill();
+}
+
 // read: get a single byte from buffer
 int Client::read() {
-  int x;
-interrupted:
-// read a byte
-  int r = ::read(sockfd, &x, 1);
-// a 1 signals success
-  if (r == 1) return x;
-// We may have been prevented to read
-  if (r < 0 && errno == EINTR) goto interrupted;
-// A zero signals no data available
-  if (r == 0) return -1;
-// All else is some error state
-// Lazyness... No error handling here!
-  return r;
+// Without blocking, like the Arduino Client does: -1 if no data
+  if (fill() == 0) return -1;
+  return rxBuffer[rxHead++];
 }
 
 // read: get a buffer full of data
 int Client::read(uint8_t *buf, size_t size) {
+// Serve buffered data first
+  if (rxHead < rxTail) {
+    size_t len = rxTail - rxHead;
+    if (len > size) len = size;
+    memcpy(buf, rxBuffer + rxHead, len);
+    rxHead += len;
+    return len;
+  }
 interrupted:
-// peek-read buffer
+// Nothing buffered - read directly into the caller's buffer
   int r = ::read(sockfd, buf, size);
 // Anything >0 is number of bytes available
   if (r > 0) return r;
@@ -172,16 +276,8 @@ interrupted:
 
 // peek: read one byte without popping it from the buffer
 int Client::peek() {
-  int x;
-interrupted:
-// peek-read a byte
-  int r = ::recv(sockfd, &x, 1, MSG_DONTWAIT|MSG_PEEK);
-// a 1 signals success
-  if (r == 1) return x;
-// We may have been prevented to read
-  if (r < 0 && errno == EINTR) goto interrupted;
-// All else is some error state
-  return r;
+  if (fill() == 0) return -1;
+  return rxBuffer[rxHead];
 }
 
 // flush: no op for now
@@ -196,6 +292,8 @@ void Client::stop() {
 // connected: return stat eof current host connetion
 uint8_t Client::connected() {
   char x;
+// Buffered data means there was a connection - no need to ask the socket
+  if (rxHead < rxTail) return 1;
 interrupted:
 // Try to peek a byte
   int r = ::recv(sockfd, &x, 1, MSG_DONTWAIT|MSG_PEEK);
@@ -227,6 +325,21 @@ void Client::setNoDelay(bool yesNo) {
 IPAddress Client::hostname_to_ip(const char *hostname)
 {
   IPAddress returnIP = NIL_ADDR;
+
+// Do we know the host already? The cache is empty if disabled
+  {
+    LOCK_GUARD(lock, dnsMutex);
+    auto it = dnsCache.find(hostname);
+    if (it != dnsCache.end()) {
+    // Yes. Is the entry still valid?
+      if ((int32_t)(it->second.expires - millis()) > 0) {
+        LOG_D("Host '%s'=%s (cached)\n", hostname, string(it->second.ip).c_str());
+        return it->second.ip;
+      }
+    // No, expired. Forget it
+      dnsCache.erase(it);
+    }
+  }
   struct addrinfo hints, *servinfo, *p;
   struct sockaddr_in *h;
   int rv;
@@ -255,11 +368,44 @@ IPAddress Client::hostname_to_ip(const char *hostname)
 
   if (returnIP != NIL_ADDR) {
     LOG_D("Host '%s'=%s\n", hostname, string(returnIP).c_str());
+  // Remember the address for next time
+    LOCK_GUARD(lock, dnsMutex);
+    if (dnsTTL) {
+      uint32_t now = millis();
+    // Cache full? Drop expired entries, or all if none has expired
+      if (dnsCache.size() >= DNSCACHESIZE) {
+        for (auto it = dnsCache.begin(); it != dnsCache.end();) {
+          if ((int32_t)(it->second.expires - now) <= 0) {
+            it = dnsCache.erase(it);
+          } else {
+            ++it;
+          }
+        }
+        if (dnsCache.size() >= DNSCACHESIZE) dnsCache.clear();
+      }
+      DNSEntry entry;
+      entry.ip = returnIP;
+      entry.expires = now + dnsTTL;
+      dnsCache[hostname] = entry;
+    }
   } else {
     LOG_D("No IP for '%s' found\n", hostname);
   }
   return returnIP;
 }
 
+// setDNSCacheTTL: set the time in ms resolved host names are kept. 0 disables the cache
+void Client::setDNSCacheTTL(uint32_t ttl) {
+  LOCK_GUARD(lock, dnsMutex);
+  dnsTTL = ttl;
+  if (!ttl) dnsCache.clear();
+}
+
+// clearDNSCache: forget all resolved host names
+void Client::clearDNSCache() {
+  LOCK_GUARD(lock, dnsMutex);
+  dnsCache.clear();
+}
+
 #endif // IS_LINUX
 
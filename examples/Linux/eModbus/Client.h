@@ -15,35 +15,72 @@
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h> 
+#include <map>
+#include <mutex>
+#include <string>
 #include "IPAddress.h"
+#include "ModbusSegments.h"
 
+// Client: the Linux version of the Arduino Client interface. Its methods are virtual as in the
+// Arduino core, so other transports (like in-memory test stubs) may be used in place of a socket.
 class Client {
 public:
   Client();
   Client(IPAddress ip, uint16_t port);
   Client(const char *hostname, uint16_t port);
-  ~Client();
-  int connect(IPAddress ip, uint16_t port);
-  int connect(const char *host, uint16_t port);
-  bool disconnect();
-  size_t write(uint8_t t);
-  size_t write(const uint8_t *buf, size_t size);
-  int available();
-  int read();
-  int read(uint8_t *buf, size_t size);
-  int peek();
-  void flush();
-  void stop();
+  virtual ~Client();
+  virtual int connect(IPAddress ip, uint16_t port);
+  virtual int connect(IPAddress ip, uint16_t port, int32_t timeout);
+  virtual int connect(const char *host, uint16_t port);
+  virtual int connect(const char *host, uint16_t port, int32_t timeout);
+  virtual bool disconnect();
+  virtual size_t write(uint8_t t);
+  virtual size_t write(const uint8_t *buf, size_t size);
+  virtual size_t write(const ModbusSegments& segments);
+  virtual int available();
+  virtual int read();
+  virtual int read(uint8_t *buf, size_t size);
+  virtual int peek();
+  virtual void flush();
+  virtual void stop();
   void setNoDelay(bool yesNo);
-  uint8_t connected();
-  operator bool();
+  virtual uint8_t connected();
+  virtual operator bool();
+  void setConnectTimeout(uint32_t timeout);
   static IPAddress hostname_to_ip(const char *hostname);
+  static void setDNSCacheTTL(uint32_t ttl);
+  static void clearDNSCache();
 
 protected:
+  // Size of the receive buffer - room for a couple of Modbus TCP responses
+  static const uint16_t RXBUFSIZE = 1024;
+
+  // fill: refill an empty receive buffer with a single recv() call. Returns number of bytes buffered.
+  // Virtual, so transports wrapping the socket (like TLSClient) may reuse available(), read() and peek()
+  virtual int fill();
+
+  // Default time in ms to wait for a connection to be established
+  static const uint32_t CONNECT_TIMEOUT = 3000;
+  // Maximum number of host names held in the DNS cache
+  static const uint16_t DNSCACHESIZE = 64;
+
+  // DNS cache entry: resolved address and time of expiry
+  struct DNSEntry {
+    IPAddress ip;
+    uint32_t expires;
+  };
+  static std::map<std::string, DNSEntry> dnsCache;
+  static std::mutex dnsMutex;
+  static uint32_t dnsTTL;              // Time in ms a resolved address is kept; 0 disables the cache
+
   int sockfd;
   IPAddress host;
   uint16_t port;
+  uint32_t connectTimeout;
   struct sockaddr_in server;
+  uint8_t rxBuffer[RXBUFSIZE];   // Received data not yet read
+  uint16_t rxHead;               // Next byte to read
+  uint16_t rxTail;               // End of buffered data
 };
 
 #endif // IS_LINUX
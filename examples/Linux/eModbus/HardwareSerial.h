@@ -0,0 +1,60 @@
+// =================================================================================================
+// eModbus: Copyright 2020, 2021 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _HARDWARE_SERIAL_H
+#define _HARDWARE_SERIAL_H
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Arduino signal levels, used for the RTS callbacks
+#ifndef HIGH
+#define HIGH 1
+#define LOW 0
+#endif
+
+// HardwareSerial: Linux stand-in for the Arduino class, to get RTUutils compiled and exercised on Linux.
+// This is no UART driver! Bytes to be received are put in with feed(), bytes written are collected
+// and may be inspected with sent(). Tests and benchmarks may run the RTU and ASCII framing this way.
+// Not thread safe - use it from one thread only.
+class HardwareSerial {
+public:
+  explicit HardwareSerial(uint32_t baud = 9600) : HSbaud(baud), HSrxPos(0) { }
+
+  inline void begin(uint32_t baud) { HSbaud = baud; }
+  inline uint32_t baudRate() { return HSbaud; }
+
+  // Receive side
+  inline int available() { return HSrx.size() - HSrxPos; }
+  inline int read() { return (HSrxPos < HSrx.size()) ? HSrx[HSrxPos++] : -1; }
+  inline int peek() { return (HSrxPos < HSrx.size()) ? HSrx[HSrxPos] : -1; }
+
+  // Transmit side
+  inline size_t write(uint8_t byte) { HStx.push_back(byte); return 1; }
+  inline size_t write(const uint8_t *data, size_t len) { HStx.insert(HStx.end(), data, data + len); return len; }
+  inline size_t write(const char *text) { return write((const uint8_t *)text, strlen(text)); }
+  inline void flush() { }
+
+  // feed: append bytes to be received
+  void feed(const uint8_t *data, size_t len) {
+    // Drop what was read already, if anything
+    if (HSrxPos == HSrx.size()) {
+      HSrx.clear();
+      HSrxPos = 0;
+    }
+    HSrx.insert(HSrx.end(), data, data + len);
+  }
+
+  // sent: all bytes written so far; clearSent() drops them
+  inline const std::vector<uint8_t>& sent() const { return HStx; }
+  inline void clearSent() { HStx.clear(); }
+
+protected:
+  uint32_t HSbaud;                // Nominal baud rate, used by RTUutils::calculateInterval()
+  std::vector<uint8_t> HSrx;      // Bytes to be received
+  size_t HSrxPos;                 // Next byte to be read
+  std::vector<uint8_t> HStx;      // Bytes written
+};
+
+#endif
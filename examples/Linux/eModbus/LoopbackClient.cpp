@@ -0,0 +1,142 @@
+// =================================================================================================
+// eModbus: Copyright 2020, 2021 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#include "options.h"
+
+#if IS_LINUX
+#include "LoopbackClient.h"
+#undef LOCAL_LOG_LEVEL
+#include "Logging.h"
+
+// Constructor: just remember the server, the thread will be started by connect()
+LoopbackClient::LoopbackClient(ModbusServer& s) :
+  server(s),
+  running(false),
+  frames(0) { }
+
+// Destructor: end the server thread
+LoopbackClient::~LoopbackClient() {
+  stop();
+}
+
+// connect: start the server thread, if not running already
+int LoopbackClient::connect(IPAddress, uint16_t) {
+  if (!running) {
+    running = true;
+    worker = std::thread(serve, this);
+  }
+  return 1;
+}
+
+// write a single byte to the server
+size_t LoopbackClient::write(uint8_t byte) {
+  return toServer.write(&byte, 1);
+}
+
+// ... or a buffer
+size_t LoopbackClient::write(const uint8_t *buf, size_t size) {
+  return toServer.write(buf, size);
+}
+
+// ... or all segments of a frame
+size_t LoopbackClient::write(const ModbusSegments& segments) {
+  size_t cnt = 0;
+  for (auto& s : segments) {
+    cnt += toServer.write(s.data, s.len);
+  }
+  return cnt;
+}
+
+// available: number of response bytes waiting
+int LoopbackClient::available() {
+  return toClient.available();
+}
+
+// read a single byte, -1 if there is none
+int LoopbackClient::read() {
+  uint8_t byte;
+  if (toClient.read(&byte, 1) == 0) return -1;
+  return byte;
+}
+
+// read up to size bytes, -1 if there are none
+int LoopbackClient::read(uint8_t *buf, size_t size) {
+  uint32_t cnt = toClient.read(buf, size);
+  if (cnt == 0) return -1;
+  return cnt;
+}
+
+// peek at the next byte, -1 if there is none
+int LoopbackClient::peek() {
+  uint8_t byte;
+  if (toClient.peek(&byte, 1) == 0) return -1;
+  return byte;
+}
+
+// flush: nothing to do, data is visible to the other side right away
+void LoopbackClient::flush() {
+}
+
+// stop: end the server thread and drop all unread data
+void LoopbackClient::stop() {
+  running = false;
+  if (worker.joinable()) worker.join();
+  toServer.clear();
+  toClient.clear();
+}
+
+// serve: take requests, have them answered by the server and write back the responses
+void LoopbackClient::serve(LoopbackClient *instance) {
+  const uint16_t BUFFERSIZE(6 + 256);
+  uint8_t buffer[BUFFERSIZE];
+
+  while (instance->running) {
+    // Do we have a complete TCP header?
+    if (instance->toServer.available() < 6) {
+      std::this_thread::yield();
+      continue;
+    }
+    instance->toServer.peek(buffer, 6);
+    uint16_t len = 6 + ((buffer[4] << 8) | buffer[5]);
+    // A frame shorter than serverID and FC or longer than the buffer can not be right - drop everything
+    if (len < 8 || len > BUFFERSIZE) {
+      LOG_E("Invalid frame length %d - dropped\n", len);
+      instance->toServer.clear();
+      continue;
+    }
+    // Wait for the complete frame
+    if (instance->toServer.available() < len) {
+      std::this_thread::yield();
+      continue;
+    }
+    instance->toServer.read(buffer, len);
+
+    ModbusMessage request;
+    request.add(buffer + 6, len - 6);
+    ModbusMessage response;
+    // Protocol ID shall be 0x0000 - is it?
+    if (buffer[2] == 0 && buffer[3] == 0) {
+      response = instance->server.localRequest(std::move(request));
+    } else {
+      response.setError(request.getServerID(), request.getFunctionCode(), TCP_HEAD_MISMATCH);
+    }
+    instance->frames++;
+
+    // Do we have a response to send?
+    if (response.size() >= 3 && response.size() <= BUFFERSIZE - 6) {
+      // Yes. Keep TID and protocol ID, update the length and append the response
+      buffer[4] = (response.size() >> 8) & 0xFF;
+      buffer[5] = response.size() & 0xFF;
+      memcpy(buffer + 6, response.data(), response.size());
+      len = 6 + response.size();
+      // Write it in one go, so the client will not see half a frame
+      while (instance->toClient.room() < len && instance->running) {
+        std::this_thread::yield();
+      }
+      instance->toClient.write(buffer, len);
+    }
+  }
+}
+
+#endif
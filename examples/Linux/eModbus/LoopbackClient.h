@@ -0,0 +1,70 @@
+// =================================================================================================
+// eModbus: Copyright 2020, 2021 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _LOOPBACK_CLIENT_H
+#define _LOOPBACK_CLIENT_H
+#include "Client.h"
+#include <atomic>
+#include <thread>     // NOLINT
+#include "ByteRing.h"
+#include "ModbusServer.h"
+
+// LoopbackClient: a Client connected to a ModbusServer within the same process, without any sockets.
+// Requests and responses are Modbus TCP frames passed through two lock-free ByteRings. A server thread,
+// started by connect(), takes the requests, has them answered by ModbusServer::localRequest() and writes
+// back the responses. Any IP and port will be accepted as target.
+// This leaves only the protocol handling and dispatching to be measured by benchmarks. To keep the
+// kernel out completely, the server thread will spin while connected - use it with a busy-polling
+// ModbusClientTCP and at least 2 CPUs for best results.
+class LoopbackClient : public Client {
+public:
+  explicit LoopbackClient(ModbusServer& server);
+  ~LoopbackClient();
+
+  // connect will start the server thread
+  int connect(IPAddress ip, uint16_t port);
+  inline int connect(IPAddress ip, uint16_t port, int32_t) { return connect(ip, port); }
+  inline int connect(const char *, uint16_t port) { return connect(NIL_ADDR, port); }
+  inline int connect(const char *, uint16_t port, int32_t) { return connect(NIL_ADDR, port); }
+  inline bool disconnect() { stop(); return true; }
+
+  size_t write(uint8_t byte);
+  size_t write(const uint8_t *buf, size_t size);
+  size_t write(const ModbusSegments& segments);
+
+  int available();
+  int read();
+  int read(uint8_t *buf, size_t size);
+  int peek();
+  void flush();
+
+  // stop will end the server thread and drop all unread data
+  void stop();
+
+  // connected will return true (=1) as long as the server thread is running
+  inline uint8_t connected() { return (running ? 1 : 0); }
+  inline operator bool() { return running; }
+
+  // getFrameCount: number of requests the server thread has answered
+  inline uint32_t getFrameCount() { return frames; }
+
+protected:
+  // Prevent copy construction and assignment - the rings can not be shared
+  LoopbackClient(const LoopbackClient& l) = delete;
+  LoopbackClient& operator=(const LoopbackClient& l) = delete;
+
+  static const uint32_t RINGSIZE = 1024;   // Room for several maximum size frames
+
+  ModbusServer& server;                // Server answering the requests
+  std::thread worker;                  // Server thread
+  std::atomic<bool> running;           // Server thread is serving requests
+  std::atomic<uint32_t> frames;        // Requests answered
+  ByteRing<RINGSIZE> toServer;         // Requests: written by the client, read by the server thread
+  ByteRing<RINGSIZE> toClient;         // Responses: written by the server thread, read by the client
+
+  // serve: server thread method
+  static void serve(LoopbackClient *instance);
+};
+
+#endif
@@ -0,0 +1,477 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#include "ModbusServerTLS.h"
+#include "PDUutils.h"
+
+#if IS_LINUX
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+
+#undef LOCAL_LOG_LEVEL
+// #define LOCAL_LOG_LEVEL LOG_LEVEL_VERBOSE
+#include "Logging.h"
+
+#define TLS_WRITETIMEOUT 1000     // ms to wait for a busy connection to take a response
+
+// Constructor: set up the context for all connections
+ModbusServerTLS::ModbusServerTLS() :
+  ModbusServer(),
+  serverSocket(-1),
+  serverPort(0),
+  maxClients(4),
+  serverTimeout(20000),
+  handshakes(0),
+  resumed(0),
+  serverThread(0),
+  running(false) {
+  ctx = SSL_CTX_new(TLS_server_method());
+  // Modbus/TCP Security requires TLS 1.2 at least
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  // Sessions verified with a client certificate will only be resumed within the same context
+  static const unsigned char sessionContext[] = "eModbus";
+  SSL_CTX_set_session_id_context(ctx, sessionContext, sizeof(sessionContext) - 1);
+  // A client will resume with the latest ticket only - one per handshake will do
+  SSL_CTX_set_num_tickets(ctx, 1);
+}
+
+// Destructor: stops the server
+ModbusServerTLS::~ModbusServerTLS() {
+  stop();
+  SSL_CTX_free(ctx);
+}
+
+// setCertificate: server certificate, its chain and key
+bool ModbusServerTLS::setCertificate(const char *cert, const char *privateKey) {
+  BIO *bio = BIO_new_mem_buf(cert, -1);
+  X509 *x = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr);
+  bool ok = (x != nullptr && SSL_CTX_use_certificate(ctx, x) == 1);
+  X509_free(x);
+  // Any more certificates are the chain
+  if (ok) {
+    SSL_CTX_clear_chain_certs(ctx);
+    while ((x = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr)) != nullptr) {
+      SSL_CTX_add0_chain_cert(ctx, x);
+    }
+  }
+  BIO_free(bio);
+  if (ok) {
+    bio = BIO_new_mem_buf(privateKey, -1);
+    EVP_PKEY *key = PEM_read_bio_PrivateKey(bio, nullptr, nullptr, nullptr);
+    ok = (key != nullptr && SSL_CTX_use_PrivateKey(ctx, key) == 1 && SSL_CTX_check_private_key(ctx) == 1);
+    EVP_PKEY_free(key);
+    BIO_free(bio);
+  }
+  ERR_clear_error();
+  if (!ok) LOG_E("No usable server certificate and key\n");
+  return ok;
+}
+
+// setClientCA: require client certificates signed by this CA
+bool ModbusServerTLS::setClientCA(const char *rootCA) {
+  BIO *bio = BIO_new_mem_buf(rootCA, -1);
+  X509_STORE *store = SSL_CTX_get_cert_store(ctx);
+  X509 *x;
+  int count = 0;
+  while ((x = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr)) != nullptr) {
+    // Trust it, and name it to the clients in the certificate request
+    if (X509_STORE_add_cert(store, x)) count++;
+    SSL_CTX_add_client_CA(ctx, x);
+    X509_free(x);
+  }
+  BIO_free(bio);
+  // The end of the data is reported as an error as well
+  ERR_clear_error();
+  if (!count) {
+    LOG_E("No usable CA certificate\n");
+    return false;
+  }
+  SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, nullptr);
+  return true;
+}
+
+// start: open the socket on the given port and start the server thread
+bool ModbusServerTLS::start(uint16_t port, uint8_t clients, uint32_t timeout, int coreID) {
+  // Already running? Shut it down first
+  if (running) stop();
+  // No handshake without certificate
+  if (SSL_CTX_check_private_key(ctx) != 1) {
+    ERR_clear_error();
+    LOG_E("No server certificate and key set\n");
+    return false;
+  }
+  maxClients = clients ? clients : 1;
+  serverTimeout = timeout;
+
+  serverSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (serverSocket < 0) {
+    LOG_E("Could not create socket: %s\n", strerror(errno));
+    return false;
+  }
+  int one = 1;
+  setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (bind(serverSocket, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(serverSocket, maxClients) < 0) {
+    LOG_E("Could not open port %d: %s\n", port, strerror(errno));
+    close(serverSocket);
+    serverSocket = -1;
+    return false;
+  }
+  // Find out the port actually bound - port 0 will have taken any
+  socklen_t alen = sizeof(addr);
+  getsockname(serverSocket, (sockaddr *)&addr, &alen);
+  serverPort = ntohs(addr.sin_port);
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  // Pin the thread to a CPU?
+  if (coreID >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(coreID, &cpus);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+  }
+  int rc = pthread_create(&serverThread, &attr, &serve, this);
+  pthread_attr_destroy(&attr);
+  // An invalid CPU will fail - try again without
+  if (rc && coreID >= 0) {
+    LOG_E("Could not apply core %d to TLS server thread: %s\n", coreID, strerror(rc));
+    rc = pthread_create(&serverThread, NULL, &serve, this);
+  }
+  if (rc) {
+    LOG_E("Error creating TLS server thread: %d\n", rc);
+    close(serverSocket);
+    serverSocket = -1;
+    serverPort = 0;
+    return false;
+  }
+  running = true;
+  LOG_D("TLS server started on port %d\n", serverPort);
+  return true;
+}
+
+// stop: kill the server thread and close all connections
+bool ModbusServerTLS::stop() {
+  if (!running) return false;
+  pthread_cancel(serverThread);
+  pthread_join(serverThread, NULL);
+  running = false;
+  for (auto c : connections) {
+    closeConnection(*c);
+    delete c;
+  }
+  connections.clear();
+  close(serverSocket);
+  serverSocket = -1;
+  serverPort = 0;
+  LOG_D("TLS server stopped\n");
+  return true;
+}
+
+// getPort: port the server is listening on
+uint16_t ModbusServerTLS::getPort() {
+  return serverPort;
+}
+
+// getHandshakes: number of handshakes done
+uint32_t ModbusServerTLS::getHandshakes() {
+  LOCK_GUARD(cntLock, m);
+  return handshakes;
+}
+
+// getResumed: number of handshakes resuming a session
+uint32_t ModbusServerTLS::getResumed() {
+  LOCK_GUARD(cntLock, m);
+  return resumed;
+}
+
+// serve: loop function for server thread
+void *ModbusServerTLS::serve(void *p) {
+  ModbusServerTLS *myself = (ModbusServerTLS *)p;
+  // OpenSSL writes with write() - a client gone must not raise SIGPIPE
+  sigset_t pipeSet;
+  sigemptyset(&pipeSet);
+  sigaddset(&pipeSet, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &pipeSet, nullptr);
+  // stop() shall not catch the thread within OpenSSL - allow it in poll() only
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, nullptr);
+
+  std::vector<pollfd> pfds;
+  std::vector<Connection *>& connections = myself->connections;
+  while (1) {
+    // Listen for new connections only while there is room for them
+    pfds.clear();
+    pfds.push_back({ connections.size() < myself->maxClients ? myself->serverSocket : -1, POLLIN, 0 });
+    for (auto c : connections) pfds.push_back({ c->fd, (short)(c->wantWrite ? POLLOUT : POLLIN), 0 });
+    // Wake up now and then to check for idle connections
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, nullptr);
+    poll(pfds.data(), pfds.size(), connections.empty() ? -1 : 100);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, nullptr);
+
+    unsigned long now = millis();
+    for (uint16_t i = 1; i < pfds.size(); ++i) {
+      Connection *c = connections[i - 1];
+      bool keep = true;
+      if (pfds[i].revents) {
+        c->wantWrite = false;
+        if (c->established) {
+          keep = myself->readConnection(*c);
+        } else {
+          // Requests may follow the handshake right away
+          keep = myself->handshake(*c) && (!c->established || myself->readConnection(*c));
+        }
+      } else if (myself->serverTimeout && now - c->lastMessage >= myself->serverTimeout) {
+        // Idle for too long
+        LOG_D("Connection closed due to timeout.\n");
+        keep = false;
+      }
+      if (!keep) {
+        myself->closeConnection(*c);
+        c->fd = -1;
+      }
+    }
+    // Remove the closed connections
+    for (auto it = connections.begin(); it != connections.end(); ) {
+      if ((*it)->fd < 0) {
+        delete *it;
+        it = connections.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    // New connection?
+    if (pfds[0].revents & POLLIN) {
+      int fd = accept4(myself->serverSocket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd >= 0) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        Connection *c = new Connection;
+        c->fd = fd;
+        c->ssl = SSL_new(myself->ctx);
+        SSL_set_fd(c->ssl, fd);
+        c->established = false;
+        c->wantWrite = false;
+        c->rxLen = 0;
+        c->lastMessage = millis();
+        connections.push_back(c);
+        LOG_D("Accepted connection - %d clients running\n", (int)connections.size());
+      }
+    }
+  }
+  return nullptr;
+}
+
+// handshake: continue the TLS handshake
+bool ModbusServerTLS::handshake(Connection& c) {
+  int rc = SSL_accept(c.ssl);
+  if (rc == 1) {
+    c.established = true;
+    bool wasResumed = (SSL_session_reused(c.ssl) == 1);
+    {
+      LOCK_GUARD(cntLock, m);
+      handshakes++;
+      if (wasResumed) resumed++;
+    }
+    LOG_D("%s connection, %s\n", SSL_get_version(c.ssl), wasResumed ? "session resumed" : "full handshake");
+    return true;
+  }
+  switch (SSL_get_error(c.ssl, rc)) {
+  case SSL_ERROR_WANT_READ:
+    return true;
+  case SSL_ERROR_WANT_WRITE:
+    c.wantWrite = true;
+    return true;
+  default:
+    {
+      char ebuf[256];
+      ERR_error_string_n(ERR_get_error(), ebuf, sizeof(ebuf));
+      LOG_D("TLS handshake failed: %s\n", ebuf);
+    }
+    break;
+  }
+  ERR_clear_error();
+  return false;
+}
+
+// readConnection: read from a connection and answer the complete requests
+bool ModbusServerTLS::readConnection(Connection& c) {
+  uint8_t response[260];
+  // OpenSSL may hold data poll() does not know of - read until there is nothing left
+  while (1) {
+    int got = SSL_read(c.ssl, c.rx + c.rxLen, sizeof(c.rx) - c.rxLen);
+    if (got <= 0) {
+      switch (SSL_get_error(c.ssl, got)) {
+      case SSL_ERROR_WANT_READ:
+        return true;
+      case SSL_ERROR_WANT_WRITE:
+        c.wantWrite = true;
+        return true;
+      case SSL_ERROR_ZERO_RETURN:
+        LOG_D("Connection closed by client.\n");
+        break;
+      default:
+        LOG_D("Connection lost.\n");
+        break;
+      }
+      ERR_clear_error();
+      return false;
+    }
+    c.rxLen += got;
+
+    // Cut the stream into frames and answer each one
+    uint16_t used = 0;
+    while (c.rxLen - used >= 6) {
+      uint16_t len = (c.rx[used + 4] << 8) | c.rx[used + 5];
+      // Server ID and function code at least, and no more than a Modbus frame may hold
+      if (len < 2 || len > 254) {
+        // The stream is out of sync, there is no way to find the next frame
+        HEXDUMP_V("Invalid data", c.rx + used, c.rxLen - used);
+        LOG_D("Invalid frame length %d, connection closed.\n", len);
+        return false;
+      }
+      if (c.rxLen - used < len + 6) break;
+      c.lastMessage = millis();
+      uint16_t rlen = process(c.rx + used, len + 6, response);
+      used += len + 6;
+      if (rlen && !sslWrite(c, response, rlen)) return false;
+    }
+    if (used) {
+      memmove(c.rx, c.rx + used, c.rxLen - used);
+      c.rxLen -= used;
+    }
+  }
+}
+
+// sslWrite: send a response, waiting a while for a busy connection
+bool ModbusServerTLS::sslWrite(Connection& c, const uint8_t *buf, uint16_t len) {
+  unsigned long startTime = millis();
+  while (1) {
+    int rc = SSL_write(c.ssl, buf, len);
+    if (rc > 0) return true;
+    int err = SSL_get_error(c.ssl, rc);
+    if ((err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) || millis() - startTime >= TLS_WRITETIMEOUT) {
+      LOG_D("TLS send failed.\n");
+      ERR_clear_error();
+      return false;
+    }
+    pollfd pfd = { c.fd, (short)(err == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT), 0 };
+    poll(&pfd, 1, TLS_WRITETIMEOUT);
+  }
+}
+
+// closeConnection: end the TLS session and close the socket
+void ModbusServerTLS::closeConnection(Connection& c) {
+  if (c.ssl) {
+    // Say goodbye without waiting for the answer
+    if (c.established) SSL_shutdown(c.ssl);
+    ERR_clear_error();
+    SSL_free(c.ssl);
+    c.ssl = nullptr;
+  }
+  if (c.fd >= 0) close(c.fd);
+}
+
+// process: handle one request frame
+uint16_t ModbusServerTLS::process(const uint8_t *frame, uint16_t len, uint8_t *buffer) {
+  ModbusMessage response;               // Data buffer to hold prepared response
+
+  HEXDUMP_V("Request", frame, len);
+  {
+    LOCK_GUARD(cntLock, m);
+    messageCount++;
+  }
+  // Extract request data
+  ModbusMessage request;
+  request.add(frame + 6, len - 6);
+
+  // Protocol ID shall be 0x0000 - is it?
+  if (frame[2] == 0 && frame[3] == 0) {
+    // ServerID shall be at [6], FC at [7]. Check both
+    if (isServerFor(request.getServerID())) {
+      // Server is correct - in principle. Do we serve the FC?
+      MBSworker callBack = getWorker(request.getServerID(), request.getFunctionCode());
+      if (callBack) {
+        // Yes, we do. Is the request well-formed?
+        ModbusMessage data;
+        Error e = PDUutils::checkRequest(request);
+        if (e == SUCCESS) {
+          // Yes. Invoke the worker method to get a response
+          data = callBack(request);
+        } else {
+          // No. Respond with the error
+          data.setError(request.getServerID(), request.getFunctionCode(), e);
+        }
+        // Process Response
+        // One of the predefined types?
+        if (data[0] == 0xFF && (data[1] == 0xF0 || data[1] == 0xF1)) {
+          // Yes. Check it
+          switch (data[1]) {
+          case 0xF0: // NIL
+            response.clear();
+            LOG_D("NIL response\n");
+            break;
+          case 0xF1: // ECHO
+            response = std::move(request);
+            if (response.getFunctionCode() == WRITE_MULT_REGISTERS ||
+                response.getFunctionCode() == WRITE_MULT_COILS) {
+              response.resize(6);
+            }
+            LOG_D("ECHO response\n");
+            break;
+          default:   // Will not get here!
+            break;
+          }
+        } else {
+          // No. User provided data response
+          response = std::move(data);
+          LOG_D("Data response\n");
+        }
+      } else {
+        // No, function code is not served here
+        response.setError(request.getServerID(), request.getFunctionCode(), ILLEGAL_FUNCTION);
+      }
+    } else {
+      // No, serverID is not served here
+      response.setError(request.getServerID(), request.getFunctionCode(), INVALID_SERVER);
+    }
+  } else {
+    // No, protocol ID was something weird
+    response.setError(request.getServerID(), request.getFunctionCode(), TCP_HEAD_MISMATCH);
+  }
+
+  // Do we have a response to send?
+  if (response.size() < 3) return 0;
+  if (response.size() > 254) {
+    LOG_E("Response too long for a Modbus TCP frame: %d bytes\n", response.size());
+    return 0;
+  }
+  // Keep transaction and protocol ID, then update the length
+  memcpy(buffer, frame, 4);
+  buffer[4] = (response.size() >> 8) & 0xFF;
+  buffer[5] = response.size() & 0xFF;
+  memcpy(buffer + 6, response.data(), response.size());
+  HEXDUMP_V("Response", buffer, response.size() + 6);
+  // count error responses
+  if (response.getError() != SUCCESS) {
+    LOCK_GUARD(cntLock, m);
+    errorCount++;
+  }
+  return response.size() + 6;
+}
+
+#endif  // IS_LINUX
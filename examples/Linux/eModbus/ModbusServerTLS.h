@@ -0,0 +1,104 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _MODBUS_SERVER_TLS_H
+#define _MODBUS_SERVER_TLS_H
+
+#include "options.h"
+
+#if IS_LINUX
+#include <pthread.h>
+#include <vector>
+#include <openssl/ssl.h>
+#include "ModbusServer.h"
+
+#define MODBUS_TLS_PORT 802       // Registered port of Modbus/TCP Security
+
+// ModbusServerTLS: Modbus/TCP Security server - Modbus TCP frames over TLS connections, answered by the
+// registered worker functions as with any ModbusServer. The server certificate and key are set with
+// setCertificate(), PEM encoded. setClientCA() lets only clients with a certificate signed by that CA
+// connect, as Modbus/TCP Security requires; the role given in a client certificate is not evaluated.
+// TLS 1.2 is the minimum, TLS 1.3 is preferred. Session tickets are issued, so clients may resume their
+// session on the next connect without the full handshake. Connections are kept open until the client
+// closes them or they were idle for the timeout given to start().
+// A single thread serves all connections. Linux only, needs OpenSSL (link with -lssl -lcrypto).
+class ModbusServerTLS : public ModbusServer {
+public:
+  ModbusServerTLS();
+
+  // Destructor: stops the server
+  ~ModbusServerTLS();
+
+  // setCertificate: server certificate, followed by its chain if any, and its private key
+  bool setCertificate(const char *cert, const char *privateKey);
+
+  // setClientCA: require client certificates signed by this CA
+  bool setClientCA(const char *rootCA);
+
+  // start: open the socket on the given port and start the server thread. Port 0 will take any free port,
+  // see getPort(). Up to maxClients connections are served, each closed after timeout ms without a
+  // request (0: never). coreID >= 0 will pin the thread to that CPU.
+  bool start(uint16_t port = MODBUS_TLS_PORT, uint8_t maxClients = 4, uint32_t timeout = 20000, int coreID = -1);
+
+  // stop: kill the server thread and close all connections
+  bool stop();
+
+  // getPort: port the server is listening on, 0 if not started
+  uint16_t getPort();
+
+  // getHandshakes, getResumed: number of handshakes done, and how many of them resumed a session
+  uint32_t getHandshakes();
+  uint32_t getResumed();
+
+protected:
+  // Prevent copy construction and assignment
+  ModbusServerTLS(ModbusServerTLS& m) = delete;
+  ModbusServerTLS& operator=(ModbusServerTLS& m) = delete;
+
+  inline void isInstance() { }
+
+  // A TLS connection and its data not processed yet
+  struct Connection {
+    int fd;
+    SSL *ssl;
+    bool established;             // Handshake is done
+    bool wantWrite;               // OpenSSL waits for the socket to become writable
+    uint16_t rxLen;
+    unsigned long lastMessage;    // millis() of the last request, or of the connect
+    uint8_t rx[512];
+  };
+
+  // serve: loop function for server thread
+  static void *serve(void *p);
+
+  // handshake: continue the TLS handshake. Returns false if it failed
+  bool handshake(Connection& c);
+
+  // readConnection: read from a connection and answer the complete requests. Returns false if it was closed
+  bool readConnection(Connection& c);
+
+  // sslWrite: send a response. Returns false if the connection is unusable
+  bool sslWrite(Connection& c, const uint8_t *buf, uint16_t len);
+
+  // closeConnection: end the TLS session and close the socket
+  void closeConnection(Connection& c);
+
+  // process: handle one request frame. Returns the length of the response frame to send, 0 for none
+  uint16_t process(const uint8_t *frame, uint16_t len, uint8_t *buffer);
+
+  SSL_CTX *ctx;                   // Settings and credentials for all connections
+  int serverSocket;               // Listening socket, -1 if not started
+  uint16_t serverPort;            // Port listened on
+  uint8_t maxClients;             // Connections served at most
+  uint32_t serverTimeout;         // Idle time in ms before a connection is closed
+  uint32_t handshakes;            // Handshakes done
+  uint32_t resumed;               // Handshakes resuming a session
+  std::vector<Connection *> connections;   // Open connections, server thread only
+  pthread_t serverThread;         // Thread reading and answering requests
+  bool running;                   // true while the thread exists
+};
+
+#endif  // IS_LINUX
+
+#endif  // INCLUDE GUARD
@@ -0,0 +1,385 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#include "options.h"
+
+#if IS_LINUX
+#include "TLSClient.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+
+#undef LOCAL_LOG_LEVEL
+// #define LOCAL_LOG_LEVEL LOG_LEVEL_VERBOSE
+#include "Logging.h"
+
+// OpenSSL writes to the socket with write(), not with send(..., MSG_NOSIGNAL) as Client does.
+// SigPipeBlock keeps SIGPIPE blocked for the calling thread while it is in scope, and swallows
+// the signal a write to a closed connection has raised.
+struct SigPipeBlock {
+  sigset_t pipeSet;
+  sigset_t oldSet;
+  SigPipeBlock() {
+    sigemptyset(&pipeSet);
+    sigaddset(&pipeSet, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeSet, &oldSet);
+  }
+  ~SigPipeBlock() {
+    // Was it us who blocked it, and was there a broken pipe? Then take the pending signal
+    if (!sigismember(&oldSet, SIGPIPE)) {
+      sigset_t pending;
+      sigpending(&pending);
+      if (sigismember(&pending, SIGPIPE)) {
+        struct timespec zero = { 0, 0 };
+        sigtimedwait(&pipeSet, nullptr, &zero);
+      }
+    }
+    pthread_sigmask(SIG_SETMASK, &oldSet, nullptr);
+  }
+};
+
+// Constructor: set up the context for all connections
+TLSClient::TLSClient() :
+  Client(),
+  ssl(nullptr),
+  verify(true),
+  resume(true),
+  reused(false),
+  closed(true),
+  sessionKey(0) {
+  ctx = SSL_CTX_new(TLS_client_method());
+  // Modbus/TCP Security requires TLS 1.2 at least
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+  // Sessions are kept by us, per IP and port - OpenSSL will only hand them over
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(ctx, &newSession);
+}
+
+// Destructor: close the connection and release all OpenSSL objects
+TLSClient::~TLSClient() {
+  stop();
+  clearSessions();
+  SSL_CTX_free(ctx);
+}
+
+// setCACert: add the certificate(s) to check the server's certificate against
+bool TLSClient::setCACert(const char *rootCA) {
+  BIO *bio = BIO_new_mem_buf(rootCA, -1);
+  X509_STORE *store = SSL_CTX_get_cert_store(ctx);
+  X509 *cert;
+  int count = 0;
+  while ((cert = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr)) != nullptr) {
+    if (X509_STORE_add_cert(store, cert)) count++;
+    X509_free(cert);
+  }
+  BIO_free(bio);
+  // The end of the data is reported as an error as well
+  ERR_clear_error();
+  if (!count) {
+    LOG_E("No usable CA certificate\n");
+    return false;
+  }
+  verify = true;
+  SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+  // Sessions of servers verified otherwise may not be trusted any more
+  clearSessions();
+  return true;
+}
+
+// setCertificate: certificate to present to the server, followed by its chain, if any
+bool TLSClient::setCertificate(const char *clientCert) {
+  BIO *bio = BIO_new_mem_buf(clientCert, -1);
+  X509 *cert = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr);
+  bool ok = (cert != nullptr && SSL_CTX_use_certificate(ctx, cert) == 1);
+  X509_free(cert);
+  // Any more certificates are the chain
+  if (ok) {
+    SSL_CTX_clear_chain_certs(ctx);
+    while ((cert = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr)) != nullptr) {
+      SSL_CTX_add0_chain_cert(ctx, cert);
+    }
+  }
+  BIO_free(bio);
+  ERR_clear_error();
+  if (!ok) LOG_E("No usable client certificate\n");
+  clearSessions();
+  return ok;
+}
+
+// setPrivateKey: key of the client certificate
+bool TLSClient::setPrivateKey(const char *privateKey) {
+  BIO *bio = BIO_new_mem_buf(privateKey, -1);
+  EVP_PKEY *key = PEM_read_bio_PrivateKey(bio, nullptr, nullptr, nullptr);
+  bool ok = (key != nullptr && SSL_CTX_use_PrivateKey(ctx, key) == 1);
+  EVP_PKEY_free(key);
+  BIO_free(bio);
+  ERR_clear_error();
+  if (!ok) LOG_E("No usable private key\n");
+  clearSessions();
+  return ok;
+}
+
+// setInsecure: do not verify the server certificate
+void TLSClient::setInsecure() {
+  verify = false;
+  SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, nullptr);
+}
+
+// setSessionResumption: keep sessions and resume them, or not
+void TLSClient::setSessionResumption(bool on) {
+  resume = on;
+  if (!on) clearSessions();
+}
+
+// clearSessions: forget all sessions kept
+void TLSClient::clearSessions() {
+  LOCK_GUARD(lock, sessionLock);
+  for (auto& s : sessions) SSL_SESSION_free(s.second);
+  sessions.clear();
+}
+
+// newSession: keep a session for the IP and port of the connection it was made on
+int TLSClient::newSession(SSL *ssl, SSL_SESSION *session) {
+  TLSClient *myself = (TLSClient *)SSL_get_app_data(ssl);
+  if (!myself || !myself->resume || !SSL_SESSION_is_resumable(session)) return 0;
+  LOCK_GUARD(lock, myself->sessionLock);
+  auto it = myself->sessions.find(myself->sessionKey);
+  if (it != myself->sessions.end()) {
+    // TLS 1.3 will send new tickets on every connection - the latest one is taken
+    SSL_SESSION_free(it->second);
+    it->second = session;
+  } else {
+    // Cache full? Start over
+    if (myself->sessions.size() >= SESSIONCACHESIZE) {
+      for (auto& s : myself->sessions) SSL_SESSION_free(s.second);
+      myself->sessions.clear();
+    }
+    myself->sessions[myself->sessionKey] = session;
+  }
+  LOG_D("Session kept\n");
+  // We hold the reference now
+  return 1;
+}
+
+// connect with IP/port: establish a connection, waiting the default timeout at most
+int TLSClient::connect(IPAddress ip, uint16_t p) {
+  return connect(ip, p, connectTimeout);
+}
+
+// connect with IP/port/timeout: connect and do the TLS handshake, waiting timeout ms at most for both
+int TLSClient::connect(IPAddress ip, uint16_t p, int32_t timeout) {
+  if (connected()) disconnect();
+  uint32_t startTime = millis();
+  int rc = Client::connect(ip, p, timeout);
+  if (rc < 0) return rc;
+
+  // The socket stays non-blocking - SSL_read() shall not wait for the rest of a record
+  int flags = ::fcntl(sockfd, F_GETFL, 0);
+  ::fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
+  // Handshake flights are written in pieces - Nagle would hold back all but the first
+  setNoDelay(true);
+
+  ssl = SSL_new(ctx);
+  SSL_set_fd(ssl, sockfd);
+  SSL_set_app_data(ssl, this);
+  closed = false;
+  reused = false;
+  sessionKey = ((uint64_t)uint32_t(ip) << 16) | p;
+
+  // Check the certificate against the host name, or the IP address if we have none
+  char buf[16];
+  snprintf(buf, 16, "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+  if (verify) {
+    if (peerName.empty()) {
+      X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), buf);
+    } else {
+      SSL_set1_host(ssl, peerName.c_str());
+    }
+  }
+  if (!peerName.empty()) SSL_set_tlsext_host_name(ssl, peerName.c_str());
+
+  // Do we have a session to resume?
+  if (resume) {
+    LOCK_GUARD(lock, sessionLock);
+    auto it = sessions.find(sessionKey);
+    if (it != sessions.end()) SSL_set_session(ssl, it->second);
+  }
+
+  // Do the handshake
+  ERR_clear_error();
+  while ((rc = SSL_connect(ssl)) != 1) {
+    int err = SSL_get_error(ssl, rc);
+    int32_t remaining = timeout - (int32_t)(millis() - startTime);
+    if ((err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) || remaining <= 0) {
+      // Failed or timed out. Tell why and drop the connection
+      long vr = SSL_get_verify_result(ssl);
+      if (vr != X509_V_OK) {
+        LOG_E("TLS handshake with %s:%d failed: %s\n", buf, p, X509_verify_cert_error_string(vr));
+      } else {
+        char ebuf[256];
+        ERR_error_string_n(ERR_get_error(), ebuf, sizeof(ebuf));
+        LOG_E("TLS handshake with %s:%d failed: %s\n", buf, p, remaining <= 0 ? "timeout" : ebuf);
+      }
+      ERR_clear_error();
+      SSL_free(ssl);
+      ssl = nullptr;
+      closed = true;
+      Client::disconnect();
+      return -1;
+    }
+    struct pollfd pfd;
+    pfd.fd = sockfd;
+    pfd.events = (err == SSL_ERROR_WANT_READ) ? POLLIN : POLLOUT;
+    ::poll(&pfd, 1, remaining);
+  }
+  reused = (SSL_session_reused(ssl) == 1);
+  LOG_D("%s connected, %s\n", SSL_get_version(ssl), reused ? "session resumed" : "full handshake");
+  return 0;
+}
+
+// connect with hostname/port: try to find and connect to host
+int TLSClient::connect(const char *hostname, uint16_t p) {
+  return connect(hostname, p, connectTimeout);
+}
+
+// connect with hostname/port/timeout: the certificate will be checked against the host name
+int TLSClient::connect(const char *hostname, uint16_t p, int32_t timeout) {
+  IPAddress myHost = hostname_to_ip(hostname);
+  if (myHost == NIL_ADDR) {
+    LOG_E("No such host '%s'\n", hostname);
+    return -1;
+  }
+  peerName = hostname;
+  int rc = connect(myHost, p, timeout);
+  peerName.clear();
+  return rc;
+}
+
+// disconnect: end the TLS session and close the connection
+bool TLSClient::disconnect() {
+  if (ssl) {
+    if (!closed) {
+      // Take in what has arrived - TLS 1.3 session tickets may be among it
+      uint8_t buf[256];
+      while (SSL_read(ssl, buf, sizeof(buf)) > 0) {}
+      // Say goodbye without waiting for the answer. This will keep the session resumable
+      SigPipeBlock noSignal;
+      SSL_shutdown(ssl);
+    }
+    ERR_clear_error();
+    SSL_free(ssl);
+    ssl = nullptr;
+  }
+  closed = true;
+  return Client::disconnect();
+}
+
+// sslFailed: check the result of an SSL call
+bool TLSClient::sslFailed(int rc, const char *what) {
+  int err = SSL_get_error(ssl, rc);
+  switch (err) {
+  case SSL_ERROR_WANT_READ:
+  case SSL_ERROR_WANT_WRITE:
+    // Nothing there, or socket busy - try again later
+    return false;
+  case SSL_ERROR_ZERO_RETURN:
+    LOG_D("Connection closed by server\n");
+    break;
+  default:
+    {
+      char ebuf[256];
+      ERR_error_string_n(ERR_get_error(), ebuf, sizeof(ebuf));
+      LOG_E("TLS %s failed: %s (errno %d)\n", what, ebuf, errno);
+    }
+    break;
+  }
+  ERR_clear_error();
+  closed = true;
+  return true;
+}
+
+// fill: refill an empty receive buffer with the decrypted data of one SSL_read()
+int TLSClient::fill() {
+  if (rxHead < rxTail) return rxTail - rxHead;
+  rxHead = rxTail = 0;
+  if (!ssl || closed) return 0;
+  int r = SSL_read(ssl, rxBuffer, RXBUFSIZE);
+  if (r > 0) {
+    rxTail = r;
+    return r;
+  }
+  sslFailed(r, "read");
+  return 0;
+}
+
+// read: get a buffer full of data
+int TLSClient::read(uint8_t *buf, size_t size) {
+// Serve buffered data first
+  if (rxHead < rxTail) {
+    size_t len = rxTail - rxHead;
+    if (len > size) len = size;
+    memcpy(buf, rxBuffer + rxHead, len);
+    rxHead += len;
+    return len;
+  }
+  if (!ssl || closed) return 0;
+// Nothing buffered - decrypt directly into the caller's buffer
+  int r = SSL_read(ssl, buf, size);
+  if (r > 0) return r;
+  sslFailed(r, "read");
+  return 0;
+}
+
+// sslWrite: write all of buf as one record, waiting for the socket if need be
+size_t TLSClient::sslWrite(const uint8_t *buf, size_t size) {
+  if (!ssl || closed || !size) return 0;
+  uint32_t startTime = millis();
+  SigPipeBlock noSignal;
+  while (1) {
+    int rc = SSL_write(ssl, buf, size);
+    if (rc > 0) return rc;
+    if (sslFailed(rc, "write")) return 0;
+    int32_t remaining = connectTimeout - (int32_t)(millis() - startTime);
+    if (remaining <= 0) {
+      LOG_E("TLS write timed out\n");
+      return 0;
+    }
+    struct pollfd pfd;
+    pfd.fd = sockfd;
+    pfd.events = SSL_want_read(ssl) ? POLLIN : POLLOUT;
+    ::poll(&pfd, 1, remaining);
+  }
+}
+
+// write (single byte): send out 1 byte
+size_t TLSClient::write(uint8_t t) {
+  return sslWrite(&t, 1);
+}
+
+// write (buffer): send block of data
+size_t TLSClient::write(const uint8_t *buf, size_t size) {
+  return sslWrite(buf, size);
+}
+
+// write (segments): copy the segments together to send them in a single record
+size_t TLSClient::write(const ModbusSegments& segments) {
+  uint8_t buffer[6 + 256];
+  return sslWrite(buffer, segments.copyTo(buffer, sizeof(buffer)));
+}
+
+// connected: return state of the connection
+uint8_t TLSClient::connected() {
+  if (!ssl || closed) return 0;
+  // Buffered data means there was a connection
+  if (rxHead < rxTail) return 1;
+  // Try to read - this will notice a closed connection
+  fill();
+  return closed ? 0 : 1;
+}
+
+#endif // IS_LINUX
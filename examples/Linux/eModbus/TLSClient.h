@@ -0,0 +1,90 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _TLS_CLIENT_H
+#define _TLS_CLIENT_H
+#include "Client.h"
+
+#if IS_LINUX
+#include <map>
+#include <mutex>
+#include <string>
+#include <openssl/ssl.h>
+
+#define MODBUS_TLS_PORT 802       // Registered port of Modbus/TCP Security
+
+// TLSClient: a Client speaking TLS over its socket, for Modbus/TCP Security. Use it with a
+// ModbusClientTCP in place of a Client - with a target on port 802.
+// Credentials are given PEM encoded, as with the ESP32's WiFiClientSecure. The server certificate is
+// checked against the CA set with setCACert() and the IP or host name connected to, unless setInsecure()
+// was called. A client certificate and key, as required by Modbus/TCP Security, are set with
+// setCertificate() and setPrivateKey().
+// TLS 1.2 is the minimum, TLS 1.3 is preferred. The session of each host and port is kept after the
+// handshake and resumed on the next connect, skipping the certificate exchange and the signatures.
+// As ModbusClientTCP keeps its connection open as long as the target does not change, the handshake
+// cost will be paid rarely anyway. Linux only, needs OpenSSL (link with -lssl -lcrypto).
+class TLSClient : public Client {
+public:
+  TLSClient();
+  ~TLSClient();
+
+  // Credentials, PEM encoded. Return false if the data could not be used
+  bool setCACert(const char *rootCA);
+  bool setCertificate(const char *clientCert);
+  bool setPrivateKey(const char *privateKey);
+  // setInsecure: do not verify the server certificate at all - for tests only
+  void setInsecure();
+
+  // setSessionResumption: keep sessions and resume them on the next connect (default), or not
+  void setSessionResumption(bool on);
+  // clearSessions: forget all sessions kept
+  void clearSessions();
+  // sessionReused: true if the last handshake did resume a session
+  inline bool sessionReused() { return reused; }
+
+  int connect(IPAddress ip, uint16_t port);
+  int connect(IPAddress ip, uint16_t port, int32_t timeout);
+  int connect(const char *host, uint16_t port);
+  int connect(const char *host, uint16_t port, int32_t timeout);
+  bool disconnect();
+  size_t write(uint8_t t);
+  size_t write(const uint8_t *buf, size_t size);
+  size_t write(const ModbusSegments& segments);
+  int read(uint8_t *buf, size_t size);
+  uint8_t connected();
+
+protected:
+  // Prevent copy construction and assignment - SSL objects can not be shared
+  TLSClient(const TLSClient& t) = delete;
+  TLSClient& operator=(const TLSClient& t) = delete;
+
+  // Maximum number of sessions kept
+  static const uint16_t SESSIONCACHESIZE = 64;
+
+  // fill: refill an empty receive buffer with decrypted data
+  int fill();
+
+  // sslWrite: write all of buf, waiting for the socket if need be. Returns bytes written, 0 on error
+  size_t sslWrite(const uint8_t *buf, size_t size);
+
+  // sslFailed: check the result of an SSL call. Returns true if the connection is unusable
+  bool sslFailed(int rc, const char *what);
+
+  // newSession: OpenSSL callback for a new session to be kept
+  static int newSession(SSL *ssl, SSL_SESSION *session);
+
+  SSL_CTX *ctx;                   // Settings and credentials for all connections
+  SSL *ssl;                       // TLS state of the current connection, nullptr if none
+  bool verify;                    // Check the server certificate
+  bool resume;                    // Keep and resume sessions
+  bool reused;                    // Last handshake resumed a session
+  bool closed;                    // Connection was closed or failed
+  std::string peerName;           // Host name to verify, empty if connected by IP
+  uint64_t sessionKey;            // IP and port of the current connection
+  std::map<uint64_t, SSL_SESSION *> sessions;   // Sessions kept per IP and port
+  std::mutex sessionLock;         // Protect sessions
+};
+
+#endif // IS_LINUX
+#endif // _TLS_CLIENT_H
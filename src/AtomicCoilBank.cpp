@@ -0,0 +1,257 @@
+// =================================================================================================
+// eModbus: Copyright 2020, 2021 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#include "AtomicCoilBank.h"
+#include "CoilBits.h"
+#include "PDUutils.h"
+#undef LOCAL_LOG_LEVEL
+#include "Logging.h"
+
+// All atomic operations use the default sequentially consistent ordering. Each write is then
+// ordered between its "started" and "finished" increments for every reader, which is what
+// the snapshot check relies on.
+// As the counters only grow, and no stripe can have more writes finished than started, a reader
+// may compare the sums over all stripes of a range instead of each stripe's counters.
+
+// Constructor: size in coils (max. 65536), initial value for all coils
+AtomicCoilBank::AtomicCoilBank(uint32_t size, bool initValue) :
+  ABwords(nullptr),
+  ABsize(size > 65536 ? 65536 : size),
+  ABwordCount(0),
+  ABstarted(nullptr),
+  ABfinished(nullptr) {
+  ABwordCount = (ABsize + 31) >> 5;
+  if (ABwordCount) {
+    ABwords = new std::atomic<uint32_t>[ABwordCount];
+    for (uint32_t i = 0; i < ABwordCount; ++i) {
+      ABwords[i] = 0;
+    }
+    uint32_t stripes = (ABsize + STRIPE - 1) / STRIPE;
+    ABstarted = new std::atomic<uint32_t>[stripes];
+    ABfinished = new std::atomic<uint32_t>[stripes];
+    for (uint32_t i = 0; i < stripes; ++i) {
+      ABstarted[i] = 0;
+      ABfinished[i] = 0;
+    }
+  }
+  init(initValue);
+}
+
+// Destructor
+AtomicCoilBank::~AtomicCoilBank() {
+  if (ABwords) {
+    delete[] ABwords;
+    delete[] ABstarted;
+    delete[] ABfinished;
+  }
+}
+
+// begin: count a write to coils first..last as started
+void AtomicCoilBank::begin(uint32_t first, uint32_t last) {
+  for (uint32_t i = first / STRIPE; i <= last / STRIPE; ++i) ABstarted[i]++;
+}
+
+// end: count a write to coils first..last as finished
+void AtomicCoilBank::end(uint32_t first, uint32_t last) {
+  for (uint32_t i = first / STRIPE; i <= last / STRIPE; ++i) ABfinished[i]++;
+}
+
+// sumStarted: writes started in the stripes of coils first..last
+uint32_t AtomicCoilBank::sumStarted(uint32_t first, uint32_t last) const {
+  uint32_t sum = 0;
+  for (uint32_t i = first / STRIPE; i <= last / STRIPE; ++i) sum += ABstarted[i].load();
+  return sum;
+}
+
+// sumFinished: writes finished in the stripes of coils first..last
+uint32_t AtomicCoilBank::sumFinished(uint32_t first, uint32_t last) const {
+  uint32_t sum = 0;
+  for (uint32_t i = first / STRIPE; i <= last / STRIPE; ++i) sum += ABfinished[i].load();
+  return sum;
+}
+
+// operator[]: value of a single coil
+bool AtomicCoilBank::operator[](uint32_t index) const {
+  if (index < ABsize) {
+    return (ABwords[index >> 5].load() >> (index & 31)) & 1;
+  }
+  // Wrong parameter -> always return false
+  return false;
+}
+
+// set: set or clear a single coil
+bool AtomicCoilBank::set(uint32_t index, bool value) {
+  if (index < ABsize) {
+    uint32_t mask = (uint32_t)1 << (index & 31);
+    begin(index, index);
+    if (value) {
+      ABwords[index >> 5].fetch_or(mask);
+    } else {
+      ABwords[index >> 5].fetch_and(~mask);
+    }
+    end(index, index);
+    return true;
+  }
+  return false;
+}
+
+// toggle: invert a single coil
+bool AtomicCoilBank::toggle(uint32_t index) {
+  if (index < ABsize) {
+    begin(index, index);
+    ABwords[index >> 5].fetch_xor((uint32_t)1 << (index & 31));
+    end(index, index);
+    return true;
+  }
+  return false;
+}
+
+// update: replace the bits of mask in a word by those of value
+void AtomicCoilBank::update(uint32_t word, uint32_t mask, uint32_t value) {
+  uint32_t expected = ABwords[word].load();
+  // Other bits of the word may be changed concurrently - retry until our change is based on the current value
+  while (!ABwords[word].compare_exchange_weak(expected, (expected & ~mask) | (value & mask))) { }
+}
+
+// set: alter a group of coils from a packed bit buffer
+bool AtomicCoilBank::set(uint32_t start, uint32_t length, const uint8_t *newValue) {
+  if (length && start < ABsize && length <= ABsize - start) {
+    begin(start, start + length - 1);
+    // Take the source in chunks of 32 bits and merge them into one or two words each
+    for (uint32_t i = 0; i < length; i += 32) {
+      uint8_t n = (length - i < 32) ? length - i : 32;
+      uint32_t v = CoilBits::get(newValue, i, n);
+      uint32_t pos = start + i;
+      uint8_t shift = pos & 31;
+      uint64_t mask = CoilBits::lowMask(n) << shift;
+      uint64_t value = (uint64_t)v << shift;
+      update(pos >> 5, (uint32_t)mask, (uint32_t)value);
+      if (mask >> 32) {
+        update((pos >> 5) + 1, (uint32_t)(mask >> 32), (uint32_t)(value >> 32));
+      }
+    }
+    end(start, start + length - 1);
+    return true;
+  }
+  return false;
+}
+
+// init: set all coils to 1 or 0
+void AtomicCoilBank::init(bool value) {
+  if (ABsize) {
+    begin(0, ABsize - 1);
+    for (uint32_t i = 0; i < ABwordCount; ++i) {
+      ABwords[i] = value ? 0xFFFFFFFF : 0;
+    }
+    // Keep the bits beyond the last coil at 0
+    if (ABsize & 31) {
+      ABwords[ABwordCount - 1] &= (uint32_t)CoilBits::lowMask(ABsize & 31);
+    }
+    end(0, ABsize - 1);
+  }
+}
+
+// bits: n (<= 32) coils starting at pos
+uint32_t AtomicCoilBank::bits(uint32_t pos, uint8_t n) const {
+  uint8_t shift = pos & 31;
+  uint64_t w = ABwords[pos >> 5].load() >> shift;
+  // Does the range extend into the next word?
+  if (shift + n > 32) {
+    w |= (uint64_t)ABwords[(pos >> 5) + 1].load() << (32 - shift);
+  }
+  return (uint32_t)(w & CoilBits::lowMask(n));
+}
+
+// snapshot: copy a consistent image of a coil range
+bool AtomicCoilBank::snapshot(uint32_t start, uint32_t length, uint8_t *buffer, uint16_t maxTries) const {
+  if (!length || start >= ABsize || length > ABsize - start) return false;
+
+  for (uint16_t t = 0; t < maxTries; ++t) {
+    // finished first: if started is equal afterwards, no write was in progress
+    uint32_t finished = sumFinished(start, start + length - 1);
+    uint32_t started = sumStarted(start, start + length - 1);
+    if (started != finished) continue;
+
+    // Copy the range, 32 coils at a time
+    for (uint32_t i = 0; i < length; i += 32) {
+      uint8_t n = (length - i < 32) ? length - i : 32;
+      uint32_t v = bits(start + i, n);
+      uint8_t bytes = (n + 7) >> 3;
+      for (uint8_t b = 0; b < bytes; ++b) {
+        buffer[(i >> 3) + b] = (v >> (b * 8)) & 0xFF;
+      }
+    }
+
+    // Accept the copy only if no write has started meanwhile
+    if (sumStarted(start, start + length - 1) == started) return true;
+  }
+  LOG_D("No consistent coil snapshot after %u tries\n", maxTries);
+  return false;
+}
+
+// slice: consistent snapshot as a CoilData object
+CoilData AtomicCoilBank::slice(uint32_t start, uint32_t length) const {
+  CoilData retval;
+  if (length && length <= 2000) {
+    CoilData c(length);
+    if (snapshot(start, length, c.data())) {
+      retval = std::move(c);
+    }
+  }
+  return retval;
+}
+
+// serve: answer a coil request from the bank
+ModbusMessage AtomicCoilBank::serve(const ModbusMessage& request) {
+  ModbusMessage response;
+  uint16_t start = 0;
+  uint16_t count = 0;
+
+  // Reject malformed requests
+  Error e = PDUutils::checkRequest(request);
+  if (e != SUCCESS) {
+    response.setError(request.getServerID(), request.getFunctionCode(), e);
+    return response;
+  }
+
+  switch (request.getFunctionCode()) {
+  case READ_COIL:
+  case READ_DISCR_INPUT:
+    {
+      request.get(2, start, count);
+      if (start + count > ABsize) break;
+      uint8_t bytes = (count + 7) >> 3;
+      uint8_t buffer[256];
+      if (!snapshot(start, count, buffer)) {
+        response.setError(request.getServerID(), request.getFunctionCode(), SERVER_DEVICE_BUSY);
+        return response;
+      }
+      response = ModbusMessage(3 + bytes);
+      response.add(request.getServerID(), request.getFunctionCode(), bytes);
+      response.add(buffer, bytes);
+      return response;
+    }
+  case WRITE_COIL:
+    {
+      request.get(2, start, count);
+      if (!set(start, count == 0xFF00)) break;
+      // Response is the echoed request
+      return request;
+    }
+  case WRITE_MULT_COILS:
+    {
+      request.get(2, start, count);
+      // Coil bits are taken right from the request PDU
+      if (!set(start, count, request.data() + 7)) break;
+      response.add(request.getServerID(), request.getFunctionCode(), start, count);
+      return response;
+    }
+  default:
+    response.setError(request.getServerID(), request.getFunctionCode(), ILLEGAL_FUNCTION);
+    return response;
+  }
+  // Coils were out of range
+  response.setError(request.getServerID(), request.getFunctionCode(), ILLEGAL_DATA_ADDRESS);
+  return response;
+}
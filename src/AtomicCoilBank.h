@@ -0,0 +1,90 @@
+// =================================================================================================
+// eModbus: Copyright 2020, 2021 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _ATOMIC_COIL_BANK_H
+#define _ATOMIC_COIL_BANK_H
+
+#include <atomic>
+#include <cstdint>
+#include "options.h"
+#include "ModbusMessage.h"
+#include "CoilData.h"
+
+// AtomicCoilBank: coil storage of up to 65536 coils, shared by application threads and server workers
+// without any locks.
+// Coils are held in 32-bit atomic words, so single coils are set, cleared and toggled by one atomic
+// operation each. Readers take consistent snapshots of coil ranges seqlock-style: every write is
+// bracketed by a "started" and a "finished" counter, and a snapshot is only accepted if no write was
+// in progress or has started while it was copied. Otherwise the copy is simply repeated.
+// The counters are kept per stripe of STRIPE coils, so writes elsewhere in the bank will not
+// disturb a snapshot. Writers never wait for readers, and readers never hold up writers.
+class AtomicCoilBank {
+public:
+  // Default number of snapshot attempts before giving up
+  static const uint16_t SNAPSHOT_TRIES = 100;
+  // Number of coils sharing a pair of write counters
+  static const uint32_t STRIPE = 512;
+
+  // Constructor: size in coils (max. 65536), initial value for all coils
+  explicit AtomicCoilBank(uint32_t size = 65536, bool initValue = false);
+
+  // Destructor
+  ~AtomicCoilBank();
+
+  // get size in coils
+  inline uint32_t coils() const { return ABsize; }
+
+  // operator[]: value of a single coil
+  bool operator[](uint32_t index) const;
+
+  // Single coil operations. Will return false if index is outside the bank
+  bool set(uint32_t index, bool value);
+  inline bool clear(uint32_t index) { return set(index, false); }
+  bool toggle(uint32_t index);
+
+  // set: alter a group of coils from a packed bit buffer, as found in a FC 0x0F request.
+  // Snapshots will see either none or all of the changes
+  bool set(uint32_t start, uint32_t length, const uint8_t *newValue);
+  inline bool set(uint32_t start, const CoilData& c) { return set(start, c.coils(), c.data()); }
+
+  // (Re-)init all coils to 1 or 0
+  void init(bool value = false);
+
+  // snapshot: copy a consistent image of coils start..start+length-1 leftmost into buffer,
+  // packed as in a FC 0x01 response. buffer must hold (length + 7) / 8 bytes.
+  // Returns false if the range is invalid or no consistent copy could be taken in maxTries attempts.
+  // That will happen if a writer was preempted in the middle of a write - try again later then.
+  bool snapshot(uint32_t start, uint32_t length, uint8_t *buffer, uint16_t maxTries = SNAPSHOT_TRIES) const;
+
+  // slice: consistent snapshot as a CoilData object (max. 2000 coils). Empty if no snapshot was taken
+  CoilData slice(uint32_t start, uint32_t length) const;
+
+  // serve: answer a FC 0x01, 0x02, 0x05 or 0x0F request from the bank.
+  // If writers keep the bank too busy for a consistent read, SERVER_DEVICE_BUSY is returned.
+  ModbusMessage serve(const ModbusMessage& request);
+
+protected:
+  // Prevent copy construction and assignment
+  AtomicCoilBank(const AtomicCoilBank& b) = delete;
+  AtomicCoilBank& operator=(const AtomicCoilBank& b) = delete;
+
+  // update: replace the bits of mask in a word by those of value
+  void update(uint32_t word, uint32_t mask, uint32_t value);
+  // bits: n (<= 32) coils starting at pos, not consistent by itself
+  uint32_t bits(uint32_t pos, uint8_t n) const;
+  // begin/end: bracket a write to coils first..last
+  void begin(uint32_t first, uint32_t last);
+  void end(uint32_t first, uint32_t last);
+  // sum of the started and finished counters of the stripes of coils first..last
+  uint32_t sumStarted(uint32_t first, uint32_t last) const;
+  uint32_t sumFinished(uint32_t first, uint32_t last) const;
+
+  std::atomic<uint32_t> *ABwords;       // Coil storage, coil n is bit (n & 31) of word (n >> 5)
+  uint32_t ABsize;                      // Number of coils
+  uint32_t ABwordCount;                 // Number of words
+  std::atomic<uint32_t> *ABstarted;     // Number of writes started, per stripe
+  std::atomic<uint32_t> *ABfinished;    // Number of writes finished, per stripe
+};
+
+#endif
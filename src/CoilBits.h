@@ -0,0 +1,245 @@
+// =================================================================================================
+// eModbus: Copyright 2020, 2021 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _COILBITS_H
+#define _COILBITS_H
+#include <stdint.h>
+#include <string.h>
+
+// CoilBits: word-parallel operations on Modbus bit buffers.
+// Coils are packed LSB first, coil n being bit (n & 7) of byte (n >> 3) - the layout of
+// FC 0x01/0x02/0x0F PDUs and CoilData. Bytes are combined into little-endian 64-bit words,
+// so that word bit n is coil n, whatever the byte order of the machine.
+// Ranges at arbitrary bit positions are moved in chunks of up to 56 bits, the most a
+// 64-bit word can hold when shifted into place. Only bytes within a range are touched.
+class CoilBits {
+public:
+  // CHUNK: bits moved at once for unaligned ranges
+  static const uint8_t CHUNK = 56;
+
+  // lowMask: word with the n lowest bits set
+  inline static uint64_t lowMask(uint8_t n) { return (n >= 64) ? ~(uint64_t)0 : (((uint64_t)1 << n) - 1); }
+
+  // load: little-endian word from n (<= 8) bytes
+  inline static uint64_t load(const uint8_t *p, uint8_t n) {
+    uint64_t w = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // Constant size for full words lets the compiler use a single load
+    if (n == 8) memcpy(&w, p, 8);
+    else        memcpy(&w, p, n);
+#else
+    for (uint8_t i = 0; i < n; ++i) w |= (uint64_t)p[i] << (i * 8);
+#endif
+    return w;
+  }
+
+  // store: n (<= 8) bytes of a little-endian word
+  inline static void store(uint8_t *p, uint8_t n, uint64_t w) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (n == 8) memcpy(p, &w, 8);
+    else        memcpy(p, &w, n);
+#else
+    for (uint8_t i = 0; i < n; ++i) p[i] = (w >> (i * 8)) & 0xFF;
+#endif
+  }
+
+  // popcount: number of 1 bits in a word
+  inline static uint8_t popcount(uint64_t w) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(w);
+#else
+    w = w - ((w >> 1) & 0x5555555555555555ULL);
+    w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+    w = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (w * 0x0101010101010101ULL) >> 56;
+#endif
+  }
+
+  // ctz: number of trailing 0 bits in a word, that must not be 0
+  inline static uint8_t ctz(uint64_t w) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(w);
+#else
+    uint8_t n = 0;
+    while (!(w & 1)) {
+      w >>= 1;
+      n++;
+    }
+    return n;
+#endif
+  }
+
+  // get: n (<= CHUNK) bits starting at bit pos
+  inline static uint64_t get(const uint8_t *buf, uint32_t pos, uint8_t n) {
+    uint8_t shift = pos & 7;
+    return (load(buf + (pos >> 3), (shift + n + 7) >> 3) >> shift) & lowMask(n);
+  }
+
+  // put: overwrite n (<= CHUNK) bits starting at bit pos with the low bits of v
+  inline static void put(uint8_t *buf, uint32_t pos, uint8_t n, uint64_t v) {
+    uint8_t shift = pos & 7;
+    uint8_t bytes = (shift + n + 7) >> 3;
+    uint64_t mask = lowMask(n) << shift;
+    uint8_t *p = buf + (pos >> 3);
+    store(p, bytes, (load(p, bytes) & ~mask) | ((v << shift) & mask));
+  }
+
+  // copy: copy len bits from src at spos to dst at dpos. The ranges must not overlap
+  static void copy(uint8_t *dst, uint32_t dpos, const uint8_t *src, uint32_t spos, uint32_t len) {
+    // Both byte aligned? Then whole bytes can be taken as they are
+    if (((dpos | spos) & 7) == 0) {
+      uint32_t bytes = len >> 3;
+      memcpy(dst + (dpos >> 3), src + (spos >> 3), bytes);
+      bytes <<= 3;
+      dpos += bytes;
+      spos += bytes;
+      len -= bytes;
+    }
+    // Shift-merge the rest in chunks
+    while (len) {
+      uint8_t n = (len < CHUNK) ? len : CHUNK;
+      put(dst, dpos, n, get(src, spos, n));
+      dpos += n;
+      spos += n;
+      len -= n;
+    }
+  }
+
+  // fill: set len bits starting at pos to value
+  static void fill(uint8_t *buf, uint32_t pos, uint32_t len, bool value) {
+    uint64_t v = value ? ~(uint64_t)0 : 0;
+    // Leading bits up to the next byte boundary
+    if (pos & 7) {
+      uint8_t n = 8 - (pos & 7);
+      if (n > len) n = len;
+      put(buf, pos, n, v);
+      pos += n;
+      len -= n;
+    }
+    // Whole bytes
+    memset(buf + (pos >> 3), value ? 0xFF : 0, len >> 3);
+    pos += len & ~7;
+    // Trailing bits
+    if (len & 7) put(buf, pos, len & 7, v);
+  }
+
+  // count: number of 1 bits in len bits starting at pos
+  static uint32_t count(const uint8_t *buf, uint32_t pos, uint32_t len) {
+    uint32_t cnt = 0;
+    // Byte aligned: whole words
+    if ((pos & 7) == 0) {
+      const uint8_t *p = buf + (pos >> 3);
+      for (; len >= 64; len -= 64, pos += 64, p += 8) {
+        cnt += popcount(load(p, 8));
+      }
+    }
+    while (len) {
+      uint8_t n = (len < CHUNK) ? len : CHUNK;
+      cnt += popcount(get(buf, pos, n));
+      pos += n;
+      len -= n;
+    }
+    return cnt;
+  }
+
+  // equal: compare len bits of a at apos with b at bpos
+  static bool equal(const uint8_t *a, uint32_t apos, const uint8_t *b, uint32_t bpos, uint32_t len) {
+    // Both byte aligned: whole words
+    if (((apos | bpos) & 7) == 0) {
+      const uint8_t *pa = a + (apos >> 3);
+      const uint8_t *pb = b + (bpos >> 3);
+      for (; len >= 64; len -= 64, apos += 64, bpos += 64, pa += 8, pb += 8) {
+        if (load(pa, 8) != load(pb, 8)) return false;
+      }
+    }
+    while (len) {
+      uint8_t n = (len < CHUNK) ? len : CHUNK;
+      if (get(a, apos, n) != get(b, bpos, n)) return false;
+      apos += n;
+      bpos += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  // exclusiveOr: dst = a ^ b for len bits, all buffers starting at bit 0.
+  // Bits beyond len in the last byte of dst are cleared - a or b may be longer than len.
+  static void exclusiveOr(uint8_t *dst, const uint8_t *a, const uint8_t *b, uint32_t len) {
+    uint32_t bytes = (len + 7) >> 3;
+    uint32_t i = 0;
+    for (; i + 8 <= bytes; i += 8) {
+      store(dst + i, 8, load(a + i, 8) ^ load(b + i, 8));
+    }
+    for (; i < bytes; ++i) {
+      dst[i] = a[i] ^ b[i];
+    }
+    if (len & 7) dst[bytes - 1] &= (1 << (len & 7)) - 1;
+  }
+
+  // forEachSet: call f(offset) for every 1 bit in len bits starting at pos, in ascending order.
+  // Only the 1 bits cost time beyond the word loop.
+  template <typename F>
+  static void forEachSet(const uint8_t *buf, uint32_t pos, uint32_t len, F f) {
+    uint32_t base = 0;
+    // Byte aligned: whole words
+    if ((pos & 7) == 0) {
+      for (; len - base >= 64; base += 64) {
+        uint64_t w = load(buf + ((pos + base) >> 3), 8);
+        while (w) {
+          f(base + ctz(w));
+          w &= w - 1;   // clear lowest 1 bit
+        }
+      }
+    }
+    for (; base < len; base += CHUNK) {
+      uint8_t n = (len - base < CHUNK) ? len - base : CHUNK;
+      uint64_t w = get(buf, pos + base, n);
+      while (w) {
+        f(base + ctz(w));
+        w &= w - 1;
+      }
+    }
+  }
+
+  // forEachDiff: call f(offset, value) for every bit differing between a at apos and b at bpos,
+  // value being the bit in a. Returns the number of differences
+  template <typename F>
+  static uint32_t forEachDiff(const uint8_t *a, uint32_t apos, const uint8_t *b, uint32_t bpos, uint32_t len, F f) {
+    uint32_t cnt = 0;
+    uint32_t base = 0;
+    // Both byte aligned: whole words
+    if (((apos | bpos) & 7) == 0) {
+      for (; len - base >= 64; base += 64) {
+        uint64_t wa = load(a + ((apos + base) >> 3), 8);
+        uint64_t d = wa ^ load(b + ((bpos + base) >> 3), 8);
+        cnt += reportDiff(base, wa, d, f);
+      }
+    }
+    for (; base < len; base += CHUNK) {
+      uint8_t n = (len - base < CHUNK) ? len - base : CHUNK;
+      uint64_t wa = get(a, apos + base, n);
+      cnt += reportDiff(base, wa, wa ^ get(b, bpos + base, n), f);
+    }
+    return cnt;
+  }
+
+protected:
+  // reportDiff: call f(offset, value) for all 1 bits in d, value taken from w. Returns the number of bits
+  template <typename F>
+  inline static uint8_t reportDiff(uint32_t base, uint64_t w, uint64_t d, F& f) {
+    uint8_t cnt = 0;
+    while (d) {
+      uint8_t bit = ctz(d);
+      f(base + bit, ((w >> bit) & 1) != 0);
+      d &= d - 1;   // clear lowest 1 bit
+      cnt++;
+    }
+    return cnt;
+  }
+
+  // Prevent instances
+  CoilBits() = delete;
+};
+
+#endif
@@ -41,7 +41,7 @@ CoilData::CoilData(const char *initVector) :
 // Destructor: take care of cleaning up
 CoilData::~CoilData() {
   if (CDbuffer) {
-    delete CDbuffer;
+    delete[] CDbuffer;
   }
 }
 
@@ -49,7 +49,7 @@ CoilData::~CoilData() {
 CoilData& CoilData::operator=(const CoilData& m) {
   // Remove old data
   if (CDbuffer) {
-    delete CDbuffer;
+    delete[] CDbuffer;
   }
   // Are coils in source?
   if (m.CDsize > 0) {
@@ -99,7 +99,7 @@ CoilData::CoilData(CoilData&& m) {
 CoilData& CoilData::operator=(CoilData&& m) {
   // Remove buffer, if already allocated
   if (CDbuffer) {
-    delete CDbuffer;
+    delete[] CDbuffer;
   }
   // Are there coils in the source at all?
   if (m.CDsize > 0) {
@@ -127,9 +127,8 @@ bool CoilData::operator==(const CoilData& m) {
   if (this == &m) return true;
   // Different sizes are never equal
   if (CDsize != m.CDsize) return false;
-  // Compare the data
-  if (CDsize > 0 && memcmp(CDbuffer, m.CDbuffer, CDbyteSize)) return false;
-  return true;
+  // Compare the data word-wise
+  return CoilBits::equal(CDbuffer, 0, m.CDbuffer, 0, CDsize);
 }
 
 // Inequality: invert the result of the equality comparison
@@ -137,6 +136,18 @@ bool CoilData::operator!=(const CoilData& m) {
   return !(*this == m);
 }
 
+// XOR-diff: coils differing between two sets are 1 in the result
+CoilData CoilData::operator^(const CoilData& m) const {
+  CoilData retval;
+  // Sets of different sizes are compared up to the smaller size, as forEachChange() does
+  uint16_t length = (CDsize < m.CDsize) ? CDsize : m.CDsize;
+  if (length) {
+    retval = CoilData(length);
+    CoilBits::exclusiveOr(retval.CDbuffer, CDbuffer, m.CDbuffer, length);
+  }
+  return retval;
+}
+
 // Assignment of a bit image char array to re-init
 CoilData& CoilData::operator=(const char *initVector) {
   // setVector() may be unsuccessful - then data is deleted!
@@ -175,11 +186,9 @@ CoilData CoilData::slice(uint16_t start, uint16_t length) {
     // Yes, it does. Extend return object
     retval = CoilData(length);
 
-  // Loop over all requested bits
-    for (uint16_t i = start; i < start + length; ++i) {
-      if (CDbuffer[byteIndex(i)] & (1 << bitIndex(i))) {
-        retval.set(i - start, true);
-      }
+    // Copy over the requested bits, shifted to the leftmost position
+    if (length) {
+      CoilBits::copy(retval.CDbuffer, 0, CDbuffer, start, length);
     }
   }
   return retval;
@@ -220,7 +229,7 @@ bool CoilData::set(uint16_t index, bool value) {
 // set #2: alter a group of coils, overwriting it by the bits from vector newValue
 bool CoilData::set(uint16_t start, uint16_t length, vector<uint8_t> newValue) {
   // Does the vector contain enough data for the specified size?
-  if (newValue.size() >= (size_t)((length >> 3) + 1)) {
+  if (newValue.size() >= (size_t)((length + 7) >> 3)) {
     // Yes, we safely may call set #3 with it
     return set(start, length, newValue.data());
   }
@@ -234,33 +243,8 @@ bool CoilData::set(uint16_t start, uint16_t length, vector<uint8_t> newValue) {
 bool CoilData::set(uint16_t start, uint16_t length, uint8_t *newValue) {
   // Does the requested slice fit in the buffer?
   if (length && (start + length) <= CDsize) {
-    // Yes, it does. 
-    // Prepare pointers to the source byte and the bit within
-    uint8_t *cp = newValue;
-    uint8_t bitPtr = 0;
-
-    // Loop over all bits to be set
-    for (uint16_t i = start; i < start + length; i++) {
-      // Get affected byte
-      uint8_t by = byteIndex(i);
-      // Calculate single-bit mask in target byte
-      uint8_t mask = 1 << bitIndex(i);
-      // Stamp out bit
-      CDbuffer[by] &= ~mask;
-      // is source bit set?
-      if (*cp & (1 << bitPtr)) {
-        // Yes. Set it in target as well
-        CDbuffer[by] |= mask;
-      }
-      // Advance source bit ptr
-      bitPtr++;
-      // Overflow?
-      if (bitPtr >= 8) {
-        // Yes. move pointers to first bit in next source byte
-        bitPtr = 0;
-        cp++;
-      }
-    }
+    // Yes, it does. Shift-merge the source bits into place
+    CoilBits::copy(CDbuffer, start, newValue, 0, length);
     return true;
   }
   return false;
@@ -270,7 +254,7 @@ bool CoilData::set(uint16_t start, uint16_t length, uint8_t *newValue) {
 // Setting stops when either target storage or source coils are exhausted
 bool CoilData::set(uint16_t index, const CoilData& c) {
   // if source object is empty, return false
-  if (c.empty()) return false;
+  if (c.CDsize == 0) return false;
 
   // If target is empty, or index is beyond coils, return false
   if (CDsize == 0 || index >= CDsize) return false;
@@ -279,9 +263,12 @@ bool CoilData::set(uint16_t index, const CoilData& c) {
   uint16_t length = CDsize - index;
   if (c.coils() < length) length = c.coils();
 
-  // Loop over all coils to be copied
-  for (uint16_t i = index; i < index + length; ++i) {
-    set(i, c[i - index]);
+  // Copying a set onto itself needs an intermediate copy, as the ranges may overlap
+  if (&c == this) {
+    CoilData source(c);
+    CoilBits::copy(CDbuffer, index, source.CDbuffer, 0, length);
+  } else {
+    CoilBits::copy(CDbuffer, index, c.CDbuffer, 0, length);
   }
   return true;
 }
@@ -430,7 +417,7 @@ bool CoilData::setVector(const char *initVector) {
 
   // If there are coils already, trash them.
   if (CDbuffer) {
-    delete CDbuffer;
+    delete[] CDbuffer;
   }
   CDsize = 0;
   CDbyteSize = 0;
@@ -493,22 +480,9 @@ void CoilData::init(bool value) {
 }
 
 // Return number of coils set to 1 (or not)
-// Uses Brian Kernighan's algorithm!
+// Counts 64 coils at a time by popcount
 uint16_t CoilData::coilsSetON() const {
-  uint16_t count = 0;
-
-  // Do we have coils at all?
-  if (CDbyteSize) {
-    // Yes. Loop over all bytes summing up the '1' bits
-    for (uint8_t i = 0; i < CDbyteSize; ++i) {
-      uint8_t by = CDbuffer[i];
-      while (by) {
-        by &= by - 1; // this clears the LSB-most set bit
-        count++;
-      }
-    }
-  }
-  return count;
+  return CoilBits::count(CDbuffer, 0, CDsize);
 }
 
 uint16_t CoilData::coilsSetOFF() const {
@@ -9,6 +9,7 @@
 #include <vector>
 #include <cstdint>
 #include "options.h"
+#include "CoilBits.h"
 
 using std::vector;
 
@@ -93,12 +94,30 @@ public:
   inline bool empty() const { return (CDsize >0) ? true : false; }
   inline operator bool () const { return empty(); }
 
+  // XOR-diff: coils differing between two sets are 1 in the result.
+  // Sets of different sizes are compared up to the smaller size, the result has that size
+  CoilData operator^(const CoilData& m) const;
+
+  // forEachSet: call f(index) for every coil set to 1, in ascending order
+  template <typename F>
+  void forEachSet(F f) const {
+    if (CDsize) CoilBits::forEachSet(CDbuffer, 0, CDsize, f);
+  }
+
+  // forEachChange: call f(index, value) for every coil differing from previous, value being the new one.
+  // Sets of different sizes are compared up to the smaller size. Returns the number of changes
+  template <typename F>
+  uint16_t forEachChange(const CoilData& previous, F f) const {
+    uint16_t length = (CDsize < previous.CDsize) ? CDsize : previous.CDsize;
+    return length ? CoilBits::forEachDiff(CDbuffer, 0, previous.CDbuffer, 0, length, f) : 0;
+  }
+
   // Return number of coils set to 1 (or ON)
   uint16_t coilsSetON() const;
   // Return number of coils set to 0 (or OFF)
   uint16_t coilsSetOFF() const;
 
-#if !ISLINUX
+#if !IS_LINUX
   // Helper function to dump out coils in logical order
   void print(const char *label, Print& s);
 #endif
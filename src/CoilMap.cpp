@@ -0,0 +1,160 @@
+// =================================================================================================
+// eModbus: Copyright 2020, 2021 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#include "CoilMap.h"
+#include "CoilBits.h"
+#include "PDUutils.h"
+#undef LOCAL_LOG_LEVEL
+#include "Logging.h"
+
+// operator[]: value of a single coil, relative to the view's start
+bool CoilView::operator[](uint32_t index) const {
+  if (index < CVlength) {
+    return CoilBits::get(CVbuffer, CVstart + index, 1);
+  }
+  // Wrong parameter -> always return false
+  return false;
+}
+
+// Number of coils set to 1 (or ON)
+uint32_t CoilView::coilsSetON() const {
+  return CVlength ? CoilBits::count(CVbuffer, CVstart, CVlength) : 0;
+}
+
+// copyTo: pack the coils leftmost into buffer
+void CoilView::copyTo(uint8_t *buffer) const {
+  if (CVlength) {
+    // Clear the last byte to have the unused bits set to 0
+    buffer[byteCount() - 1] = 0;
+    CoilBits::copy(buffer, 0, CVbuffer, CVstart, CVlength);
+  }
+}
+
+// Conversion into a CoilData copy
+CoilView::operator CoilData() const {
+  // CoilData is limited to 2000 coils
+  CoilData retval(CVlength > 2000 ? 2000 : CVlength);
+  if (retval.coils()) {
+    CoilBits::copy(retval.data(), 0, CVbuffer, CVstart, retval.coils());
+  }
+  return retval;
+}
+
+// Comparison with a CoilData object
+bool CoilView::operator==(const CoilData& c) const {
+  if (c.coils() != CVlength) return false;
+  return !CVlength || CoilBits::equal(CVbuffer, CVstart, c.data(), 0, CVlength);
+}
+
+// Constructor: size in coils (max. 65536), initial value for all coils
+CoilMap::CoilMap(uint32_t size, bool initValue) :
+  CMsize(size > 65536 ? 65536 : size) {
+  CMbuffer.resize((CMsize + 7) >> 3);
+  init(initValue);
+}
+
+// operator[]: value of a single coil
+bool CoilMap::operator[](uint32_t index) const {
+  if (index < CMsize) {
+    return CoilBits::get(CMbuffer.data(), index, 1);
+  }
+  // Wrong parameter -> always return false
+  return false;
+}
+
+// view: zero-copy window on coils start..start+length-1
+CoilView CoilMap::view(uint32_t start, uint32_t length) const {
+  if (length && start < CMsize && length <= CMsize - start) {
+    return CoilView(CMbuffer.data(), start, length);
+  }
+  return CoilView();
+}
+
+// set #1: alter one single coil
+bool CoilMap::set(uint32_t index, bool value) {
+  if (index < CMsize) {
+    CoilBits::put(CMbuffer.data(), index, 1, value ? 1 : 0);
+    return true;
+  }
+  return false;
+}
+
+// set #2: alter a group of coils from a packed bit buffer
+bool CoilMap::set(uint32_t start, uint32_t length, const uint8_t *newValue) {
+  if (length && start < CMsize && length <= CMsize - start) {
+    CoilBits::copy(CMbuffer.data(), start, newValue, 0, length);
+    return true;
+  }
+  return false;
+}
+
+// set #3: alter a group of coils from a CoilData object
+bool CoilMap::set(uint32_t start, const CoilData& c) {
+  return set(start, c.coils(), c.data());
+}
+
+// init: set all coils to 1 or 0
+void CoilMap::init(bool value) {
+  // Overhang bits in the last byte are not touched and will stay 0
+  if (CMsize) {
+    CoilBits::fill(CMbuffer.data(), 0, CMsize, value);
+  }
+}
+
+// Number of coils set to 1 (or ON)
+uint32_t CoilMap::coilsSetON() const {
+  return CoilBits::count(CMbuffer.data(), 0, CMsize);
+}
+
+// serve: answer a coil request from the map
+ModbusMessage CoilMap::serve(const ModbusMessage& request) {
+  ModbusMessage response;
+  uint16_t start = 0;
+  uint16_t count = 0;
+
+  // Reject malformed requests
+  Error e = PDUutils::checkRequest(request);
+  if (e != SUCCESS) {
+    response.setError(request.getServerID(), request.getFunctionCode(), e);
+    return response;
+  }
+
+  switch (request.getFunctionCode()) {
+  case READ_COIL:
+  case READ_DISCR_INPUT:
+    {
+      request.get(2, start, count);
+      CoilView v = view(start, count);
+      if (!v) break;
+      // Pack the window directly into the response
+      uint8_t bytes = v.byteCount();
+      response = ModbusMessage(3 + bytes);
+      response.add(request.getServerID(), request.getFunctionCode(), bytes);
+      response.MM_data.resize(3 + bytes);
+      v.copyTo(response.MM_data.data() + 3);
+      return response;
+    }
+  case WRITE_COIL:
+    {
+      request.get(2, start, count);
+      if (!set(start, count == 0xFF00)) break;
+      // Response is the echoed request
+      return request;
+    }
+  case WRITE_MULT_COILS:
+    {
+      request.get(2, start, count);
+      // Coil bits are taken right from the request PDU
+      if (!set(start, count, request.data() + 7)) break;
+      response.add(request.getServerID(), request.getFunctionCode(), start, count);
+      return response;
+    }
+  default:
+    response.setError(request.getServerID(), request.getFunctionCode(), ILLEGAL_FUNCTION);
+    return response;
+  }
+  // Coils were out of range
+  response.setError(request.getServerID(), request.getFunctionCode(), ILLEGAL_DATA_ADDRESS);
+  return response;
+}
@@ -0,0 +1,104 @@
+// =================================================================================================
+// eModbus: Copyright 2020, 2021 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _COILMAP_H
+#define _COILMAP_H
+
+#include <vector>
+#include <cstdint>
+#include "options.h"
+#include "ModbusMessage.h"
+#include "CoilData.h"
+
+// CoilView: read-only window into a CoilMap. It does not copy any coils, but refers to the
+// map's storage - the map must outlive its views, and the view reflects later changes to the map.
+class CoilView {
+public:
+  // Empty view
+  CoilView() : CVbuffer(nullptr), CVstart(0), CVlength(0) { }
+
+  // Number of coils in the view
+  inline uint32_t coils() const { return CVlength; }
+  // Number of bytes the coils will occupy packed into a PDU
+  inline uint16_t byteCount() const { return (CVlength + 7) >> 3; }
+  // true, if there are coils in the view
+  inline explicit operator bool() const { return CVlength > 0; }
+
+  // operator[]: value of a single coil, relative to the view's start
+  bool operator[](uint32_t index) const;
+
+  // Number of coils set to 1 (or ON)
+  uint32_t coilsSetON() const;
+
+  // copyTo: pack the coils leftmost into buffer, as needed for a FC 0x01/0x02 response.
+  // buffer must hold byteCount() bytes. Unused bits in the last byte are set to 0.
+  void copyTo(uint8_t *buffer) const;
+
+  // Conversion into a CoilData copy (up to 2000 coils)
+  operator CoilData() const;
+
+  // Comparison with a CoilData object
+  bool operator==(const CoilData& c) const;
+  inline bool operator!=(const CoilData& c) const { return !(*this == c); }
+
+protected:
+  friend class CoilMap;
+  CoilView(const uint8_t *buffer, uint32_t start, uint32_t length) :
+    CVbuffer(buffer), CVstart(start), CVlength(length) { }
+
+  const uint8_t *CVbuffer;     // Storage of the map
+  uint32_t CVstart;            // First coil of the view in the map
+  uint32_t CVlength;           // Number of coils
+};
+
+// CoilMap: coil storage for a complete Modbus address space of up to 65536 coils.
+// Different from CoilData it is not limited to the 2000 coils of a single PDU, and hands out
+// zero-copy views on any window. serve() will answer FC 0x01/0x02/0x05/0x0F requests right
+// from the storage, so it can be used directly in a worker function.
+// There is no locking - concurrent workers must be serialized by the caller.
+class CoilMap {
+public:
+  // Constructor: size in coils (max. 65536), initial value for all coils
+  explicit CoilMap(uint32_t size = 65536, bool initValue = false);
+
+  // get size in coils
+  inline uint32_t coils() const { return CMsize; }
+
+  // Raw access to the storage
+  inline const uint8_t *data() const { return CMbuffer.data(); }
+
+  // operator[]: value of a single coil
+  bool operator[](uint32_t index) const;
+
+  // view: zero-copy window on coils start..start+length-1. Empty view if out of range
+  CoilView view(uint32_t start, uint32_t length) const;
+
+  // Set functions to change coil value(s)
+  // Will return true if done, false if impossible (wrong address)
+
+  // set #1: alter one single coil
+  bool set(uint32_t index, bool value);
+
+  // set #2: alter a group of coils from a packed bit buffer, as found in a FC 0x0F request
+  bool set(uint32_t start, uint32_t length, const uint8_t *newValue);
+
+  // set #3: alter a group of coils from a CoilData object
+  bool set(uint32_t start, const CoilData& c);
+
+  // (Re-)init all coils to 1 or 0
+  void init(bool value = false);
+
+  // Number of coils set to 1 (or ON)
+  uint32_t coilsSetON() const;
+
+  // serve: answer a FC 0x01, 0x02, 0x05 or 0x0F request from the map.
+  // Other function codes and coils outside the map will get an error response.
+  ModbusMessage serve(const ModbusMessage& request);
+
+protected:
+  std::vector<uint8_t> CMbuffer;   // Bit storage
+  uint32_t CMsize;                 // Number of coils
+};
+
+#endif
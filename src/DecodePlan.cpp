@@ -0,0 +1,233 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#include <string.h>
+#include "DecodePlan.h"
+#undef LOCAL_LOG_LEVEL
+#include "Logging.h"
+
+// Conversion kernels. Source values are MSB first, swap rules are applied to the value in
+// message order, so results are identical to ModbusMessage::get() with the same rules.
+static inline uint16_t load16(const uint8_t *p, uint8_t swap) {
+  uint16_t v = (p[0] << 8) | p[1];
+  if (swap & SWAP_BYTES) v = (v << 8) | (v >> 8);
+  if (swap & SWAP_NIBBLES) v = ((v & 0x0F0F) << 4) | ((v >> 4) & 0x0F0F);
+  return v;
+}
+
+static inline uint32_t load32(const uint8_t *p, uint8_t swap) {
+  uint32_t v = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+  if (swap & SWAP_REGISTERS) v = (v << 16) | (v >> 16);
+  if (swap & SWAP_BYTES) v = ((v & 0x00FF00FF) << 8) | ((v >> 8) & 0x00FF00FF);
+  if (swap & SWAP_NIBBLES) v = ((v & 0x0F0F0F0F) << 4) | ((v >> 4) & 0x0F0F0F0F);
+  return v;
+}
+
+static inline float toFloat(uint32_t v) {
+  float f;
+  memcpy(&f, &v, sizeof(f));
+  return f;
+}
+
+// get one value of a step as double
+static inline double loadValue(const uint8_t *p, DecodeType type, uint8_t swap) {
+  switch (type) {
+  case DEC_INT16:  return (int16_t)load16(p, swap);
+  case DEC_UINT16: return load16(p, swap);
+  case DEC_INT32:  return (int32_t)load32(p, swap);
+  case DEC_UINT32: return load32(p, swap);
+  case DEC_FLOAT:  return toFloat(load32(p, swap));
+  }
+  return 0.0;
+}
+
+// Bulk kernel: count values of the same width from src into consecutive fields at dst
+template <typename T, typename F>
+static inline void bulk(const uint8_t *src, uint8_t *dst, uint16_t count, uint8_t width, F convert) {
+  for (uint16_t i = 0; i < count; ++i) {
+    T v = convert(src);
+    memcpy(dst, &v, sizeof(T));
+    src += width;
+    dst += sizeof(T);
+  }
+}
+
+// Constructor: empty plan
+DecodePlan::DecodePlan(uint16_t firstRegister) :
+  DPfirst(firstRegister),
+  DPvalues(0),
+  DPbytes(0),
+  DPtargetSize(0),
+  DPerror(SUCCESS) { }
+
+// sourceWidth: 2 bytes for 16 bit types, 4 bytes for all others
+uint8_t DecodePlan::sourceWidth(const DecodeStep& s) {
+  return (s.type == DEC_INT16 || s.type == DEC_UINT16) ? 2 : 4;
+}
+
+// targetWidth: scaled values are floats, else the native type size
+uint8_t DecodePlan::targetWidth(const DecodeStep& s) {
+  return s.scaled ? sizeof(float) : sourceWidth(s);
+}
+
+// add: append a tag
+DecodePlan& DecodePlan::add(uint16_t reg, DecodeType type, uint8_t swapRules, uint16_t count) {
+  // Is the tag within the response at all?
+  if (reg < DPfirst || count == 0 || (uint32_t)(reg - DPfirst) * 2 + 3 > 0xFFFF) {
+    LOG_E("Tag @%04X (%d) is outside of response starting at %04X\n", reg, count, DPfirst);
+    if (DPerror == SUCCESS) DPerror = PARAMETER_LIMIT_ERROR;
+    return *this;
+  }
+  DecodeStep s;
+  s.src = (reg - DPfirst) * 2 + 3;    // skip server ID, function code and byte count
+  s.count = count;
+  s.index = DPtags.empty() ? 0 : DPtags.back().index + DPtags.back().count;
+  s.target = NO_TARGET;
+  s.type = type;
+  s.swap = swapRules;
+  s.scaled = false;
+  s.factor = 1.0;
+  s.offset = 0.0;
+  DPtags.push_back(s);
+  compile();
+  return *this;
+}
+
+// scale: apply factor and offset to the last tag
+DecodePlan& DecodePlan::scale(float factor, float offset) {
+  if (DPtags.empty()) {
+    LOG_E("scale() without a tag\n");
+    if (DPerror == SUCCESS) DPerror = PARAMETER_COUNT_ERROR;
+    return *this;
+  }
+  DPtags.back().scaled = true;
+  DPtags.back().factor = factor;
+  DPtags.back().offset = offset;
+  compile();
+  return *this;
+}
+
+// to: set struct offset of the last tag
+DecodePlan& DecodePlan::to(uint16_t targetOffset) {
+  if (DPtags.empty()) {
+    LOG_E("to() without a tag\n");
+    if (DPerror == SUCCESS) DPerror = PARAMETER_COUNT_ERROR;
+    return *this;
+  }
+  DPtags.back().target = targetOffset;
+  compile();
+  return *this;
+}
+
+// compile: merge adjacent tags with identical conversion into one step.
+// Tags are merged only if they are contiguous in the response and in the struct as well
+void DecodePlan::compile() {
+  DPsteps.clear();
+  DPvalues = 0;
+  DPbytes = 0;
+  DPtargetSize = 0;
+
+  for (auto& t : DPtags) {
+    uint16_t srcEnd = t.src + t.count * sourceWidth(t) - 3;
+    if (srcEnd > DPbytes) DPbytes = srcEnd;
+    if (t.target != NO_TARGET) {
+      uint16_t tgtEnd = t.target + t.count * targetWidth(t);
+      if (tgtEnd > DPtargetSize) DPtargetSize = tgtEnd;
+    }
+    DPvalues += t.count;
+
+    if (!DPsteps.empty()) {
+      DecodeStep& last = DPsteps.back();
+      if (last.type == t.type && last.swap == t.swap && last.scaled == t.scaled
+       && last.factor == t.factor && last.offset == t.offset
+       && last.src + last.count * sourceWidth(last) == t.src
+       && ((last.target == NO_TARGET && t.target == NO_TARGET)
+        || (last.target != NO_TARGET && t.target != NO_TARGET
+         && last.target + last.count * targetWidth(last) == t.target))) {
+        // Yes, can be merged
+        last.count += t.count;
+        continue;
+      }
+    }
+    DPsteps.push_back(t);
+  }
+}
+
+// check: response has to be a data response to FC 0x03, 0x04 or 0x17 long enough for the plan
+Error DecodePlan::check(const ModbusMessage& response) const {
+  if (DPerror != SUCCESS) return DPerror;
+  if (response.size() < 3) return PACKET_LENGTH_ERROR;
+  Error e = response.getError();
+  if (e != SUCCESS) return e;
+  uint8_t fc = response.getFunctionCode();
+  if (fc != READ_HOLD_REGISTER && fc != READ_INPUT_REGISTER && fc != R_W_MULT_REGISTERS) return FC_MISMATCH;
+  // Byte count must match the response size and cover all tags
+  if (response[2] != response.size() - 3 || response[2] < DPbytes) return PACKET_LENGTH_ERROR;
+  return SUCCESS;
+}
+
+// decode: convert response into an array of double values
+Error DecodePlan::decode(const ModbusMessage& response, double *values, uint16_t maxValues) const {
+  Error e = check(response);
+  if (e != SUCCESS) return e;
+  if (maxValues < DPvalues) return PARAMETER_COUNT_ERROR;
+
+  const uint8_t *data = response.data();
+  for (auto& s : DPsteps) {
+    const uint8_t *src = data + s.src;
+    double *dst = values + s.index;
+    uint8_t width = sourceWidth(s);
+    for (uint16_t i = 0; i < s.count; ++i) {
+      double v = loadValue(src, s.type, s.swap);
+      *dst++ = s.scaled ? v * s.factor + s.offset : v;
+      src += width;
+    }
+  }
+  return SUCCESS;
+}
+
+// decodeStruct: convert response into struct fields, using the native type or float for scaled tags
+Error DecodePlan::decodeStruct(const ModbusMessage& response, uint8_t *target, uint16_t targetSize) const {
+  Error e = check(response);
+  if (e != SUCCESS) return e;
+  if (targetSize < DPtargetSize) return PARAMETER_LIMIT_ERROR;
+
+  const uint8_t *data = response.data();
+  for (auto& s : DPsteps) {
+    if (s.target == NO_TARGET) continue;
+    const uint8_t *src = data + s.src;
+    uint8_t *dst = target + s.target;
+    uint8_t width = sourceWidth(s);
+    uint8_t swap = s.swap;
+
+    // Scaled tags all end up as float
+    if (s.scaled) {
+      float factor = s.factor;
+      float offset = s.offset;
+      DecodeType type = s.type;
+      bulk<float>(src, dst, s.count, width, [=](const uint8_t *p) { return (float)loadValue(p, type, swap) * factor + offset; });
+      continue;
+    }
+
+    // Native types
+    switch (s.type) {
+    case DEC_INT16:
+      bulk<int16_t>(src, dst, s.count, width, [=](const uint8_t *p) { return (int16_t)load16(p, swap); });
+      break;
+    case DEC_UINT16:
+      bulk<uint16_t>(src, dst, s.count, width, [=](const uint8_t *p) { return load16(p, swap); });
+      break;
+    case DEC_INT32:
+      bulk<int32_t>(src, dst, s.count, width, [=](const uint8_t *p) { return (int32_t)load32(p, swap); });
+      break;
+    case DEC_UINT32:
+      bulk<uint32_t>(src, dst, s.count, width, [=](const uint8_t *p) { return load32(p, swap); });
+      break;
+    case DEC_FLOAT:
+      bulk<float>(src, dst, s.count, width, [=](const uint8_t *p) { return toFloat(load32(p, swap)); });
+      break;
+    }
+  }
+  return SUCCESS;
+}
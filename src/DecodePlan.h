@@ -0,0 +1,100 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _DECODE_PLAN_H
+#define _DECODE_PLAN_H
+#include <vector>
+#include "ModbusMessage.h"
+
+// DecodePlan: declarative description of the register layout of a FC 0x03/0x04 response.
+// The tags are described once, the plan will merge them into a flat list of decode steps
+// that convert a complete response in one pass - either into an array of double values
+// or directly into the fields of a struct:
+//
+//   struct Meter { int16_t temp; uint32_t energy; float power; float volts; };
+//   DecodePlan plan(0x100);                                // first register requested
+//   plan.add(0x100, DEC_INT16).to(offsetof(Meter, temp))
+//       .add(0x101, DEC_UINT32).to(offsetof(Meter, energy))
+//       .add(0x103, DEC_FLOAT, SWAP_REGISTERS).to(offsetof(Meter, power))
+//       .add(0x105, DEC_INT16).scale(0.1).to(offsetof(Meter, volts));
+//   Meter m;
+//   Error e = plan.decodeStruct(response, m);
+
+// Register data types
+enum DecodeType : uint8_t {
+  DEC_INT16,        // int16_t, one register
+  DEC_UINT16,       // uint16_t, one register
+  DEC_INT32,        // int32_t, two registers
+  DEC_UINT32,       // uint32_t, two registers
+  DEC_FLOAT,        // IEEE754 float, two registers
+};
+
+class DecodePlan {
+public:
+  // Constructor: takes the address of the first register the response will hold
+  explicit DecodePlan(uint16_t firstRegister = 0);
+
+  // add: describe a tag - or count consecutive tags of the same type - starting at register reg.
+  // swapRules are the same as for ModbusMessage::get(float): SWAP_BYTES, SWAP_REGISTERS and SWAP_NIBBLES
+  DecodePlan& add(uint16_t reg, DecodeType type, uint8_t swapRules = 0, uint16_t count = 1);
+
+  // scale: convert the last tag to raw * factor + offset. A struct target field has to be a float then
+  DecodePlan& scale(float factor, float offset = 0.0);
+
+  // to: byte offset of the last tag's field in the target struct (use offsetof()).
+  // Tags without to() will be skipped by decodeStruct()
+  DecodePlan& to(uint16_t targetOffset);
+
+  // decode: convert response into values[], one value per tag in the sequence of add() calls
+  Error decode(const ModbusMessage& response, double *values, uint16_t maxValues) const;
+
+  // decodeStruct: convert response into the fields of target
+  template <typename T>
+  Error decodeStruct(const ModbusMessage& response, T& target) const {
+    return decodeStruct(response, reinterpret_cast<uint8_t *>(&target), sizeof(T));
+  }
+  Error decodeStruct(const ModbusMessage& response, uint8_t *target, uint16_t targetSize) const;
+
+  // Informative
+  inline uint16_t values() const { return DPvalues; }         // Number of values in the plan
+  inline uint16_t registers() const { return DPbytes >> 1; }  // Number of registers the response must hold
+  inline uint16_t steps() const { return DPsteps.size(); }    // Number of decode steps after merging
+
+  // Marker for tags without a struct target
+  static const uint16_t NO_TARGET = 0xFFFF;
+
+protected:
+  // DecodeStep: one tag or one instruction of the plan, covering count values of identical type
+  struct DecodeStep {
+    uint16_t src;       // byte index of the first value in the response
+    uint16_t count;     // number of values
+    uint16_t index;     // index of the first value in values[]
+    uint16_t target;    // byte offset of the first field in the struct or NO_TARGET
+    DecodeType type;    // register data type
+    uint8_t swap;       // swap rules
+    bool scaled;        // true, if factor and offset are to be applied
+    float factor;       // scaling factor
+    float offset;       // scaling offset
+  };
+
+  // Number of response bytes and struct bytes a single value of a step will occupy
+  static uint8_t sourceWidth(const DecodeStep& s);
+  static uint8_t targetWidth(const DecodeStep& s);
+
+  // compile: rebuild the plan from the tags, merging adjacent compatible tags into one step
+  void compile();
+
+  // check: common response checks for both decode variants
+  Error check(const ModbusMessage& response) const;
+
+  std::vector<DecodeStep> DPtags;   // the tags as described by add(), scale() and to()
+  std::vector<DecodeStep> DPsteps;  // the plan
+  uint16_t DPfirst;                 // address of the first register in the response
+  uint16_t DPvalues;                // number of values
+  uint16_t DPbytes;                 // number of data bytes required in the response
+  uint16_t DPtargetSize;            // minimum size of a target struct
+  Error DPerror;                    // SUCCESS or the first error detected while building the plan
+};
+
+#endif
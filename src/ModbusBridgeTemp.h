@@ -70,9 +70,9 @@ protected:
       port(p) {}
   };
 
-  // Default worker functions
+  // Default worker functions. bridgeWorker() takes a copy of the request, as it has to modify it
   ModbusMessage bridgeWorker(ModbusMessage msg);
-  ModbusMessage bridgeDenyWorker(ModbusMessage msg);
+  ModbusMessage bridgeDenyWorker(const ModbusMessage& msg);
 
   // Map of servers attached
   std::map<uint8_t, ServerData *> servers;
@@ -174,9 +174,9 @@ ModbusMessage ModbusBridge<SERVERCLASS>::bridgeWorker(ModbusMessage msg) {
     LOG_D("Request (%02X/%02X) sent\n", servers[aliasID]->serverID, functionCode);
     // TCP servers have a target host/port that needs to be set in the client
     if (servers[aliasID]->serverType == TCP_SERVER) {
-      response = reinterpret_cast<ModbusClientTCP *>(servers[aliasID]->client)->syncRequestMT(msg, (uint32_t)millis(), servers[aliasID]->host, servers[aliasID]->port);
+      response = reinterpret_cast<ModbusClientTCP *>(servers[aliasID]->client)->syncRequestMT(std::move(msg), (uint32_t)millis(), servers[aliasID]->host, servers[aliasID]->port);
     } else {
-      response = servers[aliasID]->client->syncRequestM(msg, (uint32_t)millis());
+      response = servers[aliasID]->client->syncRequestM(std::move(msg), (uint32_t)millis());
     }
 
     // Re-set the requested server ID
@@ -190,7 +190,7 @@ ModbusMessage ModbusBridge<SERVERCLASS>::bridgeWorker(ModbusMessage msg) {
 
 // bridgeDenyWorker: worker function to block function codes
 template<typename SERVERCLASS>
-ModbusMessage ModbusBridge<SERVERCLASS>::bridgeDenyWorker(ModbusMessage msg) {
+ModbusMessage ModbusBridge<SERVERCLASS>::bridgeDenyWorker(const ModbusMessage& msg) {
   ModbusMessage response;
   response.setError(msg.getServerID(), msg.getFunctionCode(), ILLEGAL_FUNCTION);
   return response;
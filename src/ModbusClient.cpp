@@ -16,6 +16,7 @@ ModbusClient::ModbusClient() :
   worker(NULL),
   #elif IS_LINUX
   worker(0),
+  busyPoll(false),
   #endif
   onData(nullptr),
   onError(nullptr),
@@ -78,9 +79,6 @@ void ModbusClient::resetCounts() {
 ModbusMessage ModbusClient::waitSync(uint8_t serverID, uint8_t functionCode, uint32_t token) {
   ModbusMessage response;
   unsigned long lostPatience = millis();
- 
-  // Default response is TIMEOUT
-  response.setError(serverID, functionCode, TIMEOUT);
 
   // Loop 60 seconds, if unlucky
   while (millis() - lostPatience < 60000) {
@@ -91,13 +89,22 @@ ModbusMessage ModbusClient::waitSync(uint8_t serverID, uint8_t functionCode, uin
       // Is it there?
       if (sR != syncResponse.end()) {
         // Yes. get the response, delete it from the map and return
-        response = sR->second;
+        response = std::move(sR->second);
         syncResponse.erase(sR);
-        break;
+        return response;
       }
     }
+#if IS_LINUX
+    // Busy-polling? Then only let others run that are waiting for the CPU
+    if (busyPoll) {
+      std::this_thread::yield();
+      continue;
+    }
+#endif
     // Give the watchdog time to act
     delay(10);
   }
+  // If we get here, no response has arrived: TIMEOUT
+  response.setError(serverID, functionCode, TIMEOUT);
   return response;
 }
@@ -9,6 +9,7 @@
 #include <map>
 #include "options.h"
 #include "ModbusMessage.h"
+#include "ModbusRequest.h"
 
 #if HAS_FREERTOS
 extern "C" {
@@ -17,6 +18,8 @@ extern "C" {
 }
 #elif IS_LINUX
 #include <pthread.h>
+#include <atomic>
+#include <thread>                   // NOLINT
 #endif
 
 #if USE_MUTEX
@@ -25,6 +28,8 @@ using std::mutex;
 using std::lock_guard;
 #endif
 
+// Response handlers take the message by value. The clients hand over their response with
+// std::move(), so a handler may keep or modify the message without another copy being made.
 typedef std::function<void(ModbusMessage msg, uint32_t token)> MBOnData;
 typedef std::function<void(Modbus::Error errorCode, uint32_t token)> MBOnError;
 typedef std::function<void(ModbusMessage msg, uint32_t token)> MBOnResponse;
@@ -37,8 +42,17 @@ public:
   uint32_t getMessageCount();             // Informative: return number of messages created
   uint32_t getErrorCount();              // Informative: return number of errors received
   void resetCounts();                    // Set both message and error counts to zero
-  inline Error addRequest(ModbusMessage m, uint32_t token) { return addRequestM(m, token); }
-  inline ModbusMessage syncRequest(ModbusMessage m, uint32_t token) { return syncRequestM(m, token); }
+  // addRequest/syncRequest for preformatted messages. The message is moved along the queue,
+  // so pass it with std::move() if it is not needed afterwards to save a copy
+  inline Error addRequest(ModbusMessage m, uint32_t token) { return addRequestM(std::move(m), token); }
+  inline ModbusMessage syncRequest(ModbusMessage m, uint32_t token) { return syncRequestM(std::move(m), token); }
+
+  // addRequest/syncRequest variants for compile-time checked Request<> frames.
+  // These were validated by the compiler already, so no setMessage() checks are needed
+  template <uint8_t FC, uint16_t N, FCType T>
+  inline Error addRequest(const Request<FC, N, T>& r, uint32_t token) { return addRequestM(r, token); }
+  template <uint8_t FC, uint16_t N, FCType T>
+  inline ModbusMessage syncRequest(const Request<FC, N, T>& r, uint32_t token) { return syncRequestM(r, token); }
 
   // Template function to generate syncRequest functions as long as there is a 
   // matching ModbusMessage::setMessage() call
@@ -51,7 +65,7 @@ public:
 
     // Add it to the queue and wait for a response, if valid
     if (rc == SUCCESS) {
-      return syncRequestM(m, token);
+      return syncRequestM(std::move(m), token);
     } 
     // Else return the error as a message
     return buildErrorMsg(rc, std::forward<Args>(args) ...);
@@ -77,7 +91,7 @@ public:
 
     // Add it to the queue, if valid
     if (rc == SUCCESS) {
-      return addRequestM(m, token);
+      return addRequestM(std::move(m), token);
     }
     // Else return the error
     return rc;
@@ -99,6 +113,7 @@ protected:
   TaskHandle_t worker;             // Interface instance worker task
 #elif IS_LINUX
   pthread_t worker;
+  std::atomic<bool> busyPoll;      // Spin instead of sleeping while waiting for responses - read by the worker
 #endif
   MBOnData onData;                 // Data response handler
   MBOnError onError;               // Error response handler
@@ -3,6 +3,7 @@
 //               MIT license - see license.md for details
 // =================================================================================================
 #include "ModbusClientRTU.h"
+#include "PDUutils.h"
 
 #if HAS_FREERTOS
 
@@ -141,7 +142,7 @@ Error ModbusClientRTU::addRequestM(ModbusMessage msg, uint32_t token) {
   // Add it to the queue, if valid
   if (msg) {
     // Queue add successful?
-    if (!addToQueue(token, msg)) {
+    if (!addToQueue(token, std::move(msg))) {
       // No. Return error after deleting the allocated request.
       rc = REQUEST_QUEUE_FULL;
     }
@@ -156,13 +157,16 @@ ModbusMessage ModbusClientRTU::syncRequestM(ModbusMessage msg, uint32_t token) {
   ModbusMessage response;
 
   if (msg) {
+    // Keep server ID and function code, msg will be moved into the queue
+    uint8_t serverID = msg.getServerID();
+    uint8_t functionCode = msg.getFunctionCode();
     // Queue add successful?
-    if (!addToQueue(token, msg, true)) {
+    if (!addToQueue(token, std::move(msg), true)) {
       // No. Return error after deleting the allocated request.
-      response.setError(msg.getServerID(), msg.getFunctionCode(), REQUEST_QUEUE_FULL);
+      response.setError(serverID, functionCode, REQUEST_QUEUE_FULL);
     } else {
       // Request is queued - wait for the result.
-      response = waitSync(msg.getServerID(), msg.getFunctionCode(), token);
+      response = waitSync(serverID, functionCode, token);
     }
   } else {
     response.setError(msg.getServerID(), msg.getFunctionCode(), EMPTY_MESSAGE);
@@ -180,7 +184,7 @@ Error ModbusClientRTU::addBroadcastMessage(const uint8_t *data, uint8_t len) {
   if (len && len < 254) {
     // Create a "broadcast token"
     uint32_t token = (millis() & 0xFFFFFF) | 0xBC000000;
-    ModbusMessage msg;
+    ModbusMessage msg(len + 1);
     
     // Server ID is 0x00 for broadcast
     msg.add((uint8_t)0x00);
@@ -188,7 +192,7 @@ Error ModbusClientRTU::addBroadcastMessage(const uint8_t *data, uint8_t len) {
     msg.add(data, len);
 
     // Queue add successful?
-    if (!addToQueue(token, msg)) {
+    if (!addToQueue(token, std::move(msg))) {
       // No. Return error after deleting the allocated request.
       rc = REQUEST_QUEUE_FULL;
     }
@@ -206,12 +210,11 @@ bool ModbusClientRTU::addToQueue(uint32_t token, ModbusMessage request, bool syn
   bool rc = false;
   // Did we get one?
   if (request) {
-    RequestEntry re(token, request, syncReq);
     if (requests.size()<MR_qLimit) {
       // Yes. Safely lock queue and push request to queue
       rc = true;
       LOCK_GUARD(lockGuard, qLock);
-      requests.push(re);
+      requests.emplace(token, std::move(request), syncReq);
     }
     {
       LOCK_GUARD(cntLock, countAccessM);
@@ -234,8 +237,9 @@ void ModbusClientRTU::handleConnection(ModbusClientRTU *instance) {
   while (1) {
     // Do we have a reuest in queue?
     if (!instance->requests.empty()) {
-      // Yes. pull it.
-      RequestEntry request = instance->requests.front();
+      // Yes. pull it. The entry will stay in place until it is popped below,
+      // so we can work on it directly instead of a copy.
+      RequestEntry& request = instance->requests.front();
 
       LOG_D("Pulled request from queue\n");
 
@@ -261,16 +265,12 @@ void ModbusClientRTU::handleConnection(ModbusClientRTU *instance) {
   
         // No error in receive()?
         if (response.size() > 1) {
-          // No. Check message contents
-          // Does the serverID match the requested?
-          if (request.msg.getServerID() != response.getServerID()) {
-            // No. Return error response
-            response.setError(request.msg.getServerID(), request.msg.getFunctionCode(), SERVER_ID_MISMATCH);
-          // ServerID ok, but does the FC match as well?
-          } else if (request.msg.getFunctionCode() != (response.getFunctionCode() & 0x7F)) {
-            // No. Return error response
-            response.setError(request.msg.getServerID(), request.msg.getFunctionCode(), FC_MISMATCH);
-          } 
+          // No. Check server ID, function code and length against the request
+          Error e = PDUutils::checkResponse(response, request.msg);
+          if (e != SUCCESS) {
+            // No match. Return error response
+            response.setError(request.msg.getServerID(), request.msg.getFunctionCode(), e);
+          }
         } else {
           // No, we got an error code from receive()
           // Return it as error response
@@ -290,12 +290,12 @@ void ModbusClientRTU::handleConnection(ModbusClientRTU *instance) {
           // Yes. Put it into the response map
           {
             LOCK_GUARD(sL, instance->syncRespM);
-            instance->syncResponse[request.token] = response;
+            instance->syncResponse[request.token] = std::move(response);
           }
         // No, an async request. Do we have an onResponse handler?
         } else if (instance->onResponse) {
           // Yes. Call it
-          instance->onResponse(response, request.token);
+          instance->onResponse(std::move(response), request.token);
         } else {
           // No, but we may have onData or onError handlers
           // Did we get a normal response?
@@ -303,7 +303,7 @@ void ModbusClientRTU::handleConnection(ModbusClientRTU *instance) {
             // Yes. Do we have an onData handler registered?
             if (instance->onData) {
               // Yes. call it
-              instance->onData(response, request.token);
+              instance->onData(std::move(response), request.token);
             }
           } else {
             // No, something went wrong. All we have is an error
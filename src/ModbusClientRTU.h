@@ -64,7 +64,7 @@ protected:
     bool isSyncRequest;
     RequestEntry(uint32_t t, ModbusMessage m, bool syncReq = false) :
       token(t),
-      msg(m),
+      msg(std::move(m)),
       isSyncRequest(syncReq) {}
   };
 
@@ -0,0 +1,602 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#include "ModbusClientRTUoverIP.h"
+#include "PDUutils.h"
+#include "RTUutils.h"
+
+#if IS_LINUX
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#undef LOCAL_LOG_LEVEL
+// #define LOCAL_LOG_LEVEL LOG_LEVEL_VERBOSE
+#include "Logging.h"
+
+// Constructor takes the transport and the limit of requests queued or waiting for a response
+ModbusClientRTUoverIP::ModbusClientRTUoverIP(RTUtransport transport, uint16_t queueLimit) :
+  ModbusClient(),
+  MT_pending(0),
+  MT_transport(transport),
+  MT_socket(-1),
+  MT_peer(makeTarget(IPAddress(0, 0, 0, 0), 0)),
+  MT_target(makeTarget(IPAddress(0, 0, 0, 0), 0)),
+  MT_targetTimeout(DEFAULTTIMEOUT),
+  MT_defaultTimeout(DEFAULTTIMEOUT),
+  MT_qLimit(queueLimit),
+  MT_pipeline(1),
+  MT_lastExpire(0),
+  MT_rxLen(0),
+  MT_lastRx(0)
+  { }
+
+// Alternative Constructor takes initial target host
+ModbusClientRTUoverIP::ModbusClientRTUoverIP(IPAddress host, uint16_t port, RTUtransport transport, uint16_t queueLimit) :
+  ModbusClient(),
+  MT_pending(0),
+  MT_transport(transport),
+  MT_socket(-1),
+  MT_peer(makeTarget(IPAddress(0, 0, 0, 0), 0)),
+  MT_target(makeTarget(host, port)),
+  MT_targetTimeout(DEFAULTTIMEOUT),
+  MT_defaultTimeout(DEFAULTTIMEOUT),
+  MT_qLimit(queueLimit),
+  MT_pipeline(1),
+  MT_lastExpire(0),
+  MT_rxLen(0),
+  MT_lastRx(0)
+  { }
+
+// Destructor: clean up queue, thread and socket
+ModbusClientRTUoverIP::~ModbusClientRTUoverIP() {
+  // Kill thread first - if begin() was called at all - it owns the requests in flight
+  if (worker) {
+    pthread_cancel(worker);
+    pthread_join(worker, NULL);
+  }
+  LOG_D("RTU over IP client worker killed.\n");
+  {
+    LOCK_GUARD(lockGuard, qLock);
+    for (auto r : requests) delete r;
+    requests.clear();
+    for (auto r : inFlight) delete r;
+    inFlight.clear();
+  }
+  if (MT_socket >= 0) close(MT_socket);
+}
+
+// begin: start the worker thread
+void *ModbusClientRTUoverIP::pHandle(void *p) {
+  handleConnection((ModbusClientRTUoverIP *)p);
+  return nullptr;
+}
+
+void ModbusClientRTUoverIP::begin(int coreID) {
+  // UDP will use one socket for all targets, TCP connects on the first request
+  if (MT_transport == RTU_OVER_UDP) {
+    MT_socket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (MT_socket < 0) {
+      LOG_E("Could not create UDP socket: %s\n", strerror(errno));
+      return;
+    }
+  }
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  // Pin the worker to a CPU?
+  if (coreID >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(coreID, &cpus);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+  }
+  int rc = pthread_create(&worker, &attr, &pHandle, this);
+  pthread_attr_destroy(&attr);
+  // An invalid CPU will fail - try again without
+  if (rc && coreID >= 0) {
+    LOG_E("Could not apply core %d to RTU over IP client thread: %s\n", coreID, strerror(rc));
+    rc = pthread_create(&worker, NULL, &pHandle, this);
+  }
+  if (rc) {
+    LOG_E("Error creating RTU over IP client thread: %d\n", rc);
+  } else {
+    LOG_D("RTU over IP client worker started.\n");
+  }
+}
+
+// setBusyPoll: switch between sleeping and spinning while waiting
+void ModbusClientRTUoverIP::setBusyPoll(bool busy) {
+  busyPoll = busy;
+}
+
+// Set default timeout value
+void ModbusClientRTUoverIP::setTimeout(uint32_t timeout) {
+  MT_defaultTimeout = timeout;
+}
+
+// Set target host for the following requests
+void ModbusClientRTUoverIP::setTarget(IPAddress host, uint16_t port, uint32_t timeout) {
+  LOCK_GUARD(lockGuard, qLock);
+  MT_target = makeTarget(host, port);
+  MT_targetTimeout = timeout ? timeout : MT_defaultTimeout;
+  LOG_D("Target set: %d.%d.%d.%d:%d\n", host[0], host[1], host[2], host[3], port);
+}
+
+// setPipeline: number of requests per host sent before the first of them was answered
+void ModbusClientRTUoverIP::setPipeline(uint8_t depth) {
+  MT_pipeline = depth ? depth : 1;
+}
+
+// Return number of requests queued or waiting for a response
+uint32_t ModbusClientRTUoverIP::pendingRequests() {
+  LOCK_GUARD(lockGuard, qLock);
+  return MT_pending;
+}
+
+// makeTarget: fill a socket address from host and port
+sockaddr_in ModbusClientRTUoverIP::makeTarget(IPAddress host, uint16_t port) {
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(uint32_t(host));
+  addr.sin_port = htons(port);
+  return addr;
+}
+
+// Base addRequest for preformatted ModbusMessage and last set target
+Error ModbusClientRTUoverIP::addRequestM(ModbusMessage msg, uint32_t token) {
+  Error rc = SUCCESS;        // Return value
+
+  // Add it to the queue, if valid
+  if (msg) {
+    sockaddr_in target;
+    uint32_t timeout;
+    {
+      LOCK_GUARD(lockGuard, qLock);
+      target = MT_target;
+      timeout = MT_targetTimeout;
+    }
+    // Queue add successful?
+    if (!addToQueue(token, std::move(msg), target, timeout)) {
+      // No. Return error
+      rc = REQUEST_QUEUE_FULL;
+    }
+  }
+
+  LOG_D("Add RTU over IP request result: %02X\n", rc);
+  return rc;
+}
+
+// addRequest for preformatted ModbusMessage and adhoc target
+Error ModbusClientRTUoverIP::addRequestMT(ModbusMessage msg, uint32_t token, IPAddress targetHost, uint16_t targetPort) {
+  Error rc = SUCCESS;        // Return value
+
+  // Add it to the queue, if valid
+  if (msg) {
+    // Queue add successful?
+    if (!addToQueue(token, std::move(msg), makeTarget(targetHost, targetPort), MT_defaultTimeout)) {
+      // No. Return error
+      rc = REQUEST_QUEUE_FULL;
+    }
+  }
+
+  LOG_D("Add RTU over IP request result: %02X\n", rc);
+  return rc;
+}
+
+// Base syncRequest follows the same pattern
+ModbusMessage ModbusClientRTUoverIP::syncRequestM(ModbusMessage msg, uint32_t token) {
+  ModbusMessage response;
+
+  if (msg) {
+    // Keep server ID and function code, msg will be moved into the queue
+    uint8_t serverID = msg.getServerID();
+    uint8_t functionCode = msg.getFunctionCode();
+    sockaddr_in target;
+    uint32_t timeout;
+    {
+      LOCK_GUARD(lockGuard, qLock);
+      target = MT_target;
+      timeout = MT_targetTimeout;
+    }
+    // Queue add successful?
+    if (!addToQueue(token, std::move(msg), target, timeout, true)) {
+      // No. Return error
+      response.setError(serverID, functionCode, REQUEST_QUEUE_FULL);
+    } else {
+      // Request is queued - wait for the result.
+      response = waitSync(serverID, functionCode, token);
+    }
+  } else {
+    response.setError(msg.getServerID(), msg.getFunctionCode(), EMPTY_MESSAGE);
+  }
+  return response;
+}
+
+// syncRequest with adhoc target parameters
+ModbusMessage ModbusClientRTUoverIP::syncRequestMT(ModbusMessage msg, uint32_t token, IPAddress targetHost, uint16_t targetPort) {
+  ModbusMessage response;
+
+  if (msg) {
+    // Keep server ID and function code, msg will be moved into the queue
+    uint8_t serverID = msg.getServerID();
+    uint8_t functionCode = msg.getFunctionCode();
+    // Queue add successful?
+    if (!addToQueue(token, std::move(msg), makeTarget(targetHost, targetPort), MT_defaultTimeout, true)) {
+      // No. Return error
+      response.setError(serverID, functionCode, REQUEST_QUEUE_FULL);
+    } else {
+      // Request is queued - wait for the result.
+      response = waitSync(serverID, functionCode, token);
+    }
+  } else {
+    response.setError(msg.getServerID(), msg.getFunctionCode(), EMPTY_MESSAGE);
+  }
+  return response;
+}
+
+// addToQueue: send freshly created request to queue
+bool ModbusClientRTUoverIP::addToQueue(uint32_t token, ModbusMessage request, const sockaddr_in& target, uint32_t timeout, bool syncReq) {
+  bool rc = false;
+  HEXDUMP_D("Enqueue", request.data(), request.size());
+  // Server ID, function code and CRC must fit into a RTU frame
+  if (request && request.size() <= 254) {
+    LOCK_GUARD(lockGuard, qLock);
+    if (MT_pending < MT_qLimit) {
+      requests.push_back(new RequestEntry(token, std::move(request), target, timeout, syncReq));
+      MT_pending++;
+      rc = true;
+    }
+  }
+  if (rc) {
+    LOCK_GUARD(cntLock, countAccessM);
+    messageCount++;
+  }
+  return rc;
+}
+
+// handleConnection: worker thread
+// Sends what the pipeline takes, reads what has arrived and times out what is overdue
+void ModbusClientRTUoverIP::handleConnection(ModbusClientRTUoverIP *instance) {
+  while (1) {
+    bool active = instance->send();
+    active |= instance->receive();
+    instance->expire();
+    // Nothing to do? Wait for data or a new request
+    if (!active) instance->idle();
+  }
+}
+
+// idle: wait for data - or only yield if busy-polling
+void ModbusClientRTUoverIP::idle() {
+  if (busyPoll) {
+    // yield() is no cancellation point - the destructor would wait forever for an idle worker
+    pthread_testcancel();
+    std::this_thread::yield();
+    return;
+  }
+  // New requests are not signalled on the socket, so do not sleep longer than the TCP client would
+  if (MT_socket >= 0) {
+    pollfd pfd = { MT_socket, POLLIN, 0 };
+    poll(&pfd, 1, 1);
+  } else {
+    delay(1);
+  }
+}
+
+// inFlightTo: number of requests waiting for a response from target
+uint16_t ModbusClientRTUoverIP::inFlightTo(const sockaddr_in& target) {
+  uint16_t cnt = 0;
+  for (auto r : inFlight) {
+    if (sameHost(r->target, target)) cnt++;
+  }
+  return cnt;
+}
+
+// connectTo: open a TCP connection to target
+bool ModbusClientRTUoverIP::connectTo(const sockaddr_in& target, uint32_t timeout) {
+  MT_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (MT_socket < 0) {
+    LOG_E("Could not create TCP socket: %s\n", strerror(errno));
+    return false;
+  }
+  int one = 1;
+  setsockopt(MT_socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  // Do not wait longer for the connection than for a response
+  int rc = connect(MT_socket, (const sockaddr *)&target, sizeof(target));
+  if (rc < 0 && errno == EINPROGRESS) {
+    pollfd pfd = { MT_socket, POLLOUT, 0 };
+    rc = -1;
+    if (poll(&pfd, 1, timeout) > 0) {
+      int err = 0;
+      socklen_t len = sizeof(err);
+      getsockopt(MT_socket, SOL_SOCKET, SO_ERROR, &err, &len);
+      if (err == 0) rc = 0;
+    }
+  }
+  if (rc < 0) {
+    LOG_D("Connect failed\n");
+    close(MT_socket);
+    MT_socket = -1;
+    return false;
+  }
+  MT_peer = target;
+  MT_rxLen = 0;
+  LOG_D("Connected to %s:%d\n", inet_ntoa(target.sin_addr), ntohs(target.sin_port));
+  return true;
+}
+
+// disconnect: close the TCP connection, failing all requests waiting for a response
+void ModbusClientRTUoverIP::disconnect(Error e) {
+  if (MT_socket >= 0) close(MT_socket);
+  MT_socket = -1;
+  MT_rxLen = 0;
+  while (!inFlight.empty()) {
+    RequestEntry *request = inFlight.front();
+    inFlight.pop_front();
+    ModbusMessage response;
+    response.setError(request->msg.getServerID(), request->msg.getFunctionCode(), e);
+    respond(request, std::move(response));
+  }
+}
+
+// send: send queued requests as far as the pipeline allows
+bool ModbusClientRTUoverIP::send() {
+  bool sentAny = false;
+  while (1) {
+    RequestEntry *request = nullptr;
+    {
+      LOCK_GUARD(lockGuard, qLock);
+      if (!requests.empty()) request = requests.front();
+    }
+    if (!request) break;
+    // Requests are sent in order, so the first one not fitting into its pipeline will hold the others
+    if (inFlightTo(request->target) >= MT_pipeline) break;
+
+    bool ok = true;
+    if (MT_transport == RTU_OVER_TCP) {
+      // Another host? The connection can only be switched after all responses have arrived
+      if (MT_socket >= 0 && !sameHost(MT_peer, request->target)) {
+        if (!inFlight.empty()) break;
+        LOG_D("Target different, disconnect\n");
+        disconnect(IP_CONNECTION_FAILED);
+      }
+      if (MT_socket < 0) ok = connectTo(request->target, request->timeout);
+    }
+
+    if (ok) {
+      // Assemble the frame: request and CRC
+      uint8_t frame[256];
+      uint16_t len = request->msg.size();
+      memcpy(frame, request->msg.data(), len);
+      uint16_t crc = RTUutils::calcCRC(frame, len);
+      frame[len++] = crc & 0xFF;
+      frame[len++] = (crc >> 8) & 0xFF;
+      ssize_t rc;
+      if (MT_transport == RTU_OVER_TCP) {
+        rc = ::send(MT_socket, frame, len, MSG_NOSIGNAL);
+        // A frame is small - a full socket buffer will have drained soon
+        while (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+          pollfd pfd = { MT_socket, POLLOUT, 0 };
+          if (poll(&pfd, 1, request->timeout) <= 0) break;
+          rc = ::send(MT_socket, frame, len, MSG_NOSIGNAL);
+        }
+      } else {
+        rc = sendto(MT_socket, frame, len, 0, (const sockaddr *)&request->target, sizeof(request->target));
+        // Socket buffer full? Then try again later
+        if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)) break;
+      }
+      HEXDUMP_V("Request frame", frame, len);
+      if (rc != len) {
+        LOG_E("RTU over IP send failed: %s\n", rc < 0 ? strerror(errno) : "incomplete");
+        ok = false;
+      }
+    }
+
+    {
+      LOCK_GUARD(lockGuard, qLock);
+      requests.pop_front();
+    }
+    sentAny = true;
+    if (!ok) {
+      // The connection is unusable
+      if (MT_transport == RTU_OVER_TCP) disconnect(IP_CONNECTION_FAILED);
+      ModbusMessage response;
+      response.setError(request->msg.getServerID(), request->msg.getFunctionCode(), IP_CONNECTION_FAILED);
+      respond(request, std::move(response));
+    } else if (request->msg.getServerID() == 0) {
+      // A broadcast will get no response
+      delete request;
+      LOCK_GUARD(lockGuard, qLock);
+      MT_pending--;
+    } else {
+      request->sentAt = millis();
+      inFlight.push_back(request);
+    }
+  }
+  return sentAny;
+}
+
+// receive: read and hand out responses
+bool ModbusClientRTUoverIP::receive() {
+  if (MT_socket < 0) return false;
+
+  if (MT_transport == RTU_OVER_UDP) {
+    // One frame per datagram
+    uint8_t data[300];
+    bool hadData = false;
+    sockaddr_in from;
+    socklen_t fromLen = sizeof(from);
+    ssize_t got;
+    while ((got = recvfrom(MT_socket, data, sizeof(data), MSG_DONTWAIT, (sockaddr *)&from, &fromLen)) >= 0) {
+      hadData = true;
+      handleFrame(data, got, from);
+      fromLen = sizeof(from);
+    }
+    return hadData;
+  }
+
+  // TCP: collect the stream and cut it into frames
+  ssize_t got = recv(MT_socket, MT_rx + MT_rxLen, sizeof(MT_rx) - MT_rxLen, MSG_DONTWAIT);
+  if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+    LOG_D("Connection closed by server\n");
+    disconnect(IP_CONNECTION_FAILED);
+    return true;
+  }
+  if (got < 0) {
+    // No data. Drop the rest of an incomplete frame after a while
+    if (MT_rxLen && millis() - MT_lastRx > RTUIP_FRAMEGAP) {
+      HEXDUMP_V("Incomplete frame dropped", MT_rx, MT_rxLen);
+      MT_rxLen = 0;
+    }
+    return false;
+  }
+  MT_rxLen += got;
+  MT_lastRx = millis();
+  uint16_t used = 0;
+  while (used < MT_rxLen) {
+    int len = RTUutils::frameLength(MT_rx + used, MT_rxLen - used, true);
+    if (len == 0) break;
+    if (len < 0) {
+      // No valid frame - the stream is out of sync. Start over with the next data
+      HEXDUMP_V("Invalid data dropped", MT_rx + used, MT_rxLen - used);
+      used = MT_rxLen;
+      break;
+    }
+    handleFrame(MT_rx + used, len, MT_peer);
+    used += len;
+  }
+  if (used) {
+    memmove(MT_rx, MT_rx + used, MT_rxLen - used);
+    MT_rxLen -= used;
+  }
+  return true;
+}
+
+// handleFrame: match a received frame to a request and hand it out
+void ModbusClientRTUoverIP::handleFrame(const uint8_t *data, uint16_t len, const sockaddr_in& from) {
+  HEXDUMP_V("Response frame", data, len);
+  bool crcOK = (len >= 4 && RTUutils::validCRC(data, len));
+  // Find the oldest request to the sender this is the response to. A broken frame goes to the oldest one.
+  auto match = inFlight.end();
+  for (auto it = inFlight.begin(); it != inFlight.end(); ++it) {
+    if (!sameHost((*it)->target, from)) continue;
+    if (!crcOK || ((*it)->msg.getServerID() == data[0] && (*it)->msg.getFunctionCode() == (data[1] & 0x7F))) {
+      match = it;
+      break;
+    }
+  }
+  if (match == inFlight.end()) {
+    LOG_D("Response without request dropped\n");
+    return;
+  }
+  RequestEntry *request = *match;
+  // Earlier requests to the same host were skipped - the serial line answers in order, they will get no response
+  for (auto it = inFlight.begin(); it != match; ) {
+    if (sameHost((*it)->target, from)) {
+      RequestEntry *skipped = *it;
+      it = inFlight.erase(it);
+      ModbusMessage response;
+      response.setError(skipped->msg.getServerID(), skipped->msg.getFunctionCode(), TIMEOUT);
+      respond(skipped, std::move(response));
+    } else {
+      ++it;
+    }
+  }
+  inFlight.erase(match);
+
+  ModbusMessage response;
+  if (!crcOK) {
+    response.setError(request->msg.getServerID(), request->msg.getFunctionCode(), CRC_ERROR);
+  } else {
+    // Check server ID, function code and length against the request
+    Error e = PDUutils::checkResponse(data, len - 2, request->msg);
+    if (e != SUCCESS) {
+      // Not matching, report error
+      response.setError(request->msg.getServerID(), request->msg.getFunctionCode(), e);
+    } else {
+      // Looks good.
+      response.add(data, len - 2);
+    }
+  }
+  respond(request, std::move(response));
+}
+
+// expire: answer requests with TIMEOUT that waited too long
+void ModbusClientRTUoverIP::expire() {
+  unsigned long now = millis();
+  // Timeouts are in milliseconds - one check per tick is enough
+  if (now == MT_lastExpire) return;
+  MT_lastExpire = now;
+  for (auto it = inFlight.begin(); it != inFlight.end(); ) {
+    RequestEntry *request = *it;
+    if (now - request->sentAt >= request->timeout) {
+      it = inFlight.erase(it);
+      ModbusMessage response;
+      response.setError(request->msg.getServerID(), request->msg.getFunctionCode(), TIMEOUT);
+      respond(request, std::move(response));
+    } else {
+      ++it;
+    }
+  }
+}
+
+// respond: hand out the response to a request and delete it
+void ModbusClientRTUoverIP::respond(RequestEntry *request, ModbusMessage response) {
+  // Did we get a normal response?
+  if (response.getError() == SUCCESS) {
+    LOG_D("Data response.\n");
+    // Yes. Is it a synchronous request?
+    if (request->isSyncRequest) {
+      // Yes. Put the response into the response map
+      LOCK_GUARD(sL, syncRespM);
+      syncResponse[request->token] = std::move(response);
+    // No, async request. Do we have an onResponse handler?
+    } else if (onResponse) {
+      // Yes. Call it.
+      onResponse(std::move(response), request->token);
+    // No, but do we have an onData handler registered?
+    } else if (onData) {
+      // Yes. call it
+      onData(std::move(response), request->token);
+    } else {
+      LOG_D("No handler for response!\n");
+    }
+  } else {
+    // No, something went wrong. All we have is an error
+    LOG_D("Error response.\n");
+    // Count it
+    {
+      LOCK_GUARD(responseCnt, countAccessM);
+      errorCount++;
+    }
+    // Is it a synchronous request?
+    if (request->isSyncRequest) {
+      // Yes. Put the response into the response map
+      LOCK_GUARD(sL, syncRespM);
+      syncResponse[request->token] = std::move(response);
+    // No, but do we have an onResponse handler?
+    } else if (onResponse) {
+      // Yes, call it.
+      onResponse(std::move(response), request->token);
+    // No, but do we have an onError handler?
+    } else if (onError) {
+      // Yes. Forward the error code to it
+      onError(response.getError(), request->token);
+    } else {
+      LOG_D("No onError handler\n");
+    }
+  }
+  delete request;
+  LOCK_GUARD(lockGuard, qLock);
+  MT_pending--;
+}
+
+#endif  // IS_LINUX
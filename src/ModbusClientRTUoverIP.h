@@ -0,0 +1,151 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _MODBUS_CLIENT_RTU_OVER_IP_H
+#define _MODBUS_CLIENT_RTU_OVER_IP_H
+
+#include "options.h"
+
+#if IS_LINUX
+#include <netinet/in.h>
+#include <deque>
+#include <list>
+#include "ModbusClient.h"
+#include "IPAddress.h"
+
+#define DEFAULTTIMEOUT 2000
+#define RTUIP_FRAMEGAP 50         // ms without data that end an incomplete frame in a TCP stream
+
+// ModbusClientRTUoverIP: Modbus RTU frames - server ID, function code, data and CRC, no MBAP header -
+// over a TCP connection or in UDP datagrams, as serial device servers forward them from their serial line.
+// With TCP, the connection to the target is kept open until another target is addressed.
+// A RTU frame has no transaction ID, so responses are matched to the requests by order, server ID and
+// function code. By default one request is sent at a time. If the device server queues requests for its
+// serial line, setPipeline() lets more requests be sent before the first one was answered - the serial
+// line answers in order, so a response will end the wait for all earlier requests to the same host.
+// Linux only.
+class ModbusClientRTUoverIP : public ModbusClient {
+public:
+  // Constructor takes the transport and the limit of requests queued or waiting for a response
+  explicit ModbusClientRTUoverIP(RTUtransport transport = RTU_OVER_TCP, uint16_t queueLimit = 100);
+
+  // Alternative Constructor takes initial target host
+  ModbusClientRTUoverIP(IPAddress host, uint16_t port, RTUtransport transport = RTU_OVER_TCP, uint16_t queueLimit = 100);
+
+  // Destructor: clean up queue, thread and socket
+  ~ModbusClientRTUoverIP();
+
+  // begin: start the worker thread. coreID >= 0 will pin the thread to that CPU
+  void begin(int coreID = -1);
+
+  // setBusyPoll: spin on the socket instead of sleeping in poll(). May be switched while running.
+  void setBusyPoll(bool busy);
+
+  // Set default timeout value
+  void setTimeout(uint32_t timeout = DEFAULTTIMEOUT);
+
+  // Set target host for the following requests
+  void setTarget(IPAddress host, uint16_t port, uint32_t timeout = 0);
+
+  // setPipeline: number of requests per host sent before the first of them was answered (1..255)
+  void setPipeline(uint8_t depth);
+
+  // Return number of requests queued or waiting for a response
+  uint32_t pendingRequests();
+
+protected:
+  struct RequestEntry {
+    uint32_t token;
+    ModbusMessage msg;
+    sockaddr_in target;           // Target host and port
+    uint32_t timeout;             // Time in ms waiting for the response
+    unsigned long sentAt;         // millis() when the request was sent
+    bool isSyncRequest;
+    RequestEntry(uint32_t t, ModbusMessage m, const sockaddr_in& tg, uint32_t to, bool syncReq = false) :
+      token(t),
+      msg(std::move(m)),
+      target(tg),
+      timeout(to),
+      sentAt(0),
+      isSyncRequest(syncReq) {}
+  };
+
+  // Prevent copy construction and assignment
+  ModbusClientRTUoverIP(ModbusClientRTUoverIP& m) = delete;
+  ModbusClientRTUoverIP& operator=(ModbusClientRTUoverIP& m) = delete;
+
+  // Base addRequest and syncRequest must be present
+  Error addRequestM(ModbusMessage msg, uint32_t token);
+  ModbusMessage syncRequestM(ModbusMessage msg, uint32_t token);
+  // Addition "...MT()" including adhoc target
+  Error addRequestMT(ModbusMessage msg, uint32_t token, IPAddress targetHost, uint16_t targetPort);
+  ModbusMessage syncRequestMT(ModbusMessage msg, uint32_t token, IPAddress targetHost, uint16_t targetPort);
+
+  // addToQueue: send freshly created request to queue
+  bool addToQueue(uint32_t token, ModbusMessage request, const sockaddr_in& target, uint32_t timeout, bool syncReq = false);
+
+  // handleConnection: worker thread method
+  static void handleConnection(ModbusClientRTUoverIP *instance);
+  static void *pHandle(void *p);
+
+  // send: send queued requests as far as the pipeline allows. Returns true if any was sent
+  bool send();
+
+  // receive: read and hand out responses. Returns true if any data was read
+  bool receive();
+
+  // handleFrame: match a received frame to a request and hand it out
+  void handleFrame(const uint8_t *data, uint16_t len, const sockaddr_in& from);
+
+  // expire: answer requests with TIMEOUT that waited too long
+  void expire();
+
+  // connectTo: open a TCP connection to target, waiting timeout ms at most
+  bool connectTo(const sockaddr_in& target, uint32_t timeout);
+
+  // disconnect: close the TCP connection, failing all requests waiting for a response
+  void disconnect(Error e);
+
+  // inFlightTo: number of requests waiting for a response from target
+  uint16_t inFlightTo(const sockaddr_in& target);
+
+  // respond: hand out the response to a request and delete it
+  void respond(RequestEntry *request, ModbusMessage response);
+
+  // idle: wait for data - or only yield if busy-polling
+  void idle();
+
+  // makeTarget: fill a socket address from host and port
+  static sockaddr_in makeTarget(IPAddress host, uint16_t port);
+
+  // sameHost: true if both addresses have the same IP and port
+  static inline bool sameHost(const sockaddr_in& a, const sockaddr_in& b) {
+    return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+  }
+
+  void isInstance() { return; }   // make class instantiable
+  std::deque<RequestEntry *> requests;    // Requests not sent yet
+  std::list<RequestEntry *> inFlight;     // Sent requests in order, worker only
+  mutex qLock;                    // Mutex to protect queue and pending count
+  uint32_t MT_pending;            // Requests queued or in flight
+  RTUtransport MT_transport;      // TCP or UDP
+  int MT_socket;                  // TCP connection or UDP socket, -1 if none
+  sockaddr_in MT_peer;            // Host of the TCP connection
+  sockaddr_in MT_target;          // Target for requests without an adhoc one
+  uint32_t MT_targetTimeout;      // Timeout for MT_target
+  uint32_t MT_defaultTimeout;     // Standard timeout value taken if no dedicated was set
+  uint16_t MT_qLimit;             // Maximum number of requests queued or in flight
+  uint8_t MT_pipeline;            // Maximum number of requests in flight per host
+  unsigned long MT_lastExpire;    // millis() of the last timeout check
+  uint8_t MT_rx[512];             // TCP stream data not processed yet
+  uint16_t MT_rxLen;              // Bytes in MT_rx
+  unsigned long MT_lastRx;        // millis() when data was read last
+
+  // Let any ModbusBridge class use protected members
+  template<typename SERVERCLASS> friend class ModbusBridge;
+};
+
+#endif  // IS_LINUX
+
+#endif  // INCLUDE GUARD
@@ -3,6 +3,7 @@
 //               MIT license - see license.md for details
 // =================================================================================================
 #include "ModbusClientTCP.h"
+#include "PDUutils.h"
 
 #if HAS_FREERTOS || IS_LINUX
 
@@ -19,6 +20,9 @@ ModbusClientTCP::ModbusClientTCP(Client& client, uint16_t queueLimit) :
   MT_defaultTimeout(DEFAULTTIMEOUT),
   MT_defaultInterval(TARGETHOSTINTERVAL),
   MT_qLimit(queueLimit)
+#if IS_LINUX
+  , MT_priority(0)
+#endif
   { }
 
 // Alternative Constructor takes reference to Client (EthernetClient or WiFiClient) plus initial target host
@@ -30,26 +34,33 @@ ModbusClientTCP::ModbusClientTCP(Client& client, IPAddress host, uint16_t port,
   MT_defaultTimeout(DEFAULTTIMEOUT),
   MT_defaultInterval(TARGETHOSTINTERVAL),
   MT_qLimit(queueLimit)
+#if IS_LINUX
+  , MT_priority(0)
+#endif
   { }
 
 // Destructor: clean up queue, task etc.
 ModbusClientTCP::~ModbusClientTCP() {
+  // Kill task first - if begin() was called at all. It uses the front queue entry without the lock
+  if (worker) {
+#if IS_LINUX
+    pthread_cancel(worker);
+    pthread_join(worker, NULL);
+#else
+    vTaskDelete(worker);
+#endif
+  }
+  LOG_D("TCP client worker killed.\n");
   // Clean up queue
   {
     // Safely lock access
     LOCK_GUARD(lockGuard, qLock);
     // Get all queue entries one by one
     while (!requests.empty()) {
+      delete requests.front();
       requests.pop();
     }
   }
-  LOG_D("TCP client worker killed.\n");
-  // Kill task
-#if IS_LINUX
-  pthread_cancel(worker);
-#else
-  vTaskDelete(worker);
-#endif
 }
 
 // begin: start worker task
@@ -62,7 +73,30 @@ void *ModbusClientTCP::pHandle(void *p) {
 
 void ModbusClientTCP::begin(int coreID) {
 #if IS_LINUX
-  int rc = pthread_create(&worker, NULL, &pHandle, this);
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  // Pin the worker to a CPU?
+  if (coreID >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(coreID, &cpus);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+  }
+  // Realtime scheduling?
+  if (MT_priority > 0) {
+    struct sched_param param;
+    param.sched_priority = MT_priority;
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+  }
+  int rc = pthread_create(&worker, &attr, &pHandle, this);
+  pthread_attr_destroy(&attr);
+  // Lacking the permission or an invalid CPU will fail - try again without
+  if (rc && (coreID >= 0 || MT_priority > 0)) {
+    LOG_E("Could not apply core %d/priority %d to TCP client thread: %s\n", coreID, MT_priority, strerror(rc));
+    rc = pthread_create(&worker, NULL, &pHandle, this);
+  }
   if (rc) {
     LOG_E("Error creating TCP client thread: %d\n", rc);
   } else {
@@ -79,6 +113,18 @@ void ModbusClientTCP::begin(int coreID) {
 #endif
 }
 
+#if IS_LINUX
+// setPriority: set the SCHED_FIFO priority for the worker thread
+void ModbusClientTCP::setPriority(int priority) {
+  MT_priority = (priority < 0) ? 0 : (priority > 99) ? 99 : priority;
+}
+
+// setBusyPoll: switch between sleeping and spinning while waiting
+void ModbusClientTCP::setBusyPoll(bool busy) {
+  busyPoll = busy;
+}
+#endif
+
 // Set default timeout value (and interval)
 void ModbusClientTCP::setTimeout(uint32_t timeout, uint32_t interval) {
   MT_defaultTimeout = timeout;
@@ -109,7 +155,7 @@ Error ModbusClientTCP::addRequestM(ModbusMessage msg, uint32_t token) {
   // Add it to the queue, if valid
   if (msg) {
     // Queue add successful?
-    if (!addToQueue(token, msg, MT_target)) {
+    if (!addToQueue(token, std::move(msg), MT_target)) {
       // No. Return error after deleting the allocated request.
       rc = REQUEST_QUEUE_FULL;
     }
@@ -128,7 +174,7 @@ Error ModbusClientTCP::addRequestMT(ModbusMessage msg, uint32_t token, IPAddress
     // Set up adhoc target 
     TargetHost adhocTarget(targetHost, targetPort, MT_defaultTimeout, MT_defaultInterval);
     // Queue add successful?
-    if (!addToQueue(token, msg, adhocTarget, true)) {
+    if (!addToQueue(token, std::move(msg), adhocTarget, true)) {
       // No. Return error after deleting the allocated request.
       rc = REQUEST_QUEUE_FULL;
     }
@@ -143,13 +189,16 @@ ModbusMessage ModbusClientTCP::syncRequestM(ModbusMessage msg, uint32_t token) {
   ModbusMessage response;
 
   if (msg) {
+    // Keep server ID and function code, msg will be moved into the queue
+    uint8_t serverID = msg.getServerID();
+    uint8_t functionCode = msg.getFunctionCode();
     // Queue add successful?
-    if (!addToQueue(token, msg, MT_target, true)) {
+    if (!addToQueue(token, std::move(msg), MT_target, true)) {
       // No. Return error after deleting the allocated request.
-      response.setError(msg.getServerID(), msg.getFunctionCode(), REQUEST_QUEUE_FULL);
+      response.setError(serverID, functionCode, REQUEST_QUEUE_FULL);
     } else {
       // Request is queued - wait for the result.
-      response = waitSync(msg.getServerID(), msg.getFunctionCode(), token);
+      response = waitSync(serverID, functionCode, token);
     }
   } else {
     response.setError(msg.getServerID(), msg.getFunctionCode(), EMPTY_MESSAGE);
@@ -164,13 +213,16 @@ ModbusMessage ModbusClientTCP::syncRequestMT(ModbusMessage msg, uint32_t token,
   if (msg) {
     // Set up adhoc target 
     TargetHost adhocTarget(targetHost, targetPort, MT_defaultTimeout, MT_defaultInterval);
+    // Keep server ID and function code, msg will be moved into the queue
+    uint8_t serverID = msg.getServerID();
+    uint8_t functionCode = msg.getFunctionCode();
     // Queue add successful?
-    if (!addToQueue(token, msg, adhocTarget, true)) {
+    if (!addToQueue(token, std::move(msg), adhocTarget, true)) {
       // No. Return error after deleting the allocated request.
-      response.setError(msg.getServerID(), msg.getFunctionCode(), REQUEST_QUEUE_FULL);
+      response.setError(serverID, functionCode, REQUEST_QUEUE_FULL);
     } else {
       // Request is queued - wait for the result.
-      response = waitSync(msg.getServerID(), msg.getFunctionCode(), token);
+      response = waitSync(serverID, functionCode, token);
     }
   } else {
     response.setError(msg.getServerID(), msg.getFunctionCode(), EMPTY_MESSAGE);
@@ -186,10 +238,11 @@ bool ModbusClientTCP::addToQueue(uint32_t token, ModbusMessage request, TargetHo
   HEXDUMP_D("Enqueue", request.data(), request.size());
   if (request) {
     if (requests.size()<MT_qLimit) {
-      RequestEntry *re = new RequestEntry(token, request, target, syncReq);
+      uint16_t len = request.size();
+      RequestEntry *re = new RequestEntry(token, std::move(request), target, syncReq);
       // inject proper transactionID
       re->head.transactionID = messageCount++;
-      re->head.len = request.size();
+      re->head.len = len;
       // Safely lock queue and push request to queue
       rc = true;
       LOCK_GUARD(lockGuard, qLock);
@@ -228,14 +281,19 @@ void ModbusClientTCP::handleConnection(ModbusClientTCP *instance) {
         } else {
           // it is the same host/port.
           // Give it some slack to get ready again
-          while (millis() - lastRequest < request->target.interval) { delay(1); }
+          while (millis() - lastRequest < request->target.interval) { instance->idle(); }
         }
       }
       // if client is disconnected (we will have to switch hosts)
       if (!instance->MT_client.connected()) {
         // Serial.println("Client reconnecting");
         // It is disconnected. connect to host/port from queue
+#if IS_LINUX
+        // Do not wait longer for the connection than for a response
+        instance->MT_client.connect(request->target.host, request->target.port, request->target.timeout);
+#else
         instance->MT_client.connect(request->target.host, request->target.port);
+#endif
         LOG_D("Target connect (%d.%d.%d.%d:%d).\n", request->target.host[0], request->target.host[1], request->target.host[2], request->target.host[3], request->target.port);
 
         delay(1);  // Give scheduler room to breathe
@@ -245,10 +303,14 @@ void ModbusClientTCP::handleConnection(ModbusClientTCP *instance) {
       if (instance->MT_client.connected()) {
         LOG_D("Is connected. Send request.\n");
         // Yes. Send the request via IP
-        instance->send(request);
+        Error e = instance->send(request);
 
         // Get the response - if any
-        response = instance->receive(request);
+        if (e == SUCCESS) {
+          response = instance->receive(request);
+        } else {
+          response.setError(request->msg.getServerID(), request->msg.getFunctionCode(), e);
+        }
 
         // Did we get a normal response?
         if (response.getError()==SUCCESS) {
@@ -258,16 +320,16 @@ void ModbusClientTCP::handleConnection(ModbusClientTCP *instance) {
             // Yes. Put the response into the response map
             {
               LOCK_GUARD(sL, instance->syncRespM);
-              instance->syncResponse[request->token] = response;
+              instance->syncResponse[request->token] = std::move(response);
             }
           // No, async request. Do we have an onResponse handler?
           } else if (instance->onResponse) {
             // Yes. Call it.
-            instance->onResponse(response, request->token);
+            instance->onResponse(std::move(response), request->token);
           // No, but do we have an onData handler registered?
           } else if (instance->onData) {
             // Yes. call it
-            instance->onData(response, request->token);
+            instance->onData(std::move(response), request->token);
           } else {
             LOG_D("No handler for response!\n");
           }
@@ -284,12 +346,12 @@ void ModbusClientTCP::handleConnection(ModbusClientTCP *instance) {
             // Yes. Put the response into the response map
             {
               LOCK_GUARD(sL, instance->syncRespM);
-              instance->syncResponse[request->token] = response;
+              instance->syncResponse[request->token] = std::move(response);
             }
           // No, but do we have an onResponse handler?
           } else if (instance->onResponse) {
             // Yes, call it.
-            instance->onResponse(response, request->token);
+            instance->onResponse(std::move(response), request->token);
           // No, but do we have an onError handler?
           } else if (instance->onError) {
             // Yes. Forward the error code to it
@@ -308,12 +370,12 @@ void ModbusClientTCP::handleConnection(ModbusClientTCP *instance) {
           // Yes. Put the response into the response map
           {
             LOCK_GUARD(sL, instance->syncRespM);
-            instance->syncResponse[request->token] = response;
+            instance->syncResponse[request->token] = std::move(response);
           }
         // No, but do we have an onResponse handler?
         } else if (instance->onResponse) {
           // Yes, call it.
-          instance->onResponse(response, request->token);
+          instance->onResponse(std::move(response), request->token);
         // Finally, do we have an onError handler?
         } else if (instance->onError) {
           // Yes. Forward the error code to it
@@ -333,24 +395,52 @@ void ModbusClientTCP::handleConnection(ModbusClientTCP *instance) {
       }
       lastRequest = millis();
     } else {
-      delay(1);  // Give scheduler room to breathe
+      instance->idle();
     }
   }
 }
 
+// idle: wait before polling again - or only yield if busy-polling
+void ModbusClientTCP::idle() {
+#if IS_LINUX
+  if (busyPoll) {
+    // yield() is no cancellation point - the destructor would wait forever for an idle worker
+    pthread_testcancel();
+    std::this_thread::yield();
+    return;
+  }
+#endif
+  delay(1);  // Give scheduler room to breathe
+}
+
 // send: send request via Client connection
-void ModbusClientTCP::send(RequestEntry *request) {
+Error ModbusClientTCP::send(RequestEntry *request) {
   // We have a established connection here, so we can write right away.
-  // Move tcpHead and request into one continuous buffer, since the very first request tends to 
-  // take too long to be sent to be recognized.
-  ModbusMessage m;
-  m.add((const uint8_t *)request->head, 6);
-  m.append(request->msg);
+  // TCP head and request are kept in separate segments, no need to copy them together.
+  ModbusSegments frame;
+  frame.add((const uint8_t *)request->head, 6);
+  frame.add(request->msg);
 
-  MT_client.write(m.data(), m.size());
+#if IS_LINUX
+  // The Linux Client will gather the segments in a single sendmsg() call
+  MT_client.write(frame);
+#else
+  // Other Clients need one continuous buffer, since the very first request tends to 
+  // take too long to be sent to be recognized. Use the stack for it.
+  uint8_t buffer[6 + 256];
+  uint16_t len = frame.copyTo(buffer, sizeof(buffer));
+  // Does not fit? Then do not send a truncated frame
+  if (len != frame.size()) {
+    LOG_E("Request too long (%d bytes)\n", frame.size());
+    return PACKET_LENGTH_ERROR;
+  }
+  MT_client.write(buffer, len);
+#endif
   // Done. Are we?
   MT_client.flush();
-  HEXDUMP_V("Request packet", m.data(), m.size());
+  HEXDUMP_V("Request head", (const uint8_t *)request->head, 6);
+  HEXDUMP_V("Request packet", request->msg.data(), request->msg.size());
+  return SUCCESS;
 }
 
 // receive: get response via Client connection
@@ -367,15 +457,19 @@ ModbusMessage ModbusClientTCP::receive(RequestEntry *request) {
     // Is there data waiting?
     if (MT_client.available()) {
       // Yes. catch as much as is there and fits into buffer
-      while (MT_client.available() && dataPtr < dataLen) {
-        data[dataPtr++] = MT_client.read();
+      int avail;
+      while ((avail = MT_client.available()) > 0 && dataPtr < dataLen) {
+        if (avail > dataLen - dataPtr) avail = dataLen - dataPtr;
+        int got = MT_client.read(data + dataPtr, avail);
+        if (got <= 0) break;
+        dataPtr += got;
       }
       // Register data received
       hadData = true;
       // Rewind EOT and timeout timers
       lastMillis = millis();
     }
-    delay(1); // Give scheduler room to breathe
+    idle();
   }
   // Did we get some data?
   if (hadData) {
@@ -388,15 +482,16 @@ ModbusMessage ModbusClientTCP::receive(RequestEntry *request) {
     if (memcmp((const uint8_t *)head, data, 6)) {
       // No. return Error response
       response.setError(request->msg.getServerID(), request->msg.getFunctionCode(), TCP_HEAD_MISMATCH);
-      // If the server id does not match that of the request, report error
-    } else if (data[6] != request->msg.getServerID()) {
-      response.setError(request->msg.getServerID(), request->msg.getFunctionCode(), SERVER_ID_MISMATCH);
-      // If the function code does not match that of the request, report error
-    } else if ((data[7] & 0x7F) != request->msg.getFunctionCode()) {
-      response.setError(request->msg.getServerID(), request->msg.getFunctionCode(), FC_MISMATCH);
     } else {
-      // Looks good.
-      response.add(data + 6, dataPtr - 6);
+      // Check server ID, function code and length against the request
+      Error e = PDUutils::checkResponse(data + 6, dataPtr - 6, request->msg);
+      if (e != SUCCESS) {
+        // Not matching, report error
+        response.setError(request->msg.getServerID(), request->msg.getFunctionCode(), e);
+      } else {
+        // Looks good.
+        response.add(data + 6, dataPtr - 6);
+      }
     }
   } else {
     // No, timeout must have struck
@@ -13,6 +13,7 @@
 #endif
 
 #include "ModbusClient.h"
+#include "ModbusSegments.h"
 #include "Client.h"
 #include <queue>
 #include <vector>
@@ -32,9 +33,21 @@ public:
   // Destructor: clean up queue, task etc.
   ~ModbusClientTCP();
 
-  // begin: start worker task
+  // begin: start worker task. On Linux, coreID >= 0 will pin the worker thread to that CPU
   void begin(int coreID = -1);
 
+#if IS_LINUX
+  // setPriority: run the worker thread with SCHED_FIFO at priority 1..99, 0 for normal scheduling.
+  // Must be called before begin(). Needs CAP_SYS_NICE (or root), else the worker runs normally.
+  void setPriority(int priority);
+
+  // setBusyPoll: spin on the socket and the response map instead of sleeping between polls.
+  // Lowest latency, but costs a full CPU for the worker and each thread waiting in syncRequest().
+  // May be switched while the client is running. Combined with setPriority(), the worker will starve
+  // any other thread on its CPU - pin it to a CPU of its own with begin(coreID) then.
+  void setBusyPoll(bool busy);
+#endif
+
   // Set default timeout value (and interval)
   void setTimeout(uint32_t timeout = DEFAULTTIMEOUT, uint32_t interval = TARGETHOSTINTERVAL);
 
@@ -140,7 +153,7 @@ protected:
     bool isSyncRequest;
     RequestEntry(uint32_t t, ModbusMessage m, TargetHost tg, bool syncReq = false) :
       token(t),
-      msg(m),
+      msg(std::move(m)),
       target(tg),
       head(ModbusTCPhead()),
       isSyncRequest(syncReq) {}
@@ -162,12 +175,15 @@ protected:
   static void *pHandle(void *p);
 #endif
 
-  // send: send request via Client connection
-  void send(RequestEntry *request);
+  // send: send request via Client connection. Returns SUCCESS or the reason it could not be sent
+  Error send(RequestEntry *request);
 
   // receive: get response via Client connection
   ModbusMessage receive(RequestEntry *request);
 
+  // idle: wait before polling again - or only yield if busy-polling
+  void idle();
+
   void isInstance() { return; }   // make class instantiable
   queue<RequestEntry *> requests;   // Queue to hold requests to be processed
   #if USE_MUTEX
@@ -179,6 +195,9 @@ protected:
   uint32_t MT_defaultTimeout;     // Standard timeout value taken if no dedicated was set
   uint32_t MT_defaultInterval;    // Standard interval value taken if no dedicated was set
   uint16_t MT_qLimit;             // Maximum number of requests to accept in queue
+#if IS_LINUX
+  int MT_priority;                // SCHED_FIFO priority of the worker, 0 for normal scheduling
+#endif
 
   // Let any ModbusBridge class use protected members
   template<typename SERVERCLASS> friend class ModbusBridge;
@@ -3,6 +3,7 @@
 //               MIT license - see license.md for details
 // =================================================================================================
 #include "ModbusClientTCPasync.h"
+#include "PDUutils.h"
 #define LOCAL_LOG_LEVEL LOG_LEVEL_VERBOSE
 // #undef LOCAL_LOG_LEVEL
 #include "Logging.h"
@@ -103,7 +104,7 @@ Error ModbusClientTCPasync::addRequestM(ModbusMessage msg, uint32_t token) {
   // Add it to the queue, if valid
   if (msg) {
     // Queue add successful?
-    if (!addToQueue(token, msg)) {
+    if (!addToQueue(token, std::move(msg))) {
       // No. Return error after deleting the allocated request.
       rc = REQUEST_QUEUE_FULL;
     }
@@ -118,13 +119,16 @@ ModbusMessage ModbusClientTCPasync::syncRequestM(ModbusMessage msg, uint32_t tok
   ModbusMessage response;
 
   if (msg) {
+    // Keep server ID and function code, msg will be moved into the queue
+    uint8_t serverID = msg.getServerID();
+    uint8_t functionCode = msg.getFunctionCode();
     // Queue add successful?
-    if (!addToQueue(token, msg, true)) {
+    if (!addToQueue(token, std::move(msg), true)) {
       // No. Return error after deleting the allocated request.
-      response.setError(msg.getServerID(), msg.getFunctionCode(), REQUEST_QUEUE_FULL);
+      response.setError(serverID, functionCode, REQUEST_QUEUE_FULL);
     } else {
       // Request is queued - wait for the result.
-      response = waitSync(msg.getServerID(), msg.getFunctionCode(), token);
+      response = waitSync(serverID, functionCode, token);
     }
   } else {
     response.setError(msg.getServerID(), msg.getFunctionCode(), EMPTY_MESSAGE);
@@ -139,11 +143,12 @@ bool ModbusClientTCPasync::addToQueue(int32_t token, ModbusMessage request, bool
     LOCK_GUARD(lock1, qLock);
     if (txQueue.size() + rxQueue.size() < MTA_qLimit) {
       HEXDUMP_V("Enqueue", request.data(), request.size());
-      RequestEntry *re = new RequestEntry(token, request, syncReq);
+      uint16_t len = request.size();
+      RequestEntry *re = new RequestEntry(token, std::move(request), syncReq);
       if (!re) return false;  //TODO: proper error returning in case allocation fails
       // inject proper transactionID
       re->head.transactionID = messageCount++;
-      re->head.len = request.size();
+      re->head.len = len;
       // if we're already connected, try to send and push to rxQueue
       // or else push to txQueue and (re)connect
       if (MTA_state == CONNECTED && send(re)) {
@@ -220,7 +225,7 @@ void ModbusClientTCPasync::onPacket(uint8_t* data, size_t length) {
   }
   while (length > 0) {
     RequestEntry* request = nullptr;
-    ModbusMessage* response = nullptr;
+    ModbusMessage response;
     uint16_t transactionID = 0;
     uint16_t protocolID = 0;
     uint16_t messageLength = 0;
@@ -237,8 +242,7 @@ void ModbusClientTCPasync::onPacket(uint8_t* data, size_t length) {
       if (protocolID == 0 &&
         length >= (uint32_t)messageLength + 6 &&
         messageLength < 256) {
-        response = new ModbusMessage(messageLength);
-        response->add(&data[6], messageLength);
+        response.add(&data[6], messageLength);
         LOG_D("packet validated (len:%d)\n", messageLength);
 
         // on next iteration: adjust remaining length and pointer to data
@@ -271,13 +275,12 @@ void ModbusClientTCPasync::onPacket(uint8_t* data, size_t length) {
     // 3. we have a valid request and a valid response, call appropriate callback
     if (request) {
       // compare request with response
-      Error error = SUCCESS;
-      if (request->msg.getFunctionCode() != (response->getFunctionCode() & 0x7F)) {
-        error = FC_MISMATCH;
-      } else if (request->msg.getServerID() != response->getServerID()) {
-        error = SERVER_ID_MISMATCH;
+      Error error = PDUutils::checkResponse(response, request->msg);
+      if (error == SUCCESS) {
+        error = response.getError();
       } else {
-        error = response->getError();
+        // Not matching, report error
+        response.setError(request->msg.getServerID(), request->msg.getFunctionCode(), error);
       }
 
       if (error != SUCCESS) {
@@ -288,24 +291,23 @@ void ModbusClientTCPasync::onPacket(uint8_t* data, size_t length) {
       if (request->isSyncRequest) {
         {
           LOCK_GUARD(sL ,syncRespM);
-          syncResponse[request->token] = *response;
+          syncResponse[request->token] = std::move(response);
         }
       } else if (onResponse) {
-        onResponse(*response, request->token);
+        onResponse(std::move(response), request->token);
       } else {
         if (error == SUCCESS) {
           if (onData) {
-            onData(*response, request->token);
+            onData(std::move(response), request->token);
           }
         } else {
           if (onError) {
-            onError(response->getError(), request->token);
+            onError(error, request->token);
           }
         }
       }
       delete request;
     }
-    delete response;
 
   }  // end processing of incoming data
 
@@ -374,12 +376,18 @@ bool ModbusClientTCPasync::send(RequestEntry* re) {
     return false;
   }
 
+  // TCP header first, request comes next
+  ModbusSegments frame;
+  frame.add((const uint8_t *)(re->head), 6);
+  frame.add(re->msg);
+
   // check if TCP client is able to send
-  if (MTA_client.space() > ((uint32_t)re->msg.size() + 6)) {
-    // Write TCP header first
-    MTA_client.add(reinterpret_cast<const char *>((const uint8_t *)(re->head)), 6, ASYNC_WRITE_FLAG_COPY);
-    // Request comes next
-    MTA_client.add(reinterpret_cast<const char*>(re->msg.data()), re->msg.size(), ASYNC_WRITE_FLAG_COPY);
+  if (MTA_client.space() > frame.size()) {
+    // Hand over the segments. AsyncTCP has to copy them, since the request entry
+    // may be gone before the data has been acknowledged
+    for (auto& segment : frame) {
+      MTA_client.add(reinterpret_cast<const char *>(segment.data), segment.len, ASYNC_WRITE_FLAG_COPY);
+    }
     // done
     MTA_client.send();
     LOG_D("request sent (msgid:%d)\n", re->head.transactionID);
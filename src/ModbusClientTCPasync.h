@@ -13,6 +13,7 @@
 #include "options.h"
 #include "ModbusMessage.h"
 #include "ModbusClient.h"
+#include "ModbusSegments.h"
 #include <list>
 #include <map>
 #include <vector>
@@ -99,7 +100,7 @@ protected:
     bool isSyncRequest;
     RequestEntry(uint32_t t, ModbusMessage m, bool syncReq = false) :
       token(t),
-      msg(m),
+      msg(std::move(m)),
       head(ModbusTCPhead()),
       sentTime(0),
       isSyncRequest(syncReq) {}
@@ -0,0 +1,496 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#include "ModbusClientUDP.h"
+#include "PDUutils.h"
+
+#if IS_LINUX
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#undef LOCAL_LOG_LEVEL
+// #define LOCAL_LOG_LEVEL LOG_LEVEL_VERBOSE
+#include "Logging.h"
+
+// Constructor takes the limit of requests queued or waiting for a response
+ModbusClientUDP::ModbusClientUDP(uint16_t queueLimit) :
+  ModbusClient(),
+  MT_pending(0),
+  MT_socket(-1),
+  MT_target(makeTarget(IPAddress(0, 0, 0, 0), 0)),
+  MT_targetTimeout(DEFAULTTIMEOUT),
+  MT_defaultTimeout(DEFAULTTIMEOUT),
+  MT_qLimit(queueLimit),
+  MT_nextTID(0),
+  MT_priority(0),
+  MT_lastExpire(0)
+  { }
+
+// Alternative Constructor takes initial target host
+ModbusClientUDP::ModbusClientUDP(IPAddress host, uint16_t port, uint16_t queueLimit) :
+  ModbusClient(),
+  MT_pending(0),
+  MT_socket(-1),
+  MT_target(makeTarget(host, port)),
+  MT_targetTimeout(DEFAULTTIMEOUT),
+  MT_defaultTimeout(DEFAULTTIMEOUT),
+  MT_qLimit(queueLimit),
+  MT_nextTID(0),
+  MT_priority(0),
+  MT_lastExpire(0)
+  { }
+
+// Destructor: clean up queue, thread and socket
+ModbusClientUDP::~ModbusClientUDP() {
+  // Kill thread first - if begin() was called at all - it owns the requests in flight
+  if (worker) {
+    pthread_cancel(worker);
+    pthread_join(worker, NULL);
+  }
+  LOG_D("UDP client worker killed.\n");
+  {
+    LOCK_GUARD(lockGuard, qLock);
+    for (auto r : requests) delete r;
+    requests.clear();
+    for (auto& r : inFlight) delete r.second;
+    inFlight.clear();
+  }
+  if (MT_socket >= 0) close(MT_socket);
+}
+
+// begin: open the socket and start the worker thread
+void *ModbusClientUDP::pHandle(void *p) {
+  handleConnection((ModbusClientUDP *)p);
+  return nullptr;
+}
+
+void ModbusClientUDP::begin(int coreID) {
+  // One unconnected socket for all targets
+  MT_socket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (MT_socket < 0) {
+    LOG_E("Could not create UDP socket: %s\n", strerror(errno));
+    return;
+  }
+  sockaddr_in local = makeTarget(IPAddress(0, 0, 0, 0), 0);
+  if (bind(MT_socket, (sockaddr *)&local, sizeof(local)) < 0) {
+    LOG_E("Could not bind UDP socket: %s\n", strerror(errno));
+  }
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  // Pin the worker to a CPU?
+  if (coreID >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(coreID, &cpus);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+  }
+  // Realtime scheduling?
+  if (MT_priority > 0) {
+    struct sched_param param;
+    param.sched_priority = MT_priority;
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+  }
+  int rc = pthread_create(&worker, &attr, &pHandle, this);
+  pthread_attr_destroy(&attr);
+  // Lacking the permission or an invalid CPU will fail - try again without
+  if (rc && (coreID >= 0 || MT_priority > 0)) {
+    LOG_E("Could not apply core %d/priority %d to UDP client thread: %s\n", coreID, MT_priority, strerror(rc));
+    rc = pthread_create(&worker, NULL, &pHandle, this);
+  }
+  if (rc) {
+    LOG_E("Error creating UDP client thread: %d\n", rc);
+  } else {
+    LOG_D("UDP client worker started.\n");
+  }
+}
+
+// setPriority: set the SCHED_FIFO priority for the worker thread
+void ModbusClientUDP::setPriority(int priority) {
+  MT_priority = (priority < 0) ? 0 : (priority > 99) ? 99 : priority;
+}
+
+// setBusyPoll: switch between sleeping and spinning while waiting
+void ModbusClientUDP::setBusyPoll(bool busy) {
+  busyPoll = busy;
+}
+
+// Set default timeout value
+void ModbusClientUDP::setTimeout(uint32_t timeout) {
+  MT_defaultTimeout = timeout;
+}
+
+// Set target host for the following requests
+void ModbusClientUDP::setTarget(IPAddress host, uint16_t port, uint32_t timeout) {
+  LOCK_GUARD(lockGuard, qLock);
+  MT_target = makeTarget(host, port);
+  MT_targetTimeout = timeout ? timeout : MT_defaultTimeout;
+  LOG_D("Target set: %d.%d.%d.%d:%d\n", host[0], host[1], host[2], host[3], port);
+}
+
+// Return number of requests queued or waiting for a response
+uint32_t ModbusClientUDP::pendingRequests() {
+  LOCK_GUARD(lockGuard, qLock);
+  return MT_pending;
+}
+
+// makeTarget: fill a socket address from host and port
+sockaddr_in ModbusClientUDP::makeTarget(IPAddress host, uint16_t port) {
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(uint32_t(host));
+  addr.sin_port = htons(port);
+  return addr;
+}
+
+// Base addRequest for preformatted ModbusMessage and last set target
+Error ModbusClientUDP::addRequestM(ModbusMessage msg, uint32_t token) {
+  Error rc = SUCCESS;        // Return value
+
+  // Add it to the queue, if valid
+  if (msg) {
+    sockaddr_in target;
+    uint32_t timeout;
+    {
+      LOCK_GUARD(lockGuard, qLock);
+      target = MT_target;
+      timeout = MT_targetTimeout;
+    }
+    // Queue add successful?
+    if (!addToQueue(token, std::move(msg), target, timeout)) {
+      // No. Return error
+      rc = REQUEST_QUEUE_FULL;
+    }
+  }
+
+  LOG_D("Add UDP request result: %02X\n", rc);
+  return rc;
+}
+
+// UDP addRequest for preformatted ModbusMessage and adhoc target
+Error ModbusClientUDP::addRequestMT(ModbusMessage msg, uint32_t token, IPAddress targetHost, uint16_t targetPort) {
+  Error rc = SUCCESS;        // Return value
+
+  // Add it to the queue, if valid
+  if (msg) {
+    // Queue add successful?
+    if (!addToQueue(token, std::move(msg), makeTarget(targetHost, targetPort), MT_defaultTimeout)) {
+      // No. Return error
+      rc = REQUEST_QUEUE_FULL;
+    }
+  }
+
+  LOG_D("Add UDP request result: %02X\n", rc);
+  return rc;
+}
+
+// Base syncRequest follows the same pattern
+ModbusMessage ModbusClientUDP::syncRequestM(ModbusMessage msg, uint32_t token) {
+  ModbusMessage response;
+
+  if (msg) {
+    // Keep server ID and function code, msg will be moved into the queue
+    uint8_t serverID = msg.getServerID();
+    uint8_t functionCode = msg.getFunctionCode();
+    sockaddr_in target;
+    uint32_t timeout;
+    {
+      LOCK_GUARD(lockGuard, qLock);
+      target = MT_target;
+      timeout = MT_targetTimeout;
+    }
+    // Queue add successful?
+    if (!addToQueue(token, std::move(msg), target, timeout, true)) {
+      // No. Return error
+      response.setError(serverID, functionCode, REQUEST_QUEUE_FULL);
+    } else {
+      // Request is queued - wait for the result.
+      response = waitSync(serverID, functionCode, token);
+    }
+  } else {
+    response.setError(msg.getServerID(), msg.getFunctionCode(), EMPTY_MESSAGE);
+  }
+  return response;
+}
+
+// UDP syncRequest with adhoc target parameters
+ModbusMessage ModbusClientUDP::syncRequestMT(ModbusMessage msg, uint32_t token, IPAddress targetHost, uint16_t targetPort) {
+  ModbusMessage response;
+
+  if (msg) {
+    // Keep server ID and function code, msg will be moved into the queue
+    uint8_t serverID = msg.getServerID();
+    uint8_t functionCode = msg.getFunctionCode();
+    // Queue add successful?
+    if (!addToQueue(token, std::move(msg), makeTarget(targetHost, targetPort), MT_defaultTimeout, true)) {
+      // No. Return error
+      response.setError(serverID, functionCode, REQUEST_QUEUE_FULL);
+    } else {
+      // Request is queued - wait for the result.
+      response = waitSync(serverID, functionCode, token);
+    }
+  } else {
+    response.setError(msg.getServerID(), msg.getFunctionCode(), EMPTY_MESSAGE);
+  }
+  return response;
+}
+
+// addToQueue: send freshly created request to queue
+bool ModbusClientUDP::addToQueue(uint32_t token, ModbusMessage request, const sockaddr_in& target, uint32_t timeout, bool syncReq) {
+  bool rc = false;
+  HEXDUMP_D("Enqueue", request.data(), request.size());
+  if (request) {
+    // Requests in flight count against the limit as well - they hold a transaction ID
+    LOCK_GUARD(lockGuard, qLock);
+    if (MT_pending < MT_qLimit) {
+      requests.push_back(new RequestEntry(token, std::move(request), target, timeout, syncReq));
+      MT_pending++;
+      rc = true;
+    }
+  }
+  if (rc) {
+    LOCK_GUARD(cntLock, countAccessM);
+    messageCount++;
+  }
+  return rc;
+}
+
+// handleConnection: worker thread
+// Sends what is queued, reads what has arrived and times out what is overdue, all without blocking
+void ModbusClientUDP::handleConnection(ModbusClientUDP *instance) {
+  while (1) {
+    bool active = instance->send();
+    active |= instance->receive();
+    instance->expire();
+    // Nothing to do? Wait for a datagram or a new request
+    if (!active) instance->idle();
+  }
+}
+
+// idle: wait for data - or only yield if busy-polling
+void ModbusClientUDP::idle() {
+  if (busyPoll) {
+    // yield() is no cancellation point - the destructor would wait forever for an idle worker
+    pthread_testcancel();
+    std::this_thread::yield();
+    return;
+  }
+  // New requests are not signalled on the socket, so do not sleep longer than the TCP client would
+  pollfd pfd = { MT_socket, POLLIN, 0 };
+  poll(&pfd, 1, 1);
+}
+
+// send: send a batch of queued requests
+bool ModbusClientUDP::send() {
+  RequestEntry *batch[UDP_BATCH];
+  uint32_t count = 0;
+  {
+    LOCK_GUARD(lockGuard, qLock);
+    while (count < UDP_BATCH && count < requests.size()) {
+      batch[count] = requests[count];
+      count++;
+    }
+  }
+  if (!count) return false;
+
+  // Give each request a transaction ID not in use and set up its datagram: MBAP header and PDU.
+  // The requests are entered as in flight right away, so the batch will not reuse an ID.
+  // Until they have left the queue, they are in both containers - the destructor would delete them
+  // twice if the thread was cancelled in sendmmsg() or logging, so cancellation waits for that.
+  int cancelState;
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancelState);
+  mmsghdr hdr[UDP_BATCH];
+  iovec iov[UDP_BATCH][2];
+  for (uint32_t i = 0; i < count; ++i) {
+    RequestEntry *r = batch[i];
+    while (inFlight.count(MT_nextTID)) MT_nextTID++;
+    uint16_t tid = MT_nextTID++;
+    inFlight[tid] = r;
+    uint16_t len = r->msg.size();
+    r->head[0] = (tid >> 8) & 0xFF;
+    r->head[1] = tid & 0xFF;
+    r->head[2] = 0;
+    r->head[3] = 0;
+    r->head[4] = (len >> 8) & 0xFF;
+    r->head[5] = len & 0xFF;
+    iov[i][0].iov_base = r->head;
+    iov[i][0].iov_len = 6;
+    iov[i][1].iov_base = const_cast<uint8_t *>(r->msg.data());
+    iov[i][1].iov_len = len;
+    memset(&hdr[i], 0, sizeof(hdr[i]));
+    hdr[i].msg_hdr.msg_name = &r->target;
+    hdr[i].msg_hdr.msg_namelen = sizeof(r->target);
+    hdr[i].msg_hdr.msg_iov = iov[i];
+    hdr[i].msg_hdr.msg_iovlen = 2;
+  }
+
+  int sent = sendmmsg(MT_socket, hdr, count, 0);
+  bool failed = false;
+  if (sent < 0) {
+    // Socket buffer full? Then try again later. Else the first request could not be sent at all:
+    // bad address, unreachable network etc.
+    failed = !(errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS);
+    if (failed) LOG_E("UDP send failed: %s\n", strerror(errno));
+    sent = 0;
+  }
+  // Requests not sent stay in the queue and will get a new transaction ID next time
+  for (uint32_t i = sent; i < count; ++i) {
+    inFlight.erase((batch[i]->head[0] << 8) | batch[i]->head[1]);
+  }
+  unsigned long now = millis();
+  for (int i = 0; i < sent; ++i) {
+    batch[i]->sentAt = now;
+    HEXDUMP_V("Request head", batch[i]->head, 6);
+    HEXDUMP_V("Request packet", batch[i]->msg.data(), batch[i]->msg.size());
+  }
+  {
+    LOCK_GUARD(lockGuard, qLock);
+    requests.erase(requests.begin(), requests.begin() + sent + (failed ? 1 : 0));
+  }
+  pthread_setcancelstate(cancelState, NULL);
+  if (failed) {
+    ModbusMessage response;
+    response.setError(batch[0]->msg.getServerID(), batch[0]->msg.getFunctionCode(), IP_CONNECTION_FAILED);
+    respond(batch[0], std::move(response));
+  }
+  return sent > 0 || failed;
+}
+
+// receive: read a batch of responses and hand them out
+bool ModbusClientUDP::receive() {
+  const uint16_t dataLen(300);        // Modbus Packet supposedly will fit (260<300)
+  uint8_t data[UDP_BATCH][dataLen];   // Local buffers to collect received datagrams
+  mmsghdr hdr[UDP_BATCH];
+  iovec iov[UDP_BATCH];
+  sockaddr_in from[UDP_BATCH];
+  for (uint32_t i = 0; i < UDP_BATCH; ++i) {
+    iov[i].iov_base = data[i];
+    iov[i].iov_len = dataLen;
+    memset(&hdr[i], 0, sizeof(hdr[i]));
+    hdr[i].msg_hdr.msg_name = &from[i];
+    hdr[i].msg_hdr.msg_namelen = sizeof(from[i]);
+    hdr[i].msg_hdr.msg_iov = &iov[i];
+    hdr[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  int got = recvmmsg(MT_socket, hdr, UDP_BATCH, MSG_DONTWAIT, nullptr);
+  if (got <= 0) return false;
+
+  for (int i = 0; i < got; ++i) {
+    uint8_t *d = data[i];
+    uint32_t len = hdr[i].msg_len;
+    HEXDUMP_V("Response packet", d, len);
+    // Too short to carry a transaction ID?
+    if (len < 2) continue;
+    // Find the request by transaction ID - late responses to timed out requests will find none
+    auto it = inFlight.find((d[0] << 8) | d[1]);
+    if (it == inFlight.end()) {
+      LOG_D("Response without request dropped\n");
+      continue;
+    }
+    RequestEntry *request = it->second;
+    // Another host may have sent it
+    if (from[i].sin_addr.s_addr != request->target.sin_addr.s_addr || from[i].sin_port != request->target.sin_port) {
+      LOG_D("Response from wrong host dropped\n");
+      continue;
+    }
+    inFlight.erase(it);
+
+    ModbusMessage response;
+    // Protocol ID shall be 0, length has to match the remainder
+    if (len < 8 || d[2] != 0 || d[3] != 0 || (uint32_t)((d[4] << 8) | d[5]) != len - 6) {
+      response.setError(request->msg.getServerID(), request->msg.getFunctionCode(), TCP_HEAD_MISMATCH);
+    } else {
+      // Check server ID, function code and length against the request
+      Error e = PDUutils::checkResponse(d + 6, len - 6, request->msg);
+      if (e != SUCCESS) {
+        // Not matching, report error
+        response.setError(request->msg.getServerID(), request->msg.getFunctionCode(), e);
+      } else {
+        // Looks good.
+        response.add(d + 6, len - 6);
+      }
+    }
+    respond(request, std::move(response));
+  }
+  return true;
+}
+
+// expire: answer requests with TIMEOUT that waited too long
+void ModbusClientUDP::expire() {
+  unsigned long now = millis();
+  // Timeouts are in milliseconds - one check per tick is enough
+  if (now == MT_lastExpire) return;
+  MT_lastExpire = now;
+  for (auto it = inFlight.begin(); it != inFlight.end(); ) {
+    RequestEntry *request = it->second;
+    if (now - request->sentAt >= request->timeout) {
+      it = inFlight.erase(it);
+      ModbusMessage response;
+      response.setError(request->msg.getServerID(), request->msg.getFunctionCode(), TIMEOUT);
+      respond(request, std::move(response));
+    } else {
+      ++it;
+    }
+  }
+}
+
+// respond: hand out the response to a request and delete it
+void ModbusClientUDP::respond(RequestEntry *request, ModbusMessage response) {
+  // Did we get a normal response?
+  if (response.getError() == SUCCESS) {
+    LOG_D("Data response.\n");
+    // Yes. Is it a synchronous request?
+    if (request->isSyncRequest) {
+      // Yes. Put the response into the response map
+      LOCK_GUARD(sL, syncRespM);
+      syncResponse[request->token] = std::move(response);
+    // No, async request. Do we have an onResponse handler?
+    } else if (onResponse) {
+      // Yes. Call it.
+      onResponse(std::move(response), request->token);
+    // No, but do we have an onData handler registered?
+    } else if (onData) {
+      // Yes. call it
+      onData(std::move(response), request->token);
+    } else {
+      LOG_D("No handler for response!\n");
+    }
+  } else {
+    // No, something went wrong. All we have is an error
+    LOG_D("Error response.\n");
+    // Count it
+    {
+      LOCK_GUARD(responseCnt, countAccessM);
+      errorCount++;
+    }
+    // Is it a synchronous request?
+    if (request->isSyncRequest) {
+      // Yes. Put the response into the response map
+      LOCK_GUARD(sL, syncRespM);
+      syncResponse[request->token] = std::move(response);
+    // No, but do we have an onResponse handler?
+    } else if (onResponse) {
+      // Yes, call it.
+      onResponse(std::move(response), request->token);
+    // No, but do we have an onError handler?
+    } else if (onError) {
+      // Yes. Forward the error code to it
+      onError(response.getError(), request->token);
+    } else {
+      LOG_D("No onError handler\n");
+    }
+  }
+  delete request;
+  LOCK_GUARD(lockGuard, qLock);
+  MT_pending--;
+}
+
+#endif  // IS_LINUX
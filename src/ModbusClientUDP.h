@@ -0,0 +1,131 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _MODBUS_CLIENT_UDP_H
+#define _MODBUS_CLIENT_UDP_H
+
+#include "options.h"
+
+#if IS_LINUX
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <deque>
+#include <unordered_map>
+#include "ModbusClient.h"
+#include "IPAddress.h"
+
+#define DEFAULTTIMEOUT 2000
+#define UDP_BATCH 32              // Datagrams sent or received with one system call
+
+// ModbusClientUDP: Modbus TCP framing (MBAP header plus PDU) in UDP datagrams, one request or response
+// per datagram. A single socket serves any number of target hosts, there is no connection to set up.
+// Requests are sent as soon as they are queued, without waiting for the responses to earlier ones.
+// Responses are matched to their requests by transaction ID and sender, each request has its own timeout.
+// Linux only: the worker thread sends and receives in batches with sendmmsg() and recvmmsg().
+class ModbusClientUDP : public ModbusClient {
+public:
+  // Constructor takes the limit of requests queued or waiting for a response
+  explicit ModbusClientUDP(uint16_t queueLimit = 100);
+
+  // Alternative Constructor takes initial target host
+  ModbusClientUDP(IPAddress host, uint16_t port, uint16_t queueLimit = 100);
+
+  // Destructor: clean up queue, thread and socket
+  ~ModbusClientUDP();
+
+  // begin: open the socket and start the worker thread. coreID >= 0 will pin the thread to that CPU
+  void begin(int coreID = -1);
+
+  // setPriority: run the worker thread with SCHED_FIFO at priority 1..99, 0 for normal scheduling.
+  // Must be called before begin(). Needs CAP_SYS_NICE (or root), else the worker runs normally.
+  void setPriority(int priority);
+
+  // setBusyPoll: spin on the socket instead of sleeping in poll(). May be switched while running.
+  void setBusyPoll(bool busy);
+
+  // Set default timeout value
+  void setTimeout(uint32_t timeout = DEFAULTTIMEOUT);
+
+  // Set target host for the following requests
+  void setTarget(IPAddress host, uint16_t port, uint32_t timeout = 0);
+
+  // Return number of requests queued or waiting for a response
+  uint32_t pendingRequests();
+
+protected:
+  struct RequestEntry {
+    uint32_t token;
+    ModbusMessage msg;
+    sockaddr_in target;           // Target host and port
+    uint32_t timeout;             // Time in ms waiting for the response
+    unsigned long sentAt;         // millis() when the request was sent
+    uint8_t head[6];              // MBAP header, MSB first
+    bool isSyncRequest;
+    RequestEntry(uint32_t t, ModbusMessage m, const sockaddr_in& tg, uint32_t to, bool syncReq = false) :
+      token(t),
+      msg(std::move(m)),
+      target(tg),
+      timeout(to),
+      sentAt(0),
+      head{0, 0, 0, 0, 0, 0},
+      isSyncRequest(syncReq) {}
+  };
+
+  // Prevent copy construction and assignment
+  ModbusClientUDP(ModbusClientUDP& m) = delete;
+  ModbusClientUDP& operator=(ModbusClientUDP& m) = delete;
+
+  // Base addRequest and syncRequest must be present
+  Error addRequestM(ModbusMessage msg, uint32_t token);
+  ModbusMessage syncRequestM(ModbusMessage msg, uint32_t token);
+  // UDP-specific addition "...MT()" including adhoc target
+  Error addRequestMT(ModbusMessage msg, uint32_t token, IPAddress targetHost, uint16_t targetPort);
+  ModbusMessage syncRequestMT(ModbusMessage msg, uint32_t token, IPAddress targetHost, uint16_t targetPort);
+
+  // addToQueue: send freshly created request to queue
+  bool addToQueue(uint32_t token, ModbusMessage request, const sockaddr_in& target, uint32_t timeout, bool syncReq = false);
+
+  // handleConnection: worker thread method
+  static void handleConnection(ModbusClientUDP *instance);
+  static void *pHandle(void *p);
+
+  // send: send a batch of queued requests. Returns true if any was sent
+  bool send();
+
+  // receive: read a batch of responses and hand them out. Returns true if any datagram was read
+  bool receive();
+
+  // expire: answer requests with TIMEOUT that waited too long
+  void expire();
+
+  // respond: hand out the response to a request and delete it
+  void respond(RequestEntry *request, ModbusMessage response);
+
+  // idle: wait for data - or only yield if busy-polling
+  void idle();
+
+  // makeTarget: fill a socket address from host and port
+  static sockaddr_in makeTarget(IPAddress host, uint16_t port);
+
+  void isInstance() { return; }   // make class instantiable
+  std::deque<RequestEntry *> requests;                    // Requests not sent yet
+  std::unordered_map<uint16_t, RequestEntry *> inFlight;  // Sent requests by transaction ID, worker only
+  mutex qLock;                    // Mutex to protect queue and pending count
+  uint32_t MT_pending;            // Requests queued or in flight
+  int MT_socket;                  // UDP socket for all targets
+  sockaddr_in MT_target;          // Target for requests without an adhoc one
+  uint32_t MT_targetTimeout;      // Timeout for MT_target
+  uint32_t MT_defaultTimeout;     // Standard timeout value taken if no dedicated was set
+  uint16_t MT_qLimit;             // Maximum number of requests queued or in flight
+  uint16_t MT_nextTID;            // Transaction ID to try next
+  int MT_priority;                // SCHED_FIFO priority of the worker, 0 for normal scheduling
+  unsigned long MT_lastExpire;    // millis() of the last timeout check
+
+  // Let any ModbusBridge class use protected members
+  template<typename SERVERCLASS> friend class ModbusBridge;
+};
+
+#endif  // IS_LINUX
+
+#endif  // INCLUDE GUARD
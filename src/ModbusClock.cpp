@@ -0,0 +1,120 @@
+// =================================================================================================
+// eModbus: Copyright 2020, 2021 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#include "options.h"
+
+#if IS_LINUX
+#include <chrono>  // NOLINT
+#include <thread>  // NOLINT
+#include <pthread.h>
+#include <time.h>
+#include "ModbusClock.h"
+
+// The system clock serves until another one is chosen
+static SystemClock systemClock;
+std::atomic<ModbusClock *> ModbusClock::active(&systemClock);
+
+// use: switch all timing to clock, or back to the system clock with nullptr
+void ModbusClock::use(ModbusClock *clock) {
+  active.store(clock ? clock : &systemClock, std::memory_order_release);
+}
+
+// now: steady_clock time in microseconds
+uint64_t SystemClock::now() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// sleep: use nanosleep() to avoid problems with pthreads (std::this_thread::sleep_for would interfere!)
+void SystemClock::sleep(uint32_t ms) {
+  struct timespec t = { (time_t)(ms / 1000), (long)(ms % 1000) * 1000000L };
+  nanosleep(&t, NULL);
+}
+
+void SystemClock::sleepMicros(uint32_t us) {
+  struct timespec t = { (time_t)(us / 1000000), (long)(us % 1000000) * 1000L };
+  nanosleep(&t, NULL);
+}
+
+// Constructor: set start time in microseconds
+VirtualClock::VirtualClock(bool autoAdvance, uint64_t start) :
+  VCnow(start),
+  VCauto(autoAdvance) { }
+
+// now: current virtual time
+uint64_t VirtualClock::now() {
+  return VCnow.load();
+}
+
+// forward: move time to t, if that is later than now
+void VirtualClock::forward(uint64_t t) {
+  uint64_t current = VCnow.load();
+  // Concurrent sleepers may have moved the time already - never go back
+  while (current < t && !VCnow.compare_exchange_weak(current, t)) { }
+}
+
+// sleep: let virtual time pass
+void VirtualClock::sleep(uint32_t ms) {
+  wait((uint64_t)ms * 1000);
+}
+
+void VirtualClock::sleepMicros(uint32_t us) {
+  wait(us);
+}
+
+// wait: let us microseconds of virtual time pass
+void VirtualClock::wait(uint64_t us) {
+  uint64_t wakeup = VCnow.load() + us;
+  // The real sleep was a cancellation point - keep it that way for pthread_cancel()
+  pthread_testcancel();
+
+  if (VCauto) {
+    // Jump to the end of the sleep and give other threads a chance to do their work
+    forward(wakeup);
+    VCwake.notify_all();
+    std::this_thread::yield();
+    return;
+  }
+
+  // Wait for advance() to get us there. A thread cancelled within a condition variable wait may not
+  // unwind cleanly, so the wait is cut into short slices with cancellation checks in between.
+  std::unique_lock<std::mutex> lock(VCmutex);
+  auto entry = VCdeadlines.insert(wakeup);
+  while (VCnow.load() < wakeup) {
+    int cancelState;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancelState);
+    VCwake.wait_for(lock, std::chrono::milliseconds(1));
+    pthread_setcancelstate(cancelState, NULL);
+    if (VCnow.load() < wakeup) {
+      VCdeadlines.erase(entry);
+      lock.unlock();
+      pthread_testcancel();
+      lock.lock();
+      entry = VCdeadlines.insert(wakeup);
+    }
+  }
+  VCdeadlines.erase(entry);
+}
+
+// advance: move time forward and wake up due sleepers
+void VirtualClock::advance(uint32_t ms) {
+  advanceMicros((uint64_t)ms * 1000);
+}
+
+void VirtualClock::advanceMicros(uint64_t us) {
+  {
+    // Hold the lock, so no sleeper can miss the notification between its check and its wait
+    std::lock_guard<std::mutex> lock(VCmutex);
+    VCnow += us;
+  }
+  VCwake.notify_all();
+}
+
+// sleepers: number of threads waiting in sleep() for a time still to come.
+// Threads already due, but not yet woken up, are not counted.
+uint32_t VirtualClock::sleepers() {
+  std::lock_guard<std::mutex> lock(VCmutex);
+  return std::distance(VCdeadlines.upper_bound(VCnow.load()), VCdeadlines.end());
+}
+
+#endif
@@ -0,0 +1,91 @@
+// =================================================================================================
+// eModbus: Copyright 2020, 2021 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _MODBUS_CLOCK_H
+#define _MODBUS_CLOCK_H
+
+// This file is included by options.h on Linux, before millis(), micros() and delay() are defined.
+// It must not use these names itself.
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <set>
+
+// ModbusClock: time source behind millis(), micros() and delay() on Linux.
+// The library uses the system's monotonic clock by default. Tests may switch to a VirtualClock
+// to run timeouts of seconds or hours in no time, with reproducible results.
+class ModbusClock {
+public:
+  // The constexpr constructors let the default clock be set up before any static constructor
+  // of other translation units may call millis()
+  constexpr ModbusClock() {}
+  virtual ~ModbusClock() {}
+
+  // now: monotonic time in microseconds
+  virtual uint64_t now() = 0;
+
+  // sleep: pause the calling thread for ms milliseconds
+  virtual void sleep(uint32_t ms) = 0;
+
+  // sleepMicros: pause the calling thread for us microseconds
+  virtual void sleepMicros(uint32_t us) = 0;
+
+  // current: the clock used by millis(), micros(), delay() and delayMicroseconds()
+  static inline ModbusClock& current() { return *active.load(std::memory_order_acquire); }
+
+  // use: switch all timing to clock, or back to the system clock with nullptr.
+  // The clock must outlive any thread still using it.
+  static void use(ModbusClock *clock);
+
+protected:
+  static std::atomic<ModbusClock *> active;
+};
+
+// SystemClock: std::chrono::steady_clock and nanosleep()
+class SystemClock : public ModbusClock {
+public:
+  constexpr SystemClock() {}
+  uint64_t now();
+  void sleep(uint32_t ms);
+  void sleepMicros(uint32_t us);
+};
+
+// VirtualClock: simulated time that only passes when told so.
+// With autoAdvance, each sleep() moves the time forward to the end of the sleep right away, as if
+// all other threads were idle meanwhile - a 60s timeout loop polling every 10ms is done after
+// 6000 yields. Otherwise sleeping threads wait until advance() has moved the time far enough,
+// so a test has full control over the order of events.
+// Virtual time will run ahead of real I/O; use it with in-memory transports or manual advancing.
+class VirtualClock : public ModbusClock {
+public:
+  explicit VirtualClock(bool autoAdvance = true, uint64_t start = 0);
+
+  uint64_t now();
+  void sleep(uint32_t ms);
+  void sleepMicros(uint32_t us);
+
+  // advance: move time forward by ms milliseconds (or us microseconds) and wake up due sleepers
+  void advance(uint32_t ms);
+  void advanceMicros(uint64_t us);
+
+  // sleepers: number of threads waiting in sleep() for a later time (always 0 with autoAdvance).
+  // If it equals the number of threads involved, all are idle and time may be advanced.
+  uint32_t sleepers();
+
+protected:
+  // forward: move time to t, if that is later than now
+  void forward(uint64_t t);
+
+  // wait: common part of sleep() and sleepMicros()
+  void wait(uint64_t us);
+
+  std::atomic<uint64_t> VCnow;         // Current virtual time in microseconds
+  bool VCauto;                         // Time jumps on sleep()
+  std::multiset<uint64_t> VCdeadlines; // Wakeup times of the threads waiting for time to pass
+  std::mutex VCmutex;                  // Protects VCdeadlines and the wait for VCwake
+  std::condition_variable VCwake;      // Signalled whenever time moves forward
+};
+
+#endif
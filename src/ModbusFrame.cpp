@@ -0,0 +1,188 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#include <string.h>
+#include "ModbusFrame.h"
+#undef LOCAL_LOG_LEVEL
+#include "Logging.h"
+
+const ModbusMessage ModbusFrame::emptyMessage;
+
+// FramePoolState: the free list of a FramePool, kept alive by the pool and all of its blocks
+struct FramePoolState {
+  ModbusFrame::Block *free;       // List of free blocks
+  uint16_t available;             // Number of blocks in the free list
+  uint16_t bufferSize;            // Buffer size preallocated for each block
+  bool alive;                     // false once the pool was destroyed
+#if USE_MUTEX
+  std::mutex lock;                // Protects all of the above
+#endif
+  explicit FramePoolState(uint16_t size) : free(nullptr), available(0), bufferSize(size), alive(true) {}
+};
+
+// Empty frame
+ModbusFrame::ModbusFrame() :
+  MF_block(nullptr) { }
+
+// Frame taking over the data of a ModbusMessage
+ModbusFrame::ModbusFrame(ModbusMessage&& m) :
+  MF_block(new Block()) {
+  MF_block->refs = 1;
+  MF_block->msg = std::move(m);
+}
+
+// Frame holding a copy of a ModbusMessage
+ModbusFrame::ModbusFrame(const ModbusMessage& m) :
+  MF_block(new Block()) {
+  MF_block->refs = 1;
+  MF_block->msg = m;
+}
+
+// Constructor for FramePool: take a block
+ModbusFrame::ModbusFrame(Block *b) :
+  MF_block(b) {
+  MF_block->refs = 1;
+}
+
+// Copy constructor: share the block
+ModbusFrame::ModbusFrame(const ModbusFrame& f) :
+  MF_block(f.MF_block) {
+  if (MF_block) MF_block->refs++;
+}
+
+// Move constructor: take over the reference
+ModbusFrame::ModbusFrame(ModbusFrame&& f) :
+  MF_block(f.MF_block) {
+  f.MF_block = nullptr;
+}
+
+// Assignment: share the block
+ModbusFrame& ModbusFrame::operator=(const ModbusFrame& f) {
+  if (MF_block != f.MF_block) {
+    if (f.MF_block) f.MF_block->refs++;
+    release();
+    MF_block = f.MF_block;
+  }
+  return *this;
+}
+
+// Move assignment: take over the reference
+ModbusFrame& ModbusFrame::operator=(ModbusFrame&& f) {
+  if (this != &f) {
+    release();
+    MF_block = f.MF_block;
+    f.MF_block = nullptr;
+  }
+  return *this;
+}
+
+// Destructor: drop reference
+ModbusFrame::~ModbusFrame() {
+  release();
+}
+
+// release: drop own reference. The last one will free or recycle the block
+void ModbusFrame::release() {
+  if (MF_block) {
+    if (--MF_block->refs == 0) {
+      if (MF_block->pool) {
+        FramePool::recycle(MF_block);
+      } else {
+        delete MF_block;
+      }
+    }
+    MF_block = nullptr;
+  }
+}
+
+// message: the ModbusMessage proper
+const ModbusMessage& ModbusFrame::message() const {
+  return MF_block ? MF_block->msg : emptyMessage;
+}
+
+// Comparison with a message: same bytes?
+bool ModbusFrame::operator==(const ModbusMessage& m) const {
+  if (size() != m.size()) return false;
+  return !size() || memcmp(data(), m.data(), size()) == 0;
+}
+
+// useCount: number of frames sharing the buffer
+uint16_t ModbusFrame::useCount() const {
+  return MF_block ? MF_block->refs.load() : 0;
+}
+
+// FramePool constructor: preallocate blocks
+FramePool::FramePool(uint16_t blocks, uint16_t bufferSize) :
+  FP_state(std::make_shared<FramePoolState>(bufferSize)) {
+  for (uint16_t i = 0; i < blocks; ++i) {
+    ModbusFrame::Block *b = new ModbusFrame::Block();
+    b->msg = ModbusMessage(bufferSize);
+    b->pool = FP_state;
+    b->next = FP_state->free;
+    FP_state->free = b;
+    FP_state->available++;
+  }
+}
+
+// FramePool destructor: free all blocks in the free list. Blocks still in use are freed by their last frame
+FramePool::~FramePool() {
+  ModbusFrame::Block *list;
+  {
+    LOCK_GUARD(lockGuard, FP_state->lock);
+    FP_state->alive = false;
+    list = FP_state->free;
+    FP_state->free = nullptr;
+    FP_state->available = 0;
+  }
+  // Deleting the blocks will drop their references to the state - do it outside the lock
+  while (list) {
+    ModbusFrame::Block *b = list;
+    list = b->next;
+    delete b;
+  }
+}
+
+// make: create a frame holding a copy of the data
+ModbusFrame FramePool::make(const uint8_t *data, uint16_t len) {
+  ModbusFrame::Block *b = nullptr;
+  {
+    LOCK_GUARD(lockGuard, FP_state->lock);
+    if (FP_state->free) {
+      b = FP_state->free;
+      FP_state->free = b->next;
+      FP_state->available--;
+    }
+  }
+  // Pool exhausted? Use a block of our own then
+  if (!b) {
+    LOG_D("Frame pool exhausted\n");
+    b = new ModbusFrame::Block();
+  }
+  b->next = nullptr;
+  b->msg.add(data, len);
+  return ModbusFrame(b);
+}
+
+// available: number of free blocks
+uint16_t FramePool::available() {
+  LOCK_GUARD(lockGuard, FP_state->lock);
+  return FP_state->available;
+}
+
+// recycle: take back a block. The buffer is kept for the next frame
+void FramePool::recycle(ModbusFrame::Block *b) {
+  FramePoolState& state = *b->pool;
+  b->msg.clear();
+  {
+    LOCK_GUARD(lockGuard, state.lock);
+    if (state.alive) {
+      b->next = state.free;
+      state.free = b;
+      state.available++;
+      return;
+    }
+  }
+  // The pool is gone - the block will not be needed any more. This may free the state as well
+  delete b;
+}
@@ -0,0 +1,132 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _MODBUS_FRAME_H
+#define _MODBUS_FRAME_H
+#include <atomic>
+#include <memory>
+#include "options.h"
+#include "ModbusMessage.h"
+
+#if USE_MUTEX
+#include <mutex>                    // NOLINT
+#endif
+
+// ModbusFrame: immutable, reference counted Modbus message.
+// Copying a ModbusFrame will not copy the data, but let both copies share the same buffer.
+// Any number of consumers (sniffers, loggers, recorders...) may hold on to the same received frame
+// this way. The buffer is released - or given back to its FramePool - when the last reference is dropped.
+// The read accessors are those of ModbusMessage; message() gives access to the complete
+// ModbusMessage interface for reading, and a frame will convert into a ModbusMessage copy if needed.
+class FramePool;
+struct FramePoolState;
+
+class ModbusFrame {
+public:
+  // Empty frame
+  ModbusFrame();
+
+  // Frame taking over the data of a ModbusMessage without copying
+  explicit ModbusFrame(ModbusMessage&& m);
+
+  // Frame holding a copy of a ModbusMessage
+  explicit ModbusFrame(const ModbusMessage& m);
+
+  // Copy and move will share the buffer
+  ModbusFrame(const ModbusFrame& f);
+  ModbusFrame(ModbusFrame&& f);
+  ModbusFrame& operator=(const ModbusFrame& f);
+  ModbusFrame& operator=(ModbusFrame&& f);
+
+  // Destructor: drop reference
+  ~ModbusFrame();
+
+  // message: the ModbusMessage proper, an empty one for an empty frame
+  const ModbusMessage& message() const;
+
+  // Conversion into a (modifiable) copy of the message
+  inline operator ModbusMessage() const { return message(); }
+
+  // Exposed read accessors of ModbusMessage
+  inline const uint8_t *data() const { return message().data(); }
+  inline uint16_t size() const { return message().size(); }
+  inline uint8_t operator[](uint16_t index) const { return message()[index]; }
+  inline ModbusMessage::const_iterator begin() const { return message().begin(); }
+  inline ModbusMessage::const_iterator end() const { return message().end(); }
+  inline uint8_t getServerID() const { return message().getServerID(); }
+  inline uint8_t getFunctionCode() const { return message().getFunctionCode(); }
+  inline Error getError() const { return message().getError(); }
+  template <typename... Args>
+  inline uint16_t get(uint16_t index, Args&&... args) const { return message().get(index, std::forward<Args>(args)...); }
+
+  // Comparison with messages and frames
+  bool operator==(const ModbusMessage& m) const;
+  inline bool operator!=(const ModbusMessage& m) const { return !(*this == m); }
+  inline bool operator==(const ModbusFrame& f) const { return MF_block == f.MF_block || *this == f.message(); }
+  inline bool operator!=(const ModbusFrame& f) const { return !(*this == f); }
+
+  // true, if the frame holds a message
+  inline explicit operator bool() const { return MF_block != nullptr; }
+
+  // useCount: number of ModbusFrames sharing the buffer (0 for an empty frame)
+  uint16_t useCount() const;
+
+protected:
+  friend class FramePool;
+  friend struct FramePoolState;
+
+  // Shared buffer with reference count
+  struct Block {
+    std::atomic<uint16_t> refs;   // Number of frames referring to the block
+    std::shared_ptr<FramePoolState> pool;   // State of the pool to return the block to or nullptr
+    Block *next;                  // Link in the pool's free list
+    ModbusMessage msg;            // The data
+    Block() : refs(0), next(nullptr) {}
+  };
+
+  // Constructor for FramePool: take a block
+  explicit ModbusFrame(Block *b);
+
+  // release: drop own reference to the block
+  void release();
+
+  Block *MF_block;                          // Shared block or nullptr
+  static const ModbusMessage emptyMessage;  // message() of empty frames
+};
+
+// FramePool: recycles ModbusFrame buffers.
+// make() will copy data into a buffer from the pool, without any allocation as long as
+// there are free blocks and the data fits the preallocated buffer size.
+// If the pool is exhausted, make() falls back to freshly allocated frames.
+// Frames may outlive the pool: their blocks share the pool's free list state, and blocks coming
+// back after the pool was destroyed are freed instead of being recycled.
+class FramePool {
+public:
+  // Constructor: preallocate blocks with buffers of bufferSize bytes each
+  explicit FramePool(uint16_t blocks = 4, uint16_t bufferSize = 256);
+
+  // Destructor: free all blocks in the pool - those still in use will be freed when released
+  ~FramePool();
+
+  // make: create a frame holding a copy of the data
+  ModbusFrame make(const uint8_t *data, uint16_t len);
+  inline ModbusFrame make(const ModbusMessage& m) { return make(m.data(), m.size()); }
+
+  // available: number of free blocks
+  uint16_t available();
+
+protected:
+  friend class ModbusFrame;
+
+  // Prevent copy construction and assignment
+  FramePool(const FramePool& p) = delete;
+  FramePool& operator=(const FramePool& p) = delete;
+
+  // recycle: take back a block whose last reference was dropped, or free it if the pool is gone
+  static void recycle(ModbusFrame::Block *b);
+
+  std::shared_ptr<FramePoolState> FP_state;   // Free list, shared with the blocks handed out
+};
+
+#endif
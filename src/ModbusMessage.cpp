@@ -14,7 +14,7 @@ ModbusMessage::ModbusMessage(uint16_t dataLen) {
 
 // Special message Constructor - takes a std::vector<uint8_t>
 ModbusMessage::ModbusMessage(std::vector<uint8_t> s) :
-MM_data(s) { }
+MM_data(std::move(s)) { }
 
 // Destructor
 ModbusMessage::~ModbusMessage() { 
@@ -34,9 +34,8 @@ ModbusMessage& ModbusMessage::operator=(const ModbusMessage& m) {
 
 #ifndef NO_MOVE
   // Move constructor
-ModbusMessage::ModbusMessage(ModbusMessage&& m) {
-  MM_data = std::move(m.MM_data);
-}
+ModbusMessage::ModbusMessage(ModbusMessage&& m) :
+  MM_data(std::move(m.MM_data)) { }
   
 	// Move assignment
 ModbusMessage& ModbusMessage::operator=(ModbusMessage&& m) {
@@ -77,8 +76,8 @@ ModbusMessage::operator bool() {
 }
 
 // Exposed methods of std::vector
-const uint8_t *ModbusMessage::data() { return MM_data.data(); }
-uint16_t       ModbusMessage::size() { return MM_data.size(); }
+const uint8_t *ModbusMessage::data() const { return MM_data.data(); }
+uint16_t       ModbusMessage::size() const { return MM_data.size(); }
 void           ModbusMessage::push_back(const uint8_t& val) { MM_data.push_back(val); }
 void           ModbusMessage::clear() { MM_data.clear(); }
 // provide restricted operator[] interface
@@ -157,10 +156,8 @@ void    ModbusMessage::setFunctionCode(uint8_t FC) {
 
 // add() variant to copy a buffer into MM_data. Returns updated size
 uint16_t ModbusMessage::add(const uint8_t *arrayOfBytes, uint16_t count) {
-  // Copy it
-  while (count--) {
-    MM_data.push_back(*arrayOfBytes++);
-  }
+  // Copy it in one go
+  MM_data.insert(MM_data.end(), arrayOfBytes, arrayOfBytes + count);
   // Return updated size (logical length of message so far)
   return MM_data.size();
 }
@@ -305,10 +302,8 @@ double ModbusMessage::swapDouble(double& f, int swapRule) {
 }
 
 // add() variant for a vector of uint8_t
-uint16_t ModbusMessage::add(vector<uint8_t> v) {
-  for (auto& b: v) {
-    MM_data.push_back(b);
-  }
+uint16_t ModbusMessage::add(const vector<uint8_t>& v) {
+  MM_data.insert(MM_data.end(), v.begin(), v.end());
   return MM_data.size();
 }
 
@@ -571,9 +566,9 @@ Error ModbusMessage::setMessage(uint8_t serverID, uint8_t functionCode) {
   if (returnCode == SUCCESS)
   {
     // Yes, all fine. Create new ModbusMessage
-    MM_data.reserve(2);
-    MM_data.shrink_to_fit();
     MM_data.clear();
+    MM_data.shrink_to_fit();
+    MM_data.reserve(2);
     add(serverID, functionCode);
   }
   return returnCode;
@@ -587,9 +582,9 @@ Error ModbusMessage::setMessage(uint8_t serverID, uint8_t functionCode, uint16_t
   if (returnCode == SUCCESS)
   {
     // Yes, all fine. Create new ModbusMessage
-    MM_data.reserve(4);
-    MM_data.shrink_to_fit();
     MM_data.clear();
+    MM_data.shrink_to_fit();
+    MM_data.reserve(4);
     add(serverID, functionCode, p1);
   }
   return returnCode;
@@ -603,9 +598,9 @@ Error ModbusMessage::setMessage(uint8_t serverID, uint8_t functionCode, uint16_t
   if (returnCode == SUCCESS)
   {
     // Yes, all fine. Create new ModbusMessage
-    MM_data.reserve(6);
-    MM_data.shrink_to_fit();
     MM_data.clear();
+    MM_data.shrink_to_fit();
+    MM_data.reserve(6);
     add(serverID, functionCode, p1, p2);
   }
   return returnCode;
@@ -619,9 +614,9 @@ Error ModbusMessage::setMessage(uint8_t serverID, uint8_t functionCode, uint16_t
   if (returnCode == SUCCESS)
   {
     // Yes, all fine. Create new ModbusMessage
-    MM_data.reserve(8);
-    MM_data.shrink_to_fit();
     MM_data.clear();
+    MM_data.shrink_to_fit();
+    MM_data.reserve(8);
     add(serverID, functionCode, p1, p2, p3);
   }
   return returnCode;
@@ -635,9 +630,9 @@ Error ModbusMessage::setMessage(uint8_t serverID, uint8_t functionCode, uint16_t
   if (returnCode == SUCCESS)
   {
     // Yes, all fine. Create new ModbusMessage
-    MM_data.reserve(7 + count * 2);
-    MM_data.shrink_to_fit();
     MM_data.clear();
+    MM_data.shrink_to_fit();
+    MM_data.reserve(7 + count * 2);
     add(serverID, functionCode, p1, p2);
     add(count);
     for (uint8_t i = 0; i < (count >> 1); ++i) {
@@ -655,9 +650,9 @@ Error ModbusMessage::setMessage(uint8_t serverID, uint8_t functionCode, uint16_t
   if (returnCode == SUCCESS)
   {
     // Yes, all fine. Create new ModbusMessage
-    MM_data.reserve(7 + count);
-    MM_data.shrink_to_fit();
     MM_data.clear();
+    MM_data.shrink_to_fit();
+    MM_data.reserve(7 + count);
     add(serverID, functionCode, p1, p2);
     add(count);
     for (uint8_t i = 0; i < count; ++i) {
@@ -675,9 +670,9 @@ Error ModbusMessage::setMessage(uint8_t serverID, uint8_t functionCode, uint16_t
   if (returnCode == SUCCESS)
   {
     // Yes, all fine. Create new ModbusMessage
-    MM_data.reserve(2 + count);
-    MM_data.shrink_to_fit();
     MM_data.clear();
+    MM_data.shrink_to_fit();
+    MM_data.reserve(2 + count);
     add(serverID, functionCode);
     for (uint8_t i = 0; i < count; ++i) {
       add(arrayOfBytes[i]);
@@ -689,9 +684,9 @@ Error ModbusMessage::setMessage(uint8_t serverID, uint8_t functionCode, uint16_t
 // 8. Error response generator
 Error ModbusMessage::setError(uint8_t serverID, uint8_t functionCode, Error errorCode) {
   // No error checking for server ID or function code here, as both may be the cause for the message!? 
-  MM_data.reserve(3);
-  MM_data.shrink_to_fit();
   MM_data.clear();
+  MM_data.shrink_to_fit();
+  MM_data.reserve(3);
   add(serverID, static_cast<uint8_t>((functionCode | 0x80) & 0xFF), static_cast<uint8_t>(errorCode));
   return SUCCESS;
 }
@@ -55,8 +55,8 @@ public:
   operator bool();
   
   // Exposed methods of std::vector
-  const uint8_t   *data();  // address of MM_data
-  uint16_t   size();  // used length in MM_data
+  const uint8_t   *data() const;  // address of MM_data
+  uint16_t   size() const;  // used length in MM_data
   uint8_t    operator[](uint16_t index) const; // provide restricted operator[] interface
   void push_back(const uint8_t& val); // add a byte at the end of MM_data
   void clear();             // delete message contents
@@ -119,7 +119,7 @@ get(uint16_t index, T& v, Args&... args) const {
 }
 
 // add() variant for vectors of uint8_t
-uint16_t add(vector<uint8_t> v);
+uint16_t add(const vector<uint8_t>& v);
 
 // add() variants for float and double values
 uint16_t add(float v, int swapRules = 0);
@@ -185,6 +185,9 @@ protected:
 
   std::vector<uint8_t> MM_data;  // Message data buffer
 
+  // CoilMap packs coil windows right into the data buffer of a response
+  friend class CoilMap;
+
   static uint8_t floatOrder[sizeof(float)]; // order of bytes in a float variable
   static uint8_t doubleOrder[sizeof(double)]; // order of bytes in a double variable
 
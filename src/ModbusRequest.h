@@ -0,0 +1,143 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _MODBUS_REQUEST_H
+#define _MODBUS_REQUEST_H
+#include <array>
+#include "ModbusTypeDefs.h"
+#include "ModbusMessage.h"
+
+// Request<FC, N> - compile-time typed builders for the fixed size requests.
+// The complete frame (server ID, function code and parameters) is held in a std::array,
+// function code and quantity are checked by the compiler instead of ModbusMessage::checkData():
+//
+//   Request<READ_HOLD_REGISTER, 10> poll(1, 0x100);   // 01 03 01 00 00 0A
+//   Request<WRITE_COIL> on(1, 0x20, true);            // 01 05 00 20 FF 00
+//   Request<READ_HOLD_REGISTER, 126> bad(1, 0);       // will not compile
+//
+// Requests with variable length (FC 0x0F, 0x10, generic and user defined function codes)
+// are not covered - use ModbusMessage::setMessage() for those.
+// NOTE: the server ID is taken as is; there is no check for 1..247 at runtime either!
+
+namespace Modbus {
+
+// requestType: compile time pendant of FCT::getType() for the predefined function codes.
+// Function codes with variable length requests are mapped to FCGENERIC.
+constexpr FCType requestType(uint8_t functionCode) {
+  return (functionCode >= READ_COIL && functionCode <= WRITE_HOLD_REGISTER) ? FC01_TYPE
+       : (functionCode == READ_EXCEPTION_SERIAL || functionCode == READ_COMM_CNT_SERIAL
+          || functionCode == READ_COMM_LOG_SERIAL || functionCode == REPORT_SERVER_ID_SERIAL) ? FC07_TYPE
+       : (functionCode == MASK_WRITE_REGISTER) ? FC16_TYPE
+       : (functionCode == READ_FIFO_QUEUE) ? FC18_TYPE
+       : FCGENERIC;
+}
+
+// requestLimit: maximum quantity for the read function codes, 0 for all others
+constexpr uint16_t requestLimit(uint8_t functionCode) {
+  return (functionCode == READ_COIL || functionCode == READ_DISCR_INPUT) ? 0x07D0
+       : (functionCode == READ_HOLD_REGISTER || functionCode == READ_INPUT_REGISTER) ? 0x007D
+       : 0;
+}
+
+// RequestFrame: common base holding the frame bytes
+template <uint16_t LEN>
+class RequestFrame {
+public:
+  typedef std::array<uint8_t, LEN> Frame;
+
+  // Access to the frame
+  inline const uint8_t *data() const { return RQ_frame.data(); }
+  static constexpr uint16_t size() { return LEN; }
+  inline const Frame& frame() const { return RQ_frame; }
+  inline uint8_t getServerID() const { return RQ_frame[0]; }
+  inline uint8_t getFunctionCode() const { return RQ_frame[1]; }
+
+  // Conversion to ModbusMessage, so all APIs taking one will accept a Request as well
+  operator ModbusMessage() const {
+    ModbusMessage m(LEN);
+    m.add(RQ_frame.data(), LEN);
+    return m;
+  }
+
+protected:
+  constexpr explicit RequestFrame(const Frame& f) : RQ_frame(f) {}
+  // High and low byte of a 16 bit value
+  static constexpr uint8_t hi(uint16_t v) { return static_cast<uint8_t>(v >> 8); }
+  static constexpr uint8_t lo(uint16_t v) { return static_cast<uint8_t>(v & 0xFF); }
+
+  Frame RQ_frame;  // server ID, function code and parameters
+};
+
+// Helper to let the static_assert below only fire if the template is instantiated
+template <uint8_t FC>
+struct unsupportedRequest { static constexpr bool value = false; };
+
+// Request: primary template - any function code not covered by a specialization below will end here
+template <uint8_t FC, uint16_t N = 0, FCType T = requestType(FC)>
+class Request {
+  static_assert(unsupportedRequest<FC>::value, "No fixed size request for this function code - use ModbusMessage::setMessage()");
+};
+
+// FC 0x01, 0x02, 0x03, 0x04: read N coils/inputs/registers. FC 0x06: write a register
+template <uint8_t FC, uint16_t N>
+class Request<FC, N, FC01_TYPE> : public RequestFrame<6> {
+public:
+  // Read requests: the quantity is the template argument N
+  constexpr Request(uint8_t serverID, uint16_t address) :
+    RequestFrame<6>(Frame{{ serverID, FC, hi(address), lo(address), hi(N), lo(N) }}) {
+    static_assert(FC != WRITE_HOLD_REGISTER, "FC 0x06 needs a value, not a quantity");
+    static_assert(N > 0 && N <= requestLimit(FC), "Quantity out of range for this function code");
+  }
+
+  // Write single register: no quantity, but a value
+  constexpr Request(uint8_t serverID, uint16_t address, uint16_t value) :
+    RequestFrame<6>(Frame{{ serverID, FC, hi(address), lo(address), hi(value), lo(value) }}) {
+    static_assert(FC == WRITE_HOLD_REGISTER, "Only FC 0x06 takes a value");
+    static_assert(N == 0, "FC 0x06 has no quantity");
+  }
+};
+
+// FC 0x05: write a single coil. Taking a bool, the value can only be 0x0000 or 0xFF00
+template <uint16_t N>
+class Request<WRITE_COIL, N, FC01_TYPE> : public RequestFrame<6> {
+public:
+  constexpr Request(uint8_t serverID, uint16_t address, bool on) :
+    RequestFrame<6>(Frame{{ serverID, WRITE_COIL, hi(address), lo(address), static_cast<uint8_t>(on ? 0xFF : 0x00), 0x00 }}) {
+    static_assert(N == 0, "FC 0x05 has no quantity");
+  }
+};
+
+// FC 0x07, 0x0B, 0x0C, 0x11: no parameters
+template <uint8_t FC, uint16_t N>
+class Request<FC, N, FC07_TYPE> : public RequestFrame<2> {
+public:
+  constexpr explicit Request(uint8_t serverID) :
+    RequestFrame<2>(Frame{{ serverID, FC }}) {
+    static_assert(N == 0, "This function code has no quantity");
+  }
+};
+
+// FC 0x16: mask write register
+template <uint8_t FC, uint16_t N>
+class Request<FC, N, FC16_TYPE> : public RequestFrame<8> {
+public:
+  constexpr Request(uint8_t serverID, uint16_t address, uint16_t andMask, uint16_t orMask) :
+    RequestFrame<8>(Frame{{ serverID, FC, hi(address), lo(address), hi(andMask), lo(andMask), hi(orMask), lo(orMask) }}) {
+    static_assert(N == 0, "FC 0x16 has no quantity");
+  }
+};
+
+// FC 0x18: read FIFO queue
+template <uint8_t FC, uint16_t N>
+class Request<FC, N, FC18_TYPE> : public RequestFrame<4> {
+public:
+  constexpr Request(uint8_t serverID, uint16_t address) :
+    RequestFrame<4>(Frame{{ serverID, FC, hi(address), lo(address) }}) {
+    static_assert(N == 0, "FC 0x18 has no quantity");
+  }
+};
+
+}  // namespace Modbus
+
+#endif
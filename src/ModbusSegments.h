@@ -0,0 +1,98 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _MODBUS_SEGMENTS_H
+#define _MODBUS_SEGMENTS_H
+#include <stdint.h>
+#include <string.h>
+#include "options.h"
+#include "ModbusMessage.h"
+
+#if IS_LINUX
+#include <sys/uio.h>
+#endif
+
+// ModbusSegment: one piece of a frame. The data is not owned!
+struct ModbusSegment {
+  const uint8_t *data;
+  uint16_t len;
+};
+
+// ModbusSegments: iovec-style view of a frame made of separate pieces - typically a
+// header (TCP head), the PDU proper and a trailer (CRC).
+// Transports may hand the segments to a gathering write like writev()/sendmsg() or write them
+// one by one, without assembling the frame in a contiguous copy first.
+// All data referenced must stay valid as long as the ModbusSegments are in use.
+class ModbusSegments {
+public:
+  static const uint8_t MAXSEGMENTS = 3;
+
+  // Empty view
+  ModbusSegments() : MS_count(0), MS_size(0) { }
+
+  // View on a single buffer
+  ModbusSegments(const uint8_t *data, uint16_t len) : MS_count(0), MS_size(0) { add(data, len); }
+
+  // add: append a segment. Empty segments are skipped. Returns false if all segments are in use
+  bool add(const uint8_t *data, uint16_t len) {
+    if (!len) return true;
+    if (MS_count >= MAXSEGMENTS) return false;
+    MS_segment[MS_count].data = data;
+    MS_segment[MS_count].len = len;
+    MS_count++;
+    MS_size += len;
+    return true;
+  }
+  inline bool add(const ModbusMessage& m) { return add(m.data(), m.size()); }
+
+  // Informative
+  inline uint8_t count() const { return MS_count; }   // Number of segments
+  inline uint16_t size() const { return MS_size; }    // Total length of all segments
+
+  // Access to the segments
+  inline const ModbusSegment& operator[](uint8_t index) const { return MS_segment[index]; }
+  inline const ModbusSegment *begin() const { return MS_segment; }
+  inline const ModbusSegment *end() const { return MS_segment + MS_count; }
+
+  // copyTo: gather all segments into buffer, for transports that need one contiguous block.
+  // Returns the number of bytes copied - less than size(), if the buffer was too small
+  uint16_t copyTo(uint8_t *buffer, uint16_t maxLen) const {
+    uint16_t pos = 0;
+    for (auto& s : *this) {
+      uint16_t len = (s.len < maxLen - pos) ? s.len : maxLen - pos;
+      memcpy(buffer + pos, s.data, len);
+      pos += len;
+      if (pos >= maxLen) break;
+    }
+    return pos;
+  }
+
+  // writeTo: write the segments one by one to anything with a write(const uint8_t *, size_t) call
+  template <typename T>
+  size_t writeTo(T& target) const {
+    size_t written = 0;
+    for (auto& s : *this) {
+      written += target.write(s.data, s.len);
+    }
+    return written;
+  }
+
+#if IS_LINUX
+  // toIovec: fill an iovec array of at least MAXSEGMENTS entries. Returns the number of entries used
+  uint8_t toIovec(struct iovec *iov) const {
+    for (uint8_t i = 0; i < MS_count; ++i) {
+      iov[i].iov_base = const_cast<uint8_t *>(MS_segment[i].data);
+      iov[i].iov_len = MS_segment[i].len;
+    }
+    return MS_count;
+  }
+#endif
+
+protected:
+  ModbusSegment MS_segment[MAXSEGMENTS];  // The segments
+  uint8_t MS_count;                       // Number of segments in use
+  uint16_t MS_size;                       // Sum of all segment lengths
+};
+
+#endif
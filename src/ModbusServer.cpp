@@ -2,8 +2,9 @@
 // eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
 //               MIT license - see license.md for details
 // =================================================================================================
-#include <Arduino.h>
+#include "options.h"
 #include "ModbusServer.h"
+#include "PDUutils.h"
 
 #undef LOCAL_LOG_LEVEL
 // #define LOCAL_LOG_LEVEL LOG_LEVEL_VERBOSE
@@ -12,11 +13,12 @@
 // registerWorker: register a worker function for a certain serverID/FC combination
 // If there is one already, it will be overwritten!
 void ModbusServer::registerWorker(uint8_t serverID, uint8_t functionCode, MBSworker worker) {
-  workerMap[serverID][functionCode] = worker;
+  workerMap[serverID][functionCode] = std::move(worker);
   LOG_D("Registered worker for %02X/%02X\n", serverID, functionCode);
 }
 
-// getWorker: if a worker function is registered, return its address, nullptr otherwise
+// getWorker: if a worker function is registered, return a copy of it, nullptr otherwise.
+// A copy, as the worker may be unregistered or replaced while it is running.
 MBSworker ModbusServer::getWorker(uint8_t serverID, uint8_t functionCode) {
   // Search the FC map associated with the serverID
   auto svmap = workerMap.find(serverID);
@@ -108,7 +110,14 @@ ModbusMessage ModbusServer::localRequest(ModbusMessage msg) {
   MBSworker worker = getWorker(serverID, functionCode);
   // Did we get one?
   if (worker != nullptr) {
-    // Yes. call it and return the response
+    // Yes. Is the request well-formed?
+    Error e = PDUutils::checkRequest(msg);
+    if (e != SUCCESS) {
+      // No. Return an error response
+      m.setError(serverID, functionCode, e);
+      return m;
+    }
+    // call it and return the response
     LOG_D("Call worker\n");
     m = worker(msg);
     LOG_D("Worker responded\n");
@@ -121,8 +130,8 @@ ModbusMessage ModbusServer::localRequest(ModbusMessage msg) {
         m.clear();
         break;
       case 0xF1: // ECHO
-        m.clear();
-        m.append(msg);
+        // The request is not needed any more, so it can be moved into the response
+        m = std::move(msg);
         break;
       default:   // Will not get here, but lint likes it!
         break;
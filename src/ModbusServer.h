@@ -27,7 +27,9 @@ const ModbusMessage NIL_RESPONSE (std::vector<uint8_t>{0xFF, 0xF0});
 const ModbusMessage ECHO_RESPONSE(std::vector<uint8_t>{0xFF, 0xF1});
 
 // MBSworker: function signature for worker functions to handle single serverID/functionCode combinations
-using MBSworker = std::function<ModbusMessage(ModbusMessage msg)>;
+// The request is handed over by reference. Worker functions taking a ModbusMessage by value will
+// still work, but will get a copy of the request.
+using MBSworker = std::function<ModbusMessage(const ModbusMessage& msg)>;
 
 class ModbusServer {
 public:
@@ -35,7 +37,8 @@ public:
   // If there is one already, it will be overwritten!
   void registerWorker(uint8_t serverID, uint8_t functionCode, MBSworker worker);
   
-  // getWorker: if a worker function is registered, return its address, nullptr otherwise
+  // getWorker: if a worker function is registered, return a copy of it, nullptr otherwise.
+  // A copy, as the worker may be unregistered or replaced while it is running.
   MBSworker getWorker(uint8_t serverID, uint8_t functionCode);
 
   // unregisterWorker; remove again all or part of the registered workers for a given server ID
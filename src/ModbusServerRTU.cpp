@@ -3,6 +3,7 @@
 //               MIT license - see license.md for details
 // =================================================================================================
 #include "ModbusServerRTU.h"
+#include "PDUutils.h"
 
 #if HAS_FREERTOS
 
@@ -24,7 +25,8 @@ ModbusServerRTU::ModbusServerRTU(HardwareSerial& serial, uint32_t timeout, int r
   MSRuseASCII(false),
   MSRskipLeadingZeroByte(false),
   listener(nullptr),
-  sniffer(nullptr) {
+  sniffer(nullptr),
+  MSRframes(nullptr) {
   // Count instances one up
   instanceCounter++;
   // If we have a GPIO RE/DE pin, configure it.
@@ -51,7 +53,8 @@ ModbusServerRTU::ModbusServerRTU(HardwareSerial& serial, uint32_t timeout, RTSca
   MSRuseASCII(false),
   MSRskipLeadingZeroByte(false),
   listener(nullptr),
-  sniffer(nullptr) {
+  sniffer(nullptr),
+  MSRframes(nullptr) {
   // Count instances one up
   instanceCounter++;
   // Configure RTS callback
@@ -61,6 +64,10 @@ ModbusServerRTU::ModbusServerRTU(HardwareSerial& serial, uint32_t timeout, RTSca
 
 // Destructor
 ModbusServerRTU::~ModbusServerRTU() {
+  // The server task may be using the frame pool
+  stop();
+  // Frames still held by listeners will be freed when they are released
+  delete MSRframes;
 }
 
 // start: create task with RTU server
@@ -133,7 +140,9 @@ void ModbusServerRTU::skipLeading0x00(bool onOff) {
 // Special case: worker to react on broadcast requests
 void ModbusServerRTU::registerBroadcastWorker(MSRlistener worker) {
   // If there is one already, it will be overwritten!
-  listener = worker;
+  // The frames for the listener are set up before the server task may see it
+  if (!MSRframes) MSRframes = new FramePool(4, 256);
+  listener = std::move(worker);
   LOG_D("Registered worker for broadcast requests\n");
 }
 
@@ -142,7 +151,9 @@ void ModbusServerRTU::registerSniffer(MSRlistener worker) {
   // If there is one already, it will be overwritten!
   // This holds true for the broadcast worker as well, 
   // so a sniffer never will do else but to sniff on broadcast requests!
-  sniffer = worker;
+  // The frames for the sniffer are set up before the server task may see it
+  if (!MSRframes) MSRframes = new FramePool(4, 256);
+  sniffer = std::move(worker);
   LOG_D("Registered sniffer\n");
 }
 
@@ -175,17 +186,22 @@ void ModbusServerRTU::serve(ModbusServerRTU *myServer) {
       LOG_D("Request received.\n");
 
       // Yes. 
+      // Do we have a sniffer or a broadcast listener? Both will share the same frame
+      ModbusFrame frame;
+      if (myServer->sniffer || (request[0] == 0 && myServer->listener)) {
+        frame = myServer->MSRframes->make(request);
+      }
       // Do we have a sniffer listening?
       if (myServer->sniffer) {
         // Yes. call it
-        myServer->sniffer(request);
+        myServer->sniffer(frame);
       }
       // Is it a broadcast?
       if (request[0] == 0) {
         // Yes. Do we have a listener?
         if (myServer->listener) {
           // Yes. call it
-          myServer->listener(request);
+          myServer->listener(frame);
         }
         // else we simply ignore it
       } else {
@@ -199,9 +215,16 @@ void ModbusServerRTU::serve(ModbusServerRTU *myServer) {
             LOCK_GUARD(cntLock, myServer->m);
             myServer->messageCount++;
           }
-          // Get the user's response
-          LOG_D("Callback called.\n");
-          m = callBack(request);
+          // Is the request well-formed?
+          Error e = PDUutils::checkRequest(request);
+          if (e == SUCCESS) {
+            // Yes. Get the user's response
+            LOG_D("Callback called.\n");
+            m = callBack(request);
+          } else {
+            // No. Respond with the error
+            m.setError(request.getServerID(), request.getFunctionCode(), e);
+          }
           HEXDUMP_V("Callback response", m.data(), m.size());
 
           // Process Response. Is it one of the predefined types?
@@ -212,9 +235,9 @@ void ModbusServerRTU::serve(ModbusServerRTU *myServer) {
               response.clear();
               break;
             case 0xF1: // ECHO
-              response = request;
-              if (request.getFunctionCode() == WRITE_MULT_REGISTERS ||
-                  request.getFunctionCode() == WRITE_MULT_COILS) {
+              response = std::move(request);
+              if (response.getFunctionCode() == WRITE_MULT_REGISTERS ||
+                  response.getFunctionCode() == WRITE_MULT_COILS) {
                 response.resize(6);
               }
               break;
@@ -223,7 +246,7 @@ void ModbusServerRTU::serve(ModbusServerRTU *myServer) {
             }
           } else {
             // No predefined. User provided data in free format
-            response = m;
+            response = std::move(m);
           }
         } else {
           // No callback. Is at least the serverID valid and no broadcast?
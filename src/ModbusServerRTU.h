@@ -12,6 +12,7 @@
 #include <Arduino.h>
 #include "HardwareSerial.h"
 #include "ModbusServer.h"
+#include "ModbusFrame.h"
 #include "RTUutils.h"
 
 extern "C" {
@@ -20,7 +21,10 @@ extern "C" {
 }
 
 // Specal function signature for broadcast or sniffer listeners
-using MSRlistener = std::function<void(ModbusMessage msg)>;
+// Both may be called for the same request, so they share one ModbusFrame. A listener
+// may keep a copy of the frame without copying the data. Listeners taking a ModbusMessage
+// will still work, but will get a copy of the request.
+using MSRlistener = std::function<void(const ModbusFrame& msg)>;
 
 class ModbusServerRTU : public ModbusServer {
 public:
@@ -78,6 +82,7 @@ protected:
   bool MSRskipLeadingZeroByte;           // true=first byte ignored if 0x00, false=all bytes accepted
   MSRlistener listener;                  // Broadcast listener 
   MSRlistener sniffer;                   // Sniffer listener 
+  FramePool *MSRframes;                  // Frames for sniffer and listener, made when the first is registered
 
   // serve: loop function for server task
   static void serve(ModbusServerRTU *myself);
@@ -0,0 +1,339 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#include "ModbusServerRTUoverIP.h"
+#include "PDUutils.h"
+#include "RTUutils.h"
+
+#if IS_LINUX
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#undef LOCAL_LOG_LEVEL
+// #define LOCAL_LOG_LEVEL LOG_LEVEL_VERBOSE
+#include "Logging.h"
+
+// Constructor takes the transport
+ModbusServerRTUoverIP::ModbusServerRTUoverIP(RTUtransport transport) :
+  ModbusServer(),
+  transport(transport),
+  serverSocket(-1),
+  serverPort(0),
+  maxClients(4),
+  serverTimeout(20000),
+  serverThread(0),
+  running(false) { }
+
+// Destructor: stops the server
+ModbusServerRTUoverIP::~ModbusServerRTUoverIP() {
+  stop();
+}
+
+// start: open the socket on the given port and start the server thread
+bool ModbusServerRTUoverIP::start(uint16_t port, uint8_t clients, uint32_t timeout, int coreID) {
+  // Already running? Shut it down first
+  if (running) stop();
+  maxClients = clients ? clients : 1;
+  serverTimeout = timeout;
+
+  serverSocket = socket(AF_INET, (transport == RTU_OVER_UDP ? SOCK_DGRAM : SOCK_STREAM) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (serverSocket < 0) {
+    LOG_E("Could not create socket: %s\n", strerror(errno));
+    return false;
+  }
+  int one = 1;
+  setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (bind(serverSocket, (sockaddr *)&addr, sizeof(addr)) < 0
+   || (transport == RTU_OVER_TCP && listen(serverSocket, maxClients) < 0)) {
+    LOG_E("Could not open port %d: %s\n", port, strerror(errno));
+    close(serverSocket);
+    serverSocket = -1;
+    return false;
+  }
+  // Find out the port actually bound - port 0 will have taken any
+  socklen_t alen = sizeof(addr);
+  getsockname(serverSocket, (sockaddr *)&addr, &alen);
+  serverPort = ntohs(addr.sin_port);
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  // Pin the thread to a CPU?
+  if (coreID >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(coreID, &cpus);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+  }
+  int rc = pthread_create(&serverThread, &attr, &serve, this);
+  pthread_attr_destroy(&attr);
+  // An invalid CPU will fail - try again without
+  if (rc && coreID >= 0) {
+    LOG_E("Could not apply core %d to RTU over IP server thread: %s\n", coreID, strerror(rc));
+    rc = pthread_create(&serverThread, NULL, &serve, this);
+  }
+  if (rc) {
+    LOG_E("Error creating RTU over IP server thread: %d\n", rc);
+    close(serverSocket);
+    serverSocket = -1;
+    serverPort = 0;
+    return false;
+  }
+  running = true;
+  LOG_D("RTU over %s server started on port %d\n", transport == RTU_OVER_UDP ? "UDP" : "TCP", serverPort);
+  return true;
+}
+
+// stop: kill the server thread and close all sockets
+bool ModbusServerRTUoverIP::stop() {
+  if (!running) return false;
+  pthread_cancel(serverThread);
+  pthread_join(serverThread, NULL);
+  running = false;
+  for (auto c : connections) {
+    close(c->fd);
+    delete c;
+  }
+  connections.clear();
+  close(serverSocket);
+  serverSocket = -1;
+  serverPort = 0;
+  LOG_D("RTU over IP server stopped\n");
+  return true;
+}
+
+// getPort: port the server is listening on
+uint16_t ModbusServerRTUoverIP::getPort() {
+  return serverPort;
+}
+
+// serve: loop function for server thread
+void *ModbusServerRTUoverIP::serve(void *p) {
+  ModbusServerRTUoverIP *myself = (ModbusServerRTUoverIP *)p;
+  if (myself->transport == RTU_OVER_UDP) {
+    myself->serveUDP();
+  } else {
+    myself->serveTCP();
+  }
+  return nullptr;
+}
+
+// serveUDP: one request frame per datagram, answered to its sender
+void ModbusServerRTUoverIP::serveUDP() {
+  uint8_t request[300];
+  uint8_t response[260];
+  while (1) {
+    // Wait for requests - poll() is a cancellation point for stop()
+    pollfd pfd = { serverSocket, POLLIN, 0 };
+    if (poll(&pfd, 1, -1) <= 0) continue;
+    sockaddr_in from;
+    socklen_t fromLen = sizeof(from);
+    ssize_t got;
+    while ((got = recvfrom(serverSocket, request, sizeof(request), MSG_DONTWAIT, (sockaddr *)&from, &fromLen)) >= 0) {
+      uint16_t len = process(request, got, response);
+      if (len) {
+        if (sendto(serverSocket, response, len, 0, (sockaddr *)&from, fromLen) < 0) {
+          LOG_E("UDP send failed: %s\n", strerror(errno));
+        }
+      }
+      fromLen = sizeof(from);
+    }
+  }
+}
+
+// serveTCP: accept connections and answer the requests on them
+void ModbusServerRTUoverIP::serveTCP() {
+  std::vector<pollfd> pfds;
+  while (1) {
+    // Listen for new connections only while there is room for them
+    pfds.clear();
+    pfds.push_back({ connections.size() < maxClients ? serverSocket : -1, POLLIN, 0 });
+    for (auto c : connections) pfds.push_back({ c->fd, POLLIN, 0 });
+    // Wake up in time for idle connections and incomplete frames
+    poll(pfds.data(), pfds.size(), connections.empty() ? -1 : RTUIP_FRAMEGAP);
+
+    unsigned long now = millis();
+    for (uint16_t i = 1; i < pfds.size(); ++i) {
+      Connection *c = connections[i - 1];
+      bool keep = true;
+      if (pfds[i].revents) {
+        keep = readConnection(*c);
+      } else {
+        // Drop the rest of an incomplete frame after a while
+        if (c->rxLen && now - c->lastRx > RTUIP_FRAMEGAP) {
+          HEXDUMP_V("Incomplete frame dropped", c->rx, c->rxLen);
+          c->rxLen = 0;
+        }
+        // Idle for too long?
+        if (serverTimeout && now - c->lastMessage >= serverTimeout) {
+          LOG_D("Connection closed due to timeout.\n");
+          keep = false;
+        }
+      }
+      if (!keep) {
+        close(c->fd);
+        c->fd = -1;
+      }
+    }
+    // Remove the closed connections
+    for (auto it = connections.begin(); it != connections.end(); ) {
+      if ((*it)->fd < 0) {
+        delete *it;
+        it = connections.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    // New connection?
+    if (pfds[0].revents & POLLIN) {
+      int fd = accept4(serverSocket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd >= 0) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        Connection *c = new Connection;
+        c->fd = fd;
+        c->rxLen = 0;
+        c->lastRx = c->lastMessage = millis();
+        connections.push_back(c);
+        LOG_D("Accepted connection - %d clients running\n", (int)connections.size());
+      }
+    }
+  }
+}
+
+// readConnection: read from a connection and answer the complete requests
+bool ModbusServerRTUoverIP::readConnection(Connection& c) {
+  ssize_t got = recv(c.fd, c.rx + c.rxLen, sizeof(c.rx) - c.rxLen, MSG_DONTWAIT);
+  if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+  if (got <= 0) {
+    LOG_D("Connection closed by client.\n");
+    return false;
+  }
+  c.rxLen += got;
+  c.lastRx = millis();
+
+  // Cut the stream into frames and answer each one
+  uint8_t response[260];
+  uint16_t used = 0;
+  while (used < c.rxLen) {
+    int len = RTUutils::frameLength(c.rx + used, c.rxLen - used, false);
+    if (len == 0) break;
+    if (len < 0) {
+      // No valid frame - the stream is out of sync. Start over with the next data
+      HEXDUMP_V("Invalid data dropped", c.rx + used, c.rxLen - used);
+      used = c.rxLen;
+      break;
+    }
+    c.lastMessage = c.lastRx;
+    uint16_t rlen = process(c.rx + used, len, response);
+    used += len;
+    if (rlen && ::send(c.fd, response, rlen, MSG_NOSIGNAL) != rlen) {
+      LOG_E("TCP send failed: %s\n", strerror(errno));
+      return false;
+    }
+  }
+  if (used) {
+    memmove(c.rx, c.rx + used, c.rxLen - used);
+    c.rxLen -= used;
+  }
+  return true;
+}
+
+// process: handle one request frame
+uint16_t ModbusServerRTUoverIP::process(const uint8_t *frame, uint16_t len, uint8_t *buffer) {
+  ModbusMessage response;               // Response proper to be sent
+
+  HEXDUMP_V("Request", frame, len);
+  // Server ID, function code and CRC at least, and a valid CRC?
+  if (len < 4 || !RTUutils::validCRC(frame, len)) {
+    // No. A device on a serial line would not answer either
+    LOG_D("Request with bad CRC ignored\n");
+    return 0;
+  }
+  // A broadcast gets no response
+  if (frame[0] == 0) return 0;
+
+  ModbusMessage request;
+  request.add(frame, len - 2);
+  // Do we have a callback function registered for it?
+  MBSworker callBack = getWorker(request.getServerID(), request.getFunctionCode());
+  if (callBack) {
+    // Yes, we do. Count the message
+    {
+      LOCK_GUARD(cntLock, m);
+      messageCount++;
+    }
+    ModbusMessage data;                 // Application's response data
+    // Is the request well-formed?
+    Error e = PDUutils::checkRequest(request);
+    if (e == SUCCESS) {
+      // Yes. Get the user's response
+      data = callBack(request);
+    } else {
+      // No. Respond with the error
+      data.setError(request.getServerID(), request.getFunctionCode(), e);
+    }
+    // Process Response. Is it one of the predefined types?
+    if (data[0] == 0xFF && (data[1] == 0xF0 || data[1] == 0xF1)) {
+      // Yes. Check it
+      switch (data[1]) {
+      case 0xF0: // NIL
+        response.clear();
+        break;
+      case 0xF1: // ECHO
+        response = std::move(request);
+        if (response.getFunctionCode() == WRITE_MULT_REGISTERS ||
+            response.getFunctionCode() == WRITE_MULT_COILS) {
+          response.resize(6);
+        }
+        break;
+      default:   // Will not get here, but lint likes it!
+        break;
+      }
+    } else {
+      // No predefined. User provided data in free format
+      response = std::move(data);
+    }
+  } else {
+    // No callback. Is at least the serverID valid?
+    if (isServerFor(request.getServerID())) {
+      // Yes. Send back a ILLEGAL_FUNCTION error
+      response.setError(request.getServerID(), request.getFunctionCode(), ILLEGAL_FUNCTION);
+    }
+    // Else we will ignore the request, as it is not meant for us
+  }
+
+  // Do we have gathered a valid response now?
+  if (response.size() < 3) return 0;
+  if (response.size() > 254) {
+    LOG_E("Response too long for a RTU frame: %d bytes\n", response.size());
+    return 0;
+  }
+  // Add the CRC
+  uint16_t rlen = response.size();
+  memcpy(buffer, response.data(), rlen);
+  uint16_t crc = RTUutils::calcCRC(buffer, rlen);
+  buffer[rlen++] = crc & 0xFF;
+  buffer[rlen++] = (crc >> 8) & 0xFF;
+  HEXDUMP_V("Response", buffer, rlen);
+  // Count it, in case we had an error response
+  if (response.getError() != SUCCESS) {
+    LOCK_GUARD(errorCntLock, m);
+    errorCount++;
+  }
+  return rlen;
+}
+
+#endif  // IS_LINUX
@@ -0,0 +1,83 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _MODBUS_SERVER_RTU_OVER_IP_H
+#define _MODBUS_SERVER_RTU_OVER_IP_H
+
+#include "options.h"
+
+#if IS_LINUX
+#include <pthread.h>
+#include <vector>
+#include "ModbusServer.h"
+
+#define RTUIP_FRAMEGAP 50         // ms without data that end an incomplete frame in a TCP stream
+
+// ModbusServerRTUoverIP: answers Modbus RTU frames - server ID, function code, data and CRC, no MBAP
+// header - received over TCP connections or in UDP datagrams, as a serial device server would forward
+// them. The registered worker functions are used as with ModbusServerRTU, and it behaves like a device
+// on a serial line: requests with a bad CRC, broadcasts and requests for server IDs not served get no
+// response. Requests following each other on a TCP connection are answered in order.
+// A single thread serves all connections. Linux only.
+class ModbusServerRTUoverIP : public ModbusServer {
+public:
+  // Constructor takes the transport
+  explicit ModbusServerRTUoverIP(RTUtransport transport = RTU_OVER_TCP);
+
+  // Destructor: stops the server
+  ~ModbusServerRTUoverIP();
+
+  // start: open the socket on the given port and start the server thread. Port 0 will take any free port,
+  // see getPort(). With TCP, up to maxClients connections are served, each closed after timeout ms
+  // without a request (0: never). coreID >= 0 will pin the thread to that CPU.
+  bool start(uint16_t port, uint8_t maxClients = 4, uint32_t timeout = 20000, int coreID = -1);
+
+  // stop: kill the server thread and close all sockets
+  bool stop();
+
+  // getPort: port the server is listening on, 0 if not started
+  uint16_t getPort();
+
+protected:
+  // Prevent copy construction and assignment
+  ModbusServerRTUoverIP(ModbusServerRTUoverIP& m) = delete;
+  ModbusServerRTUoverIP& operator=(ModbusServerRTUoverIP& m) = delete;
+
+  inline void isInstance() { }
+
+  // A TCP connection and its data not processed yet
+  struct Connection {
+    int fd;
+    uint16_t rxLen;
+    unsigned long lastRx;         // millis() when data was read last
+    unsigned long lastMessage;    // millis() of the last request
+    uint8_t rx[512];
+  };
+
+  // serve: loop function for server thread
+  static void *serve(void *p);
+
+  // serveTCP, serveUDP: wait for and answer requests
+  void serveTCP();
+  void serveUDP();
+
+  // readConnection: read from a connection and answer the complete requests. Returns false if it was closed
+  bool readConnection(Connection& c);
+
+  // process: handle one request frame. Returns the length of the response frame to send, 0 for none
+  uint16_t process(const uint8_t *frame, uint16_t len, uint8_t *buffer);
+
+  RTUtransport transport;         // TCP or UDP
+  int serverSocket;               // Listening TCP or UDP socket, -1 if not started
+  uint16_t serverPort;            // Port listened on
+  uint8_t maxClients;             // TCP connections served at most
+  uint32_t serverTimeout;         // Idle time in ms before a TCP connection is closed
+  std::vector<Connection *> connections;   // Open TCP connections, server thread only
+  pthread_t serverThread;         // Thread reading and answering requests
+  bool running;                   // true while the thread exists
+};
+
+#endif  // IS_LINUX
+
+#endif  // INCLUDE GUARD
@@ -4,6 +4,7 @@
 // =================================================================================================
 
 #include "ModbusServerTCPasync.h"
+#include "PDUutils.h"
 #define LOCAL_LOG_LEVEL LOG_LEVEL_VERBOSE
 // #undef LOCAL_LOG_LEVEL
 #include "Logging.h"
@@ -88,8 +89,15 @@ void ModbusServerTCPasync::mb_client::onData(uint8_t* data, size_t len) {
     if (server->isServerFor(request.getServerID())) {
       MBSworker callback = server->getWorker(request.getServerID(), request.getFunctionCode());
       if (callback) {
-        // request is well formed and is being served by user API
-        userData = callback(request);
+        // request is being served by user API. Is it well formed?
+        Error e = PDUutils::checkRequest(request);
+        if (e == SUCCESS) {
+          // Yes. Call the worker
+          userData = callback(request);
+        } else {
+          // No. Respond with the error
+          userData.setError(request.getServerID(), request.getFunctionCode(), e);
+        }
         // Process Response
         // One of the predefined types?
         if (userData[0] == 0xFF && (userData[1] == 0xF0 || userData[1] == 0xF1)) {
@@ -100,9 +108,9 @@ void ModbusServerTCPasync::mb_client::onData(uint8_t* data, size_t len) {
             LOG_D("NIL response\n");
             break;
           case 0xF1: // ECHO
-            userData = request;
-            if (request.getFunctionCode() == WRITE_MULT_REGISTERS ||
-                request.getFunctionCode() == WRITE_MULT_COILS) {
+            userData = std::move(request);
+            if (userData.getFunctionCode() == WRITE_MULT_REGISTERS ||
+                userData.getFunctionCode() == WRITE_MULT_COILS) {
               userData.resize(6);
             }
             LOG_D("ECHO response\n");
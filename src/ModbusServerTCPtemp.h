@@ -8,6 +8,7 @@
 #include <Arduino.h>
 #include <mutex>  // NOLINT
 #include "ModbusServer.h"
+#include "PDUutils.h"
 #undef LOCAL_LOG_LEVEL
 // #define LOCAL_LOG_LEVEL LOG_LEVEL_VERBOSE
 #include "Logging.h"
@@ -285,9 +286,16 @@ void ModbusServerTCP<ST, CT>::worker(ClientData *myData) {
             // Server is correct - in principle. Do we serve the FC?
             MBSworker callBack = myParent->getWorker(request.getServerID(), request.getFunctionCode());
             if (callBack) {
-              // Yes, we do.
-              // Invoke the worker method to get a response
-              ModbusMessage data = callBack(request);
+              // Yes, we do. Is the request well-formed?
+              ModbusMessage data;
+              Error e = PDUutils::checkRequest(request);
+              if (e == SUCCESS) {
+                // Yes. Invoke the worker method to get a response
+                data = callBack(request);
+              } else {
+                // No. Respond with the error
+                data.setError(request.getServerID(), request.getFunctionCode(), e);
+              }
               // Process Response
               // One of the predefined types?
               if (data[0] == 0xFF && (data[1] == 0xF0 || data[1] == 0xF1)) {
@@ -298,9 +306,9 @@ void ModbusServerTCP<ST, CT>::worker(ClientData *myData) {
                   LOG_D("NIL response\n");
                   break;
                 case 0xF1: // ECHO
-                  response = request;
-                  if (request.getFunctionCode() == WRITE_MULT_REGISTERS ||
-                      request.getFunctionCode() == WRITE_MULT_COILS) {
+                  response = std::move(request);
+                  if (response.getFunctionCode() == WRITE_MULT_REGISTERS ||
+                      response.getFunctionCode() == WRITE_MULT_COILS) {
                     response.resize(6);
                   }
                   LOG_D("ECHO response\n");
@@ -310,7 +318,7 @@ void ModbusServerTCP<ST, CT>::worker(ClientData *myData) {
                 }
               } else {
                 // No. User provided data response
-                response = data;
+                response = std::move(data);
                 LOG_D("Data response\n");
               }
             } else {
@@ -0,0 +1,263 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#include "ModbusServerUDP.h"
+#include "PDUutils.h"
+
+#if IS_LINUX
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#undef LOCAL_LOG_LEVEL
+// #define LOCAL_LOG_LEVEL LOG_LEVEL_VERBOSE
+#include "Logging.h"
+
+#define UDP_MAXFRAME 300          // Modbus Packet supposedly will fit (260<300)
+
+// Constructor
+ModbusServerUDP::ModbusServerUDP() :
+  ModbusServer(),
+  serverSocket(-1),
+  serverPort(0),
+  serverThread(0),
+  running(false) { }
+
+// Destructor: stops the server
+ModbusServerUDP::~ModbusServerUDP() {
+  stop();
+}
+
+// start: open the socket on the given port and start the server thread
+bool ModbusServerUDP::start(uint16_t port, int coreID) {
+  // Already running? Shut it down first
+  if (running) stop();
+
+  serverSocket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (serverSocket < 0) {
+    LOG_E("Could not create UDP socket: %s\n", strerror(errno));
+    return false;
+  }
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (bind(serverSocket, (sockaddr *)&addr, sizeof(addr)) < 0) {
+    LOG_E("Could not bind UDP port %d: %s\n", port, strerror(errno));
+    close(serverSocket);
+    serverSocket = -1;
+    return false;
+  }
+  // Find out the port actually bound - port 0 will have taken any
+  socklen_t alen = sizeof(addr);
+  getsockname(serverSocket, (sockaddr *)&addr, &alen);
+  serverPort = ntohs(addr.sin_port);
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  // Pin the thread to a CPU?
+  if (coreID >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(coreID, &cpus);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+  }
+  int rc = pthread_create(&serverThread, &attr, &serve, this);
+  pthread_attr_destroy(&attr);
+  // An invalid CPU will fail - try again without
+  if (rc && coreID >= 0) {
+    LOG_E("Could not apply core %d to UDP server thread: %s\n", coreID, strerror(rc));
+    rc = pthread_create(&serverThread, NULL, &serve, this);
+  }
+  if (rc) {
+    LOG_E("Error creating UDP server thread: %d\n", rc);
+    close(serverSocket);
+    serverSocket = -1;
+    serverPort = 0;
+    return false;
+  }
+  running = true;
+  LOG_D("UDP server started on port %d\n", serverPort);
+  return true;
+}
+
+// stop: kill the server thread and close the socket
+bool ModbusServerUDP::stop() {
+  if (!running) return false;
+  pthread_cancel(serverThread);
+  pthread_join(serverThread, NULL);
+  running = false;
+  close(serverSocket);
+  serverSocket = -1;
+  serverPort = 0;
+  LOG_D("UDP server stopped\n");
+  return true;
+}
+
+// getPort: port the server is listening on
+uint16_t ModbusServerUDP::getPort() {
+  return serverPort;
+}
+
+// serve: loop function for server thread
+// Waits for request datagrams, then reads and answers as many as have arrived
+void *ModbusServerUDP::serve(void *p) {
+  ModbusServerUDP *myself = (ModbusServerUDP *)p;
+  uint8_t request[UDP_SERVER_BATCH][UDP_MAXFRAME];
+  uint8_t response[UDP_SERVER_BATCH][UDP_MAXFRAME];
+  sockaddr_in from[UDP_SERVER_BATCH];
+  iovec rxIov[UDP_SERVER_BATCH];
+  iovec txIov[UDP_SERVER_BATCH];
+  mmsghdr rx[UDP_SERVER_BATCH];
+  mmsghdr tx[UDP_SERVER_BATCH];
+
+  while (1) {
+    // Wait for requests - poll() is a cancellation point for stop()
+    pollfd pfd = { myself->serverSocket, POLLIN, 0 };
+    if (poll(&pfd, 1, -1) <= 0) continue;
+
+    // Read all that is there, up to a batch
+    for (uint16_t i = 0; i < UDP_SERVER_BATCH; ++i) {
+      rxIov[i].iov_base = request[i];
+      rxIov[i].iov_len = UDP_MAXFRAME;
+      memset(&rx[i], 0, sizeof(rx[i]));
+      rx[i].msg_hdr.msg_name = &from[i];
+      rx[i].msg_hdr.msg_namelen = sizeof(from[i]);
+      rx[i].msg_hdr.msg_iov = &rxIov[i];
+      rx[i].msg_hdr.msg_iovlen = 1;
+    }
+    int got = recvmmsg(myself->serverSocket, rx, UDP_SERVER_BATCH, MSG_DONTWAIT, nullptr);
+    if (got <= 0) continue;
+
+    // Process the requests, collect the responses to send
+    uint16_t count = 0;
+    for (int i = 0; i < got; ++i) {
+      uint16_t len = myself->process(request[i], rx[i].msg_len, response[count]);
+      if (len) {
+        txIov[count].iov_base = response[count];
+        txIov[count].iov_len = len;
+        memset(&tx[count], 0, sizeof(tx[count]));
+        tx[count].msg_hdr.msg_name = &from[i];
+        tx[count].msg_hdr.msg_namelen = rx[i].msg_hdr.msg_namelen;
+        tx[count].msg_hdr.msg_iov = &txIov[count];
+        tx[count].msg_hdr.msg_iovlen = 1;
+        count++;
+      }
+    }
+
+    // Send them all. A response that cannot be sent is lost, as the datagram request could have been
+    uint16_t done = 0;
+    while (done < count) {
+      int sent = sendmmsg(myself->serverSocket, tx + done, count - done, 0);
+      if (sent < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+          pollfd wfd = { myself->serverSocket, POLLOUT, 0 };
+          poll(&wfd, 1, 10);
+          continue;
+        }
+        LOG_E("UDP send failed: %s\n", strerror(errno));
+        sent = 1;
+      }
+      done += sent;
+    }
+  }
+  return nullptr;
+}
+
+// process: handle one request datagram
+uint16_t ModbusServerUDP::process(const uint8_t *frame, uint16_t len, uint8_t *buffer) {
+  ModbusMessage response;               // Data buffer to hold prepared response
+
+  // has it the minimal length (6 bytes TCP header plus serverID plus FC)?
+  if (len < 8) return 0;
+  HEXDUMP_V("Request", frame, len);
+  {
+    LOCK_GUARD(cntLock, m);
+    messageCount++;
+  }
+  // Extract request data
+  ModbusMessage request;
+  request.add(frame + 6, len - 6);
+
+  // Protocol ID shall be 0x0000 and the length has to match the datagram - is it?
+  if (frame[2] == 0 && frame[3] == 0 && ((frame[4] << 8) | frame[5]) == len - 6) {
+    // ServerID shall be at [6], FC at [7]. Check both
+    if (isServerFor(request.getServerID())) {
+      // Server is correct - in principle. Do we serve the FC?
+      MBSworker callBack = getWorker(request.getServerID(), request.getFunctionCode());
+      if (callBack) {
+        // Yes, we do. Is the request well-formed?
+        ModbusMessage data;
+        Error e = PDUutils::checkRequest(request);
+        if (e == SUCCESS) {
+          // Yes. Invoke the worker method to get a response
+          data = callBack(request);
+        } else {
+          // No. Respond with the error
+          data.setError(request.getServerID(), request.getFunctionCode(), e);
+        }
+        // Process Response
+        // One of the predefined types?
+        if (data[0] == 0xFF && (data[1] == 0xF0 || data[1] == 0xF1)) {
+          // Yes. Check it
+          switch (data[1]) {
+          case 0xF0: // NIL
+            response.clear();
+            LOG_D("NIL response\n");
+            break;
+          case 0xF1: // ECHO
+            response = std::move(request);
+            if (response.getFunctionCode() == WRITE_MULT_REGISTERS ||
+                response.getFunctionCode() == WRITE_MULT_COILS) {
+              response.resize(6);
+            }
+            LOG_D("ECHO response\n");
+            break;
+          default:   // Will not get here!
+            break;
+          }
+        } else {
+          // No. User provided data response
+          response = std::move(data);
+          LOG_D("Data response\n");
+        }
+      } else {
+        // No, function code is not served here
+        response.setError(request.getServerID(), request.getFunctionCode(), ILLEGAL_FUNCTION);
+      }
+    } else {
+      // No, serverID is not served here
+      response.setError(request.getServerID(), request.getFunctionCode(), INVALID_SERVER);
+    }
+  } else {
+    // No, protocol ID or length was something weird
+    response.setError(request.getServerID(), request.getFunctionCode(), TCP_HEAD_MISMATCH);
+  }
+
+  // Do we have a response to send?
+  if (response.size() < 3) return 0;
+  if (response.size() > UDP_MAXFRAME - 6) {
+    LOG_E("Response too long for a datagram: %d bytes\n", response.size());
+    return 0;
+  }
+  // Keep transaction and protocol ID, then update the length
+  memcpy(buffer, frame, 4);
+  buffer[4] = (response.size() >> 8) & 0xFF;
+  buffer[5] = response.size() & 0xFF;
+  memcpy(buffer + 6, response.data(), response.size());
+  HEXDUMP_V("Response", buffer, response.size() + 6);
+  // count error responses
+  if (response.getError() != SUCCESS) {
+    LOCK_GUARD(cntLock, m);
+    errorCount++;
+  }
+  return response.size() + 6;
+}
+
+#endif  // IS_LINUX
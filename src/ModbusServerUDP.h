@@ -0,0 +1,60 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _MODBUS_SERVER_UDP_H
+#define _MODBUS_SERVER_UDP_H
+
+#include "options.h"
+
+#if IS_LINUX
+#include <pthread.h>
+#include "ModbusServer.h"
+
+#define UDP_SERVER_BATCH 32       // Datagrams received or sent with one system call
+
+// ModbusServerUDP: Modbus TCP framing (MBAP header plus PDU) in UDP datagrams.
+// Every request datagram is answered with one response datagram to its sender, using the registered
+// worker functions like the TCP servers do. There are no connections, so any number of clients is served
+// by a single socket and thread. Linux only: datagrams are read and answered in batches with
+// recvmmsg() and sendmmsg().
+class ModbusServerUDP : public ModbusServer {
+public:
+  // Constructor
+  ModbusServerUDP();
+
+  // Destructor: stops the server
+  ~ModbusServerUDP();
+
+  // start: open the socket on the given port and start the server thread. Port 0 will take any free port,
+  // see getPort(). coreID >= 0 will pin the thread to that CPU. Returns false if the socket failed.
+  bool start(uint16_t port = 502, int coreID = -1);
+
+  // stop: kill the server thread and close the socket
+  bool stop();
+
+  // getPort: port the server is listening on, 0 if not started
+  uint16_t getPort();
+
+protected:
+  // Prevent copy construction and assignment
+  ModbusServerUDP(ModbusServerUDP& m) = delete;
+  ModbusServerUDP& operator=(ModbusServerUDP& m) = delete;
+
+  inline void isInstance() { }
+
+  // serve: loop function for server thread
+  static void *serve(void *p);
+
+  // process: handle one request datagram. Returns the length of the response to send, 0 for none
+  uint16_t process(const uint8_t *frame, uint16_t len, uint8_t *buffer);
+
+  int serverSocket;               // UDP socket, -1 if not started
+  uint16_t serverPort;            // Port listened on
+  pthread_t serverThread;         // Thread reading and answering requests
+  bool running;                   // true while the thread exists
+};
+
+#endif  // IS_LINUX
+
+#endif  // INCLUDE GUARD
@@ -115,6 +115,12 @@ enum FCType : uint8_t {
   FCILLEGAL,         // not allowed function codes
 };
 
+// Transport of RTU frames over IP, as forwarded by serial device servers
+enum RTUtransport : uint8_t {
+  RTU_OVER_TCP,      // Frames in a TCP stream, one after the other
+  RTU_OVER_UDP,      // One frame per UDP datagram
+};
+
 // FCT: static class to hold the types of function codes
 class FCT {
 protected:
@@ -0,0 +1,149 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#include "PDUutils.h"
+#undef LOCAL_LOG_LEVEL
+#include "Logging.h"
+
+// The rule table. Entry 0 is used for all function codes without explicit rules.
+// FC 0x07 responses are open-ended: they may come from ANY_FUNCTION_CODE workers.
+const PDUutils::PDUrules PDUutils::rules[] = {
+  //  request                     response
+  { {  2, VARIABLE, CHK_NONE },      {  2, VARIABLE, CHK_NONE } },      //  0: unknown/user defined
+  { {  6, 0, CHK_READBITS },         {  3, 2, CHK_READBITS } },         //  1: 0x01 READ_COIL
+  { {  6, 0, CHK_READBITS },         {  3, 2, CHK_READBITS } },         //  2: 0x02 READ_DISCR_INPUT
+  { {  6, 0, CHK_READREGS },         {  3, 2, CHK_READREGS } },         //  3: 0x03 READ_HOLD_REGISTER
+  { {  6, 0, CHK_READREGS },         {  3, 2, CHK_READREGS } },         //  4: 0x04 READ_INPUT_REGISTER
+  { {  6, 0, CHK_COIL },             {  6, 0, CHK_COIL } },             //  5: 0x05 WRITE_COIL
+  { {  6, 0, CHK_NONE },             {  6, 0, CHK_NONE } },             //  6: 0x06 WRITE_HOLD_REGISTER
+  { {  2, 0, CHK_NONE },             {  3, VARIABLE, CHK_NONE } },      //  7: 0x07 READ_EXCEPTION_SERIAL
+  { {  4, VARIABLE, CHK_NONE },      {  4, VARIABLE, CHK_NONE } },      //  8: 0x08 DIAGNOSTICS_SERIAL
+  { {  2, 0, CHK_NONE },             {  6, 0, CHK_NONE } },             //  9: 0x0B READ_COMM_CNT_SERIAL
+  { {  2, 0, CHK_NONE },             {  3, 2, CHK_NONE } },             // 10: 0x0C READ_COMM_LOG_SERIAL
+  { {  7, 6, CHK_WRITEBITS },        {  6, 0, CHK_NONE } },             // 11: 0x0F WRITE_MULT_COILS
+  { {  7, 6, CHK_WRITEREGS },        {  6, 0, CHK_NONE } },             // 12: 0x10 WRITE_MULT_REGISTERS
+  { {  2, 0, CHK_NONE },             {  3, 2, CHK_NONE } },             // 13: 0x11 REPORT_SERVER_ID_SERIAL
+  { {  3, 2, CHK_NONE },             {  3, 2, CHK_NONE } },             // 14: 0x14 READ_FILE_RECORD
+  { {  3, 2, CHK_NONE },             {  3, 2, CHK_NONE } },             // 15: 0x15 WRITE_FILE_RECORD
+  { {  8, 0, CHK_NONE },             {  8, 0, CHK_NONE } },             // 16: 0x16 MASK_WRITE_REGISTER
+  { { 11, 10, CHK_RWREGS },          {  3, 2, CHK_RWREGS } },           // 17: 0x17 R_W_MULT_REGISTERS
+  { {  4, 0, CHK_NONE },             {  4, 2, CHK_COUNT16 } },          // 18: 0x18 READ_FIFO_QUEUE
+  { {  3, VARIABLE, CHK_NONE },      {  3, VARIABLE, CHK_NONE } },      // 19: 0x2B ENCAPSULATED_INTERFACE
+};
+
+// Function code to rule index
+const uint8_t PDUutils::ruleIndex[128] = {
+//  x0  x1  x2  x3  x4  x5  x6  x7  x8  x9  xA  xB  xC  xD  xE  xF
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  0,  0,  9, 10,  0,  0, 11,   // 0x
+    12, 13,  0,  0, 14, 15, 16, 17, 18,  0,  0,  0,  0,  0,  0,  0,   // 1x
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 19,  0,  0,  0,  0,   // 2x
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 3x
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 4x
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 5x
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 6x
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,   // 7x
+};
+
+// Read a MSB-first word from data
+static inline uint16_t getWord(const uint8_t *data, uint16_t pos) {
+  return (data[pos] << 8) | data[pos + 1];
+}
+
+// checkRule: check length and consistency
+bool PDUutils::checkRule(const PDUrule& r, const uint8_t *data, uint16_t len, const uint8_t *req, uint16_t reqLen) {
+  // Minimum length for all kinds of rules
+  if (len < r.length) return false;
+
+  // Length check
+  if (r.countPos == 0) {
+    if (len != r.length) return false;
+  } else if (r.countPos != VARIABLE) {
+    if (r.check == CHK_COUNT16) {
+      if (len != r.countPos + 2 + getWord(data, r.countPos)) return false;
+    } else if (len != r.countPos + 1 + data[r.countPos]) {
+      return false;
+    }
+  }
+
+  // Consistency checks. For responses the quantities are taken from the request
+  uint16_t qty = 0;
+  switch (r.check) {
+  case CHK_READBITS:
+    if (req) {
+      return reqLen >= 6 && data[2] == (getWord(req, 4) + 7) / 8;
+    }
+    qty = getWord(data, 4);
+    return qty >= 1 && qty <= 2000;
+  case CHK_READREGS:
+    if (req) {
+      return reqLen >= 6 && data[2] == getWord(req, 4) * 2;
+    }
+    qty = getWord(data, 4);
+    return qty >= 1 && qty <= 125;
+  case CHK_COIL:
+    return getWord(data, 4) == 0x0000 || getWord(data, 4) == 0xFF00;
+  case CHK_WRITEBITS:
+    qty = getWord(data, 4);
+    return qty >= 1 && qty <= 1968 && data[6] == (qty + 7) / 8;
+  case CHK_WRITEREGS:
+    qty = getWord(data, 4);
+    return qty >= 1 && qty <= 123 && data[6] == qty * 2;
+  case CHK_RWREGS:
+    if (req) {
+      return reqLen >= 6 && data[2] == getWord(req, 4) * 2;
+    }
+    qty = getWord(data, 8);
+    return getWord(data, 4) >= 1 && getWord(data, 4) <= 125 && qty >= 1 && qty <= 121 && data[10] == qty * 2;
+  default:
+    break;
+  }
+  return true;
+}
+
+// checkRequest: validate a request
+Error PDUutils::checkRequest(const uint8_t *data, uint16_t len) {
+  if (len < 2 || (data[1] & 0x80)) return ILLEGAL_DATA_VALUE;
+  if (!checkRule(rules[ruleIndex[data[1]]].request, data, len, nullptr, 0)) {
+    LOG_D("Request %02X/%02X (%d bytes) failed validation\n", data[0], data[1], len);
+    return ILLEGAL_DATA_VALUE;
+  }
+  return SUCCESS;
+}
+
+// checkResponse: validate a response against the request
+Error PDUutils::checkResponse(const uint8_t *data, uint16_t len, const ModbusMessage& request) {
+  if (len < 2) return PACKET_LENGTH_ERROR;
+  // Server ID and function code have to match those of the request
+  if (data[0] != request.getServerID()) return SERVER_ID_MISMATCH;
+  if ((data[1] & 0x7F) != request.getFunctionCode()) return FC_MISMATCH;
+  // Error responses have exactly one byte of data
+  if (data[1] & 0x80) {
+    return (len == 3) ? SUCCESS : PACKET_LENGTH_ERROR;
+  }
+  if (!checkRule(rules[ruleIndex[data[1]]].response, data, len, request.data(), request.size())) {
+    LOG_D("Response %02X/%02X (%d bytes) failed validation\n", data[0], data[1], len);
+    return PACKET_LENGTH_ERROR;
+  }
+  return SUCCESS;
+}
+
+// frameLength: determine the length of a frame from its first bytes
+int PDUutils::frameLength(const uint8_t *data, uint16_t len, bool isResponse) {
+  // We need at least server ID and function code
+  if (len < 2) return 0;
+  // Error response?
+  if (isResponse && (data[1] & 0x80)) return 3;
+  const PDUrule& r = isResponse ? rules[ruleIndex[data[1] & 0x7F]].response : rules[ruleIndex[data[1] & 0x7F]].request;
+  // No rule or variable size?
+  if (r.countPos == VARIABLE) return -1;
+  // Fixed length?
+  if (r.countPos == 0) return r.length;
+  // Byte count known already?
+  if (r.check == CHK_COUNT16) {
+    if (len < r.countPos + 2) return 0;
+    return r.countPos + 2 + getWord(data, r.countPos);
+  }
+  if (len <= r.countPos) return 0;
+  return r.countPos + 1 + data[r.countPos];
+}
@@ -0,0 +1,74 @@
+// =================================================================================================
+// eModbus: Copyright 2020 by Michael Harwerth, Bert Melis and the contributors to eModbus
+//               MIT license - see license.md for details
+// =================================================================================================
+#ifndef _PDU_UTILS_H
+#define _PDU_UTILS_H
+#include <stdint.h>
+#include "ModbusMessage.h"
+
+// PDUutils is bundling the structural validation of requests and responses.
+// The rules for all function codes in Modbus::FunctionCode are held in a table:
+// fixed length or position of a byte count, plus consistency checks like the byte
+// count of a FC 0x03 response against the quantity requested.
+// Clients and servers of all kinds use it, so there is one place to check a frame.
+// Function codes not found in the table (user defined etc.) are checked for the
+// minimum length of server ID and function code only.
+// All data pointers include the server ID, but no TCP header nor CRC.
+// All functions are static!
+class PDUutils {
+public:
+  // checkRequest: validate a request.
+  // Returns SUCCESS or ILLEGAL_DATA_VALUE, that may be directly used as an error response
+  static Error checkRequest(const uint8_t *data, uint16_t len);
+  inline static Error checkRequest(const ModbusMessage& request) { return checkRequest(request.data(), request.size()); }
+
+  // checkResponse: validate a response against the request it is answering.
+  // Returns SUCCESS, SERVER_ID_MISMATCH, FC_MISMATCH or PACKET_LENGTH_ERROR.
+  // An error response that is formally correct will return SUCCESS as well!
+  static Error checkResponse(const uint8_t *data, uint16_t len, const ModbusMessage& request);
+  inline static Error checkResponse(const ModbusMessage& response, const ModbusMessage& request) { return checkResponse(response.data(), response.size(), request); }
+
+  // frameLength: calculate the complete length of a request or response from its first bytes.
+  // Returns the length, 0 if more bytes are needed to tell, or -1 if the length can not be
+  // determined from the data (unknown function codes or variable sized ones without byte count)
+  static int frameLength(const uint8_t *data, uint16_t len, bool isResponse);
+
+protected:
+  // Consistency checks beyond the length
+  enum PDUcheck : uint8_t {
+    CHK_NONE = 0,
+    CHK_READBITS,    // FC 0x01, 0x02: quantity 1..2000, response byte count (quantity + 7) / 8
+    CHK_READREGS,    // FC 0x03, 0x04: quantity 1..125, response byte count 2 * quantity
+    CHK_COIL,        // FC 0x05: value 0x0000 or 0xFF00
+    CHK_WRITEBITS,   // FC 0x0F: quantity 1..1968, byte count (quantity + 7) / 8
+    CHK_WRITEREGS,   // FC 0x10: quantity 1..123, byte count 2 * quantity
+    CHK_RWREGS,      // FC 0x17: read quantity 1..125, write quantity 1..121, byte counts
+    CHK_COUNT16,     // FC 0x18 response: 16 bit byte count
+  };
+
+  // Length rule for one direction of a function code
+  struct PDUrule {
+    uint8_t length;    // fixed length or minimum length, including server ID and FC
+    uint8_t countPos;  // 0: fixed length, VARIABLE: minimum length only, else position of the byte count
+    PDUcheck check;    // additional check
+  };
+
+  // Rules for request and response of a function code
+  struct PDUrules {
+    PDUrule request;
+    PDUrule response;
+  };
+
+  static const uint8_t VARIABLE = 0xFF;
+  static const PDUrules rules[];       // the rule table
+  static const uint8_t ruleIndex[128]; // function code to rule table index
+
+  // checkRule: length and consistency checks of data against a rule.
+  // req is the request for response checks, nullptr for request checks
+  static bool checkRule(const PDUrule& r, const uint8_t *data, uint16_t len, const uint8_t *req, uint16_t reqLen);
+
+  PDUutils() = delete;
+};
+
+#endif
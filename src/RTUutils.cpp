@@ -5,6 +5,8 @@
 #include "options.h"
 #include "ModbusMessage.h"
 #include "RTUutils.h"
+#include "ModbusSegments.h"
+#include "PDUutils.h"
 #undef LOCAL_LOG_LEVEL
 // #define LOCAL_LOG_LEVEL LOG_LEVEL_VERBOSE
 #include "Logging.h"
@@ -67,7 +69,7 @@ uint16_t RTUutils::calcCRC(const uint8_t *data, uint16_t len) {
 }
 
 // calcCRC: calculate Modbus CRC16 on a given message
-uint16_t RTUutils::calcCRC(ModbusMessage msg) {
+uint16_t RTUutils::calcCRC(const ModbusMessage& msg) {
   return calcCRC(msg.data(), msg.size());
 }
 
@@ -85,12 +87,12 @@ bool RTUutils::validCRC(const uint8_t *data, uint16_t len, uint16_t CRC) {
 }
 
 // validCRC #3: check the given CRC in a message for correctness
-bool RTUutils::validCRC(ModbusMessage msg) {
+bool RTUutils::validCRC(const ModbusMessage& msg) {
   return validCRC(msg.data(), msg.size() - 2, msg[msg.size() - 2] | (msg[msg.size() - 1] << 8));
 }
 
 // validCRC #4: check the CRC of a message against a given one for equality
-bool RTUutils::validCRC(ModbusMessage msg, uint16_t CRC) {
+bool RTUutils::validCRC(const ModbusMessage& msg, uint16_t CRC) {
   return validCRC(msg.data(), msg.size(), CRC);
 }
 
@@ -101,6 +103,23 @@ void RTUutils::addCRC(ModbusMessage& raw) {
   raw.push_back((crc16 >> 8) & 0xFF);
 }
 
+// frameLength: length of the RTU frame at the start of a byte stream
+int RTUutils::frameLength(const uint8_t *data, uint16_t len, bool isResponse) {
+  // Length without CRC known from the first bytes?
+  int pduLen = PDUutils::frameLength(data, len, isResponse);
+  if (pduLen > 0) {
+    // Yes. Longer than a RTU frame may be?
+    if (pduLen + 2 > 256) return -1;
+    return (len >= pduLen + 2) ? pduLen + 2 : 0;
+  }
+  if (pduLen == 0) return 0;
+  // No. Take the shortest stretch ending in a valid CRC. Server ID, function code and CRC are 4 bytes at least.
+  for (uint16_t i = 4; i <= len && i <= 256; ++i) {
+    if (validCRC(data, i)) return i;
+  }
+  return (len >= 256) ? -1 : 0;
+}
+
 // calculateInterval: determine the minimal gap time between messages
 uint32_t RTUutils::calculateInterval(HardwareSerial& s, uint32_t overwrite) {
   uint32_t interval = 0;
@@ -160,7 +179,7 @@ int RTUutils::UARTinit(HardwareSerial& serial, int thresholdBytes) {
 }
 
 // send: send a message via Serial, watching interval times - including CRC!
-void RTUutils::send(HardwareSerial& serial, unsigned long& lastMicros, uint32_t interval, RTScallback rts, const uint8_t *data, uint16_t len, bool ASCIImode) {
+void RTUutils::send(HardwareSerial& serial, unsigned long& lastMicros, uint32_t interval, const RTScallback& rts, const uint8_t *data, uint16_t len, bool ASCIImode) {
   // Clear serial buffers
   while (serial.available()) serial.read();
   
@@ -206,11 +225,11 @@ void RTUutils::send(HardwareSerial& serial, unsigned long& lastMicros, uint32_t
 
     // Toggle rtsPin, if necessary
     rts(HIGH);
-    // Write message
-    serial.write(data, len);
-    // Write CRC in LSB order
-    serial.write(crc16 & 0xff);
-    serial.write((crc16 >> 8) & 0xFF);
+    // Write message and CRC in LSB order as separate segments
+    uint8_t crcBytes[2] = { (uint8_t)(crc16 & 0xFF), (uint8_t)((crc16 >> 8) & 0xFF) };
+    ModbusSegments frame(data, len);
+    frame.add(crcBytes, 2);
+    frame.writeTo(serial);
     serial.flush();
     // Toggle rtsPin, if necessary
     rts(LOW);
@@ -223,7 +242,7 @@ void RTUutils::send(HardwareSerial& serial, unsigned long& lastMicros, uint32_t
 }
 
 // send: send a message via Serial, watching interval times - including CRC!
-void RTUutils::send(HardwareSerial& serial, unsigned long& lastMicros, uint32_t interval, RTScallback rts, ModbusMessage raw, bool ASCIImode) {
+void RTUutils::send(HardwareSerial& serial, unsigned long& lastMicros, uint32_t interval, const RTScallback& rts, const ModbusMessage& raw, bool ASCIImode) {
   send(serial, lastMicros, interval, rts, raw.data(), raw.size(), ASCIImode);
 }
 
@@ -480,7 +499,7 @@ ModbusMessage RTUutils::receive(HardwareSerial& serial, uint32_t timeout, unsign
 }
 
 // Lower 7 bit ASCII characters - all invalid are set to 0xFF
-const char RTUutils::ASCIIread[] = { 
+const uint8_t RTUutils::ASCIIread[] = { 
   /* 00-07 */ 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
   /* 08-0F */ 0xFF, 0xFF, 0xF2, 0xFF, 0xFF, 0xF1, 0xFF, 0xFF,  // LF + CR
   /* 10-17 */ 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 
@@ -29,7 +29,7 @@ public:
   static uint16_t calcCRC(const uint8_t *data, uint16_t len);
 
 // calcCRC: calculate the CRC16 value for a given block of data
-  static uint16_t calcCRC(ModbusMessage msg);
+  static uint16_t calcCRC(const ModbusMessage& msg);
 
 // validCRC #1: check the CRC in a block of data for validity
   static bool validCRC(const uint8_t *data, uint16_t len);
@@ -38,14 +38,19 @@ public:
   static bool validCRC(const uint8_t *data, uint16_t len, uint16_t CRC);
 
 // validCRC #1: check the CRC in a message for validity
-  static bool validCRC(ModbusMessage msg);
+  static bool validCRC(const ModbusMessage& msg);
 
 // validCRC #2: check the CRC of a message against a given one
-  static bool validCRC(ModbusMessage msg, uint16_t CRC);
+  static bool validCRC(const ModbusMessage& msg, uint16_t CRC);
 
 // addCRC: extend a RTUMessage by a valid CRC
   static void addCRC(ModbusMessage& raw);
 
+// frameLength: length of the RTU frame, CRC included, at the start of a byte stream without gaps, as
+// forwarded over TCP. Returns 0 if more bytes are needed, -1 if the data can not be a valid frame.
+// Frames of function codes with no length information are found by their valid CRC.
+  static int frameLength(const uint8_t *data, uint16_t len, bool isResponse);
+
 // calculateInterval: determine the minimal gap time between messages
   static uint32_t calculateInterval(HardwareSerial& s, uint32_t overwrite);
 
@@ -55,7 +60,7 @@ public:
 protected:
 // Printable characters for ASCII protocol: 012345678ABCDEF
   static const char ASCIIwrite[];
-  static const char ASCIIread[];
+  static const uint8_t ASCIIread[];
 
   RTUutils() = delete;
 
@@ -66,8 +71,8 @@ protected:
   static ModbusMessage receive(HardwareSerial& serial, uint32_t timeout, unsigned long& lastMicros, uint32_t interval, bool ASCIImode, bool skipLeadingZeroBytes = false);
 
 // send: send a Modbus message in either format (ModbusMessage or data/len)
-  static void send(HardwareSerial& serial, unsigned long& lastMicros, uint32_t interval, RTScallback r, const uint8_t *data, uint16_t len, bool ASCIImode);
-  static void send(HardwareSerial& serial, unsigned long& lastMicros, uint32_t interval, RTScallback r, ModbusMessage raw, bool ASCIImode);
+  static void send(HardwareSerial& serial, unsigned long& lastMicros, uint32_t interval, const RTScallback& r, const uint8_t *data, uint16_t len, bool ASCIImode);
+  static void send(HardwareSerial& serial, unsigned long& lastMicros, uint32_t interval, const RTScallback& r, const ModbusMessage& raw, bool ASCIImode);
 };
 
 #endif
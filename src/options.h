@@ -39,14 +39,16 @@
 #include <cinttypes> // for uint32_t etc.
 #if IS_RASPBERRY
 #include <wiringPi.h>
-#else
+#endif
 #include <chrono>  // NOLINT
-// Use nanosleep() to avoid problems with pthreads (std::this_thread::sleep_for would interfere!)
-#define delay(x)  nanosleep((const struct timespec[]){{x/1000, (x%1000)*1000000L}}, NULL);
 typedef std::chrono::steady_clock clk;
-#define millis() std::chrono::duration_cast<std::chrono::milliseconds>(clk::now().time_since_epoch()).count()
-#define micros() std::chrono::duration_cast<std::chrono::microseconds>(clk::now().time_since_epoch()).count()
-#endif
+// All timing goes through the replaceable ModbusClock - see ModbusClock.h.
+// On a Raspberry Pi these take precedence over the wiringPi functions of the same names.
+#include "ModbusClock.h"
+#define delay(x)  ModbusClock::current().sleep(x)
+#define millis() ((unsigned long)(ModbusClock::current().now() / 1000))
+#define micros() ((unsigned long)ModbusClock::current().now())
+#define delayMicroseconds(x) ModbusClock::current().sleepMicros(x)
 
 /* === INVALID TARGET === */
 #else